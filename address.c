@@ -33,217 +33,229 @@
 #include "i18n.h"
 #include "utils.h"
 #include "log.h"
+#include "trace.h"
 #include "prefs.h"
 #include "libplugin.h"
 #include "password.h"
 
-/********************************* Constants **********************************/
-#define SORT_JAPANESE 8
-#define SORT_JOS 16
-
 /******************************* Global vars **********************************/
-static int glob_sort_rule;
 int addr_sort_order;
 
 /****************************** Main Code *************************************/
-static int address_compare(const void *v1, const void *v2)
+int get_addr_sort_rule(void)
 {
-   AddressList **al1, **al2;
-   struct Address *a1, *a2;
-   char *str1 = NULL, *str2 = NULL;
-   int last_cmp1, last_cmp2;
-   int sort_idx[4];
-   int i, j, r;
+   int sort_rule;
+   long use_jos, char_set;
 
-   al1=(AddressList **)v1;
-   al2=(AddressList **)v2;
+   sort_rule = addr_sort_order;
 
-   a1=&((*al1)->maddr.addr);
-   a2=&((*al2)->maddr.addr);
+   get_pref(PREF_CHAR_SET, &char_set, NULL);
+   if (char_set == CHAR_SET_JAPANESE || char_set == CHAR_SET_SJIS_UTF) {
+      sort_rule = sort_rule | SORT_JAPANESE;
+   } else {
+      sort_rule = sort_rule & (SORT_JAPANESE-1);
+   }
+   get_pref(PREF_USE_JOS, &use_jos, NULL);
+   if (use_jos) {
+      sort_rule = sort_rule | SORT_JOS;
+   } else {
+      sort_rule = sort_rule & (SORT_JOS-1);
+   }
 
-   switch (glob_sort_rule & 0x7) {
-    case SORT_BY_FNAME:
-      sort_idx[1] = entryFirstname;
-      sort_idx[2] = entryLastname;
-      sort_idx[3] = entryCompany;
-      break;
-    case SORT_BY_LNAME:
-    default:
-      sort_idx[1] = entryLastname;
-      sort_idx[2] = entryFirstname;
-      sort_idx[3] = entryCompany;
-      break;
-    case SORT_BY_COMPANY:
-      sort_idx[1] = entryCompany;
-      sort_idx[2] = entryLastname;
-      sort_idx[3] = entryFirstname;
-      break;
-   } 
-
-   last_cmp1=last_cmp2=0;
-
-   if (!(glob_sort_rule & SORT_JAPANESE) || (glob_sort_rule & SORT_JOS)) { /* normal */
-      while (last_cmp1 < 3 && last_cmp2 < 3) {
-         str1=str2=NULL;
-         /* Find the next non-blank field to use for sorting */
-         for (i=last_cmp1+1; i<=3; i++) {
-            if (a1->entry[sort_idx[i]]) {
-               if ((str1 = malloc(strlen(a1->entry[sort_idx[i]])+1)) == NULL) {
-                  return 0;
-               }
-               strcpy(str1, a1->entry[sort_idx[i]]);
-               /* Convert string to lower case for more accurate comparison */
-               for (j=strlen(str1)-1; j >= 0; j--) {
-                  str1[j] = tolower(str1[j]);
-               }
-               break;
-            }
-         }
-         last_cmp1 = i;
-
-         if (!str1) return -1;
-
-         for (i=last_cmp2+1; i<=3; i++) {
-            if (a2->entry[sort_idx[i]]) {
-               if ((str2 = malloc(strlen(a2->entry[sort_idx[i]])+1)) == NULL) {
-                  return 0;
-               }
-               strcpy(str2, a2->entry[sort_idx[i]]);
-               for (j=strlen(str2)-1; j >= 0; j--) {
-                  str2[j] = tolower(str2[j]);
-               }
-               break;
-            }
-         }
-         last_cmp2 = i;
+   return sort_rule;
+}
 
-         if (!str2) {
-            free(str1);
-            return 1;
-         }
+/* Lower case a copy of str for a more accurate comparison and
+ * transform it so that strcmp() gives the same order as strcoll() */
+static char *addr_collate_str(const char *str)
+{
+   char *lower, *xfrm;
+   size_t len;
+   int i;
 
-         r = strcoll(str1, str2);
+   if ((lower = strdup(str)) == NULL) {
+      return NULL;
+   }
+   for (i=strlen(lower)-1; i >= 0; i--) {
+      lower[i] = tolower(lower[i]);
+   }
 
-         if (str1) free(str1);
-         if (str2) free(str2);
+   len = strxfrm(NULL, lower, 0);
+   if ((xfrm = malloc(len+1)) != NULL) {
+      strxfrm(xfrm, lower, len+1);
+   }
+   free(lower);
 
-         if (r != 0) return r;
+   return xfrm;
+}
 
-         /* Comparisons between unequal fields, such as last name and company
-          * must assume that the other fields are blank.  This matches
-          * Palm sort ordering. */
-         if (last_cmp1 != last_cmp2) {
-            return (last_cmp2 - last_cmp1);
-         }
-      }   /* end of while loop to search over 3 fields */
+/* Part of a Japanese name field used for sorting */
+static const char *addr_japanese_part(const char *entry)
+{
+   const char *p;
 
-      /* Compared all search fields and no difference found */
-      return 0;
+   if (!(p = strchr(entry, '\1'))) {
+      p = entry[0] ? entry+1 : entry;
+   }
 
-   } else if ((glob_sort_rule & SORT_JAPANESE) && !(glob_sort_rule & SORT_JOS)){
-      /* Japanese sorting has not been updated to fix Bug 1814 because no test
-       * platform is available for Western programmers maintaining Jpilot. */
-      int sort1, sort2, sort3;
-      char *tmp_p1, *tmp_p2, *tmp_p3;
-      sort1 = sort_idx[1];
-      sort2 = sort_idx[2];
-      sort3 = sort_idx[3];
-
-      if (a1->entry[sort1] || a1->entry[sort2]) {
-         if (a1->entry[sort1] && a1->entry[sort2]) {
-            if (!(tmp_p1 = strchr(a1->entry[sort1],'\1'))) tmp_p1=a1->entry[sort1]+1;
-            if (!(tmp_p2 = strchr(a1->entry[sort2],'\1'))) tmp_p2=a1->entry[sort2]+1;
-            if ((str1 = malloc(strlen(tmp_p1)+strlen(tmp_p2)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str1, tmp_p1);
-            strcat(str1, tmp_p2);
-         }
-         if (a1->entry[sort1] && (!a1->entry[sort2])) {
-            if (!(tmp_p1 = strchr(a1->entry[sort1],'\1'))) tmp_p1=a1->entry[sort1]+1;
-            if ((str1 = malloc(strlen(tmp_p1)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str1, tmp_p1);
-         }
-         if ((!a1->entry[sort1]) && a1->entry[sort2]) {
-            if (!(tmp_p2 = strchr(a1->entry[sort2],'\1'))) tmp_p2=a1->entry[sort2]+1;
-            if ((str1 = malloc(strlen(tmp_p2)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str1, tmp_p2);
-         }
-      } else if (a1->entry[sort3]) {
-         if (!(tmp_p3 = strchr(a1->entry[sort3],'\1'))) tmp_p3=a1->entry[sort3]+1;
-         if ((str1 = malloc(strlen(tmp_p3)+1)) == NULL) {
-            return 0;
-         }
-         strcpy(str1, tmp_p3);
-      } else {
-         return 1;
-      }
+   return p;
+}
 
-      if (a2->entry[sort1] || a2->entry[sort2]) {
-         if (a2->entry[sort1] && a2->entry[sort2]) {
-            if (!(tmp_p1 = strchr(a2->entry[sort1],'\1'))) tmp_p1=a2->entry[sort1]+1;
-            if (!(tmp_p2 = strchr(a2->entry[sort2],'\1'))) tmp_p2=a2->entry[sort2]+1;
-            if ((str2 = malloc(strlen(tmp_p1)+strlen(tmp_p2)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str2, tmp_p1);
-            strcat(str2, tmp_p2);
-         }
-         if (a2->entry[sort1] && (!a2->entry[sort2])) {
-            if (!(tmp_p1 = strchr(a2->entry[sort1],'\1'))) tmp_p1=a2->entry[sort1]+1;
-            if ((str2 = malloc(strlen(tmp_p1)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str2, tmp_p1);
-         }
-         if ((!a2->entry[sort1]) && a2->entry[sort2]) {
-            if (!(tmp_p2 = strchr(a2->entry[sort2],'\1'))) tmp_p2=a2->entry[sort2]+1;
-            if ((str2 = malloc(strlen(tmp_p2)+1)) == NULL) {
-               return 0;
+struct addr_sort_key *addr_sort_key_new(char *fields[3], int sort_rule)
+{
+   struct addr_sort_key *key;
+   char *str;
+   int i;
+
+   key = calloc(1, sizeof(struct addr_sort_key));
+   if (!key) {
+      return NULL;
+   }
+   key->sort_rule = sort_rule;
+
+   if (!(sort_rule & SORT_JAPANESE) || (sort_rule & SORT_JOS)) { /* normal */
+      for (i=0; i<3; i++) {
+         if (fields[i]) {
+            key->xfrm[key->num] = addr_collate_str(fields[i]);
+            if (!key->xfrm[key->num]) {
+               addr_sort_key_free(&key);
+               return NULL;
             }
-            strcpy(str2, tmp_p2);
-         }
-      } else if (a2->entry[sort3]) {
-         if (!(tmp_p3 = strchr(a2->entry[sort3],'\1'))) tmp_p3=a2->entry[sort3]+1;
-         if ((str2 = malloc(strlen(tmp_p3)+1)) == NULL) {
-            return 0;
+            key->pos[key->num] = i+1;
+            key->num++;
          }
-         strcpy(str2, tmp_p3);
-      } else {
-         free(str1);
-         return -1;
       }
+      return key;
+   }
 
-      /* lower case the strings for a better compare */
-      for (i=strlen(str1)-1; i >= 0; i--) {
-         str1[i] = tolower(str1[i]);
-      }
-      for (i=strlen(str2)-1; i >= 0; i--) {
-         str2[i] = tolower(str2[i]);
+   /* Japanese sorting has not been updated to fix Bug 1814 because no test
+    * platform is available for Western programmers maintaining Jpilot. */
+   if (fields[0] || fields[1]) {
+      str = g_strconcat(fields[0] ? addr_japanese_part(fields[0]) : "",
+                        fields[1] ? addr_japanese_part(fields[1]) : "",
+                        NULL);
+   } else if (fields[2]) {
+      str = g_strdup(addr_japanese_part(fields[2]));
+   } else {
+      /* Blank records sort last */
+      return key;
+   }
+
+   key->xfrm[0] = addr_collate_str(str);
+   g_free(str);
+   if (!key->xfrm[0]) {
+      addr_sort_key_free(&key);
+      return NULL;
+   }
+   key->pos[0] = 1;
+   key->num = 1;
+
+   return key;
+}
+
+void addr_sort_key_free(struct addr_sort_key **key)
+{
+   int i;
+
+   if (!*key) {
+      return;
+   }
+   for (i=0; i<3; i++) {
+      if ((*key)->xfrm[i]) {
+         free((*key)->xfrm[i]);
       }
+   }
+   free(*key);
+   *key = NULL;
+}
+
+int addr_sort_key_compare(const struct addr_sort_key *key1,
+                          const struct addr_sort_key *key2)
+{
+   int i, r;
+
+   if ((key1->sort_rule & SORT_JAPANESE) && !(key1->sort_rule & SORT_JOS)) {
+      if (!key1->num) return 1;
+      if (!key2->num) return -1;
+      return strcmp(key1->xfrm[0], key2->xfrm[0]);
+   }
 
-      i = strcoll(str1, str2);
-      if (str1) free(str1);
-      if (str2) free(str2);
+   for (i=0; i<3; i++) {
+      if (i >= key1->num) return -1;
+      if (i >= key2->num) return 1;
 
-      return i;
+      r = strcmp(key1->xfrm[i], key2->xfrm[i]);
+      if (r != 0) return r;
+
+      /* Comparisons between unequal fields, such as last name and company
+       * must assume that the other fields are blank.  This matches
+       * Palm sort ordering. */
+      if (key1->pos[i] != key2->pos[i]) {
+         return (key2->pos[i] - key1->pos[i]);
+      }
+
+      /* The last sort field has been compared */
+      if (key1->pos[i] == 3) break;
    }
 
-   /* Should never be reached.  Assume records are unsortable if reached */
+   /* Compared all search fields and no difference found */
    return 0;
 }
 
+/* Returns the collation key of a record, building it if needed */
+static struct addr_sort_key *address_sort_key(AddressList *al, int sort_rule)
+{
+   struct Address *a;
+   char *fields[3];
+
+   if (al->sort_key && (al->sort_key->sort_rule == sort_rule)) {
+      return al->sort_key;
+   }
+   addr_sort_key_free(&(al->sort_key));
+
+   a = &(al->maddr.addr);
+
+   switch (sort_rule & 0x7) {
+    case SORT_BY_FNAME:
+      fields[0] = a->entry[entryFirstname];
+      fields[1] = a->entry[entryLastname];
+      fields[2] = a->entry[entryCompany];
+      break;
+    case SORT_BY_LNAME:
+    default:
+      fields[0] = a->entry[entryLastname];
+      fields[1] = a->entry[entryFirstname];
+      fields[2] = a->entry[entryCompany];
+      break;
+    case SORT_BY_COMPANY:
+      fields[0] = a->entry[entryCompany];
+      fields[1] = a->entry[entryLastname];
+      fields[2] = a->entry[entryFirstname];
+      break;
+   }
+
+   al->sort_key = addr_sort_key_new(fields, sort_rule);
+
+   return al->sort_key;
+}
+
+static int address_compare(const void *v1, const void *v2)
+{
+   AddressList **al1, **al2;
+
+   al1=(AddressList **)v1;
+   al2=(AddressList **)v2;
+
+   return addr_sort_key_compare((*al1)->sort_key, (*al2)->sort_key);
+}
+
 /* sort_order: SORT_ASCENDING | SORT_DESCENDING */
 static int address_sort(AddressList **al, int sort_order)
 {
    AddressList *temp_al;
    AddressList **sort_al;
    int count, i;
-   long use_jos, char_set;
+   int sort_rule;
 
    /* Count the entries in the list */
    for (count=0, temp_al=*al; temp_al; temp_al=temp_al->next, count++) {}
@@ -253,20 +265,7 @@ static int address_sort(AddressList **al, int sort_order)
       return EXIT_SUCCESS;
    }
 
-   glob_sort_rule = addr_sort_order;
-
-   get_pref(PREF_CHAR_SET, &char_set, NULL);
-   if (char_set == CHAR_SET_JAPANESE || char_set == CHAR_SET_SJIS_UTF) {
-      glob_sort_rule = glob_sort_rule | SORT_JAPANESE;
-   } else {
-      glob_sort_rule = glob_sort_rule & (SORT_JAPANESE-1);
-   }
-   get_pref(PREF_USE_JOS, &use_jos, NULL);
-   if (use_jos) {
-      glob_sort_rule = glob_sort_rule | SORT_JOS;
-   } else {
-      glob_sort_rule = glob_sort_rule & (SORT_JOS-1);
-   }
+   sort_rule = get_addr_sort_rule();
 
    /* Allocate an array to be qsorted */
    sort_al = calloc(count, sizeof(AddressList *));
@@ -275,9 +274,15 @@ static int address_sort(AddressList **al, int sort_order)
       return EXIT_FAILURE;
    }
 
-   /* Set our array to be a list of pointers to the nodes in the linked list */
+   /* Set our array to be a list of pointers to the nodes in the linked list
+    * and compute the collation key of each record once */
    for (i=0, temp_al=*al; temp_al; temp_al=temp_al->next, i++) {
       sort_al[i] = temp_al;
+      if (!address_sort_key(temp_al, sort_rule)) {
+         jp_logf(JP_LOG_WARN, "address_sort(): %s\n", _("Out of memory"));
+         free(sort_al);
+         return EXIT_FAILURE;
+      }
    }
 
    qsort(sort_al, count, sizeof(AddressList *), address_compare);
@@ -308,6 +313,7 @@ void free_AddressList(AddressList **al)
    AddressList *temp_al, *temp_al_next;
 
    for (temp_al = *al; temp_al; temp_al=temp_al_next) {
+      addr_sort_key_free(&(temp_al->sort_key));
       free_Address(&(temp_al->maddr.addr));
       temp_al_next = temp_al->next;
       free(temp_al);
@@ -359,14 +365,14 @@ int get_addresses2(AddressList **address_list, int sort_order,
 {
    GList *records;
    GList *temp_list;
-   int recs_returned, i, num;
+   int recs_returned, num;
    struct Address addr;
    AddressList *temp_a_list;
    long keep_modified, keep_deleted;
    int keep_priv;
    long char_set;
    buf_rec *br;
-   char *buf;
+   double unpack_start, conv_start, conv_time;
    pi_buffer_t *RecordBuffer;
 
    jp_logf(JP_LOG_DEBUG, "get_addresses2()\n");
@@ -394,6 +400,9 @@ int get_addresses2(AddressList **address_list, int sort_order,
    if (-1 == num)
       return 0;
 
+   TRACE_BEGIN("unpack");
+   unpack_start = TRACE_NOW();
+   conv_time = 0.0;
    for (temp_list = records; temp_list; temp_list = temp_list->next) {
       if (temp_list->data) {
          br=temp_list->data;
@@ -428,17 +437,12 @@ int get_addresses2(AddressList **address_list, int sort_order,
          free_Address(&addr);
          continue;
       }
-      buf = NULL;
+      conv_start = TRACE_NOW();
       if (char_set != CHAR_SET_LATIN1) {
-         for (i = 0; i < 19; i++) {
-            if ((addr.entry[i] != NULL) && (addr.entry[i][0] != '\0')) {
-               buf = charset_p2newj(addr.entry[i], -1, char_set);
-               if (buf) {
-                  free(addr.entry[i]);
-                  addr.entry[i] = buf;
-               }
-            }
-         }
+         charset_p2j_fields(addr.entry, 19, char_set);
+      }
+      if (glob_trace) {
+         conv_time += trace_now() - conv_start;
       }
 
       temp_a_list = malloc(sizeof(AddressList));
@@ -448,6 +452,7 @@ int get_addresses2(AddressList **address_list, int sort_order,
       }
       memcpy(&(temp_a_list->maddr.addr), &addr, sizeof(struct Address));
       temp_a_list->app_type = ADDRESS;
+      temp_a_list->sort_key = NULL;
       temp_a_list->maddr.rt = br->rt;
       temp_a_list->maddr.attrib = br->attrib;
       temp_a_list->maddr.unique_id = br->unique_id;
@@ -456,12 +461,19 @@ int get_addresses2(AddressList **address_list, int sort_order,
       recs_returned++;
    }
 
+   if (glob_trace) {
+      trace_total("charset conversion", unpack_start, conv_time);
+   }
+   TRACE_END("unpack");
+
    jp_free_DB_records(&records);
 
 #ifdef JPILOT_DEBUG
    print_address_list(address_list);
 #endif
+   TRACE_BEGIN("sort");
    address_sort(address_list, sort_order);
+   TRACE_END("sort");
 
    jp_logf(JP_LOG_DEBUG, "Leaving get_addresses2()\n");
 
@@ -50,9 +50,37 @@ typedef struct {
 #define SORT_BY_FNAME 2
 #define SORT_BY_COMPANY 4
 
+/* These are or'ed into the sort rule with one of the SORT_BY_ values */
+#define SORT_JAPANESE 8
+#define SORT_JOS 16
+
 /* This flag affects sorting of address records */
 extern int addr_sort_order;
 
+/*
+ * Collation key of an address or contact record.
+ * The non-blank sort fields are lower cased and passed through strxfrm()
+ * once so that sorting only has to strcmp() the keys.  Keys are kept in
+ * the list nodes and rebuilt if the sort rule changes.
+ */
+struct addr_sort_key
+{
+   int sort_rule;
+   int num;           /* number of keys, 0 if all sort fields are blank */
+   int pos[3];        /* which sort field, 1-3, each key came from */
+   char *xfrm[3];
+};
+
+/* Returns addr_sort_order with the SORT_JAPANESE and SORT_JOS bits set
+ * from the preferences */
+int get_addr_sort_rule(void);
+
+/* fields are the 3 sort fields in order of precedence, NULL if blank */
+struct addr_sort_key *addr_sort_key_new(char *fields[3], int sort_rule);
+void addr_sort_key_free(struct addr_sort_key **key);
+int addr_sort_key_compare(const struct addr_sort_key *key1,
+                          const struct addr_sort_key *key2);
+
 int get_address_app_info(struct AddressAppInfo *aai);
 
 int pc_address_write(struct Address *a, PCRecType rt, unsigned char attrib,
@@ -81,6 +109,10 @@ int get_contacts(ContactList **contact_list, int sort_order);
 int get_contacts2(ContactList **contact_list, int sort_order,
                   int modified, int deleted, int privates, int category);
 
+/* Keep a list returned by get_contacts2() sorted while patching it */
+int contacts_insert_sorted(ContactList **cl, ContactList *new_cl, int sort_order);
+int contacts_remove(ContactList **cl, MyContact *mcont);
+
 int copy_address_ai_to_contact_ai(const struct AddressAppInfo *aai, struct ContactAppInfo *cai);
 
 int copy_contact_to_address(const struct Contact *c, struct Address *a);
@@ -38,6 +38,7 @@
 #include "i18n.h"
 #include "utils.h"
 #include "log.h"
+#include "trace.h"
 #include "prefs.h"
 #include "print.h"
 #include "password.h"
@@ -212,6 +213,9 @@ static void connect_changed_signals(int con_or_dis);
 static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
                                  ContactList **cont_list, int category, int main);
 static int address_clist_redraw(void);
+static void address_clist_name(char *str2, MyContact *mcont);
+static int address_clist_patch(MyContact *old_mcont, int flag,
+                               ContactList *new_cl);
 static int address_find(void);
 
 /****************************** Main Code *************************************/
@@ -535,7 +539,7 @@ static int cb_addr_import(GtkWidget *parent_window,
    AddressList *temp_addrlist;
    struct CategoryAppInfo cai;
 
-   in=fopen(file_path, "r");
+   in=import_fopen(file_path);
    if (!in) {
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), file_path);
       return EXIT_FAILURE;
@@ -566,6 +570,7 @@ static int cb_addr_import(GtkWidget *parent_window,
       if (EXIT_FAILURE == ret) return EXIT_FAILURE;
 
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       while (1) {
          /* Read the category field */
          read_csv_field(in, text, sizeof(text));
@@ -665,8 +670,8 @@ static int cb_addr_import(GtkWidget *parent_window,
          ret = read_csv_field(in, text, sizeof(text));
          sscanf(text, "%d", &(new_cont.showPhone));
 
-         cont_text = contact_to_gstring(&new_cont);
          if (!import_all) {
+            cont_text = contact_to_gstring(&new_cont);
             ret=import_record_ask(parent_window, pane,
                                   cont_text->str,
                                   p_cai,
@@ -674,10 +679,10 @@ static int cb_addr_import(GtkWidget *parent_window,
                                   priv,
                                   suggested_cat_num,
                                   &new_cat_num);
+            g_string_free(cont_text, TRUE);
          } else {
             new_cat_num=suggested_cat_num;
          }
-         g_string_free(cont_text, TRUE);
 
          if (ret==DIALOG_SAID_IMPORT_QUIT) {
             jp_free_Contact(&new_cont);
@@ -717,6 +722,7 @@ static int cb_addr_import(GtkWidget *parent_window,
       addrlist=NULL;
       dat_get_addresses(in, &addrlist, &cai);
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       for (temp_addrlist=addrlist; temp_addrlist; temp_addrlist=temp_addrlist->next) {
          index=temp_addrlist->maddr.unique_id-1;
          if (index<0) {
@@ -768,9 +774,17 @@ static int cb_addr_import(GtkWidget *parent_window,
 
    }  /* end switch for import types */
 
+   /* Write out the imported records before they are read back */
+   ret = jp_pc_write_batch_end();
+   if (ret != EXIT_SUCCESS) {
+      jp_logf(JP_LOG_WARN, _("Unable to write the imported records\n"));
+      dialog_generic_ok(parent_window, _("Error"), DIALOG_ERROR,
+                        _("Unable to write the imported records\n"));
+   }
+
    address_refresh();
    fclose(in);
-   return EXIT_SUCCESS;
+   return ret;
 }
 
 int address_import(GtkWidget *window)
@@ -854,6 +868,7 @@ static void cb_addr_export_ok(GtkWidget *export_window, GtkWidget *clist,
 {
    MyContact *mcont;
    GList *list, *temp_list;
+   gpointer *rows;
    FILE *out;
    struct stat statb;
    const char *short_date;
@@ -898,7 +913,7 @@ static void cb_addr_export_ok(GtkWidget *export_window, GtkWidget *clist,
       }
    }
 
-   out = fopen(filename, "w");
+   out = export_fopen(filename);
    if (!out) {
       g_snprintf(text, sizeof(text), _("Error opening file: %s"), filename);
       dialog_generic(GTK_WINDOW(export_window),
@@ -1002,10 +1017,11 @@ static void cb_addr_export_ok(GtkWidget *export_window, GtkWidget *clist,
 
    get_pref(PREF_CHAR_SET, &char_set, NULL);
    list=GTK_CLIST(clist)->selection;
+   rows = clist_get_all_row_data(GTK_CLIST(clist));
 
    /* Loop over clist of records to export */
    for (record_num=0, temp_list=list; temp_list; temp_list = temp_list->next, record_num++) {
-      mcont = gtk_clist_get_row_data(GTK_CLIST(clist), GPOINTER_TO_INT(temp_list->data));
+      mcont = rows[GPOINTER_TO_INT(temp_list->data)];
       if (!mcont) {
          continue;
          jp_logf(JP_LOG_WARN, _("Can't export address %d\n"), (long) temp_list->data + 1);
@@ -1535,6 +1551,8 @@ static void cb_addr_export_ok(GtkWidget *export_window, GtkWidget *clist,
       }
    }
 
+   g_free(rows);
+
    if (out) {
       fclose(out);
    }
@@ -1639,19 +1657,21 @@ static int find_menu_cat_pos(int cat)
 }
 
 
-static void cb_delete_address(GtkWidget *widget, gpointer data)
+/* Delete the selected record from the .pc3 file, or mark it as modified.
+ * Returns EXIT_FAILURE if the record was not changed. */
+static int delete_address(int flag)
 {
    MyAddress maddr;
    MyContact *mcont;
-   int flag;
    int show_priv;
    long char_set;
    int i;
+   int r;
 
    mcont = gtk_clist_get_row_data(GTK_CLIST(clist), clist_row_selected);
    
    if (mcont < (MyContact *)CLIST_MIN_DATA) {
-      return;
+      return EXIT_FAILURE;
    }
 
    copy_contact_to_address(&(mcont->cont), &(maddr.addr));
@@ -1675,12 +1695,12 @@ static void cb_delete_address(GtkWidget *widget, gpointer data)
    if ((show_priv != SHOW_PRIVATES) &&
        (maddr.attrib & dlpRecAttrSecret)) {
       free_Address(&(maddr.addr));
-      return;
+      return EXIT_FAILURE;
    }
    /* End Masking */
-   flag = GPOINTER_TO_INT(data);
+   r = EXIT_FAILURE;
    if ((flag==MODIFY_FLAG) || (flag==DELETE_FLAG)) {
-      delete_pc_record(ADDRESS, &maddr, flag);
+      r = delete_pc_record(ADDRESS, &maddr, flag);
       if (flag==DELETE_FLAG) {
          /* when we redraw we want to go to the line above the deleted one */
          if (clist_row_selected>0) {
@@ -1692,43 +1712,54 @@ static void cb_delete_address(GtkWidget *widget, gpointer data)
    free_Address(&(maddr.addr));
 
    if (flag == DELETE_FLAG) {
-      address_clist_redraw();
+      /* If the record is still in the file the list is redrawn from it */
+      if ((r != EXIT_SUCCESS) || address_clist_patch(mcont, flag, NULL)) {
+         address_clist_redraw();
+      }
    }
+
+   return r;
 }
 
-static void cb_delete_contact(GtkWidget *widget, gpointer data)
+static int delete_contact(int flag)
 {
    MyContact *mcont;
-   int flag;
+   MyContact palm_mcont;
    int show_priv;
    long char_set;
    int i;
+   int r;
 
    mcont = gtk_clist_get_row_data(GTK_CLIST(clist), clist_row_selected);
    if (mcont < (MyContact *)CLIST_MIN_DATA) {
-      return;
+      return EXIT_FAILURE;
    }
-   /* convert to Palm character set */
+
+   /* Do masking like Palm OS 3.5 */
+   show_priv = show_privates(GET_PRIVATES);
+   if ((show_priv != SHOW_PRIVATES) &&
+       (mcont->attrib & dlpRecAttrSecret)) {
+      return EXIT_FAILURE;
+   }
+   /* End Masking */
+
+   /* Convert a copy to the Palm character set, the record may stay on
+    * the screen as deleted or modified */
+   memcpy(&palm_mcont, mcont, sizeof(MyContact));
    get_pref(PREF_CHAR_SET, &char_set, NULL);
    if (char_set != CHAR_SET_LATIN1) {
       for (i=0; i<NUM_CONTACT_ENTRIES; i++) {
          if (mcont->cont.entry[i]) {
-            charset_j2p(mcont->cont.entry[i],
-                        strlen(mcont->cont.entry[i])+1, char_set);
+            palm_mcont.cont.entry[i] = strdup(mcont->cont.entry[i]);
+            charset_j2p(palm_mcont.cont.entry[i],
+                        strlen(palm_mcont.cont.entry[i])+1, char_set);
          }
       }
    }
 
-   /* Do masking like Palm OS 3.5 */
-   show_priv = show_privates(GET_PRIVATES);
-   if ((show_priv != SHOW_PRIVATES) &&
-       (mcont->attrib & dlpRecAttrSecret)) {
-      return;
-   }
-   /* End Masking */
-   flag = GPOINTER_TO_INT(data);
+   r = EXIT_FAILURE;
    if ((flag==MODIFY_FLAG) || (flag==DELETE_FLAG)) {
-      delete_pc_record(CONTACTS, mcont, flag);
+      r = delete_pc_record(CONTACTS, &palm_mcont, flag);
       if (flag==DELETE_FLAG) {
          /* when we redraw we want to go to the line above the deleted one */
          if (clist_row_selected>0) {
@@ -1737,20 +1768,38 @@ static void cb_delete_contact(GtkWidget *widget, gpointer data)
       }
    }
 
+   if (char_set != CHAR_SET_LATIN1) {
+      for (i=0; i<NUM_CONTACT_ENTRIES; i++) {
+         if (palm_mcont.cont.entry[i]) {
+            free(palm_mcont.cont.entry[i]);
+         }
+      }
+   }
+
    if (flag == DELETE_FLAG) {
-      address_clist_redraw();
+      /* If the record is still in the file the list is redrawn from it */
+      if ((r != EXIT_SUCCESS) || address_clist_patch(mcont, flag, NULL)) {
+         address_clist_redraw();
+      }
    }
+
+   return r;
 }
 
-static void cb_delete_address_or_contact(GtkWidget *widget, gpointer data)
+static int delete_address_or_contact(int flag)
 {
    if (address_version==0) {
-      cb_delete_address(widget, data);
+      return delete_address(flag);
    } else {
-      cb_delete_contact(widget, data);
+      return delete_contact(flag);
    }
 }
 
+static void cb_delete_address_or_contact(GtkWidget *widget, gpointer data)
+{
+   delete_address_or_contact(GPOINTER_TO_INT(data));
+}
+
 
 static void cb_undelete_address(GtkWidget *widget,
                                 gpointer   data)
@@ -1928,6 +1977,52 @@ static void get_address_attrib(unsigned char *attrib)
    }
 }
 
+/* pc_contact_write() converts the record to the Palm character set in
+ * place, this writes a converted copy and leaves cont as it was */
+static int pc_contact_write_copy(struct Contact *cont, PCRecType rt,
+                                 unsigned char attrib, unsigned int *unique_id)
+{
+   struct Contact palm_cont;
+   int i, r;
+
+   memcpy(&palm_cont, cont, sizeof(struct Contact));
+   for (i=0; i<NUM_CONTACT_ENTRIES; i++) {
+      if (cont->entry[i]) {
+         palm_cont.entry[i] = strdup(cont->entry[i]);
+      }
+   }
+
+   r = pc_contact_write(&palm_cont, rt, attrib, unique_id);
+
+   for (i=0; i<NUM_CONTACT_ENTRIES; i++) {
+      if (palm_cont.entry[i]) {
+         free(palm_cont.entry[i]);
+      }
+   }
+
+   return r;
+}
+
+/* Empty fields are not packed and read back as NULL */
+static void clear_empty_entries(struct Contact *cont)
+{
+   int i;
+
+   for (i=0; i<NUM_CONTACT_ENTRIES; i++) {
+      if ((cont->entry[i]) && (cont->entry[i][0]=='\0')) {
+         free(cont->entry[i]);
+         cont->entry[i] = NULL;
+      }
+   }
+}
+
+static void free_contact_node(ContactList *cl)
+{
+   addr_sort_key_free(&(cl->sort_key));
+   jp_free_Contact(&(cl->mcont.cont));
+   free(cl);
+}
+
 static void cb_add_new_record(GtkWidget *widget, gpointer data)
 {
    int i;
@@ -1939,6 +2034,9 @@ static void cb_add_new_record(GtkWidget *widget, gpointer data)
    int flag, type;
    unsigned int unique_id;
    int show_priv;
+   int r;
+   int r_delete = EXIT_SUCCESS;
+   ContactList *new_cl;
    GtkTextIter start_iter;
    GtkTextIter end_iter;
 
@@ -2042,33 +2140,65 @@ static void cb_add_new_record(GtkWidget *widget, gpointer data)
       set_new_button_to(CLEAR_FLAG);
 
       if (flag==MODIFY_FLAG) {
-         cb_delete_address_or_contact(NULL, data);
          if ((mcont->rt==PALM_REC) || (mcont->rt==REPLACEMENT_PALM_REC)) {
             type = REPLACEMENT_PALM_REC;
          } else {
             unique_id = 0;
             type = NEW_PC_REC;
          }
+         r_delete = delete_address_or_contact(flag);
       } else {
          unique_id=0;
          type = NEW_PC_REC;
       }
 
+      /* The new record is linked into the displayed list as it would be
+       * read back from the database */
+      new_cl = malloc(sizeof(ContactList));
+      if (new_cl) {
+         new_cl->app_type = CONTACTS;
+         new_cl->next = NULL;
+         new_cl->sort_key = NULL;
+      }
+
       if (address_version==0) {
          copy_contact_to_address(&cont, &addr);
          jp_free_Contact(&cont);
-         pc_address_write(&addr, type, attrib, &unique_id);
+         if (new_cl) {
+            copy_address_to_contact(&addr, &(new_cl->mcont.cont));
+         }
+         r = pc_address_write(&addr, type, attrib, &unique_id);
          free_Address(&addr);
       } else {
-         pc_contact_write(&cont, type, attrib, &unique_id);
-         jp_free_Contact(&cont);
+         r = pc_contact_write_copy(&cont, type, attrib, &unique_id);
+         if (new_cl) {
+            memcpy(&(new_cl->mcont.cont), &cont, sizeof(struct Contact));
+         } else {
+            jp_free_Contact(&cont);
+         }
       }
 
-      /* Don't return to modified record if search gui active */
-      if (!glob_find_id) {
-         glob_find_id = unique_id;
+      if (new_cl) {
+         clear_empty_entries(&(new_cl->mcont.cont));
+         new_cl->mcont.rt = type;
+         new_cl->mcont.unique_id = unique_id;
+         new_cl->mcont.attrib = attrib;
+         /* A list that can't be patched to match the file is redrawn */
+         if ((r != EXIT_SUCCESS) || (r_delete != EXIT_SUCCESS)) {
+            free_contact_node(new_cl);
+            new_cl = NULL;
+         }
+      }
+
+      if ((!new_cl) ||
+          address_clist_patch((flag==MODIFY_FLAG) ? mcont : NULL,
+                              flag, new_cl)) {
+         /* Don't return to modified record if search gui active */
+         if (!glob_find_id) {
+            glob_find_id = unique_id;
+         }
+         address_clist_redraw();
       }
-      address_clist_redraw();
    }
 }
 
@@ -2286,8 +2416,10 @@ static void cb_address_quickfind(GtkWidget *widget,
                                  gpointer   data)
 {
    const char *entry_text;
-   char *clist_text;
-   int i, r;
+   char clist_text[ADDRESS_MAX_COLUMN_LEN+2];
+   GList *temp_list;
+   MyContact *mcont;
+   int i;
 
    jp_logf(JP_LOG_DEBUG, "cb_address_quickfind\n");
 
@@ -2296,11 +2428,16 @@ static void cb_address_quickfind(GtkWidget *widget,
       return;
    }
 
-   for (i = 0; i<GTK_CLIST(clist)->rows; i++) {
-      r = gtk_clist_get_text(GTK_CLIST(clist), i, ADDRESS_NAME_COLUMN, &clist_text);
-      if (!r) {
+   /* Rows are only filled in when drawn, so the names are made from the
+    * records rather than read back from the clist */
+   for (i = 0, temp_list = GTK_CLIST(clist)->row_list;
+        temp_list;
+        i++, temp_list = temp_list->next) {
+      mcont = GTK_CLIST_ROW(temp_list)->data;
+      if (mcont < (MyContact *)CLIST_MIN_DATA) {
          break;
       }
+      address_clist_name(clist_text, mcont);
       if (!strncasecmp(clist_text, entry_text, strlen(entry_text))) {
          clist_select_row(GTK_CLIST(clist), i, ADDRESS_NAME_COLUMN);
          gtk_clist_moveto(GTK_CLIST(clist), i, 0, 0.5, 0.0);
@@ -2747,7 +2884,7 @@ static void cb_clist_selection(GtkWidget      *clist,
    int b;
    int i, index, sorted_position;
    unsigned int unique_id = 0;
-   char *clist_text;
+   char clist_text[ADDRESS_MAX_COLUMN_LEN+2];
    const char *entry_text;
    int address_i, IM_i, phone_i;
    char birthday_str[255];
@@ -2842,8 +2979,7 @@ static void cb_clist_selection(GtkWidget      *clist,
    }
 
    cont=&(mcont->cont);
-   clist_text = NULL;
-   gtk_clist_get_text(GTK_CLIST(clist), row, ADDRESS_NAME_COLUMN, &clist_text);
+   address_clist_name(clist_text, mcont);
    entry_text = gtk_entry_get_text(GTK_ENTRY(address_quickfind_entry));
    if (strncasecmp(clist_text, entry_text, strlen(entry_text))) {
       gtk_entry_set_text(GTK_ENTRY(address_quickfind_entry), "");
@@ -3161,20 +3297,12 @@ static gboolean cb_key_pressed_right_side(GtkWidget   *widget,
    return FALSE;
 }
 
-static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
-                                 ContactList **cont_list, int category, 
-                                 int main)
+/* The name column text of mcont, str2 is ADDRESS_MAX_COLUMN_LEN+2 long */
+static void address_clist_name(char *str2, MyContact *mcont)
 {
-   int num_entries, entries_shown;
    int show1, show2, show3;
-   gchar *empty_line[] = { "","","" };
-   GdkPixmap *pixmap_note;
-   GdkBitmap *mask_note;
-   ContactList *temp_cl;
    char str[ADDRESS_MAX_COLUMN_LEN+2];
-   char str2[ADDRESS_MAX_COLUMN_LEN+2];
-   int show_priv;
-   long use_jos, char_set, show_tooltips;
+   long use_jos, char_set;
    char *tmp_p1, *tmp_p2, *tmp_p3;
    char blank[]="";
    char slash[]=" / ";
@@ -3182,8 +3310,175 @@ static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    char *field1, *field2, *field3;
    char *delim1, *delim2;
    char *tmp_delim1, *tmp_delim2;
+
+   get_pref(PREF_CHAR_SET, &char_set, NULL);
+   get_pref(PREF_USE_JOS, &use_jos, NULL);
+
+   switch (addr_sort_order) {
+    case SORT_BY_LNAME:
+    default:
+      show1=contLastname;
+      show2=contFirstname;
+      show3=contCompany;
+      delim1 = comma_space;
+      delim2 = slash;
+      break;
+    case SORT_BY_FNAME:
+      show1=contFirstname;
+      show2=contLastname;
+      show3=contCompany;
+      delim1 = comma_space;
+      delim2 = slash;
+      break;
+    case SORT_BY_COMPANY:
+      show1=contCompany;
+      show2=contLastname;
+      show3=contFirstname;
+      delim1 = slash;
+      delim2 = comma_space;
+      break;
+   }
+
+   if (!use_jos && (char_set == CHAR_SET_JAPANESE || char_set == CHAR_SET_SJIS_UTF)) {
+      str[0]='\0';
+      if (mcont->cont.entry[show1] || mcont->cont.entry[show2]) {
+         if (mcont->cont.entry[show1] && mcont->cont.entry[show2]) {
+            if ((tmp_p1 = strchr(mcont->cont.entry[show1],'\1'))) *tmp_p1='\0';
+            if ((tmp_p2 = strchr(mcont->cont.entry[show2],'\1'))) *tmp_p2='\0';
+            g_snprintf(str, ADDRESS_MAX_CLIST_NAME, "%s, %s", mcont->cont.entry[show1], mcont->cont.entry[show2]);
+            if (tmp_p1) *tmp_p1='\1';
+            if (tmp_p2) *tmp_p2='\1';
+         }
+         if (mcont->cont.entry[show1] && ! mcont->cont.entry[show2]) {
+            if ((tmp_p1 = strchr(mcont->cont.entry[show1],'\1'))) *tmp_p1='\0';
+            if (mcont->cont.entry[show3]) {
+               if ((tmp_p3 = strchr(mcont->cont.entry[show3],'\1'))) *tmp_p3='\0';
+               g_snprintf(str, ADDRESS_MAX_CLIST_NAME, "%s, %s", mcont->cont.entry[show1], mcont->cont.entry[show3]);
+               if (tmp_p3) *tmp_p3='\1';
+            } else {
+               multibyte_safe_strncpy(str, mcont->cont.entry[show1], ADDRESS_MAX_CLIST_NAME);
+            }
+            if (tmp_p1) *tmp_p1='\1';
+         }
+         if (! mcont->cont.entry[show1] && mcont->cont.entry[show2]) {
+            if ((tmp_p2 = strchr(mcont->cont.entry[show2],'\1'))) *tmp_p2='\0';
+            multibyte_safe_strncpy(str, mcont->cont.entry[show2], ADDRESS_MAX_CLIST_NAME);
+            if (tmp_p2) *tmp_p2='\1';
+         }
+      } else if (mcont->cont.entry[show3]) {
+         if ((tmp_p3 = strchr(mcont->cont.entry[show3],'\1'))) *tmp_p3='\0';
+         multibyte_safe_strncpy(str, mcont->cont.entry[show3], ADDRESS_MAX_CLIST_NAME);
+         if (tmp_p3) *tmp_p3='\1';
+      } else {
+         strcpy(str, _("-Unnamed-"));
+      }
+   } else {
+      str[0]='\0';
+      field1=field2=field3=blank;
+      tmp_delim1=delim1;
+      tmp_delim2=delim2;
+      if (mcont->cont.entry[show1]) field1=mcont->cont.entry[show1];
+      if (mcont->cont.entry[show2]) field2=mcont->cont.entry[show2];
+      if (mcont->cont.entry[show3]) field3=mcont->cont.entry[show3];
+      switch (addr_sort_order) {
+       case SORT_BY_LNAME:
+       default:
+         if ((!field1[0]) || (!field2[0])) tmp_delim1=blank;
+         if (!(field3[0])) tmp_delim2=blank;
+         if ((!field1[0]) && (!field2[0])) tmp_delim2=blank;
+         break;
+       case SORT_BY_FNAME:
+         if ((!field1[0]) || (!field2[0])) tmp_delim1=blank;
+         if (!(field3[0])) tmp_delim2=blank;
+         if ((!field1[0]) && (!field2[0])) tmp_delim2=blank;
+         break;
+       case SORT_BY_COMPANY:
+         if (!(field1[0])) tmp_delim1=blank;
+         if ((!field2[0]) || (!field3[0])) tmp_delim2=blank;
+         if ((!field2[0]) && (!field3[0])) tmp_delim1=blank;
+         break;
+      }
+      g_snprintf(str, ADDRESS_MAX_COLUMN_LEN, "%s%s%s%s%s",
+                 field1, tmp_delim1, field2, tmp_delim2, field3);
+      if (strlen(str)<1) strcpy(str, _("-Unnamed-"));
+      str[ADDRESS_MAX_COLUMN_LEN]='\0';
+   }
+
+   lstrncpy_remove_cr_lfs(str2, str, ADDRESS_MAX_COLUMN_LEN);
+}
+
+/* Fill in the text, pixmaps and colors of clist row "row" from mcont */
+static void address_clist_set_row(GtkWidget *clist, int row, MyContact *mcont)
+{
+   GdkPixmap *pixmap_note;
+   GdkBitmap *mask_note;
+   char str2[ADDRESS_MAX_COLUMN_LEN+2];
+
+   get_pixmaps(clist, PIXMAP_NOTE, &pixmap_note, &mask_note);
+#ifdef __APPLE__
+   mask_note = NULL;
+#endif
+
+   address_clist_name(str2, mcont);
+   gtk_clist_set_text(GTK_CLIST(clist), row, ADDRESS_NAME_COLUMN, str2);
+   /* Clear string so previous data won't be used inadvertently in next set_text */
+   str2[0] = '\0';
+   lstrncpy_remove_cr_lfs(str2, mcont->cont.entry[mcont->cont.showPhone + 4], ADDRESS_MAX_COLUMN_LEN);
+   gtk_clist_set_text(GTK_CLIST(clist), row, ADDRESS_PHONE_COLUMN, str2);
+   gtk_clist_set_row_data(GTK_CLIST(clist), row, mcont);
+
+   /* Highlight row background depending on status */
+   switch (mcont->rt) {
+    case NEW_PC_REC:
+    case REPLACEMENT_PALM_REC:
+      set_bg_rgb_clist_row(clist, row,
+                           CLIST_NEW_RED, CLIST_NEW_GREEN, CLIST_NEW_BLUE);
+      break;
+    case DELETED_PALM_REC:
+    case DELETED_PC_REC:
+      set_bg_rgb_clist_row(clist, row,
+                           CLIST_DEL_RED, CLIST_DEL_GREEN, CLIST_DEL_BLUE);
+      break;
+    case MODIFIED_PALM_REC:
+      set_bg_rgb_clist_row(clist, row,
+                           CLIST_MOD_RED, CLIST_MOD_GREEN, CLIST_MOD_BLUE);
+      break;
+    default:
+      if (mcont->attrib & dlpRecAttrSecret) {
+         set_bg_rgb_clist_row(clist, row,
+                              CLIST_PRIVATE_RED, CLIST_PRIVATE_GREEN, CLIST_PRIVATE_BLUE);
+      } else {
+         gtk_clist_set_row_style(GTK_CLIST(clist), row, NULL);
+      }
+   }
+
+   /* Put a note pixmap up */
+   if (mcont->cont.entry[contNote]) {
+      gtk_clist_set_pixmap(GTK_CLIST(clist), row, ADDRESS_NOTE_COLUMN, pixmap_note, mask_note);
+   } else {
+      gtk_clist_set_text(GTK_CLIST(clist), row, ADDRESS_NOTE_COLUMN, "");
+   }
+}
+
+static void address_clist_fill_row(GtkWidget *clist, int row, gpointer row_data)
+{
+   address_clist_set_row(clist, row, row_data);
+}
+
+static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
+                                 ContactList **cont_list, int category, 
+                                 int main)
+{
+   int num_entries, entries_shown;
+   gchar *empty_line[] = { "","","" };
+   ContactList *temp_cl;
+   char str[ADDRESS_MAX_COLUMN_LEN+2];
+   int show_priv;
+   long show_tooltips;
    AddressList *addr_list;
 
+   TRACE_BEGIN("address_update_clist");
+
    free_ContactList(cont_list);
 
    if (address_version==0) {
@@ -3202,6 +3497,7 @@ static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
       gtk_text_buffer_set_text(GTK_TEXT_BUFFER(addr_all_buffer), "", -1);
    }
 
+   TRACE_BEGIN("fill clist");
    /* Freeze clist to prevent flicker during updating */
    gtk_clist_freeze(GTK_CLIST(clist));
    if (main) {
@@ -3215,40 +3511,9 @@ static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    gtk_widget_show_all(clist);
    gtk_clist_freeze(GTK_CLIST(clist));
 #endif
+   clist_set_fill_func(GTK_CLIST(clist), address_clist_fill_row);
 
-   /* Collect preferences and pixmaps before loop */
-   get_pref(PREF_CHAR_SET, &char_set, NULL);
-   get_pref(PREF_USE_JOS, &use_jos, NULL);
    show_priv = show_privates(GET_PRIVATES);
-   get_pixmaps(clist, PIXMAP_NOTE, &pixmap_note, &mask_note);
-#ifdef __APPLE__
-   mask_note = NULL;
-#endif
-
-   switch (addr_sort_order) {
-    case SORT_BY_LNAME:
-    default:
-      show1=contLastname;
-      show2=contFirstname;
-      show3=contCompany;
-      delim1 = comma_space;
-      delim2 = slash;
-      break;
-    case SORT_BY_FNAME:
-      show1=contFirstname;
-      show2=contLastname;
-      show3=contCompany;
-      delim1 = comma_space;
-      delim2 = slash;
-      break;
-    case SORT_BY_COMPANY:
-      show1=contCompany;
-      show2=contLastname;
-      show3=contFirstname;
-      delim1 = slash;
-      delim2 = comma_space;
-      break;
-   }
 
    entries_shown=0;
 
@@ -3278,113 +3543,8 @@ static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
          continue;
       }
 
-      if (!use_jos && (char_set == CHAR_SET_JAPANESE || char_set == CHAR_SET_SJIS_UTF)) {
-         str[0]='\0';
-         if (temp_cl->mcont.cont.entry[show1] || temp_cl->mcont.cont.entry[show2]) {
-            if (temp_cl->mcont.cont.entry[show1] && temp_cl->mcont.cont.entry[show2]) {
-               if ((tmp_p1 = strchr(temp_cl->mcont.cont.entry[show1],'\1'))) *tmp_p1='\0';
-               if ((tmp_p2 = strchr(temp_cl->mcont.cont.entry[show2],'\1'))) *tmp_p2='\0';
-               g_snprintf(str, ADDRESS_MAX_CLIST_NAME, "%s, %s", temp_cl->mcont.cont.entry[show1], temp_cl->mcont.cont.entry[show2]);
-               if (tmp_p1) *tmp_p1='\1';
-               if (tmp_p2) *tmp_p2='\1';
-            }
-            if (temp_cl->mcont.cont.entry[show1] && ! temp_cl->mcont.cont.entry[show2]) {
-               if ((tmp_p1 = strchr(temp_cl->mcont.cont.entry[show1],'\1'))) *tmp_p1='\0';
-               if (temp_cl->mcont.cont.entry[show3]) {
-                  if ((tmp_p3 = strchr(temp_cl->mcont.cont.entry[show3],'\1'))) *tmp_p3='\0';
-                  g_snprintf(str, ADDRESS_MAX_CLIST_NAME, "%s, %s", temp_cl->mcont.cont.entry[show1], temp_cl->mcont.cont.entry[show3]);
-                  if (tmp_p3) *tmp_p3='\1';
-               } else {
-                  multibyte_safe_strncpy(str, temp_cl->mcont.cont.entry[show1], ADDRESS_MAX_CLIST_NAME);
-               }
-               if (tmp_p1) *tmp_p1='\1';
-            }
-            if (! temp_cl->mcont.cont.entry[show1] && temp_cl->mcont.cont.entry[show2]) {
-               if ((tmp_p2 = strchr(temp_cl->mcont.cont.entry[show2],'\1'))) *tmp_p2='\0';
-               multibyte_safe_strncpy(str, temp_cl->mcont.cont.entry[show2], ADDRESS_MAX_CLIST_NAME);
-               if (tmp_p2) *tmp_p2='\1';
-            }
-         } else if (temp_cl->mcont.cont.entry[show3]) {
-            if ((tmp_p3 = strchr(temp_cl->mcont.cont.entry[show3],'\1'))) *tmp_p3='\0';
-            multibyte_safe_strncpy(str, temp_cl->mcont.cont.entry[show3], ADDRESS_MAX_CLIST_NAME);
-            if (tmp_p3) *tmp_p3='\1';
-         } else {
-            strcpy(str, _("-Unnamed-"));
-         }
-         gtk_clist_append(GTK_CLIST(clist), empty_line);
-      } else {
-         str[0]='\0';
-         field1=field2=field3=blank;
-         tmp_delim1=delim1;
-         tmp_delim2=delim2;
-         if (temp_cl->mcont.cont.entry[show1]) field1=temp_cl->mcont.cont.entry[show1];
-         if (temp_cl->mcont.cont.entry[show2]) field2=temp_cl->mcont.cont.entry[show2];
-         if (temp_cl->mcont.cont.entry[show3]) field3=temp_cl->mcont.cont.entry[show3];
-         switch (addr_sort_order) {
-          case SORT_BY_LNAME:
-          default:
-            if ((!field1[0]) || (!field2[0])) tmp_delim1=blank;
-            if (!(field3[0])) tmp_delim2=blank;
-            if ((!field1[0]) && (!field2[0])) tmp_delim2=blank;
-            break;
-          case SORT_BY_FNAME:
-            if ((!field1[0]) || (!field2[0])) tmp_delim1=blank;
-            if (!(field3[0])) tmp_delim2=blank;
-            if ((!field1[0]) && (!field2[0])) tmp_delim2=blank;
-            break;
-          case SORT_BY_COMPANY:
-            if (!(field1[0])) tmp_delim1=blank;
-            if ((!field2[0]) || (!field3[0])) tmp_delim2=blank;
-            if ((!field2[0]) && (!field3[0])) tmp_delim1=blank;
-            break;
-         }
-         g_snprintf(str, ADDRESS_MAX_COLUMN_LEN, "%s%s%s%s%s",
-                    field1, tmp_delim1, field2, tmp_delim2, field3);
-         if (strlen(str)<1) strcpy(str, _("-Unnamed-"));
-         str[ADDRESS_MAX_COLUMN_LEN]='\0';
-
-         gtk_clist_append(GTK_CLIST(clist), empty_line);
-      }
-
-      lstrncpy_remove_cr_lfs(str2, str, ADDRESS_MAX_COLUMN_LEN);
-      gtk_clist_set_text(GTK_CLIST(clist), entries_shown, ADDRESS_NAME_COLUMN, str2);
-      /* Clear string so previous data won't be used inadvertently in next set_text */
-      str2[0] = '\0';
-      lstrncpy_remove_cr_lfs(str2, temp_cl->mcont.cont.entry[temp_cl->mcont.cont.showPhone + 4], ADDRESS_MAX_COLUMN_LEN);
-      gtk_clist_set_text(GTK_CLIST(clist), entries_shown, ADDRESS_PHONE_COLUMN, str2);
-      gtk_clist_set_row_data(GTK_CLIST(clist), entries_shown, &(temp_cl->mcont));
-
-      /* Highlight row background depending on status */
-      switch (temp_cl->mcont.rt) {
-       case NEW_PC_REC:
-       case REPLACEMENT_PALM_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                              CLIST_NEW_RED, CLIST_NEW_GREEN, CLIST_NEW_BLUE);
-         break;
-       case DELETED_PALM_REC:
-       case DELETED_PC_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                              CLIST_DEL_RED, CLIST_DEL_GREEN, CLIST_DEL_BLUE);
-         break;
-       case MODIFIED_PALM_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                              CLIST_MOD_RED, CLIST_MOD_GREEN, CLIST_MOD_BLUE);
-         break;
-       default:
-         if (temp_cl->mcont.attrib & dlpRecAttrSecret) {
-            set_bg_rgb_clist_row(clist, entries_shown,
-                                 CLIST_PRIVATE_RED, CLIST_PRIVATE_GREEN, CLIST_PRIVATE_BLUE);
-         } else {
-            gtk_clist_set_row_style(GTK_CLIST(clist), entries_shown, NULL);
-         }
-      }
-
-      /* Put a note pixmap up */
-      if (temp_cl->mcont.cont.entry[contNote]) {
-         gtk_clist_set_pixmap(GTK_CLIST(clist), entries_shown, ADDRESS_NOTE_COLUMN, pixmap_note, mask_note);
-      } else {
-         gtk_clist_set_text(GTK_CLIST(clist), entries_shown, ADDRESS_NOTE_COLUMN, "");
-      }
+      /* Filled in by address_clist_fill_row() when it is drawn */
+      clist_append_unfilled(GTK_CLIST(clist), &(temp_cl->mcont));
 
       entries_shown++;
    }
@@ -3418,6 +3578,7 @@ static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
 
    /* Unfreeze clist after all changes */
    gtk_clist_thaw(GTK_CLIST(clist));
+   TRACE_END("fill clist");
 
    if (tooltip_widget) {
       get_pref(PREF_SHOW_TOOLTIPS, &show_tooltips, NULL);
@@ -3433,6 +3594,129 @@ static void address_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    /* return focus to clist after any big operation which requires a redraw */
    gtk_widget_grab_focus(GTK_WIDGET(clist));
 
+   TRACE_END("address_update_clist");
+}
+
+/* Returns TRUE if address_update_clist() would give mcont a row */
+static int address_clist_shows(MyContact *mcont, int show_priv)
+{
+   if (((mcont->attrib & 0x0F) != address_category) &&
+       address_category != CATEGORY_ALL) {
+      return FALSE;
+   }
+   if ((show_priv != SHOW_PRIVATES) &&
+       (mcont->attrib & dlpRecAttrSecret)) {
+      return FALSE;
+   }
+   return TRUE;
+}
+
+/*
+ * Apply a single add, modify or delete to glob_contact_list and the clist
+ * instead of re-reading the database and rebuilding the whole clist.
+ * old_mcont is the record delete_pc_record() was just called on with flag,
+ * or NULL.  new_cl is the record just written, or NULL, and is owned by the
+ * list afterwards.
+ * Returns EXIT_FAILURE, having freed new_cl, if the clist has to be redrawn.
+ */
+static int address_clist_patch(MyContact *old_mcont, int flag,
+                               ContactList *new_cl)
+{
+   gchar *empty_line[] = { "","","" };
+   ContactList *temp_cl;
+   char str[ADDRESS_MAX_COLUMN_LEN+2];
+   int row, new_row;
+   int num_entries, entries_shown;
+   int show_priv;
+   long show_tooltips;
+
+   show_priv = show_privates(GET_PRIVATES);
+
+   /* A record being searched for and masked records need a full redraw */
+   if (glob_find_id || (show_priv == MASK_PRIVATES)) {
+      if (new_cl) {
+         free_contact_node(new_cl);
+      }
+      return EXIT_FAILURE;
+   }
+
+   addr_clear_details();
+
+   gtk_clist_freeze(GTK_CLIST(clist));
+   gtk_signal_disconnect_by_func(GTK_OBJECT(clist),
+                                 GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+
+   if (old_mcont) {
+      old_mcont->rt = pc_record_type_after_delete(old_mcont->rt, flag);
+      row = gtk_clist_find_row_from_data(GTK_CLIST(clist), old_mcont);
+      if (row >= 0) {
+         clist_remove(GTK_CLIST(clist), row);
+      }
+      if (pc_record_type_shown(old_mcont->rt)) {
+         /* Redraw the row in the colors of its new status */
+         if (row >= 0) {
+            gtk_clist_insert(GTK_CLIST(clist), row, empty_line);
+            address_clist_set_row(clist, row, old_mcont);
+         }
+      } else {
+         contacts_remove(&glob_contact_list, old_mcont);
+      }
+   }
+
+   new_row = -1;
+   if (new_cl) {
+      if (contacts_insert_sorted(&glob_contact_list, new_cl, SORT_ASCENDING)) {
+         free_contact_node(new_cl);
+         gtk_signal_connect(GTK_OBJECT(clist), "select_row",
+                            GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+         gtk_clist_thaw(GTK_CLIST(clist));
+         return EXIT_FAILURE;
+      }
+      if (address_clist_shows(&(new_cl->mcont), show_priv)) {
+         /* The clist shows the list in order, skipping hidden records */
+         new_row = 0;
+         for (temp_cl = glob_contact_list; temp_cl != new_cl; temp_cl=temp_cl->next) {
+            if (address_clist_shows(&(temp_cl->mcont), show_priv)) {
+               new_row++;
+            }
+         }
+         gtk_clist_insert(GTK_CLIST(clist), new_row, empty_line);
+         address_clist_set_row(clist, new_row, &(new_cl->mcont));
+      }
+   }
+
+   /* GTK may have moved the selection while rows were removed, the row
+    * selected below has to emit a select_row to fill in the details */
+   clist_unselect_all(GTK_CLIST(clist));
+   gtk_signal_connect(GTK_OBJECT(clist), "select_row",
+                      GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+
+   entries_shown = GTK_CLIST(clist)->rows;
+   if (new_row >= 0) {
+      clist_row_selected = new_row;
+   }
+   if (entries_shown>0) {
+      if (clist_row_selected >= entries_shown) {
+         clist_row_selected = 0;
+      }
+      clist_select_row(GTK_CLIST(clist), clist_row_selected, ADDRESS_PHONE_COLUMN);
+      if (!gtk_clist_row_is_visible(GTK_CLIST(clist), clist_row_selected)) {
+         gtk_clist_moveto(GTK_CLIST(clist), clist_row_selected, 0, 0.5, 0.0);
+      }
+   }
+
+   gtk_clist_thaw(GTK_CLIST(clist));
+
+   get_pref(PREF_SHOW_TOOLTIPS, &show_tooltips, NULL);
+   for (num_entries=0, temp_cl=glob_contact_list; temp_cl; temp_cl=temp_cl->next) {
+      num_entries++;
+   }
+   sprintf(str, _("%d of %d records"), entries_shown, num_entries);
+   set_tooltip(show_tooltips, glob_tooltips, category_menu1, str, NULL);
+
+   gtk_widget_grab_focus(GTK_WIDGET(clist));
+
+   return EXIT_SUCCESS;
 }
 
 /* default set is which menu item is to be set on by default */
@@ -0,0 +1,677 @@
+/*******************************************************************************
+ * backup_store.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pi-md5.h>
+
+#include "i18n.h"
+#include "utils.h"
+#include "log.h"
+#include "backup_store.h"
+
+/********************************* Constants **********************************/
+#define MANIFEST_HEADER "# J-Pilot backup manifest 3"
+/* YYYYMMDDhhmmss */
+#define MANIFEST_NAME_LEN 14
+
+/****************************** Main Code *************************************/
+static void store_file_name(const char *sub, char *full_name, int max_size)
+{
+   char store_dir[FILENAME_MAX];
+
+   get_home_file_name(BACKUP_STORE_DIR, store_dir, sizeof(store_dir));
+   if (sub) {
+      g_snprintf(full_name, max_size, "%s/%s", store_dir, sub);
+   } else {
+      g_snprintf(full_name, max_size, "%s", store_dir);
+   }
+}
+
+/* Objects are spread over 256 directories by the first byte of the hash */
+static void object_file_name(const char *hash, char *full_name, int max_size)
+{
+   char sub[FILENAME_MAX];
+
+   g_snprintf(sub, sizeof(sub), "objects/%.2s/%s", hash, hash);
+   store_file_name(sub, full_name, max_size);
+}
+
+static void manifest_file_name(const char *manifest, char *full_name, int max_size)
+{
+   char sub[FILENAME_MAX];
+
+   g_snprintf(sub, sizeof(sub), "manifests/%s", manifest);
+   store_file_name(sub, full_name, max_size);
+}
+
+static int is_manifest_name(const char *name)
+{
+   int i;
+
+   for (i=0; i<MANIFEST_NAME_LEN; i++) {
+      if (!isdigit((unsigned char)name[i])) {
+         return FALSE;
+      }
+   }
+   return (name[i]=='\0');
+}
+
+static int is_hash_name(const char *name)
+{
+   int i;
+
+   for (i=0; i<BACKUP_HASH_LEN; i++) {
+      if (!isxdigit((unsigned char)name[i])) {
+         return FALSE;
+      }
+   }
+   return (name[i]=='\0');
+}
+
+static int store_make_dirs(void)
+{
+   char full_name[FILENAME_MAX];
+   struct stat statb;
+
+   store_file_name(NULL, full_name, sizeof(full_name));
+   mkdir(full_name, 0700);
+   store_file_name("objects", full_name, sizeof(full_name));
+   mkdir(full_name, 0700);
+   store_file_name("manifests", full_name, sizeof(full_name));
+   mkdir(full_name, 0700);
+
+   if (stat(full_name, &statb) || !S_ISDIR(statb.st_mode)) {
+      jp_logf(JP_LOG_WARN, _("Unable to create directory %s\n"), full_name);
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+static int hash_file(const char *file_name, char *hash)
+{
+   FILE *in;
+   struct MD5Context ctx;
+   unsigned char buf[8192];
+   unsigned char digest[16];
+   size_t r;
+   int i;
+
+   in = fopen(file_name, "r");
+   if (!in) {
+      return EXIT_FAILURE;
+   }
+   MD5Init(&ctx);
+   while ((r = fread(buf, 1, sizeof(buf), in)) > 0) {
+      MD5Update(&ctx, buf, r);
+   }
+   if (ferror(in)) {
+      fclose(in);
+      return EXIT_FAILURE;
+   }
+   fclose(in);
+   MD5Final(digest, &ctx);
+
+   for (i=0; i<16; i++) {
+      sprintf(hash+i*2, "%02x", digest[i]);
+   }
+   hash[BACKUP_HASH_LEN]='\0';
+
+   return EXIT_SUCCESS;
+}
+
+/* Copy file_name into the store unless an object with its hash is there */
+static int store_object(const char *file_name, const char *hash)
+{
+   char object_name[FILENAME_MAX];
+   char tmp_name[FILENAME_MAX];
+   char src[FILENAME_MAX];
+   char sub[16];
+   struct stat statb;
+
+   object_file_name(hash, object_name, sizeof(object_name));
+   if (!stat(object_name, &statb)) {
+      return EXIT_SUCCESS;
+   }
+
+   g_snprintf(sub, sizeof(sub), "objects/%.2s", hash);
+   store_file_name(sub, tmp_name, sizeof(tmp_name));
+   mkdir(tmp_name, 0700);
+
+   /* Copy under a temporary name so that a partial copy is never used */
+   g_snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", object_name);
+   g_strlcpy(src, file_name, sizeof(src));
+   if (jp_copy_file(src, tmp_name)) {
+      unlink(tmp_name);
+      return EXIT_FAILURE;
+   }
+   if (rename(tmp_name, object_name)) {
+      unlink(tmp_name);
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/* Parse "<changed IDs> <removed IDs>", "-" stands for none */
+static void backup_entry_set_delta(struct backup_entry *entry, const char *delta)
+{
+   const char *removed;
+   int len;
+
+   removed = strchr(delta, ' ');
+   if (!removed) {
+      return;
+   }
+   len = removed - delta;
+   removed++;
+
+   free(entry->changed);
+   free(entry->removed);
+   if ((len == 1) && (delta[0] == '-')) {
+      entry->changed = strdup("");
+   } else {
+      entry->changed = malloc(len+1);
+      if (entry->changed) {
+         memcpy(entry->changed, delta, len);
+         entry->changed[len] = '\0';
+      }
+   }
+   entry->removed = strdup(strcmp(removed, "-") ? removed : "");
+}
+
+/* Read a whole line of any length into *line, growing it as needed */
+static int read_line(FILE *in, char **line, size_t *size)
+{
+   size_t len;
+   char *new_line;
+
+   len = 0;
+   while (fgets(*line + len, *size - len, in)) {
+      len += strlen(*line + len);
+      if ((len > 0) && ((*line)[len-1] == '\n')) {
+         (*line)[--len] = '\0';
+         return TRUE;
+      }
+      new_line = realloc(*line, *size * 2);
+      if (!new_line) {
+         return FALSE;
+      }
+      *line = new_line;
+      *size *= 2;
+   }
+
+   return (len > 0);
+}
+
+void backup_store_free_entries(struct backup_entry **entries)
+{
+   struct backup_entry *temp_entry, *next_entry;
+
+   for (temp_entry = *entries; temp_entry; temp_entry = next_entry) {
+      next_entry = temp_entry->next;
+      free(temp_entry->name);
+      free(temp_entry->changed);
+      free(temp_entry->removed);
+      free(temp_entry);
+   }
+   *entries = NULL;
+}
+
+int backup_store_read_manifest(const char *manifest,
+                               struct backup_entry **entries)
+{
+   FILE *in;
+   char full_name[FILENAME_MAX];
+   char *line;
+   size_t line_size;
+   struct backup_entry *entry, *last;
+   char hash[BACKUP_HASH_LEN+1];
+   long size, mtime, synced;
+   int n;
+
+   *entries = NULL;
+   last = NULL;
+
+   manifest_file_name(manifest, full_name, sizeof(full_name));
+   in = fopen(full_name, "r");
+   if (!in) {
+      jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), full_name);
+      return EXIT_FAILURE;
+   }
+
+   /* Delta lines can be long */
+   line_size = FILENAME_MAX;
+   line = malloc(line_size);
+   if (!line) {
+      fclose(in);
+      return EXIT_FAILURE;
+   }
+   while (read_line(in, &line, &line_size)) {
+      if (line[0]=='#') {
+         continue;
+      }
+      /* delta <hash> <changed IDs> <removed IDs> of the entry before */
+      if (!strncmp(line, "delta ", 6)) {
+         if (last && (sscanf(line, "delta %32s %n", hash, &n) == 1) &&
+             !strcmp(hash, last->hash)) {
+            backup_entry_set_delta(last, line+n);
+         }
+         continue;
+      }
+      /* synced <hash> <sync date> of the entry before */
+      if (!strncmp(line, "synced ", 7)) {
+         if (last && (sscanf(line, "synced %32s %ld", hash, &synced) == 2) &&
+             !strcmp(hash, last->hash)) {
+            last->synced = synced;
+         }
+         continue;
+      }
+      n = 0;
+      if ((sscanf(line, "%32s %ld %ld %n", hash, &size, &mtime, &n) < 3) ||
+          (n==0) || (line[n]=='\0') || !is_hash_name(hash)) {
+         jp_logf(JP_LOG_WARN, _("Bad line in backup manifest %s\n"), manifest);
+         continue;
+      }
+
+      entry = malloc(sizeof(struct backup_entry));
+      if (!entry) {
+         jp_logf(JP_LOG_WARN, "backup_store_read_manifest(): %s\n",
+                 _("Out of memory"));
+         break;
+      }
+      g_strlcpy(entry->hash, hash, sizeof(entry->hash));
+      entry->size = size;
+      entry->mtime = mtime;
+      entry->name = strdup(line+n);
+      entry->changed = NULL;
+      entry->removed = NULL;
+      entry->synced = 0;
+      entry->next = NULL;
+      /* Keep the order of the manifest */
+      if (last) {
+         last->next = entry;
+      } else {
+         *entries = entry;
+      }
+      last = entry;
+   }
+   free(line);
+   fclose(in);
+
+   return EXIT_SUCCESS;
+}
+
+static gint compare_manifests(gconstpointer a, gconstpointer b)
+{
+   /* Newest first, the names sort by date */
+   return strcmp((const char *)b, (const char *)a);
+}
+
+int backup_store_get_manifests(GList **manifests)
+{
+   DIR *dir;
+   struct dirent *dirent;
+   char full_name[FILENAME_MAX];
+
+   *manifests = NULL;
+
+   store_file_name("manifests", full_name, sizeof(full_name));
+   dir = opendir(full_name);
+   if (!dir) {
+      return EXIT_SUCCESS;
+   }
+   while ((dirent = readdir(dir))) {
+      if (is_manifest_name(dirent->d_name)) {
+         *manifests = g_list_prepend(*manifests, g_strdup(dirent->d_name));
+      }
+   }
+   closedir(dir);
+
+   *manifests = g_list_sort(*manifests, compare_manifests);
+
+   return EXIT_SUCCESS;
+}
+
+void backup_store_free_manifests(GList **manifests)
+{
+   GList *temp_list;
+
+   for (temp_list = *manifests; temp_list; temp_list = temp_list->next) {
+      g_free(temp_list->data);
+   }
+   g_list_free(*manifests);
+   *manifests = NULL;
+}
+
+int backup_store_manifest_time(const char *manifest, struct tm *when)
+{
+   memset(when, 0, sizeof(struct tm));
+   if (!is_manifest_name(manifest)) {
+      return EXIT_FAILURE;
+   }
+   if (sscanf(manifest, "%4d%2d%2d%2d%2d%2d",
+              &when->tm_year, &when->tm_mon, &when->tm_mday,
+              &when->tm_hour, &when->tm_min, &when->tm_sec) != 6) {
+      return EXIT_FAILURE;
+   }
+   when->tm_year -= 1900;
+   when->tm_mon -= 1;
+   when->tm_isdst = -1;
+   mktime(when);
+
+   return EXIT_SUCCESS;
+}
+
+int backup_store_snapshot(const char *dir_name, time_t when,
+                          struct backup_entry *deltas)
+{
+   DIR *dir;
+   struct dirent *dirent;
+   GList *manifests;
+   GHashTable *prev_hash;
+   struct backup_entry *prev_entries, *entry, *temp_entry;
+   struct backup_entry *entries;
+   char manifest[MANIFEST_NAME_LEN+1];
+   char full_name[FILENAME_MAX];
+   char tmp_name[FILENAME_MAX];
+   char file_name[FILENAME_MAX];
+   char object_name[FILENAME_MAX];
+   struct stat statb, object_statb;
+   struct tm *now;
+   FILE *out;
+   int num, failed;
+
+   jp_logf(JP_LOG_DEBUG, "backup_store_snapshot [%s]\n", dir_name);
+
+   if (store_make_dirs()) {
+      return EXIT_FAILURE;
+   }
+
+   /* Files that are unchanged since the last backup keep their hash
+    * so that only new or modified databases are read */
+   prev_entries = NULL;
+   prev_hash = g_hash_table_new(g_str_hash, g_str_equal);
+   backup_store_get_manifests(&manifests);
+   if (manifests) {
+      backup_store_read_manifest(manifests->data, &prev_entries);
+      for (temp_entry = prev_entries; temp_entry; temp_entry = temp_entry->next) {
+         g_hash_table_insert(prev_hash, temp_entry->name, temp_entry);
+      }
+   }
+
+   /* Two backups within a second get the next free name */
+   for (num=0; num<60; num++) {
+      now = localtime(&when);
+      strftime(manifest, sizeof(manifest), "%Y%m%d%H%M%S", now);
+      if (!g_list_find_custom(manifests, manifest, (GCompareFunc)strcmp)) {
+         break;
+      }
+      when++;
+   }
+   backup_store_free_manifests(&manifests);
+
+   entries = NULL;
+   failed = 0;
+   dir = opendir(dir_name);
+   if (!dir) {
+      jp_logf(JP_LOG_WARN, _("Unable to open directory %s\n"), dir_name);
+      failed = 1;
+   } else {
+      while ((dirent = readdir(dir))) {
+         if (dirent->d_name[0]=='.') {
+            continue;
+         }
+         g_snprintf(file_name, sizeof(file_name), "%s/%s", dir_name, dirent->d_name);
+         if (stat(file_name, &statb) || !S_ISREG(statb.st_mode)) {
+            continue;
+         }
+
+         entry = malloc(sizeof(struct backup_entry));
+         if (!entry) {
+            jp_logf(JP_LOG_WARN, "backup_store_snapshot(): %s\n",
+                    _("Out of memory"));
+            failed = 1;
+            break;
+         }
+         entry->size = statb.st_size;
+         entry->mtime = statb.st_mtime;
+         entry->name = strdup(dirent->d_name);
+         entry->hash[0]='\0';
+         entry->changed = NULL;
+         entry->removed = NULL;
+         entry->synced = 0;
+         for (temp_entry = deltas; temp_entry; temp_entry = temp_entry->next) {
+            if (!strcmp(temp_entry->name, dirent->d_name)) {
+               if (temp_entry->changed) {
+                  entry->changed = strdup(temp_entry->changed);
+                  entry->removed = strdup(temp_entry->removed ? temp_entry->removed : "");
+               }
+               entry->synced = temp_entry->synced;
+               break;
+            }
+         }
+
+         temp_entry = g_hash_table_lookup(prev_hash, dirent->d_name);
+         if (temp_entry &&
+             (temp_entry->size == entry->size) &&
+             (temp_entry->mtime == entry->mtime)) {
+            object_file_name(temp_entry->hash, object_name, sizeof(object_name));
+            if (!stat(object_name, &object_statb)) {
+               g_strlcpy(entry->hash, temp_entry->hash, sizeof(entry->hash));
+            }
+         }
+
+         if (entry->hash[0]=='\0') {
+            if (hash_file(file_name, entry->hash) ||
+                store_object(file_name, entry->hash)) {
+               jp_logf(JP_LOG_WARN, _("Unable to back up %s\n"), file_name);
+               entry->next = NULL;
+               backup_store_free_entries(&entry);
+               failed = 1;
+               continue;
+            }
+         }
+
+         entry->next = entries;
+         entries = entry;
+      }
+      closedir(dir);
+   }
+
+   g_hash_table_destroy(prev_hash);
+   backup_store_free_entries(&prev_entries);
+
+   if (dir) {
+      /* The manifest is written under a temporary name and renamed */
+      manifest_file_name(manifest, full_name, sizeof(full_name));
+      g_snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", full_name);
+      out = fopen(tmp_name, "w");
+      if (!out) {
+         jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), tmp_name);
+         failed = 1;
+      } else {
+         fprintf(out, "%s\n", MANIFEST_HEADER);
+         for (temp_entry = entries; temp_entry; temp_entry = temp_entry->next) {
+            fprintf(out, "%s %ld %ld %s\n", temp_entry->hash,
+                    temp_entry->size, (long)temp_entry->mtime, temp_entry->name);
+            if (temp_entry->changed) {
+               fprintf(out, "delta %s %s %s\n", temp_entry->hash,
+                       temp_entry->changed[0] ? temp_entry->changed : "-",
+                       temp_entry->removed[0] ? temp_entry->removed : "-");
+            }
+            if (temp_entry->synced) {
+               fprintf(out, "synced %s %ld\n", temp_entry->hash,
+                       (long)temp_entry->synced);
+            }
+         }
+         if (fclose(out) || rename(tmp_name, full_name)) {
+            jp_logf(JP_LOG_WARN, _("Unable to write backup manifest %s\n"), full_name);
+            unlink(tmp_name);
+            failed = 1;
+         }
+      }
+   }
+
+   backup_store_free_entries(&entries);
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Delete every object that is not listed in a manifest */
+static int backup_store_gc(void)
+{
+   DIR *dir, *sub_dir;
+   struct dirent *dirent, *sub_dirent;
+   GList *manifests, *temp_list;
+   GHashTable *in_use;
+   struct backup_entry *entries, *temp_entry;
+   GList *all_entries;
+   char objects_dir[FILENAME_MAX];
+   char sub_dir_name[FILENAME_MAX];
+   char file_name[FILENAME_MAX];
+   int removed;
+
+   in_use = g_hash_table_new(g_str_hash, g_str_equal);
+   all_entries = NULL;
+
+   backup_store_get_manifests(&manifests);
+   for (temp_list = manifests; temp_list; temp_list = temp_list->next) {
+      if (backup_store_read_manifest(temp_list->data, &entries)) {
+         /* Deleting objects of a manifest that could not be read
+          * would lose that backup */
+         jp_logf(JP_LOG_WARN, _("Not removing unused backups\n"));
+         backup_store_free_manifests(&manifests);
+         for (temp_list = all_entries; temp_list; temp_list = temp_list->next) {
+            entries = temp_list->data;
+            backup_store_free_entries(&entries);
+         }
+         g_list_free(all_entries);
+         g_hash_table_destroy(in_use);
+         return EXIT_FAILURE;
+      }
+      for (temp_entry = entries; temp_entry; temp_entry = temp_entry->next) {
+         g_hash_table_insert(in_use, temp_entry->hash, temp_entry);
+      }
+      all_entries = g_list_prepend(all_entries, entries);
+   }
+   backup_store_free_manifests(&manifests);
+
+   removed = 0;
+   store_file_name("objects", objects_dir, sizeof(objects_dir));
+   dir = opendir(objects_dir);
+   if (dir) {
+      while ((dirent = readdir(dir))) {
+         if (dirent->d_name[0]=='.') {
+            continue;
+         }
+         g_snprintf(sub_dir_name, sizeof(sub_dir_name), "%s/%s", objects_dir, dirent->d_name);
+         sub_dir = opendir(sub_dir_name);
+         if (!sub_dir) {
+            continue;
+         }
+         while ((sub_dirent = readdir(sub_dir))) {
+            if (sub_dirent->d_name[0]=='.') {
+               continue;
+            }
+            /* Only touch what the store itself writes: objects and
+             * leftovers of interrupted copies */
+            if (is_hash_name(sub_dirent->d_name)) {
+               if (g_hash_table_lookup(in_use, sub_dirent->d_name)) {
+                  continue;
+               }
+            } else if (!g_str_has_suffix(sub_dirent->d_name, ".tmp")) {
+               continue;
+            }
+            g_snprintf(file_name, sizeof(file_name), "%s/%s", sub_dir_name, sub_dirent->d_name);
+            jp_logf(JP_LOG_DEBUG, "backup_store_gc: removing [%s]\n", file_name);
+            if (!unlink(file_name)) {
+               removed++;
+            }
+         }
+         closedir(sub_dir);
+         /* Only succeeds once the directory is empty */
+         rmdir(sub_dir_name);
+      }
+      closedir(dir);
+   }
+   jp_logf(JP_LOG_DEBUG, "backup_store_gc: removed %d objects\n", removed);
+
+   g_hash_table_destroy(in_use);
+   for (temp_list = all_entries; temp_list; temp_list = temp_list->next) {
+      entries = temp_list->data;
+      backup_store_free_entries(&entries);
+   }
+   g_list_free(all_entries);
+
+   return EXIT_SUCCESS;
+}
+
+int backup_store_rotate(int num_backups)
+{
+   GList *manifests, *temp_list;
+   char full_name[FILENAME_MAX];
+   int i;
+
+   backup_store_get_manifests(&manifests);
+   for (i=0, temp_list = manifests; temp_list; i++, temp_list = temp_list->next) {
+      if (i < num_backups) {
+         continue;
+      }
+      manifest_file_name(temp_list->data, full_name, sizeof(full_name));
+      jp_logf(JP_LOG_DEBUG, "removing backup [%s]\n", full_name);
+      unlink(full_name);
+   }
+   backup_store_free_manifests(&manifests);
+
+   return backup_store_gc();
+}
+
+int backup_store_extract(const struct backup_entry *entry, const char *dest)
+{
+   char object_name[FILENAME_MAX];
+   char dest_name[FILENAME_MAX];
+   struct utimbuf times;
+
+   object_file_name(entry->hash, object_name, sizeof(object_name));
+   g_strlcpy(dest_name, dest, sizeof(dest_name));
+   if (jp_copy_file(object_name, dest_name)) {
+      jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), object_name);
+      return EXIT_FAILURE;
+   }
+
+   /* The file gets the modify time it had when it was backed up */
+   times.actime = entry->mtime;
+   times.modtime = entry->mtime;
+   utime(dest_name, &times);
+
+   return EXIT_SUCCESS;
+}
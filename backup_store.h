@@ -0,0 +1,83 @@
+/*******************************************************************************
+ * backup_store.h
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+#ifndef __BACKUP_STORE_H__
+#define __BACKUP_STORE_H__
+
+#include <time.h>
+#include <glib.h>
+
+/*
+ * Backups are kept in JPILOT_HOME/backup_store.  Every database file is
+ * stored once in objects/, named by the MD5 sum of its contents.  Each
+ * backup is a small manifest in manifests/, named YYYYMMDDhhmmss, that
+ * lists the hash, size, modify time and file name of every database it
+ * holds.  Removing a backup removes its manifest, and objects no longer
+ * listed in any manifest are then deleted.
+ *
+ * A database that was brought up to date by fetching only its changed
+ * records is followed in the manifest by a delta line listing the
+ * unique IDs of the records that were changed and removed.  A database
+ * fetched or found up to date during the backup is followed by a synced
+ * line giving the sync date that sync left on the handheld.
+ */
+
+#define BACKUP_STORE_DIR "backup_store"
+/* Hex digits of an MD5 sum */
+#define BACKUP_HASH_LEN  32
+
+struct backup_entry
+{
+   char hash[BACKUP_HASH_LEN+1];
+   long size;
+   time_t mtime;
+   char *name;
+   /* Comma separated record IDs of a delta, or NULL */
+   char *changed;
+   char *removed;
+   /* Sync date on the handheld when this copy matched it, or 0 */
+   time_t synced;
+   struct backup_entry *next;
+};
+
+/* Record the files in dir as a new backup made at time when.
+ * Entries of deltas, matched by name, give the record deltas and
+ * sync dates. */
+int backup_store_snapshot(const char *dir, time_t when,
+                          struct backup_entry *deltas);
+
+/* Keep the newest num_backups backups and delete unreferenced objects */
+int backup_store_rotate(int num_backups);
+
+/* List the manifest names, newest first.  Free with backup_store_free_manifests */
+int backup_store_get_manifests(GList **manifests);
+void backup_store_free_manifests(GList **manifests);
+
+/* Time a manifest was made, from its name */
+int backup_store_manifest_time(const char *manifest, struct tm *when);
+
+int backup_store_read_manifest(const char *manifest,
+                               struct backup_entry **entries);
+void backup_store_free_entries(struct backup_entry **entries);
+
+/* Copy the database of entry out of the store to the file dest */
+int backup_store_extract(const struct backup_entry *entry, const char *dest);
+
+#endif
@@ -37,6 +37,7 @@
 #include "libplugin.h"
 #include "password.h"
 #include "calendar.h"
+#include "trace.h"
 
 /* Copy AppInfo data structures */
 int copy_appointment_ai_to_calendar_ai(const struct AppointmentAppInfo *aai, struct CalendarAppInfo *cai)
@@ -404,7 +405,8 @@ int get_days_calendar_events2(CalendarEventList **calendar_event_list,
    buf_rec *br;
    long char_set;
    long datebook_version;
-   char *buf;
+   char *fields[3];
+   double unpack_start, conv_start, conv_time;
    pi_buffer_t RecordBuffer;
    int i;
 #ifdef ENABLE_DATEBK
@@ -455,6 +457,9 @@ int get_days_calendar_events2(CalendarEventList **calendar_event_list,
 
    if (total_records) *total_records = num;
 
+   TRACE_BEGIN("unpack");
+   unpack_start = TRACE_NOW();
+   conv_time = 0.0;
    for (temp_list = records; temp_list; temp_list = temp_list->next) {
       if (temp_list->data) {
          br=temp_list->data;
@@ -518,26 +523,16 @@ int get_days_calendar_events2(CalendarEventList **calendar_event_list,
          }
       }
 
-      if (cale.description) {
-         buf = charset_p2newj(cale.description, -1, char_set);
-         if (buf) {
-            free(cale.description);
-            cale.description = buf;
-         }
-      }
-      if (cale.note) {
-         buf = charset_p2newj(cale.note, -1, char_set);
-         if (buf) {
-            free(cale.note);
-            cale.note = buf;
-         }
-      }
-      if (cale.location) {
-         buf = charset_p2newj(cale.location, -1, char_set);
-         if (buf) {
-            free(cale.location);
-            cale.location = buf;
-         }
+      conv_start = TRACE_NOW();
+      fields[0] = cale.description;
+      fields[1] = cale.note;
+      fields[2] = cale.location;
+      charset_p2j_fields(fields, 3, char_set);
+      cale.description = fields[0];
+      cale.note = fields[1];
+      cale.location = fields[2];
+      if (glob_trace) {
+         conv_time += trace_now() - conv_start;
       }
 
       temp_ce_list = malloc(sizeof(CalendarEventList));
@@ -556,6 +551,11 @@ int get_days_calendar_events2(CalendarEventList **calendar_event_list,
       recs_returned++;
    }
 
+   if (glob_trace) {
+      trace_total("charset conversion", unpack_start, conv_time);
+   }
+   TRACE_END("unpack");
+
    jp_free_DB_records(&records);
 
    calendar_sort(calendar_event_list, calendar_compare);
@@ -34,19 +34,15 @@
 #include "i18n.h"
 #include "utils.h"
 #include "log.h"
+#include "trace.h"
 #include "prefs.h"
 #include "libplugin.h"
 #include "password.h"
 
 /********************************* Constants **********************************/
-#define SORT_JAPANESE 8
-#define SORT_JOS 16
-
 #define CONT_ADDR_MAP_SIZE (NUM_CONTACT_ENTRIES * 2)
 
 /******************************* Global vars **********************************/
-static int glob_sort_rule;
-
 /* Used for mapping between Contacts and Addresses */
 static long cont_addr_map[CONT_ADDR_MAP_SIZE]={
    contLastname, entryLastname,
@@ -91,196 +87,51 @@ static long cont_addr_map[CONT_ADDR_MAP_SIZE]={
 };
 
 /****************************** Main Code *************************************/
-static int contact_compare(const void *v1, const void *v2)
+/* Returns the collation key of a record, building it if needed */
+static struct addr_sort_key *contact_sort_key(ContactList *cl, int sort_rule)
 {
-   ContactList **cl1, **cl2;
-   struct Contact *c1, *c2;
-   char *str1 = NULL, *str2 = NULL;
-   int last_cmp1, last_cmp2;
-   int sort_idx[4];
-   int i, j, r;
+   struct Contact *c;
+   char *fields[3];
 
-   cl1=(ContactList **)v1;
-   cl2=(ContactList **)v2;
+   if (cl->sort_key && (cl->sort_key->sort_rule == sort_rule)) {
+      return cl->sort_key;
+   }
+   addr_sort_key_free(&(cl->sort_key));
 
-   c1=&((*cl1)->mcont.cont);
-   c2=&((*cl2)->mcont.cont);
+   c = &(cl->mcont.cont);
 
-   switch (glob_sort_rule & 0x7) {
+   switch (sort_rule & 0x7) {
     case SORT_BY_FNAME:
-      sort_idx[1] = contFirstname;
-      sort_idx[2] = contLastname;
-      sort_idx[3] = contCompany;
+      fields[0] = c->entry[contFirstname];
+      fields[1] = c->entry[contLastname];
+      fields[2] = c->entry[contCompany];
       break;
     case SORT_BY_LNAME:
     default:
-      sort_idx[1] = contLastname;
-      sort_idx[2] = contFirstname;
-      sort_idx[3] = contCompany;
+      fields[0] = c->entry[contLastname];
+      fields[1] = c->entry[contFirstname];
+      fields[2] = c->entry[contCompany];
       break;
     case SORT_BY_COMPANY:
-      sort_idx[1] = contCompany;
-      sort_idx[2] = contLastname;
-      sort_idx[3] = contFirstname;
+      fields[0] = c->entry[contCompany];
+      fields[1] = c->entry[contLastname];
+      fields[2] = c->entry[contFirstname];
       break;
-   } 
-
-   last_cmp1=last_cmp2=0;
-
-   if (!(glob_sort_rule & SORT_JAPANESE) || (glob_sort_rule & SORT_JOS)) { /* normal */
-      while (last_cmp1 < 3 && last_cmp2 < 3) {
-         str1=str2=NULL;
-         /* Find the next non-blank field to use for sorting */
-         for (i=last_cmp1+1; i<=3; i++) {
-            if (c1->entry[sort_idx[i]]) {
-               if ((str1 = malloc(strlen(c1->entry[sort_idx[i]])+1)) == NULL) {
-                  return 0;
-               }
-               strcpy(str1, c1->entry[sort_idx[i]]);
-               /* Convert string to lower case for more accurate comparison */
-               for (j=strlen(str1)-1; j >= 0; j--) {
-                  str1[j] = tolower(str1[j]);
-               }
-               break;
-            }
-         }
-         last_cmp1 = i;
-
-         if (!str1) return -1;
-
-         for (i=last_cmp2+1; i<=3; i++) {
-            if (c2->entry[sort_idx[i]]) {
-               if ((str2 = malloc(strlen(c2->entry[sort_idx[i]])+1)) == NULL) {
-                  return 0;
-               }
-               strcpy(str2, c2->entry[sort_idx[i]]);
-               for (j=strlen(str2)-1; j >= 0; j--) {
-                  str2[j] = tolower(str2[j]);
-               }
-               break;
-            }
-         }
-         last_cmp2 = i;
-
-         if (!str2) {
-            free(str1);
-            return 1;
-         }
-
-         r = strcoll(str1, str2);
-
-         if (str1) free(str1);
-         if (str2) free(str2);
-
-         if (r != 0) return r;
-
-         /* Comparisons between unequal fields, such as last name and company
-          * must assume that the other fields are blank.  This matches
-          * Palm sort ordering. */
-         if (last_cmp1 != last_cmp2) {
-            return (last_cmp2 - last_cmp1);
-         }
-      }   /* end of while loop to search over 3 fields */
-
-      /* Compared all search fields and no difference found */
-      return 0;
-
-   } else if ((glob_sort_rule & SORT_JAPANESE) && !(glob_sort_rule & SORT_JOS)){
-      /* Japanese sorting has not been updated to fix Bug 1814 because no test
-       * platform is available for Western programmers maintaining Jpilot. */
-      int sort1, sort2, sort3;
-      char *tmp_p1, *tmp_p2, *tmp_p3;
-      sort1 = sort_idx[1];
-      sort2 = sort_idx[2];
-      sort3 = sort_idx[3];
-
-      if (c1->entry[sort1] || c1->entry[sort2]) {
-         if (c1->entry[sort1] && c1->entry[sort2]) {
-            if (!(tmp_p1 = strchr(c1->entry[sort1],'\1'))) tmp_p1=c1->entry[sort1]+1;
-            if (!(tmp_p2 = strchr(c1->entry[sort2],'\1'))) tmp_p2=c1->entry[sort2]+1;
-            if ((str1 = malloc(strlen(tmp_p1)+strlen(tmp_p2)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str1, tmp_p1);
-            strcat(str1, tmp_p2);
-         }
-         if (c1->entry[sort1] && (!c1->entry[sort2])) {
-            if (!(tmp_p1 = strchr(c1->entry[sort1],'\1'))) tmp_p1=c1->entry[sort1]+1;
-            if ((str1 = malloc(strlen(tmp_p1)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str1, tmp_p1);
-         }
-         if ((!c1->entry[sort1]) && c1->entry[sort2]) {
-            if (!(tmp_p2 = strchr(c1->entry[sort2],'\1'))) tmp_p2=c1->entry[sort2]+1;
-            if ((str1 = malloc(strlen(tmp_p2)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str1, tmp_p2);
-         }
-      } else if (c1->entry[sort3]) {
-         if (!(tmp_p3 = strchr(c1->entry[sort3],'\1'))) tmp_p3=c1->entry[sort3]+1;
-         if ((str1 = malloc(strlen(tmp_p3)+1)) == NULL) {
-            return 0;
-         }
-         strcpy(str1, tmp_p3);
-      } else {
-         return 1;
-      }
-
-      if (c2->entry[sort1] || c2->entry[sort2]) {
-         if (c2->entry[sort1] && c2->entry[sort2]) {
-            if (!(tmp_p1 = strchr(c2->entry[sort1],'\1'))) tmp_p1=c2->entry[sort1]+1;
-            if (!(tmp_p2 = strchr(c2->entry[sort2],'\1'))) tmp_p2=c2->entry[sort2]+1;
-            if ((str2 = malloc(strlen(tmp_p1)+strlen(tmp_p2)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str2, tmp_p1);
-            strcat(str2, tmp_p2);
-         }
-         if (c2->entry[sort1] && (!c2->entry[sort2])) {
-            if (!(tmp_p1 = strchr(c2->entry[sort1],'\1'))) tmp_p1=c2->entry[sort1]+1;
-            if ((str2 = malloc(strlen(tmp_p1)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str2, tmp_p1);
-         }
-         if ((!c2->entry[sort1]) && c2->entry[sort2]) {
-            if (!(tmp_p2 = strchr(c2->entry[sort2],'\1'))) tmp_p2=c2->entry[sort2]+1;
-            if ((str2 = malloc(strlen(tmp_p2)+1)) == NULL) {
-               return 0;
-            }
-            strcpy(str2, tmp_p2);
-         }
-      } else if (c2->entry[sort3]) {
-         if (!(tmp_p3 = strchr(c2->entry[sort3],'\1'))) tmp_p3=c2->entry[sort3]+1;
-         if ((str2 = malloc(strlen(tmp_p3)+1)) == NULL) {
-            return 0;
-         }
-         strcpy(str2, tmp_p3);
-      } else {
-         free(str1);
-         return -1;
-      }
+   }
 
-      /* lower case the strings for a better compare */
-      for (i=strlen(str1)-1; i >= 0; i--) {
-         str1[i] = tolower(str1[i]);
-      }
-      for (i=strlen(str2)-1; i >= 0; i--) {
-         str2[i] = tolower(str2[i]);
-      }
+   cl->sort_key = addr_sort_key_new(fields, sort_rule);
 
-      i = strcoll(str1, str2);
-      if (str1) free(str1);
-      if (str2) free(str2);
+   return cl->sort_key;
+}
 
-      return i;
-   }
+static int contact_compare(const void *v1, const void *v2)
+{
+   ContactList **cl1, **cl2;
 
-   /* Should never be reached.  Assume records are unsortable if reached */
-   return 0;
+   cl1=(ContactList **)v1;
+   cl2=(ContactList **)v2;
 
+   return addr_sort_key_compare((*cl1)->sort_key, (*cl2)->sort_key);
 }
 
 /*
@@ -291,7 +142,7 @@ static int contacts_sort(ContactList **cl, int sort_order)
    ContactList *temp_cl;
    ContactList **sort_cl;
    int count, i;
-   long use_jos, char_set;
+   int sort_rule;
 
    /* Count the entries in the list */
    for (count=0, temp_cl=*cl; temp_cl; temp_cl=temp_cl->next, count++) {}
@@ -301,20 +152,7 @@ static int contacts_sort(ContactList **cl, int sort_order)
       return EXIT_SUCCESS;
    }
 
-   glob_sort_rule = addr_sort_order;
-
-   get_pref(PREF_CHAR_SET, &char_set, NULL);
-   if (char_set == CHAR_SET_JAPANESE || char_set == CHAR_SET_SJIS_UTF) {
-      glob_sort_rule = glob_sort_rule | SORT_JAPANESE;
-   } else {
-      glob_sort_rule = glob_sort_rule & (SORT_JAPANESE-1);
-   }
-   get_pref(PREF_USE_JOS, &use_jos, NULL);
-   if (use_jos) {
-      glob_sort_rule = glob_sort_rule | SORT_JOS;
-   } else {
-      glob_sort_rule = glob_sort_rule & (SORT_JOS-1);
-   }
+   sort_rule = get_addr_sort_rule();
 
    /* Allocate an array to be qsorted */
    sort_cl = calloc(count, sizeof(ContactList *));
@@ -323,9 +161,15 @@ static int contacts_sort(ContactList **cl, int sort_order)
       return EXIT_FAILURE;
    }
 
-   /* Set our array to be a list of pointers to the nodes in the linked list */
+   /* Set our array to be a list of pointers to the nodes in the linked list
+    * and compute the collation key of each record once */
    for (i=0, temp_cl=*cl; temp_cl; temp_cl=temp_cl->next, i++) {
       sort_cl[i] = temp_cl;
+      if (!contact_sort_key(temp_cl, sort_rule)) {
+         jp_logf(JP_LOG_WARN, "contacts_sort(): %s\n", _("Out of memory"));
+         free(sort_cl);
+         return EXIT_FAILURE;
+      }
    }
 
    /* qsort them */
@@ -352,6 +196,102 @@ static int contacts_sort(ContactList **cl, int sort_order)
    return EXIT_SUCCESS;
 }
 
+/*
+ * Link new_cl into a list sorted by get_contacts2() without re-sorting it.
+ * The position is found by a binary search on the collation keys.
+ * sort_order: SORT_ASCENDING | SORT_DESCENDING
+ */
+int contacts_insert_sorted(ContactList **cl, ContactList *new_cl, int sort_order)
+{
+   ContactList *temp_cl;
+   ContactList **sort_cl;
+   int count, i;
+   int lo, hi, mid, r;
+   int sort_rule;
+
+   sort_rule = get_addr_sort_rule();
+
+   if (!contact_sort_key(new_cl, sort_rule)) {
+      jp_logf(JP_LOG_WARN, "contacts_insert_sorted(): %s\n", _("Out of memory"));
+      return EXIT_FAILURE;
+   }
+
+   /* Count the entries in the list */
+   for (count=0, temp_cl=*cl; temp_cl; temp_cl=temp_cl->next, count++) {}
+
+   if (count==0) {
+      new_cl->next = NULL;
+      *cl = new_cl;
+      return EXIT_SUCCESS;
+   }
+
+   sort_cl = calloc(count, sizeof(ContactList *));
+   if (!sort_cl) {
+      jp_logf(JP_LOG_WARN, "contacts_insert_sorted(): %s\n", _("Out of memory"));
+      return EXIT_FAILURE;
+   }
+   for (i=0, temp_cl=*cl; temp_cl; temp_cl=temp_cl->next, i++) {
+      sort_cl[i] = temp_cl;
+   }
+
+   /* Find the first record that sorts after the new one */
+   lo = 0;
+   hi = count;
+   while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (!contact_sort_key(sort_cl[mid], sort_rule)) {
+         jp_logf(JP_LOG_WARN, "contacts_insert_sorted(): %s\n", _("Out of memory"));
+         free(sort_cl);
+         return EXIT_FAILURE;
+      }
+      r = contact_compare(&new_cl, &sort_cl[mid]);
+      if (sort_order==SORT_DESCENDING) {
+         r = -r;
+      }
+      if (r < 0) {
+         hi = mid;
+      } else {
+         lo = mid + 1;
+      }
+   }
+
+   if (lo==0) {
+      new_cl->next = *cl;
+      *cl = new_cl;
+   } else {
+      new_cl->next = sort_cl[lo-1]->next;
+      sort_cl[lo-1]->next = new_cl;
+   }
+
+   free(sort_cl);
+
+   return EXIT_SUCCESS;
+}
+
+/* Unlink the node holding mcont from the list and free it */
+int contacts_remove(ContactList **cl, MyContact *mcont)
+{
+   ContactList *temp_cl, *prev_cl;
+
+   for (prev_cl=NULL, temp_cl=*cl;
+        temp_cl;
+        prev_cl=temp_cl, temp_cl=temp_cl->next) {
+      if (&(temp_cl->mcont) == mcont) {
+         if (prev_cl) {
+            prev_cl->next = temp_cl->next;
+         } else {
+            *cl = temp_cl->next;
+         }
+         addr_sort_key_free(&(temp_cl->sort_key));
+         jp_free_Contact(&(temp_cl->mcont.cont));
+         free(temp_cl);
+         return EXIT_SUCCESS;
+      }
+   }
+
+   return EXIT_FAILURE;
+}
+
 /* Copy AppInfo data structures */
 int copy_address_ai_to_contact_ai(const struct AddressAppInfo *aai, struct ContactAppInfo *cai)
 {
@@ -465,6 +405,7 @@ int copy_addresses_to_contacts(AddressList *al, ContactList **cl)
       temp_cl->mcont.attrib = temp_al->maddr.attrib;
       copy_address_to_contact(&(temp_al->maddr.addr), &(temp_cl->mcont.cont));
       temp_cl->app_type = CONTACTS;
+      temp_cl->sort_key = NULL;
       temp_cl->next=NULL;
       if (!last_cl) {
          *cl = last_cl = temp_cl;
@@ -554,6 +495,7 @@ void free_ContactList(ContactList **cl)
    ContactList *temp_cl, *temp_cl_next;
 
    for (temp_cl = *cl; temp_cl; temp_cl=temp_cl_next) {
+      addr_sort_key_free(&(temp_cl->sort_key));
       jp_free_Contact(&(temp_cl->mcont.cont));
       temp_cl_next = temp_cl->next;
       free(temp_cl);
@@ -634,14 +576,14 @@ int get_contacts2(ContactList **contact_list, int sort_order,
 {
    GList *records;
    GList *temp_list;
-   int recs_returned, i, num;
+   int recs_returned, num;
    struct Contact cont;
    ContactList *temp_c_list;
    long keep_modified, keep_deleted;
    int keep_priv;
    long char_set;
    buf_rec *br;
-   char *buf;
+   double unpack_start, conv_start, conv_time;
    pi_buffer_t pi_buf;
 
    jp_logf(JP_LOG_DEBUG, "get_contacts2()\n");
@@ -669,6 +611,9 @@ int get_contacts2(ContactList **contact_list, int sort_order,
    if (-1 == num)
       return 0;
 
+   TRACE_BEGIN("unpack");
+   unpack_start = TRACE_NOW();
+   conv_time = 0.0;
    for (temp_list = records; temp_list; temp_list = temp_list->next) {
       if (temp_list->data) {
          br=temp_list->data;
@@ -718,17 +663,12 @@ int get_contacts2(ContactList **contact_list, int sort_order,
          jp_free_Contact(&cont);
          continue;
       }
-      buf = NULL;
+      conv_start = TRACE_NOW();
       if (char_set != CHAR_SET_LATIN1) {
-         for (i = 0; i < 39; i++) {
-            if ((cont.entry[i] != NULL) && (cont.entry[i][0] != '\0')) {
-               buf = charset_p2newj(cont.entry[i], -1, char_set);
-               if (buf) {
-                  free(cont.entry[i]);
-                  cont.entry[i] = buf;
-               }
-            }
-         }
+         charset_p2j_fields(cont.entry, 39, char_set);
+      }
+      if (glob_trace) {
+         conv_time += trace_now() - conv_start;
       }
 
       temp_c_list = malloc(sizeof(ContactList));
@@ -738,6 +678,7 @@ int get_contacts2(ContactList **contact_list, int sort_order,
       }
       memcpy(&(temp_c_list->mcont.cont), &cont, sizeof(struct Contact));
       temp_c_list->app_type = CONTACTS;
+      temp_c_list->sort_key = NULL;
       temp_c_list->mcont.rt = br->rt;
       temp_c_list->mcont.attrib = br->attrib;
       temp_c_list->mcont.unique_id = br->unique_id;
@@ -746,9 +687,16 @@ int get_contacts2(ContactList **contact_list, int sort_order,
       recs_returned++;
    }
 
+   if (glob_trace) {
+      trace_total("charset conversion", unpack_start, conv_time);
+   }
+   TRACE_END("unpack");
+
    jp_free_DB_records(&records);
 
+   TRACE_BEGIN("sort");
    contacts_sort(contact_list, sort_order);
+   TRACE_END("sort");
 
    jp_logf(JP_LOG_DEBUG, "Leaving get_contacts2()\n");
 
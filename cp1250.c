@@ -28,11 +28,11 @@
 /********************************* Includes ***********************************/
 #include "config.h"
 #include <stdlib.h>
+#include <string.h>
+
 #include "cp1250.h"
 
 /********************************* Constants **********************************/
-#define isCZ(c) ((c) & 0x80)
-
 /***** Unix: ISO *****/
 
 static const unsigned char w2l[128] = {
@@ -63,32 +63,37 @@ static const unsigned char l2w[128] = {
    0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 };
 
+/****************************** Prototypes ************************************/
+/* In utils.c, also a prototype in utils.h */
+size_t ascii_prefix_len(const char *buf, size_t len);
+
 /****************************** Main Code *************************************/
-void Win2Lat(char *const buf, int buf_len)
+/* Map the bytes with the high bit set through table, skipping the runs of
+ * 7-bit ASCII a word at a time */
+static void convert_high(char *const buf, int buf_len,
+                         const unsigned char *table)
 {
-   unsigned char *p;
-   int i;
+   unsigned char *p, *end;
 
-   if (buf == NULL) return;
+   if ((buf == NULL) || (buf_len <= 0)) return;
 
-   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
-      if (isCZ(*p)) {
-         *p = w2l[(*p) & 0x7f];
-      }
+   end = memchr(buf, '\0', buf_len);
+   if (end == NULL) {
+      end = (unsigned char *)buf + buf_len;
+   }
+   p = (unsigned char *)buf;
+   while ((p += ascii_prefix_len((char *)p, end - p)) < end) {
+      *p = table[(*p) & 0x7f];
+      p++;
    }
 }
 
-void Lat2Win(char *const buf, int buf_len)
+void Win2Lat(char *const buf, int buf_len)
 {
-   unsigned char *p;
-   int i;
-
-   if (buf == NULL) return;
-
-   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
-      if (isCZ(*p)) {
-         *p = l2w[(*p) & 0x7f];
-      }
-   }
+   convert_high(buf, buf_len, w2l);
 }
 
+void Lat2Win(char *const buf, int buf_len)
+{
+   convert_high(buf, buf_len, l2w);
+}
@@ -32,6 +32,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#  include <sys/mman.h>
+#endif
 
 #include "i18n.h"
 #include "utils.h"
@@ -76,64 +81,183 @@ struct field {
    char *str;
 };
 
+/* The contents of a .dat file, mapped or read in whole, and the position
+ * of the parser in them.  Every read goes through dat_get(), which fails
+ * instead of running past the end of the file. */
+struct dat_file {
+   const unsigned char *data;
+   long len;
+   long pos;
+   /* Set once a read ran past the end, all later reads then fail */
+   int truncated;
+   int mapped;
+};
+
 /****************************** Main Code *************************************/
-static int x86_short(unsigned char *str)
+static int x86_short(const unsigned char *str)
 {
    return str[1] * 0x100 + str[0];
 }
 
-static long x86_long(unsigned char *str)
+/* A signed 32 bit value, assembled unsigned so that it can not overflow */
+static long x86_long(const unsigned char *str)
 {
-   return str[3]*0x1000000 + str[2]*0x0010000 + str[1]*0x0000100 + str[0];
+   return (int)(((unsigned int)str[3] << 24) | ((unsigned int)str[2] << 16) |
+                ((unsigned int)str[1] << 8) | str[0]);
 }
 
-/* Returns the length of the CString read */
-static int get_CString(FILE *in, char **PStr)
+static int dat_open(FILE *in, struct dat_file *dat)
 {
-   unsigned char size1;
-   unsigned char size2[2];
-   int size;
+   struct stat statb;
+   unsigned char *buf;
+#ifdef HAVE_MMAP
+   void *map;
+#endif
 
-   if (fread(&size1, 1, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
+   memset(dat, 0, sizeof(struct dat_file));
+
+   if (fstat(fileno(in), &statb)) {
+      jp_logf(JP_LOG_WARN, "dat_open(): fstat failed\n");
+      return EXIT_FAILURE;
    }
-   if (size1==0) {
-      *PStr = NULL;
-      return 0;
+   dat->len = statb.st_size;
+   if (dat->len <= 0) {
+      dat->len = 0;
+      return EXIT_SUCCESS;
+   }
+
+#ifdef HAVE_MMAP
+   map = mmap(NULL, dat->len, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+   if (map != MAP_FAILED) {
+      dat->data = map;
+      dat->mapped = TRUE;
+      return EXIT_SUCCESS;
+   }
+#endif
+
+   /* Not mappable, read it in */
+   buf = malloc(dat->len);
+   if (!buf) {
+      jp_logf(JP_LOG_WARN, "dat_open(): %s\n", _("Out of memory"));
+      return EXIT_FAILURE;
+   }
+   fseek(in, 0, SEEK_SET);
+   dat->len = fread(buf, 1, dat->len, in);
+   dat->data = buf;
+
+   return EXIT_SUCCESS;
+}
+
+static void dat_close(struct dat_file *dat)
+{
+   if (!dat->data) {
+      return;
+   }
+#ifdef HAVE_MMAP
+   if (dat->mapped) {
+      munmap((void *)dat->data, dat->len);
+      dat->data = NULL;
+      return;
    }
-   if (size1==0xFF) {
-      if (fread(size2, 2, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
+#endif
+   free((void *)dat->data);
+   dat->data = NULL;
+}
+
+/* Returns the next len bytes and moves past them, or NULL if the file
+ * ends before that */
+static const unsigned char *dat_get(struct dat_file *dat, long len)
+{
+   const unsigned char *p;
+
+   if (dat->truncated || (len < 0) || (len > dat->len - dat->pos)) {
+      if (!dat->truncated) {
+         jp_logf(JP_LOG_WARN, _("%s: unexpected end of file at %ld\n"),
+                 "dat", dat->pos);
       }
-      size = x86_short(size2);
+      dat->truncated = TRUE;
+      return NULL;
+   }
+   p = dat->data + dat->pos;
+   dat->pos += len;
+
+   return p;
+}
+
+static int get_short(struct dat_file *dat)
+{
+   const unsigned char *p;
+
+   p = dat_get(dat, 2);
+   return p ? x86_short(p) : 0;
+}
+
+static long get_long(struct dat_file *dat)
+{
+   const unsigned char *p;
+
+   p = dat_get(dat, 4);
+   return p ? x86_long(p) : 0;
+}
+
+/* Returns the length of the CString at the cursor and points str at its
+ * bytes in the file, which are not NUL terminated */
+static int get_CString_ref(struct dat_file *dat, const unsigned char **str)
+{
+   const unsigned char *p;
+   int size;
+
+   *str = NULL;
+   p = dat_get(dat, 1);
+   if ((!p) || (p[0]==0)) {
+      return 0;
+   }
+   if (p[0]==0xFF) {
+      size = get_short(dat);
 #ifdef JPILOT_DEBUG
       printf("BIG STRING size=%d\n", size);
 #endif
    } else {
-      size=size1;
+      size = p[0];
    }
-   /* malloc an extra byte just to be safe */
-   *PStr=malloc(size+2);
-   if (fread(*PStr, size, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
+   *str = dat_get(dat, size);
+   if (!(*str)) {
+      return 0;
+   }
+
+   return size;
+}
+
+/* Returns the length of the CString read */
+static int get_CString(struct dat_file *dat, char **PStr)
+{
+   const unsigned char *str;
+   int size;
+
+   *PStr = NULL;
+   size = get_CString_ref(dat, &str);
+   if (!str) {
+      return 0;
    }
+   *PStr = malloc(size+1);
+   if (!(*PStr)) {
+      jp_logf(JP_LOG_WARN, "get_CString(): %s\n", _("Out of memory"));
+      return 0;
+   }
+   memcpy(*PStr, str, size);
    (*PStr)[size]='\0';
 
    return size;
 }
 
-static int get_categories(FILE *in, struct CategoryAppInfo *ai)
+static int get_categories(struct dat_file *dat, struct CategoryAppInfo *ai)
 {
-   unsigned char str_long[4];
-   char *PStr;
+   const unsigned char *str;
    long count;
-   int i;
+   int i, size;
 
    /* Get the category count */
-   if (fread(str_long, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   count = x86_long(str_long);
+   count = get_long(dat);
 
    for (i=0; i<16; i++) {
       ai->renamed[i]=0;
@@ -142,50 +266,46 @@ static int get_categories(FILE *in, struct CategoryAppInfo *ai)
    }
    ai->lastUniqueID=0;
 
-   for (i=0; i<count; i++) {
+   /* Only the first 16 fit in ai, the rest are read past */
+   for (i=0; (i<count) && (!dat->truncated); i++) {
       /* category index */
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
+      get_long(dat);
 
       /* category ID */
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
+      if (i<16) {
+         ai->ID[i] = get_long(dat);
+      } else {
+         get_long(dat);
       }
-      ai->ID[i] = x86_long(str_long);
 
       /* category dirty flag */
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
+      get_long(dat);
 
       /* long category name */
-      get_CString(in, &PStr);
-      strncpy(ai->name[i], PStr, 16);
-      ai->name[i][15]='\0';
-      free(PStr);
+      size = get_CString_ref(dat, &str);
+      if ((i<16) && str) {
+         if (size > 15) {
+            size = 15;
+         }
+         memcpy(ai->name[i], str, size);
+         ai->name[i][size]='\0';
+      }
 
       /* short category name */
-      get_CString(in, &PStr);
-      free(PStr);
+      get_CString_ref(dat, &str);
    }
    return count;
 }
 
-static int get_repeat(FILE *in, struct Appointment *appt)
+static int get_repeat(struct dat_file *dat, struct Appointment *appt)
 {
    time_t t = 0;
    struct tm *now;
-   unsigned char str_long[4];
-   unsigned char str_short[2];
+   const unsigned char *p;
    int l, s, i, bit;
-   char *PStr;
    int repeat_type;
 
-   if (fread(str_short, 2, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   s = x86_short(str_short);
+   s = get_short(dat);
 #ifdef JPILOT_DEBUG
    printf("  repeat entry follows:\n");
    printf("%d exceptions\n", s);
@@ -196,19 +316,19 @@ static int get_repeat(FILE *in, struct Appointment *appt)
    appt->exception=NULL;
    memset(&(appt->repeatEnd), 0, sizeof(appt->repeatEnd));
 
-   appt->exceptions=s;
-   if (s>0) {
+   appt->exceptions=0;
+   p = dat_get(dat, 4*s);
+   if ((s>0) && p) {
       appt->exception=malloc(sizeof(struct tm) * s);
-      if (!(appt->exceptions)) {
+      if (!(appt->exception)) {
          jp_logf(JP_LOG_WARN, "get_repeat(): %s\n", _("Out of memory"));
+         return EXIT_FAILURE;
       }
+      appt->exceptions=s;
    }
 
-   for (i=0; i<s; i++) {
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      l = x86_long(str_long);
+   for (i=0; i<appt->exceptions; i++) {
+      l = x86_long(p + 4*i);
       {
          t = l;
          now = localtime(&t);
@@ -220,10 +340,7 @@ static int get_repeat(FILE *in, struct Appointment *appt)
 #endif
    }
 
-   if (fread(str_short, 2, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   s = x86_short(str_short);
+   s = get_short(dat);
 #ifdef JPILOT_DEBUG
    printf("0x%x repeat event flag\n", s);
 #endif
@@ -235,36 +352,24 @@ static int get_repeat(FILE *in, struct Appointment *appt)
 
    if (s==0xFFFF) {
       /* Class entry here */
-      if (fread(str_short, 2, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      s = x86_short(str_short);
+      s = get_short(dat);
 #ifdef JPILOT_DEBUG
       printf("constant of 1 = %d\n", s);
 #endif
-      if (fread(str_short, 2, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      s = x86_short(str_short);
+      s = get_short(dat);
 #ifdef JPILOT_DEBUG
       printf("class name length = %d\n", s);
 #endif
 
-      PStr = malloc(s+1);
-      if (fread(PStr, s, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      PStr[s]='\0';
+      p = dat_get(dat, s);
 #ifdef JPILOT_DEBUG
-      printf("class = [%s]\n", PStr);
+      if (p) {
+         printf("class = [%.*s]\n", s, p);
+      }
 #endif
-      free(PStr);
    }
 
-   if (fread(str_long, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   repeat_type = x86_long(str_long);
+   repeat_type = get_long(dat);
    appt->repeatType=repeat_type;
 #ifdef JPILOT_DEBUG
    printf("repeatType=%d ", repeat_type);
@@ -292,19 +397,13 @@ static int get_repeat(FILE *in, struct Appointment *appt)
    }
 #endif
 
-   if (fread(str_long, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   l = x86_long(str_long);
+   l = get_long(dat);
 #ifdef JPILOT_DEBUG
    printf("Interval = %d\n", l);
 #endif
    appt->repeatFrequency=l;
 
-   if (fread(str_long, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   l = x86_long(str_long);
+   l = get_long(dat);
    {
       t = l;
       now = localtime(&t);
@@ -318,10 +417,7 @@ static int get_repeat(FILE *in, struct Appointment *appt)
 #ifdef JPILOT_DEBUG
    printf("repeatEnd: 0x%x -> ", l); print_date(l);
 #endif
-   if (fread(str_long, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   l = x86_long(str_long);
+   l = get_long(dat);
    appt->repeatWeekstart=l;
 #ifdef JPILOT_DEBUG
    printf("First Day of Week = %d\n", l);
@@ -329,73 +425,55 @@ static int get_repeat(FILE *in, struct Appointment *appt)
 
    switch (repeat_type) {
     case DAILY:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      l = x86_long(str_long);
+      l = get_long(dat);
 #ifdef JPILOT_DEBUG
       printf("Day Index = %d\n", l);
 #endif
       break;
     case WEEKLY:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      l = x86_long(str_long);
+      l = get_long(dat);
 #ifdef JPILOT_DEBUG
       printf("Day Index = %d\n", l);
 #endif
 
-      if (fread(str_long, 1, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      for (i=0, bit=1; i<7; i++, bit=bit<<1) {
-         appt->repeatDays[i]=( str_long[0] & bit );
-      }
+      p = dat_get(dat, 1);
+      if (p) {
+         for (i=0, bit=1; i<7; i++, bit=bit<<1) {
+            appt->repeatDays[i]=( p[0] & bit );
+         }
 #ifdef JPILOT_DEBUG
-      printf("Days Mask = %x\n", str_long[0]);
+         printf("Days Mask = %x\n", p[0]);
 #endif
+      }
       break;
     case MONTHLY_BY_DAY:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      s = x86_long(str_long);
+      s = get_long(dat);
 #ifdef JPILOT_DEBUG
       printf("Day Index = %d\n", l);
 #endif
 
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      l = x86_long(str_long);
+      l = get_long(dat);
 #ifdef JPILOT_DEBUG
       printf("Week Index = %d\n", l);
 #endif
 
-      appt->repeatDay = 7*l + s;
+      /* The day of a damaged file is left alone */
+      if ((l >= 0) && (l < 6) && (s >= 0) && (s < 7)) {
+         appt->repeatDay = 7*l + s;
+      }
       break;
     case MONTHLY_BY_DATE:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      l = x86_long(str_long);
+      l = get_long(dat);
 #ifdef JPILOT_DEBUG
       printf("Day Number = %d\n", l);
 #endif
       break;
     case YEARLY_BY_DATE:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      l = x86_long(str_long);
+      l = get_long(dat);
 #ifdef JPILOT_DEBUG
       printf("Day Number = %d\n", l);
 #endif
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      l = x86_long(str_long);
+      l = get_long(dat);
 #ifdef JPILOT_DEBUG
       printf("Month Index = %d\n", l);
 #endif
@@ -411,7 +489,6 @@ static int get_repeat(FILE *in, struct Appointment *appt)
 
    return EXIT_SUCCESS;
 }
-
 #ifdef JPILOT_DEBUG
 static int print_date(int palm_date)
 {
@@ -464,49 +541,39 @@ static int print_field(struct field *f)
 }
 #endif
 
-static int get_field(FILE *in, struct field *f)
+static int get_field(struct dat_file *dat, struct field *f)
 {
-   unsigned char str_long[4];
    long type;
    char *PStr;
 
-   if (fread(str_long, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   type = x86_long(str_long);
+   type = get_long(dat);
    f->type=type;
    f->str=NULL;
+   if (dat->truncated) {
+      return EXIT_FAILURE;
+   }
 
    switch (type) {
     case DAT_TYPE_INTEGER:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      f->i = x86_long(str_long);
+      f->i = get_long(dat);
       break;
     case DAT_TYPE_CSTRING:
-      fseek(in, 4, SEEK_CUR); /* padding */
-      get_CString(in, &PStr);
+      dat_get(dat, 4); /* padding */
+      get_CString(dat, &PStr);
       f->str = PStr;
       break;
     case DAT_TYPE_BOOLEAN:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      f->i = x86_long(str_long);
+      f->i = get_long(dat);
       break;
     case DAT_TYPE_DATE:
-      if (fread(str_long, 4, 1, in) < 1) {
-         jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-      }
-      f->date = x86_long(str_long);
+      f->date = get_long(dat);
       break;
     case DAT_TYPE_BITFLAG:
       /* I currently do not know how to read this datatype */
       break;
     case DAT_TYPE_REPEAT:
       /* The calling function needs to call this */
-      /* get_repeat(in, NULL); */
+      /* get_repeat(dat, NULL); */
       break;
     default:
       jp_logf(JP_LOG_WARN, "get_field(): %s %ld\n", _("unknown type ="), type);
@@ -516,6 +583,16 @@ static int get_field(FILE *in, struct field *f)
    return EXIT_SUCCESS;
 }
 
+static void free_fields(struct field *fa, int count)
+{
+   int i;
+
+   for (i=0; i<count; i++) {
+      free(fa[i].str);
+      fa[i].str=NULL;
+   }
+}
+
 int dat_check_if_dat_file(FILE *in)
 {
    char version[6];
@@ -547,43 +624,39 @@ int dat_check_if_dat_file(FILE *in)
    return EXIT_SUCCESS;
 }
 
-static int dat_read_header(FILE *in,
+static int dat_read_header(struct dat_file *dat,
                            int expected_field_count,
                            char *schema,
                            struct CategoryAppInfo *ai,
                            int *schema_count, int *field_count, long *rec_count)
 {
-   int i;
-   unsigned char filler[100];
-   char version[4];
-   char *PStr;
-   unsigned char str_long[4];
+   int i, size;
+   const unsigned char *version;
+   const unsigned char *str;
+   const unsigned char *fields;
 
-   fseek(in, 0, SEEK_SET);
+   dat->pos = 0;
 
    /* Version */
-   if (fread(version, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
+   version = dat_get(dat, 4);
+   if (!version) {
+      return EXIT_FAILURE;
    }
    jp_logf(JP_LOG_DEBUG, "version = [%c%c%d%d]\n", version[3],version[2],version[1],version[0]);
 
    /* Full file path name */
-   get_CString(in, &PStr);
-   jp_logf(JP_LOG_DEBUG, "path:[%s]\n",PStr);
-   free(PStr);
+   size = get_CString_ref(dat, &str);
+   jp_logf(JP_LOG_DEBUG, "path:[%.*s]\n", size, str ? (const char *)str : "");
 
    /* Show Header */
-   get_CString(in, &PStr);
-   jp_logf(JP_LOG_DEBUG, "show header:[%s]\n",PStr);
-   free(PStr);
+   size = get_CString_ref(dat, &str);
+   jp_logf(JP_LOG_DEBUG, "show header:[%.*s]\n", size, str ? (const char *)str : "");
 
    /* Next free category ID */
-   if (fread(filler, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
+   get_long(dat);
 
    /* Categories */
-   get_categories(in, ai);
+   get_categories(dat, ai);
 #ifdef JPILOT_DEBUG
    for (i=0; i<16; i++) {
       printf("%d [%s]\n", ai->ID[i], ai->name[i]);
@@ -591,36 +664,22 @@ static int dat_read_header(FILE *in,
 #endif
 
    /* Schema resource ID */
-   if (fread(filler, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
+   get_long(dat);
    /* Schema fields per row */
-   if (fread(filler, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   *field_count=x86_long(filler);
+   *field_count=get_long(dat);
    if (*field_count != expected_field_count) {
       jp_logf(JP_LOG_WARN, _("fields per row count != %d, unknown format\n"),
                   expected_field_count);
       return EXIT_FAILURE;
    }
    /* Schema record ID position */
-   if (fread(filler, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
+   get_long(dat);
    /* Schema record status position */
-   if (fread(filler, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
+   get_long(dat);
    /* Schema placement position */
-   if (fread(filler, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
+   get_long(dat);
    /* Schema fields count */
-   if (fread(filler, 2, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   *field_count = x86_short(filler);
+   *field_count = get_short(dat);
    if (*field_count != expected_field_count) {
       jp_logf(JP_LOG_WARN, _("field count != %d, unknown format\n"),
                   expected_field_count);
@@ -628,14 +687,15 @@ static int dat_read_header(FILE *in,
    }
 
    /* Schema fields */
-   if (fread(filler, (*field_count)*2, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
+   fields = dat_get(dat, (*field_count)*2);
+   if (!fields) {
+      return EXIT_FAILURE;
    }
-   if (memcmp(filler, schema, (*field_count)*2)) {
+   if (memcmp(fields, schema, (*field_count)*2)) {
       jp_logf(JP_LOG_WARN, _("Unknown format, file has wrong schema\n"));
       jp_logf(JP_LOG_WARN, _("File schema is:"));
       for (i=0; i<(*field_count)*2; i++) {
-         jp_logf(JP_LOG_WARN, " %02d\n", (char)filler[i]);
+         jp_logf(JP_LOG_WARN, " %02d\n", (char)fields[i]);
       }
       jp_logf(JP_LOG_WARN, _("It should be:"));
       for (i=0; i<(*field_count)*2; i++) {
@@ -645,11 +705,9 @@ static int dat_read_header(FILE *in,
    }
 
    /* Get record count */
-   if (fread(str_long, 4, 1, in) < 1) {
-      jp_logf(JP_LOG_WARN, "fread failed %s %d\n", __FILE__, __LINE__);
-   }
-   if ((*field_count)) {
-      *rec_count = x86_long(str_long) / (*field_count);
+   *rec_count = get_long(dat) / (*field_count);
+   if (dat->truncated) {
+      return EXIT_FAILURE;
    }
 #ifdef JPILOT_DEBUG
    printf("Record Count = %ld\n", *rec_count);
@@ -658,8 +716,9 @@ static int dat_read_header(FILE *in,
 }
 
 
-int dat_get_appointments(FILE *in, AppointmentList **alist, 
-                         struct CategoryAppInfo *ai)
+
+static int get_appointments(struct dat_file *dat, AppointmentList **alist,
+                            struct CategoryAppInfo *ai)
 {
 #ifdef JPILOT_DEBUG
    struct field hack_f;
@@ -717,10 +776,10 @@ int dat_get_appointments(FILE *in, AppointmentList **alist,
    if (!alist) return EXIT_SUCCESS;
    *alist=NULL;
 
-   ret = dat_read_header(in, 15, schema, ai,
+   ret = dat_read_header(dat, 15, schema, ai,
                          &schema_count, &field_count, &rec_count);
 
-   if (ret<0) return ret;
+   if (ret) return EXIT_FAILURE;
 
    /* Get records */
    last_alist=*alist;
@@ -744,20 +803,21 @@ int dat_get_appointments(FILE *in, AppointmentList **alist,
       /* Status Field */
       /* Position */
       for (j=0; j<3; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("rec field %d %s: ", j, rec_fields[j]); print_field(&(fa[j]));
 #endif
          if (fa[j].type!=schema[j*2]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
             free(temp_alist);
             return EXIT_FAILURE;
          }
       }
       /* Get Fields */
       for (j=0; j<12; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("field %d %s: ", j, field_names[j]); print_field(&(fa[j]));
          if (j==1) {
@@ -769,13 +829,22 @@ int dat_get_appointments(FILE *in, AppointmentList **alist,
          if (fa[j].type!=schema[j*2+6]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2+6], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
+            free(temp_alist->mappt.appt.exception);
             free(temp_alist);
             return EXIT_FAILURE;
          }
          if (fa[j].type==DAT_TYPE_REPEAT) {
-            get_repeat(in, &(temp_alist->mappt.appt));
+            get_repeat(dat, &(temp_alist->mappt.appt));
          }
       }
+      if (dat->truncated) {
+         jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+         free_fields(fa, 12);
+         free(temp_alist->mappt.appt.exception);
+         free(temp_alist);
+         return EXIT_FAILURE;
+      }
       /* Start Time */
       t = fa[0].date;
       now = localtime(&t);
@@ -833,8 +902,8 @@ int dat_get_appointments(FILE *in, AppointmentList **alist,
    return EXIT_SUCCESS;
 }
 
-int dat_get_addresses(FILE *in, AddressList **addrlist, 
-                      struct CategoryAppInfo *ai)
+static int get_addresses(struct dat_file *dat, AddressList **addrlist,
+                         struct CategoryAppInfo *ai)
 {
    int ret, i, j, k;
    struct field fa[28];
@@ -921,10 +990,10 @@ int dat_get_addresses(FILE *in, AddressList **addrlist,
    if (!addrlist) return EXIT_SUCCESS;
    *addrlist=NULL;
 
-   ret = dat_read_header(in, 30, schema, ai,
+   ret = dat_read_header(dat, 30, schema, ai,
                          &schema_count, &field_count, &rec_count);
 
-   if (ret<0) return ret;
+   if (ret) return EXIT_FAILURE;
 
    /* Get records */
    last_addrlist=*addrlist;
@@ -939,6 +1008,7 @@ int dat_get_addresses(FILE *in, AddressList **addrlist,
       }
       temp_addrlist->next=NULL;
       temp_addrlist->app_type=ADDRESS;
+      temp_addrlist->sort_key=NULL;
 #ifdef JPILOT_DEBUG
       printf("----- record %d -----\n", i+1);
 #endif
@@ -946,30 +1016,38 @@ int dat_get_addresses(FILE *in, AddressList **addrlist,
       /* Status Field */
       /* Position */
       for (j=0; j<3; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("rec field %d %s: ", j, rec_fields[j]); print_field(&(fa[j]));
 #endif
          if (fa[j].type!=schema[j*2]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
             free(temp_addrlist);
             return EXIT_FAILURE;
          }
       }
       /* Get Fields */
       for (j=0; j<27; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("field %d %s: ", j, field_names[j]); print_field(&(fa[j]));
 #endif
          if (fa[j].type!=schema[j*2+6]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2+6], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
             free(temp_addrlist);
             return EXIT_FAILURE;
          }
       }
+      if (dat->truncated) {
+         jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+         free_fields(fa, 27);
+         free(temp_addrlist);
+         return EXIT_FAILURE;
+      }
       for (k=0; k<19; k++) {
          temp_addrlist->maddr.addr.entry[k]=fa[dat_order[k]].str;
       }
@@ -1010,7 +1088,8 @@ int dat_get_addresses(FILE *in, AddressList **addrlist,
    return EXIT_SUCCESS;
 }
 
-int dat_get_todos(FILE *in, ToDoList **todolist, struct CategoryAppInfo *ai)
+static int get_todos(struct dat_file *dat, ToDoList **todolist,
+                     struct CategoryAppInfo *ai)
 {
    int ret, i, j;
    struct field fa[10];
@@ -1055,10 +1134,10 @@ int dat_get_todos(FILE *in, ToDoList **todolist, struct CategoryAppInfo *ai)
    if (!todolist) return EXIT_SUCCESS;
    *todolist=NULL;
 
-   ret = dat_read_header(in, 10, schema, ai,
+   ret = dat_read_header(dat, 10, schema, ai,
                          &schema_count, &field_count, &rec_count);
 
-   if (ret<0) return ret;
+   if (ret) return EXIT_FAILURE;
 
    /* Get records */
    last_todolist=*todolist;
@@ -1082,30 +1161,38 @@ int dat_get_todos(FILE *in, ToDoList **todolist, struct CategoryAppInfo *ai)
       /* Status Field */
       /* Position */
       for (j=0; j<3; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("rec field %d %s: ", j, rec_fields[j]); print_field(&(fa[j]));
 #endif
          if (fa[j].type!=schema[j*2]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
             free(temp_todolist);
             return EXIT_FAILURE;
          }
       }
       /* Get Fields */
       for (j=0; j<7; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("field %d %s: ", j, field_names[j]); print_field(&(fa[j]));
 #endif
          if (fa[j].type!=schema[j*2+6]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2+6], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
             free(temp_todolist);
             return EXIT_FAILURE;
          }
       }
+      if (dat->truncated) {
+         jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+         free_fields(fa, 7);
+         free(temp_todolist);
+         return EXIT_FAILURE;
+      }
       /* Description */
       if (fa[0].str) {
          temp_todolist->mtodo.todo.description=fa[0].str;
@@ -1160,7 +1247,8 @@ int dat_get_todos(FILE *in, ToDoList **todolist, struct CategoryAppInfo *ai)
    return EXIT_SUCCESS;
 }
 
-int dat_get_memos(FILE *in, MemoList **memolist, struct CategoryAppInfo *ai)
+static int get_memos(struct dat_file *dat, MemoList **memolist,
+                     struct CategoryAppInfo *ai)
 {
    int ret, i, j;
    struct field fa[10];
@@ -1194,10 +1282,10 @@ int dat_get_memos(FILE *in, MemoList **memolist, struct CategoryAppInfo *ai)
    if (!memolist) return EXIT_SUCCESS;
    *memolist=NULL;
 
-   ret = dat_read_header(in, 6, schema, ai,
+   ret = dat_read_header(dat, 6, schema, ai,
                          &schema_count, &field_count, &rec_count);
 
-   if (ret<0) return ret;
+   if (ret) return EXIT_FAILURE;
 
    /* Get records */
    last_memolist=*memolist;
@@ -1219,30 +1307,38 @@ int dat_get_memos(FILE *in, MemoList **memolist, struct CategoryAppInfo *ai)
       /* Status Field */
       /* Position */
       for (j=0; j<3; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("rec field %d %s: ", j, rec_fields[j]); print_field(&(fa[j]));
 #endif
          if (fa[j].type!=schema[j*2]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
             free(temp_memolist);
             return EXIT_FAILURE;
          }
       }
       /* Get Fields */
       for (j=0; j<3; j++) {
-         get_field(in, &(fa[j]));
+         get_field(dat, &(fa[j]));
 #ifdef JPILOT_DEBUG
          printf("field %d %s: ", j, field_names[j]); print_field(&(fa[j]));
 #endif
          if (fa[j].type!=schema[j*2+6]) {
             jp_logf(JP_LOG_WARN, _("%s:%d Record %d, field %d: Invalid type.  Expected %d, found %d\n"), __FILE__, __LINE__, i+1, j+3, schema[j*2+6], fa[j].type);
             jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+            free_fields(fa, j+1);
             free(temp_memolist);
             return EXIT_FAILURE;
          }
       }
+      if (dat->truncated) {
+         jp_logf(JP_LOG_WARN, _("read of file terminated\n"));
+         free_fields(fa, 3);
+         free(temp_memolist);
+         return EXIT_FAILURE;
+      }
       /* Memo */
       temp_memolist->mmemo.memo.text=fa[0].str;
       /* Private */
@@ -1271,3 +1367,61 @@ int dat_get_memos(FILE *in, MemoList **memolist, struct CategoryAppInfo *ai)
 
    return EXIT_SUCCESS;
 }
+
+int dat_get_appointments(FILE *in, AppointmentList **alist,
+                         struct CategoryAppInfo *ai)
+{
+   struct dat_file dat;
+   int ret;
+
+   if (dat_open(in, &dat)) {
+      return EXIT_FAILURE;
+   }
+   ret = get_appointments(&dat, alist, ai);
+   dat_close(&dat);
+
+   return ret;
+}
+
+int dat_get_addresses(FILE *in, AddressList **addrlist,
+                      struct CategoryAppInfo *ai)
+{
+   struct dat_file dat;
+   int ret;
+
+   if (dat_open(in, &dat)) {
+      return EXIT_FAILURE;
+   }
+   ret = get_addresses(&dat, addrlist, ai);
+   dat_close(&dat);
+
+   return ret;
+}
+
+int dat_get_todos(FILE *in, ToDoList **todolist, struct CategoryAppInfo *ai)
+{
+   struct dat_file dat;
+   int ret;
+
+   if (dat_open(in, &dat)) {
+      return EXIT_FAILURE;
+   }
+   ret = get_todos(&dat, todolist, ai);
+   dat_close(&dat);
+
+   return ret;
+}
+
+int dat_get_memos(FILE *in, MemoList **memolist, struct CategoryAppInfo *ai)
+{
+   struct dat_file dat;
+   int ret;
+
+   if (dat_open(in, &dat)) {
+      return EXIT_FAILURE;
+   }
+   ret = get_memos(&dat, memolist, ai);
+   dat_close(&dat);
+
+   return ret;
+}
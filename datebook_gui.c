@@ -34,6 +34,7 @@
 #include "utils.h"
 #include "todo.h"
 #include "log.h"
+#include "trace.h"
 #include "prefs.h"
 #include "password.h"
 #include "export.h"
@@ -423,7 +424,7 @@ static int cb_dbook_import(GtkWidget *parent_window, const char *file_path, int
    int priv;
    int year, month, day, hour, minute;
 
-   in=fopen(file_path, "r");
+   in=import_fopen(file_path);
    if (!in) {
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), file_path);
       return EXIT_FAILURE;
@@ -443,6 +444,7 @@ static int cb_dbook_import(GtkWidget *parent_window, const char *file_path, int
       if (EXIT_FAILURE == ret) return EXIT_FAILURE;
 
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       while (1) {
          memset(&new_cale, 0, sizeof(new_cale));
          /* Read the category field */
@@ -595,8 +597,8 @@ static int cb_dbook_import(GtkWidget *parent_window, const char *file_path, int
             }
          }
 
-         datebook_to_text(&new_cale, text, 65535);
          if (!import_all) {
+            datebook_to_text(&new_cale, text, 65535);
             ret=import_record_ask(parent_window, pane,
                                   text,
                                   &(dbook_app_info.category),
@@ -641,6 +643,7 @@ static int cb_dbook_import(GtkWidget *parent_window, const char *file_path, int
       free_AppointmentList(&alist);
 
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       for (temp_celist=celist; temp_celist; temp_celist=temp_celist->next) {
          index=temp_celist->mcale.unique_id-1;
          if (index<0) {
@@ -687,9 +690,17 @@ static int cb_dbook_import(GtkWidget *parent_window, const char *file_path, int
       free_CalendarEventList(&celist);
    }
 
+   /* Write out the imported records before they are read back */
+   ret = jp_pc_write_batch_end();
+   if (ret != EXIT_SUCCESS) {
+      jp_logf(JP_LOG_WARN, _("Unable to write the imported records\n"));
+      dialog_generic_ok(parent_window, _("Error"), DIALOG_ERROR,
+                        _("Unable to write the imported records\n"));
+   }
+
    datebook_refresh(FALSE, TRUE);
    fclose(in);
-   return EXIT_SUCCESS;
+   return ret;
 }
 
 int datebook_import(GtkWidget *window)
@@ -765,7 +776,7 @@ static void appt_export_ok(int type, const char *filename)
       }
    }
 
-   out = fopen(filename, "w");
+   out = export_fopen(filename);
    if (!out) {
       g_snprintf(text, sizeof(text), _("Error opening file: %s"), filename);
       dialog_generic(GTK_WINDOW(export_window),
@@ -2416,6 +2427,7 @@ static int datebook_update_clist(void)
    long show_tooltips;
 
    jp_logf(JP_LOG_DEBUG, "datebook_update_clist()\n");
+   TRACE_BEGIN("datebook_update_clist");
 
    free_CalendarEventList(&glob_cel);
 
@@ -2435,6 +2447,7 @@ static int datebook_update_clist(void)
 #endif
 
    /* Freeze clist to prevent flicker during updating */
+   TRACE_BEGIN("fill clist");
    gtk_clist_freeze(GTK_CLIST(clist));
    gtk_signal_disconnect_by_func(GTK_OBJECT(clist),
                                  GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
@@ -2632,6 +2645,7 @@ static int datebook_update_clist(void)
    }
 
    gtk_clist_thaw(GTK_CLIST(clist));
+   TRACE_END("fill clist");
 
    get_pref(PREF_SHOW_TOOLTIPS, &show_tooltips, NULL);
    g_snprintf(str, sizeof(str), _("%d of %d records"), entries_shown, num_entries);
@@ -2640,6 +2654,7 @@ static int datebook_update_clist(void)
    /* return focus to clist after any big operation which requires a redraw */
    gtk_widget_grab_focus(GTK_WIDGET(clist));
 
+   TRACE_END("datebook_update_clist");
    return EXIT_SUCCESS;
 }
 
@@ -46,6 +46,11 @@ int export_gui(GtkWidget *main_window,
  * The code is in import_gui.c
  */
 int read_csv_field(FILE *in, char *text, int size);
+/* fopen for reading with a read buffer large enough for big imports */
+FILE *import_fopen(const char *file_path);
+
+/* fopen for writing an export, with a large write buffer */
+FILE *export_fopen(const char *file_name);
 
 int export_browse(GtkWidget *main_window, int pref_export);
 
@@ -38,6 +38,9 @@
 #define BROWSE_OK     1
 #define BROWSE_CANCEL 2
 
+/* Write buffer of export files */
+#define EXPORT_BUFFER_SIZE 0x40000
+
 /******************************* Global vars **********************************/
 static GtkWidget *export_clist;
 static int export_category;
@@ -58,6 +61,17 @@ static void (*glob_cb_export_ok)(GtkWidget *export_window,
                                  const char *filename);
 
 /****************************** Main Code *************************************/
+FILE *export_fopen(const char *file_name)
+{
+   FILE *out;
+
+   out = fopen(file_name, "w");
+   if (out) {
+      setvbuf(out, NULL, _IOFBF, EXPORT_BUFFER_SIZE);
+   }
+   return out;
+}
+
 /* 
  * Browse GUI
  */
@@ -33,6 +33,15 @@
 #include "log.h"
 #include "export.h"
 
+/********************************* Constants **********************************/
+/* Read buffer of files being imported */
+#define IMPORT_BUFFER_SIZE 0x10000
+
+#define CSV_SEPARATOR(c) \
+   (((c)==',') || ((c)=='\t') || ((c)==' ') || ((c)=='\r') || ((c)=='\n'))
+#define CSV_WHITESPACE(c) \
+   (((c)=='\t') || ((c)==' ') || ((c)=='\r') || ((c)=='\n'))
+
 /******************************* Global vars **********************************/
 static GtkWidget *radio_types[MAX_IMPORT_TYPES+1];
 static int radio_file_types[MAX_IMPORT_TYPES+1];
@@ -56,8 +65,6 @@ static int (*glob_import_callback)(GtkWidget *parent_window, const char *file_pa
 int read_csv_field(FILE *in, char *text, int size)
 {
    int n, c;
-   char sep[]=",\t \r\n";
-   char whitespace[]="\t \r\n";
    int quoted;
 
    n=0;
@@ -66,15 +73,15 @@ int read_csv_field(FILE *in, char *text, int size)
 
    /* Read the field */
    while (1) {
-      c=fgetc(in);
+      c=getc(in);
 
       /* Look for EOF */
-      if (feof(in)) 
+      if (c==EOF)
          break;
       /* Look for quote */
       if (c=='"') {
          if (quoted) {
-            c=fgetc(in);
+            c=getc(in);
             if (c=='"') {
                /* Found double quotes, convert to single */
             } else {
@@ -88,28 +95,24 @@ int read_csv_field(FILE *in, char *text, int size)
          }
       }
       /* Look for separators */
-      if (strchr(sep, c)) {
-         if (!quoted) {
-            if (c != ',') {
-               /* skip whitespace  */
-               while (1) {
-                  c=getc(in);
-                  if (feof(in)) {
-                     text[n++]='\0';
-                     return n;
-                  }
-                  if (strchr(whitespace, c)) {
-                     continue;
-                  } else {
-                     ungetc(c, in);
-                     break;
-                  }
+      if ((!quoted) && CSV_SEPARATOR(c)) {
+         if (c != ',') {
+            /* skip whitespace  */
+            while (1) {
+               c=getc(in);
+               if (c==EOF) {
+                  text[n++]='\0';
+                  return n;
+               }
+               if (!CSV_WHITESPACE(c)) {
+                  ungetc(c, in);
+                  break;
                }
             }
-            /* after sep processing, break out of reading field */
-            break;   
-         } /* end if !quoted */
-      } /* end if separator */
+         }
+         /* after sep processing, break out of reading field */
+         break;
+      }
 
       /* Ordinary character, add to field */
       text[n++]=c;
@@ -125,6 +128,17 @@ int read_csv_field(FILE *in, char *text, int size)
    return n;
 }
 
+FILE *import_fopen(const char *file_path)
+{
+   FILE *in;
+
+   in=fopen(file_path, "r");
+   if (in) {
+      setvbuf(in, NULL, _IOFBF, IMPORT_BUFFER_SIZE);
+   }
+   return in;
+}
+
 static int guess_file_type(const char *path)
 {
    FILE *in;
@@ -43,9 +43,12 @@
 #define isEuc(c) \
     (0xa0 < ((unsigned char) (c)) && ((unsigned char) (c)) < 0xff)
 
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
 /****************************** Prototypes ************************************/
 /* In utils.c, also a prototype in utils.h */
 void multibyte_safe_strncpy(char *dst, char *src, size_t max_len);
+size_t ascii_prefix_len(const char *buf, size_t len);
 
 /****************************** Main Code *************************************/
 /* convert SJIS char to EUC char
@@ -72,15 +75,26 @@ static unsigned int SjisToEuc(unsigned char hi, unsigned char lo)
  */
 static char *Sjis2EucCpy(char *dest, char *src, int max_len)
 {
-    unsigned char *p, *q;
+    unsigned char *p, *q, *end;
     unsigned char hi, lo;
     unsigned int w;
     int n = 0;
+    size_t run;
 
     p = (unsigned char *)src;
     q = (unsigned char *)dest;
-    while ((*p) && (n < max_len-2)) {
-        if (isSjis1stByte(*p)) {
+    end = p + strlen(src);
+    while ((p < end) && (n < max_len-2)) {
+        /* runs of ascii are copied as they are */
+        run = ascii_prefix_len((char *)p, min(end - p, max_len-2 - n));
+        if (run) {
+            memcpy(q, p, run);
+            p += run;
+            q += run;
+            n += run;
+            continue;
+        }
+        if (isSjis1stByte(*p) && (p+1 < end)) {
             hi = *p++;
             lo = *p++;
             w = SjisToEuc(hi, lo);
@@ -91,15 +105,12 @@ static char *Sjis2EucCpy(char *dest, char *src, int max_len)
             *q++ = (unsigned char)euc_kana;
             *q++ = *p++;
             n += 2;
-        } else if ((*p) & 0x80) {                   /* irregular japanese char */
+        } else {                                    /* irregular japanese char */
             p++;                                    /* ??abort and return NULL?? */
             /* discard it */
-        } else {
-            *q++ = *p++;
-            n++;
         }
     }
-    if ((*p) && !(*p & 0x80) && (n < max_len-1)) {
+    if ((p < end) && !(*p & 0x80) && (n < max_len-1)) {
             *q++ = *p++;
             *q = '\0';
     } else {
@@ -116,15 +127,22 @@ static char *Sjis2EucCpy(char *dest, char *src, int max_len)
 */
 void Sjis2Euc(char *buf, int max_len)
 {
+        char buf_out[1000];
         char *dst;
 
         if (buf == NULL) return;
-        if ((dst = malloc(max_len)) != NULL) {
-                            /* assign buffer for destination. */
-                if (Sjis2EucCpy(dst, buf, max_len) != NULL) {
-                        multibyte_safe_strncpy(buf, dst, max_len);
-                        buf[max_len-1] = '\0';  /* i am a paranoid B-) */
-                }
+        if (max_len <= 0) return;
+        /* Most strings can be converted without recourse to malloc */
+        if (max_len <= (int)sizeof(buf_out)) {
+                dst = buf_out;
+        } else if ((dst = malloc(max_len)) == NULL) {
+                return;
+        }
+        if (Sjis2EucCpy(dst, buf, max_len) != NULL) {
+                multibyte_safe_strncpy(buf, dst, max_len);
+                buf[max_len-1] = '\0';  /* i am a paranoid B-) */
+        }
+        if (dst != buf_out) {
                 free(dst);
         }
 }
@@ -179,18 +197,31 @@ static unsigned int EucToSjis(unsigned char hi, unsigned char lo)
  */
 static char *Euc2SjisCpy(char *dest, char *src, int max_len)
 {
-    unsigned char *p, *q;
+    unsigned char *p, *q, *end;
     unsigned char hi, lo;
     unsigned int w;
     int n = 0;
+    size_t run;
 
     p = (unsigned char *)src;
     q = (unsigned char *)dest;
-    while ((*p) && (n < max_len-2)) {
+    end = p + strlen(src);
+    while ((p < end) && (n < max_len-2)) {
+        /* runs of ascii are copied as they are, dest may be src */
+        run = ascii_prefix_len((char *)p, min(end - p, max_len-2 - n));
+        if (run) {
+            memmove(q, p, run);
+            p += run;
+            q += run;
+            n += run;
+            continue;
+        }
         if (isEucKana(*p)) {      /* euc kana(2byte) -> sjis(1byte) */
             p++;
-            *q++ = *p++;
-            n++;
+            if (p < end) {
+                *q++ = *p++;
+                n++;
+            }
         } else if (isEuc(*p) && isEuc(*(p+1))) {
             hi = *p++;
             lo = *p++;
@@ -198,12 +229,12 @@ static char *Euc2SjisCpy(char *dest, char *src, int max_len)
             *q++ = (w >> 8) & 0xff;
             *q++ = w & 0xff;
             n += 2;
-        } else {                  /* ascii or irregular japanese char */
+        } else {                  /* irregular japanese char */
             *q++ = *p++;
             n++;
         }
     }
-    if ((*p) && !(*p & 0x80) && n < max_len-1) {
+    if ((p < end) && !(*p & 0x80) && n < max_len-1) {
             *q++ = *p++;
             *q = '\0';
     } else {
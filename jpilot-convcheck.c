@@ -0,0 +1,523 @@
+/*******************************************************************************
+ * jpilot-convcheck.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/*
+ * Checks the CP1250, KOI8/CP1251 and SJIS/EUC converters against the byte
+ * at a time loops they replaced, and measures both.
+ *
+ * The old loops are kept below as reference code.  Both versions convert
+ * the same inputs and must give the same bytes: runs of ASCII across word
+ * boundaries, high bytes at the end of the buffer, buffers without a
+ * '\0' for the single byte converters, and random strings.  A SJIS lead
+ * byte or EUC kana prefix at the end of a string made the old loops read
+ * past the '\0'.  The converters drop it, so for such strings the result
+ * must be that of the old loop on the string without it.  Every buffer
+ * ends where its allocation does, so a build with -fsanitize=address
+ * catches reads past it.
+ */
+
+/********************************* Includes ***********************************/
+/* The converters are compiled into this file, so that the reference loops
+ * can use their tables and double byte arithmetic */
+#define convert_high cp1250_convert_high
+#include "cp1250.c"
+#undef convert_high
+#define convert_high russian_convert_high
+#include "russian.c"
+#undef convert_high
+#include "japanese.c"
+
+#include <sys/time.h>
+
+#include "utils.h"
+#include "prefs.h"
+
+/********************************* Constants **********************************/
+#define isCZ(c) ((c) & 0x80)
+
+/* Strings per converter of the random check */
+#define CONVCHECK_STRINGS  20000
+/* Bytes per converter and version of the benchmark */
+#define CONVCHECK_BENCH_MB 32
+#define CONVCHECK_BENCH_LEN 500
+
+/******************************* Global vars **********************************/
+typedef void (*converter)(char *buf, int max_len);
+
+struct convcheck
+{
+   const char *name;
+   converter conv;
+   converter ref;
+   /* Takes a '\0' terminated string, not any buffer of max_len bytes */
+   int is_string;
+   /* Lead byte of a double byte character, dropped at the end of a string */
+   int (*is_lead)(unsigned char c);
+   /* Bytes that make up the characters of its input */
+   void (*random_char)(unsigned char *buf, int *len);
+   long failed;
+};
+
+/* State of the pseudo random numbers, the same on every host */
+static unsigned long convcheck_seed = 1;
+
+/****************************** Reference code ********************************/
+/* The converters as they were before ASCII runs were skipped a word at a
+ * time.  Only the names differ. */
+static void ref_Win2Lat(char *const buf, int buf_len)
+{
+   unsigned char *p;
+   int i;
+
+   if (buf == NULL) return;
+
+   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
+      if (isCZ(*p)) {
+         *p = w2l[(*p) & 0x7f];
+      }
+   }
+}
+
+static void ref_Lat2Win(char *const buf, int buf_len)
+{
+   unsigned char *p;
+   int i;
+
+   if (buf == NULL) return;
+
+   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
+      if (isCZ(*p)) {
+         *p = l2w[(*p) & 0x7f];
+      }
+   }
+}
+
+static void ref_win1251_to_koi8(char *const buf, int buf_len)
+{
+   unsigned char *p;
+   int i;
+
+   if (buf == NULL) return;
+
+   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
+      *p = w2k[(*p)];
+   }
+}
+
+static void ref_koi8_to_win1251(char *const buf, int buf_len)
+{
+   unsigned char *p;
+   int i;
+
+   if (buf == NULL) return;
+
+   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
+        *p = k2w[(*p)];
+   }
+}
+
+static char *ref_Sjis2EucCpy(char *dest, char *src, int max_len)
+{
+    unsigned char *p, *q;
+    unsigned char hi, lo;
+    unsigned int w;
+    int n = 0;
+
+    p = (unsigned char *)src;
+    q = (unsigned char *)dest;
+    while ((*p) && (n < max_len-2)) {
+        if (isSjis1stByte(*p)) {
+            hi = *p++;
+            lo = *p++;
+            w = SjisToEuc(hi, lo);
+            *q++ = (w >> 8) & 0xff;
+            *q++ = w & 0xff;
+            n += 2;
+        } else if (isSjisKana(*p)) {                /* sjis(1byte) -> euc(2byte) */
+            *q++ = (unsigned char)euc_kana;
+            *q++ = *p++;
+            n += 2;
+        } else if ((*p) & 0x80) {                   /* irregular japanese char */
+            p++;                                    /* ??abort and return NULL?? */
+            /* discard it */
+        } else {
+            *q++ = *p++;
+            n++;
+        }
+    }
+    if ((*p) && !(*p & 0x80) && (n < max_len-1)) {
+            *q++ = *p++;
+            *q = '\0';
+    } else {
+            *q = '\0';
+    }
+    return (char *)q;
+}
+
+static void ref_Sjis2Euc(char *buf, int max_len)
+{
+        char *dst;
+
+        if (buf == NULL) return;
+        if ((dst = malloc(max_len)) != NULL) {
+                            /* assign buffer for destination. */
+                if (ref_Sjis2EucCpy(dst, buf, max_len) != NULL) {
+                        multibyte_safe_strncpy(buf, dst, max_len);
+                        buf[max_len-1] = '\0';  /* i am a paranoid B-) */
+                }
+                free(dst);
+        }
+}
+
+static char *ref_Euc2SjisCpy(char *dest, char *src, int max_len)
+{
+    unsigned char *p, *q;
+    unsigned char hi, lo;
+    unsigned int w;
+    int n = 0;
+
+    p = (unsigned char *)src;
+    q = (unsigned char *)dest;
+    while ((*p) && (n < max_len-2)) {
+        if (isEucKana(*p)) {      /* euc kana(2byte) -> sjis(1byte) */
+            p++;
+            *q++ = *p++;
+            n++;
+        } else if (isEuc(*p) && isEuc(*(p+1))) {
+            hi = *p++;
+            lo = *p++;
+            w = EucToSjis(hi, lo);
+            *q++ = (w >> 8) & 0xff;
+            *q++ = w & 0xff;
+            n += 2;
+        } else {                  /* ascii or irregular japanese char */
+            *q++ = *p++;
+            n++;
+        }
+    }
+    if ((*p) && !(*p & 0x80) && n < max_len-1) {
+            *q++ = *p++;
+            *q = '\0';
+    } else {
+            *q = '\0';
+    }
+    return dest;
+}
+
+static void ref_Euc2Sjis(char *buf, int max_len)
+{
+        if (buf == NULL) return;
+        if (max_len <= 0) return;
+        ref_Euc2SjisCpy(buf, buf, max_len);
+}
+
+/****************************** Main Code *************************************/
+static unsigned long convcheck_random(void)
+{
+   convcheck_seed = convcheck_seed * 1103515245 + 12345;
+   return (convcheck_seed >> 16) & 0x7FFF;
+}
+
+static double convcheck_now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int is_sjis_lead(unsigned char c)
+{
+   return isSjis1stByte(c);
+}
+
+static int is_euc_lead(unsigned char c)
+{
+   return isEucKana(c);
+}
+
+/* Mostly ASCII with a high byte now and then, and the odd '\0' */
+static void random_single(unsigned char *buf, int *len)
+{
+   unsigned long r;
+
+   r = convcheck_random() % 100;
+   if (r < 80) {
+      buf[(*len)++] = 0x20 + convcheck_random() % 0x5F;
+   } else if (r < 99) {
+      buf[(*len)++] = 0x80 + convcheck_random() % 0x80;
+   } else {
+      buf[(*len)++] = '\0';
+   }
+}
+
+/* ASCII, double byte characters, half width kana and stray high bytes */
+static void random_sjis(unsigned char *buf, int *len)
+{
+   unsigned long r;
+   unsigned char lo;
+
+   r = convcheck_random() % 100;
+   if (r < 70) {
+      buf[(*len)++] = 0x20 + convcheck_random() % 0x5F;
+   } else if (r < 90) {
+      buf[(*len)++] = (convcheck_random() & 1) ?
+         0x81 + convcheck_random() % 0x1F : 0xE0 + convcheck_random() % 0x1D;
+      do {
+         lo = 0x40 + convcheck_random() % 0xBD;
+      } while (lo == 0x7F);
+      buf[(*len)++] = lo;
+   } else if (r < 97) {
+      buf[(*len)++] = 0xA1 + convcheck_random() % 0x3F;
+   } else {
+      buf[(*len)++] = (convcheck_random() & 1) ? 0x80 : 0xA0;
+   }
+}
+
+/* ASCII, double byte characters, kana and stray high bytes */
+static void random_euc(unsigned char *buf, int *len)
+{
+   unsigned long r;
+   unsigned char c;
+
+   r = convcheck_random() % 100;
+   if (r < 70) {
+      buf[(*len)++] = 0x20 + convcheck_random() % 0x5F;
+   } else if (r < 90) {
+      buf[(*len)++] = 0xA1 + convcheck_random() % 0x5E;
+      buf[(*len)++] = 0xA1 + convcheck_random() % 0x5E;
+   } else if (r < 97) {
+      buf[(*len)++] = euc_kana;
+      buf[(*len)++] = 0xA1 + convcheck_random() % 0x3F;
+   } else {
+      do {
+         c = 0x80 + convcheck_random() % 0x21;
+      } while (c == euc_kana);
+      buf[(*len)++] = c;
+   }
+}
+
+/*
+ * Convert the len bytes of in with both versions of cc and compare them.
+ * For strings in must hold a '\0' within its len bytes.  With lone_lead
+ * the last character of the string is a lead byte without its second
+ * byte, and the old loop is given the string without it.
+ */
+static void check_one(struct convcheck *cc, const unsigned char *in, int len,
+                      int max_len, int lone_lead)
+{
+   unsigned char *buf, *ref;
+   int size, slen;
+
+   size = (len > max_len) ? len : max_len;
+   buf = malloc(size);
+   /* The old loops test *p before the length, so read one byte more */
+   ref = malloc(size + 1);
+   if (!buf || !ref) {
+      free(buf);
+      free(ref);
+      cc->failed++;
+      return;
+   }
+   memset(buf, 0, size);
+   memcpy(buf, in, len);
+   memcpy(ref, buf, size);
+   ref[size] = '\0';
+   if (lone_lead) {
+      slen = strlen((char *)ref);
+      ref[slen-1] = '\0';
+   }
+
+   cc->conv((char *)buf, max_len);
+   cc->ref((char *)ref, max_len);
+
+   if (lone_lead ? strcmp((char *)buf, (char *)ref) : memcmp(buf, ref, size)) {
+      if (cc->failed < 5) {
+         fprintf(stderr, "%s: differs on %d bytes with max_len %d%s\n",
+                 cc->name, len, max_len, lone_lead ? ", lone lead byte" : "");
+      }
+      cc->failed++;
+   }
+   free(buf);
+   free(ref);
+}
+
+/* A string of about len bytes of random characters, '\0' terminated */
+static int random_string(struct convcheck *cc, unsigned char *buf, int len)
+{
+   int n;
+
+   n = 0;
+   while (n < len) {
+      cc->random_char(buf, &n);
+   }
+   if (cc->is_string) {
+      buf[n] = '\0';
+      /* '\0' only ends the string */
+      n = strlen((char *)buf) + 1;
+   }
+
+   return n;
+}
+
+static void check_converter(struct convcheck *cc)
+{
+   unsigned char buf[1024];
+   unsigned char c;
+   int i, j, len, max_len;
+
+   /* A high byte at every position of an ASCII run and at max_len-1 */
+   for (len=1; len<=40; len++) {
+      for (i=0; i<len; i++) {
+         memset(buf, 'a', len);
+         buf[len] = '\0';
+         buf[i] = cc->is_string ? 0xA4 : 0x80 + (i * 7) % 0x80;
+         max_len = cc->is_string ? len+1 : len;
+         check_one(cc, buf, cc->is_string ? len+1 : len, max_len, FALSE);
+         check_one(cc, buf, cc->is_string ? len+1 : len, i+1, FALSE);
+      }
+   }
+
+   /* Every byte value after every length of ASCII run */
+   for (len=0; len<=17; len++) {
+      for (j=1; j<256; j++) {
+         /* A lead byte at the end is checked below */
+         if (cc->is_string && cc->is_lead && cc->is_lead(j)) {
+            continue;
+         }
+         memset(buf, 'b', len);
+         buf[len] = j;
+         buf[len+1] = '\0';
+         check_one(cc, buf, len+2, len+2, FALSE);
+         if (!cc->is_string) {
+            check_one(cc, buf, len+1, len+1, FALSE);
+         }
+      }
+   }
+
+   /* A lead byte at the end of the string, also at max_len-1 */
+   if (cc->is_lead) {
+      for (i=0; i<CONVCHECK_STRINGS/10; i++) {
+         len = random_string(cc, buf, convcheck_random() % 64) - 1;
+         do {
+            c = 0x80 + convcheck_random() % 0x80;
+         } while (!cc->is_lead(c));
+         buf[len++] = c;
+         buf[len++] = '\0';
+         check_one(cc, buf, len, len, TRUE);
+         check_one(cc, buf, len, len-1, TRUE);
+         check_one(cc, buf, len, 2*len, TRUE);
+      }
+   }
+
+   /* Random strings, cut short by max_len now and then */
+   for (i=0; i<CONVCHECK_STRINGS; i++) {
+      len = random_string(cc, buf, 1 + convcheck_random() % 600);
+      max_len = (convcheck_random() % 4) ? len : 1 + convcheck_random() % len;
+      check_one(cc, buf, len, max_len, FALSE);
+   }
+}
+
+/* MB/s of conv on strings of mostly ASCII */
+static double bench_converter(struct convcheck *cc, converter conv)
+{
+   unsigned char src[CONVCHECK_BENCH_LEN+2];
+   char buf[CONVCHECK_BENCH_LEN+2];
+   double start, seconds;
+   long i, count;
+   int len;
+
+   /* Text as in most records: ASCII with a character of the set now
+    * and then, and no '\0' before the end */
+   convcheck_seed = 2;
+   len = 0;
+   while (len < CONVCHECK_BENCH_LEN) {
+      if (convcheck_random() % 32) {
+         src[len++] = 0x20 + convcheck_random() % 0x5F;
+      } else {
+         i = len;
+         cc->random_char(src, &len);
+         /* Only the high characters, the loop adds the ASCII */
+         if (!(src[i] & 0x80)) {
+            len = i;
+         }
+      }
+   }
+   src[len++] = '\0';
+   count = CONVCHECK_BENCH_MB * 1024L * 1024L / len;
+
+   start = convcheck_now();
+   for (i=0; i<count; i++) {
+      memcpy(buf, src, len);
+      conv(buf, len);
+   }
+   seconds = convcheck_now() - start;
+
+   return (seconds > 0) ? (count * len) / seconds / (1024 * 1024) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+   struct convcheck checks[] = {
+      {"Win2Lat",         Win2Lat,         ref_Win2Lat,         FALSE, NULL,         random_single, 0},
+      {"Lat2Win",         Lat2Win,         ref_Lat2Win,         FALSE, NULL,         random_single, 0},
+      {"win1251_to_koi8", win1251_to_koi8, ref_win1251_to_koi8, FALSE, NULL,         random_single, 0},
+      {"koi8_to_win1251", koi8_to_win1251, ref_koi8_to_win1251, FALSE, NULL,         random_single, 0},
+      {"Sjis2Euc",        Sjis2Euc,        ref_Sjis2Euc,        TRUE,  is_sjis_lead, random_sjis,   0},
+      {"Euc2Sjis",        Euc2Sjis,        ref_Euc2Sjis,        TRUE,  is_euc_lead,  random_euc,    0},
+      {NULL, NULL, NULL, 0, NULL, NULL, 0}
+   };
+   int i, bench, failed;
+
+   bench = TRUE;
+   for (i=1; i<argc; i++) {
+      if (!strcmp(argv[i], "-n")) {
+         bench = FALSE;
+      } else {
+         fprintf(stderr, "%s-convcheck [-n]\n", EPN);
+         fprintf(stderr, " Checks the character set converters against the old loops\n");
+         fprintf(stderr, " and prints the MB/s of both.\n");
+         fprintf(stderr, " -n only checks, without the benchmark\n");
+         return EXIT_FAILURE;
+      }
+   }
+
+   /* multibyte_safe_strncpy() keeps double byte characters whole */
+   pref_init();
+   set_pref(PREF_CHAR_SET, CHAR_SET_JAPANESE, NULL, FALSE);
+
+   failed = 0;
+   for (i=0; checks[i].name; i++) {
+      convcheck_seed = 1;
+      check_converter(&checks[i]);
+      printf("%-16s %s", checks[i].name, checks[i].failed ? "FAILED" : "ok");
+      if (bench) {
+         printf("   new %8.1f MB/s   old %8.1f MB/s",
+                bench_converter(&checks[i], checks[i].conv),
+                bench_converter(&checks[i], checks[i].ref));
+      }
+      printf("\n");
+      if (checks[i].failed) {
+         failed = 1;
+      }
+   }
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
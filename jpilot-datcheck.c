@@ -0,0 +1,297 @@
+/*******************************************************************************
+ * jpilot-datcheck.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/*
+ * Checks the Palm Desktop .dat importer against a corpus of files.
+ *
+ * Every file is given to the parsers of all four databases.  A file whose
+ * name starts with "good" must be read by the parser of its type and
+ * rejected with EXIT_FAILURE by the others.  Any other file must be
+ * rejected by all four.  With -t every shorter prefix of a good file is
+ * parsed too and must be rejected.  With -c the given number of copies of
+ * each file with a few bytes changed are parsed, which only must not
+ * crash.  Build with -fsanitize=address, or run under valgrind, to catch
+ * reads past the end of the data.
+ */
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+#include "log.h"
+
+/******************************* Global vars **********************************/
+struct dat_parser
+{
+   const char *name;
+   int type;
+   int (*parse)(FILE *in, struct CategoryAppInfo *ai);
+};
+
+/* State of the pseudo random numbers of -c, the same on every host */
+static unsigned long datcheck_seed = 1;
+
+/****************************** Main Code *************************************/
+static int parse_appointments(FILE *in, struct CategoryAppInfo *ai)
+{
+   AppointmentList *alist = NULL;
+   int r;
+
+   r = dat_get_appointments(in, &alist, ai);
+   free_AppointmentList(&alist);
+   return r;
+}
+
+static int parse_addresses(FILE *in, struct CategoryAppInfo *ai)
+{
+   AddressList *addrlist = NULL;
+   int r;
+
+   r = dat_get_addresses(in, &addrlist, ai);
+   free_AddressList(&addrlist);
+   return r;
+}
+
+static int parse_todos(FILE *in, struct CategoryAppInfo *ai)
+{
+   ToDoList *todolist = NULL;
+   int r;
+
+   r = dat_get_todos(in, &todolist, ai);
+   free_ToDoList(&todolist);
+   return r;
+}
+
+static int parse_memos(FILE *in, struct CategoryAppInfo *ai)
+{
+   MemoList *memolist = NULL;
+   int r;
+
+   r = dat_get_memos(in, &memolist, ai);
+   free_MemoList(&memolist);
+   return r;
+}
+
+static const struct dat_parser parsers[] = {
+   {"datebook", DAT_DATEBOOK_FILE, parse_appointments},
+   {"address",  DAT_ADDRESS_FILE,  parse_addresses},
+   {"todo",     DAT_TODO_FILE,     parse_todos},
+   {"memo",     DAT_MEMO_FILE,     parse_memos},
+   {NULL, 0, NULL}
+};
+
+static unsigned long datcheck_random(void)
+{
+   datcheck_seed = datcheck_seed * 1103515245 + 12345;
+   return (datcheck_seed >> 16) & 0x7FFF;
+}
+
+/*
+ * Parse len bytes of data with every parser.  The parser of type must
+ * succeed and the others fail; with a type of 0 all must fail, and with a
+ * type of -1 the results are not checked.  Returns the number of failed
+ * checks.
+ */
+static int check_data(const char *label, const unsigned char *data,
+                      size_t len, int type)
+{
+   struct CategoryAppInfo ai;
+   FILE *in;
+   int i, r, failed;
+
+   failed = 0;
+   for (i=0; parsers[i].name; i++) {
+      /* The parsers map the file, so the data must be in one */
+      in = tmpfile();
+      if (!in) {
+         fprintf(stderr, "%s: unable to create a temporary file\n", label);
+         return 1;
+      }
+      if ((len > 0) && (fwrite(data, len, 1, in) != 1)) {
+         fprintf(stderr, "%s: unable to write a temporary file\n", label);
+         fclose(in);
+         return 1;
+      }
+      fflush(in);
+      rewind(in);
+
+      memset(&ai, 0, sizeof(ai));
+      r = parsers[i].parse(in, &ai);
+      fclose(in);
+
+      if (type < 0) {
+         continue;
+      }
+      if (parsers[i].type == type) {
+         if (r != EXIT_SUCCESS) {
+            fprintf(stderr, "%s: %s parser failed on a good file\n",
+                    label, parsers[i].name);
+            failed++;
+         }
+      } else if (r != EXIT_FAILURE) {
+         fprintf(stderr, "%s: %s parser returned %d instead of EXIT_FAILURE\n",
+                 label, parsers[i].name, r);
+         failed++;
+      }
+   }
+
+   return failed;
+}
+
+static unsigned char *read_file(const char *file_name, size_t *len)
+{
+   FILE *in;
+   unsigned char *data;
+   long size;
+
+   in = fopen(file_name, "rb");
+   if (!in) {
+      fprintf(stderr, "Unable to open file: %s\n", file_name);
+      return NULL;
+   }
+   fseek(in, 0, SEEK_END);
+   size = ftell(in);
+   rewind(in);
+   /* One more byte so that an empty file still gets a buffer */
+   data = malloc(size + 1);
+   if ((!data) || ((size > 0) && (fread(data, size, 1, in) != 1))) {
+      fprintf(stderr, "Unable to read file: %s\n", file_name);
+      free(data);
+      fclose(in);
+      return NULL;
+   }
+   fclose(in);
+   *len = size;
+
+   return data;
+}
+
+static int check_file(const char *file_name, int truncations, int changes,
+                      int *num_parses)
+{
+   unsigned char *data;
+   unsigned char *copy;
+   const char *base;
+   char label[FILENAME_MAX+32];
+   size_t len, i;
+   int n, j, type, failed;
+   FILE *in;
+
+   data = read_file(file_name, &len);
+   if (!data) {
+      return 1;
+   }
+   base = strrchr(file_name, '/');
+   base = base ? base+1 : file_name;
+
+   type = 0;
+   if (!strncmp(base, "good", 4)) {
+      in = fopen(file_name, "rb");
+      if (in) {
+         type = dat_check_if_dat_file(in);
+         fclose(in);
+      }
+      if (type == 0) {
+         fprintf(stderr, "%s: not a .dat file of any type\n", file_name);
+         free(data);
+         return 1;
+      }
+   }
+
+   failed = check_data(file_name, data, len, type);
+   *num_parses += 4;
+
+   if (truncations && type) {
+      for (i=0; i<len; i++) {
+         g_snprintf(label, sizeof(label), "%s truncated to %lu", file_name,
+                    (unsigned long)i);
+         failed += check_data(label, data, i, 0);
+         *num_parses += 4;
+      }
+   }
+
+   copy = malloc(len + 1);
+   for (n=0; copy && (len > 0) && (n<changes); n++) {
+      memcpy(copy, data, len);
+      for (j=datcheck_random() % 4; j>=0; j--) {
+         copy[datcheck_random() % len] = datcheck_random() & 0xFF;
+      }
+      g_snprintf(label, sizeof(label), "%s change %d", file_name, n);
+      failed += check_data(label, copy, len, -1);
+      *num_parses += 4;
+   }
+   free(copy);
+   free(data);
+
+   return failed;
+}
+
+static void fprint_datcheck_usage_string(FILE *out)
+{
+   fprintf(out, "%s-datcheck [-t] [-c changes] file.dat ...\n", EPN);
+   fprintf(out, " Checks the .dat importer against each file.  Files named good*\n");
+   fprintf(out, " must be read by the parser of their type, all others rejected.\n");
+   fprintf(out, " -t also checks that every prefix of a good file is rejected\n");
+   fprintf(out, " -c {changes} also parses this many copies of each file with\n");
+   fprintf(out, "    random bytes changed, which must not crash\n");
+}
+
+int main(int argc, char *argv[])
+{
+   int i, truncations, changes;
+   int num_files, num_parses, failed;
+
+   /* The parsers warn about every damaged file */
+   glob_log_stdout_mask = 0;
+   glob_log_file_mask = 0;
+   glob_log_gui_mask = 0;
+
+   truncations = 0;
+   changes = 0;
+   num_files = num_parses = failed = 0;
+
+   for (i=1; i<argc; i++) {
+      if (!strcmp(argv[i], "-h")) {
+         fprint_datcheck_usage_string(stdout);
+         return EXIT_SUCCESS;
+      } else if (!strcmp(argv[i], "-t")) {
+         truncations = 1;
+      } else if (!strcmp(argv[i], "-c") && (i+1 < argc)) {
+         changes = atoi(argv[++i]);
+      } else if (argv[i][0] != '-') {
+         failed += check_file(argv[i], truncations, changes, &num_parses);
+         num_files++;
+      } else {
+         fprint_datcheck_usage_string(stderr);
+         return EXIT_FAILURE;
+      }
+   }
+   if (num_files == 0) {
+      fprint_datcheck_usage_string(stderr);
+      return EXIT_FAILURE;
+   }
+
+   printf("%d files, %d parses, %d failed\n", num_files, num_parses, failed);
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,2505 @@
+/*******************************************************************************
+ * jpilot-devsim.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/*
+ * A handheld simulator for testing and benchmarking the sync code.
+ *
+ * It serves the .pdb and .prc files of a directory as the databases of a
+ * handheld.  It connects to jpilot-sync over a network (NetSync) port,
+ * as a handheld doing a network HotSync would, and answers the DLP
+ * requests itself.  When the sync ends the changed databases are written
+ * back to the directory, and the user information is kept in the file
+ * devsim.state, so that the next sync can be a fast sync.  The files of
+ * the card in its expansion slot are those below dir/card.
+ */
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* Pilot-link header files */
+#include <pi-source.h>
+#include <pi-socket.h>
+#include <pi-dlp.h>
+#include <pi-file.h>
+#include <pi-macros.h>
+#include <pi-memo.h>
+#include <pi-todo.h>
+#include <pi-address.h>
+#include <pi-datebook.h>
+
+#include <glib.h>
+
+/********************************* Constants **********************************/
+#define DEVSIM_STATE_FILE  "devsim.state"
+#define DEVSIM_DEFAULT_PORT "net:localhost"
+/* Name of the database not synced by any conduit written by -g */
+#define DEVSIM_BENCH_DB    "JpilotBenchDB"
+/* What a handheld may leave in the gapfill byte of an appointment */
+#define DEVSIM_GAPFILL     0xA5
+
+/* A J-Pilot .pc3 record header, and its record type for an edit of a
+ * handheld record (REPLACEMENT_PALM_REC of libplugin.h) */
+#define DEVSIM_PC3_HEADER_LEN  21
+#define DEVSIM_PC3_VERSION     2
+#define DEVSIM_PC3_REPLACEMENT 106
+
+#define DEVSIM_MAX_ARGS    8
+#define DEVSIM_MAX_OPEN    16
+#define DEVSIM_MAX_REQUEST 0x20000
+
+/* The one card volume, holding the files below DEVSIM_CARD_DIR in dir */
+#define DEVSIM_CARD_DIR    "card"
+#define DEVSIM_CARD_VOLUME 1
+#define DEVSIM_CARD_LABEL  "DEVSIM"
+#define DEVSIM_CARD_SIZE   0x40000000L
+
+/* Argument ids and size flags of DLP requests and responses */
+#define DLP_ARG_FIRST_ID   0x20
+#define DLP_ARG_ID_MASK    0x3f
+#define DLP_ARG_FLAG_SHORT 0x80
+#define DLP_ARG_FLAG_LONG  0x40
+#define DLP_RESPONSE_FLAG  0x80
+
+/* The protocol version reported to the desktop */
+#define DEVSIM_DLP_MAJOR   1
+#define DEVSIM_DLP_MINOR   2
+
+/****************************** Structures ************************************/
+struct devsim_arg
+{
+   int id;
+   size_t len;
+   unsigned char *data;
+};
+
+struct devsim_record
+{
+   /* Unique ID of a record, or ID of a resource */
+   recordid_t id;
+   unsigned long type;
+   int attr;
+   int cat;
+   size_t size;
+   unsigned char *data;
+};
+
+struct devsim_db
+{
+   struct DBInfo info;
+   unsigned char *app_info;
+   size_t app_size;
+   unsigned char *sort_info;
+   size_t sort_size;
+   struct devsim_record *recs;
+   int num_recs;
+   int max_recs;
+   /* Position of ReadNextModifiedRec */
+   int next_modified;
+   recordid_t next_id;
+   /* Needs to be written back, or removed */
+   int changed;
+   int deleted;
+};
+
+struct devsim_vfs_file
+{
+   FILE *file;
+   int is_dir;
+   int open;
+};
+
+struct devsim_stat
+{
+   long count;
+   double seconds;
+};
+
+struct devsim
+{
+   char dir[FILENAME_MAX];
+   struct devsim_db **dbs;
+   int num_dbs;
+   struct devsim_db *open_dbs[DEVSIM_MAX_OPEN];
+   struct devsim_vfs_file vfs_files[DEVSIM_MAX_OPEN];
+   /* Card file and length of the data following a VFSFileWrite request */
+   struct devsim_vfs_file *write_file;
+   size_t write_len;
+   struct PilotUser user;
+   int end_of_sync;
+   int verbose;
+   /* Drop the connection after this many record writes, if not 0 */
+   long drop_after;
+   /* Statistics */
+   long records_read;
+   long records_written;
+   long records_deleted;
+   long bytes_in;
+   long bytes_out;
+   long card_bytes;
+   struct devsim_stat stats[256];
+};
+
+typedef int (*devsim_handler)(struct devsim *sim, struct devsim_arg *args,
+                              int argc, pi_buffer_t *reply);
+
+struct devsim_command
+{
+   int cmd;
+   const char *name;
+   devsim_handler handler;
+};
+
+/****************************** Main Code *************************************/
+static double devsim_now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void devsim_file_name(struct devsim *sim, const struct DBInfo *info,
+                             char *file_name, int size)
+{
+   char name[sizeof(info->name)];
+   char *Pc;
+
+   g_strlcpy(name, info->name, sizeof(name));
+   for (Pc=name; *Pc; Pc++) {
+      if (*Pc == '/') {
+         *Pc = '_';
+      }
+   }
+   g_snprintf(file_name, size, "%s/%s.%s", sim->dir, name,
+              (info->flags & dlpDBFlagResource) ? "prc" : "pdb");
+}
+
+/*
+ * Databases
+ */
+static struct devsim_db *devsim_db_new(const struct DBInfo *info)
+{
+   struct devsim_db *db;
+
+   db = malloc(sizeof(struct devsim_db));
+   if (!db) {
+      return NULL;
+   }
+   memset(db, 0, sizeof(struct devsim_db));
+   memcpy(&db->info, info, sizeof(struct DBInfo));
+   db->info.flags &= ~dlpDBFlagOpen;
+   db->next_id = 0x100001;
+
+   return db;
+}
+
+static void devsim_db_free(struct devsim_db *db)
+{
+   int i;
+
+   for (i=0; i<db->num_recs; i++) {
+      free(db->recs[i].data);
+   }
+   free(db->recs);
+   free(db->app_info);
+   free(db->sort_info);
+   free(db);
+}
+
+static int devsim_add_db(struct devsim *sim, struct devsim_db *db)
+{
+   struct devsim_db **new_dbs;
+
+   new_dbs = realloc(sim->dbs, (sim->num_dbs+1) * sizeof(struct devsim_db *));
+   if (!new_dbs) {
+      return EXIT_FAILURE;
+   }
+   sim->dbs = new_dbs;
+   db->info.index = sim->num_dbs;
+   sim->dbs[sim->num_dbs++] = db;
+
+   return EXIT_SUCCESS;
+}
+
+static struct devsim_db *devsim_find_db(struct devsim *sim, const char *name)
+{
+   int i;
+
+   for (i=0; i<sim->num_dbs; i++) {
+      if (!sim->dbs[i]->deleted && !strcmp(sim->dbs[i]->info.name, name)) {
+         return sim->dbs[i];
+      }
+   }
+   return NULL;
+}
+
+static void devsim_db_touch(struct devsim_db *db)
+{
+   db->changed = 1;
+   db->info.modnum++;
+   db->info.modifyDate = time(NULL);
+}
+
+static int devsim_set_block(unsigned char **block, size_t *block_size,
+                            const void *data, size_t size)
+{
+   free(*block);
+   *block = NULL;
+   *block_size = 0;
+   if (size == 0) {
+      return EXIT_SUCCESS;
+   }
+   *block = malloc(size);
+   if (!*block) {
+      return EXIT_FAILURE;
+   }
+   memcpy(*block, data, size);
+   *block_size = size;
+
+   return EXIT_SUCCESS;
+}
+
+/* Append a copy of data to the records of db */
+static struct devsim_record *devsim_append_record(struct devsim_db *db,
+                                                  const void *data, size_t size)
+{
+   struct devsim_record *new_recs;
+   struct devsim_record *rec;
+
+   if (db->num_recs >= db->max_recs) {
+      new_recs = realloc(db->recs, (db->max_recs*2+64) * sizeof(struct devsim_record));
+      if (!new_recs) {
+         return NULL;
+      }
+      db->recs = new_recs;
+      db->max_recs = db->max_recs*2+64;
+   }
+   rec = &db->recs[db->num_recs];
+   memset(rec, 0, sizeof(struct devsim_record));
+   if (size > 0) {
+      rec->data = malloc(size);
+      if (!rec->data) {
+         return NULL;
+      }
+      memcpy(rec->data, data, size);
+   }
+   rec->size = size;
+   db->num_recs++;
+
+   return rec;
+}
+
+static int devsim_set_record_data(struct devsim_record *rec,
+                                  const void *data, size_t size)
+{
+   unsigned char *new_data;
+
+   new_data = NULL;
+   if (size > 0) {
+      new_data = malloc(size);
+      if (!new_data) {
+         return EXIT_FAILURE;
+      }
+      memcpy(new_data, data, size);
+   }
+   free(rec->data);
+   rec->data = new_data;
+   rec->size = size;
+
+   return EXIT_SUCCESS;
+}
+
+static void devsim_remove_record(struct devsim_db *db, int idx)
+{
+   free(db->recs[idx].data);
+   memmove(&db->recs[idx], &db->recs[idx+1],
+           (db->num_recs-idx-1) * sizeof(struct devsim_record));
+   db->num_recs--;
+}
+
+static int devsim_find_record(struct devsim_db *db, recordid_t id)
+{
+   int i;
+
+   for (i=0; i<db->num_recs; i++) {
+      if (db->recs[i].id == id) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+static int devsim_find_resource(struct devsim_db *db, unsigned long type, int id)
+{
+   int i;
+
+   for (i=0; i<db->num_recs; i++) {
+      if ((db->recs[i].type == type) && (db->recs[i].id == id)) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+static struct devsim_db *devsim_load_db(const char *file_name)
+{
+   struct pi_file *pf;
+   struct DBInfo info;
+   struct devsim_db *db;
+   struct devsim_record *rec;
+   void *buf;
+   size_t size;
+   int i, num, attr, cat, res_id;
+   recordid_t uid;
+   unsigned long type;
+
+   pf = pi_file_open(file_name);
+   if (!pf) {
+      fprintf(stderr, "Unable to open file: %s\n", file_name);
+      return NULL;
+   }
+   pi_file_get_info(pf, &info);
+   db = devsim_db_new(&info);
+   if (!db) {
+      pi_file_close(pf);
+      return NULL;
+   }
+
+   pi_file_get_app_info(pf, &buf, &size);
+   devsim_set_block(&db->app_info, &db->app_size, buf, size);
+   pi_file_get_sort_info(pf, &buf, &size);
+   devsim_set_block(&db->sort_info, &db->sort_size, buf, size);
+
+   pi_file_get_entries(pf, &num);
+   for (i=0; i<num; i++) {
+      if (info.flags & dlpDBFlagResource) {
+         if (pi_file_read_resource(pf, i, &buf, &size, &type, &res_id) < 0) {
+            break;
+         }
+         rec = devsim_append_record(db, buf, size);
+         if (!rec) {
+            break;
+         }
+         rec->type = type;
+         rec->id = res_id;
+      } else {
+         if (pi_file_read_record(pf, i, &buf, &size, &attr, &cat, &uid) < 0) {
+            break;
+         }
+         rec = devsim_append_record(db, buf, size);
+         if (!rec) {
+            break;
+         }
+         rec->id = uid;
+         rec->attr = attr;
+         rec->cat = cat;
+         if (uid >= db->next_id) {
+            db->next_id = uid + 1;
+         }
+      }
+   }
+   pi_file_close(pf);
+
+   return db;
+}
+
+static int devsim_save_db(struct devsim *sim, struct devsim_db *db)
+{
+   struct pi_file *pf;
+   struct devsim_record *rec;
+   char file_name[FILENAME_MAX];
+   char tmp_name[FILENAME_MAX];
+   int i;
+
+   devsim_file_name(sim, &db->info, file_name, sizeof(file_name));
+   if (db->deleted) {
+      unlink(file_name);
+      return EXIT_SUCCESS;
+   }
+
+   g_snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name);
+   pf = pi_file_create(tmp_name, &db->info);
+   if (!pf) {
+      fprintf(stderr, "Unable to create file: %s\n", tmp_name);
+      return EXIT_FAILURE;
+   }
+   if (db->app_size) {
+      pi_file_set_app_info(pf, db->app_info, db->app_size);
+   }
+   if (db->sort_size) {
+      pi_file_set_sort_info(pf, db->sort_info, db->sort_size);
+   }
+   for (i=0; i<db->num_recs; i++) {
+      rec = &db->recs[i];
+      if (db->info.flags & dlpDBFlagResource) {
+         pi_file_append_resource(pf, rec->data, rec->size, rec->type, rec->id);
+      } else {
+         pi_file_append_record(pf, rec->data, rec->size, rec->attr, rec->cat, rec->id);
+      }
+   }
+   if (pi_file_close(pf) < 0) {
+      fprintf(stderr, "Unable to write file: %s\n", tmp_name);
+      unlink(tmp_name);
+      return EXIT_FAILURE;
+   }
+   if (rename(tmp_name, file_name)) {
+      fprintf(stderr, "rename failed: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+static int devsim_load_dir(struct devsim *sim)
+{
+   DIR *dir;
+   struct dirent *dirent;
+   struct devsim_db *db;
+   char file_name[FILENAME_MAX];
+   size_t len;
+
+   dir = opendir(sim->dir);
+   if (!dir) {
+      fprintf(stderr, "Unable to open directory %s: %s\n", sim->dir, strerror(errno));
+      return EXIT_FAILURE;
+   }
+   while ((dirent = readdir(dir))) {
+      len = strlen(dirent->d_name);
+      if ((len < 5) ||
+          (strcmp(dirent->d_name+len-4, ".pdb") &&
+           strcmp(dirent->d_name+len-4, ".prc") &&
+           strcmp(dirent->d_name+len-4, ".pqa"))) {
+         continue;
+      }
+      g_snprintf(file_name, sizeof(file_name), "%s/%s", sim->dir, dirent->d_name);
+      db = devsim_load_db(file_name);
+      if (db && devsim_add_db(sim, db)) {
+         devsim_db_free(db);
+      }
+   }
+   closedir(dir);
+
+   return EXIT_SUCCESS;
+}
+
+static int devsim_save_dir(struct devsim *sim)
+{
+   int i, r;
+
+   r = EXIT_SUCCESS;
+   for (i=0; i<sim->num_dbs; i++) {
+      if (sim->dbs[i]->changed || sim->dbs[i]->deleted) {
+         if (devsim_save_db(sim, sim->dbs[i])) {
+            r = EXIT_FAILURE;
+         }
+      }
+   }
+   return r;
+}
+
+/*
+ * The user information that a handheld keeps between syncs
+ */
+static void devsim_read_state(struct devsim *sim)
+{
+   FILE *in;
+   char file_name[FILENAME_MAX];
+   char line[256];
+   char *Pc;
+   unsigned long n;
+
+   memset(&sim->user, 0, sizeof(struct PilotUser));
+   sim->user.userID = 1000 + (getpid() % 1000);
+   g_strlcpy(sim->user.username, "J-Pilot Devsim", sizeof(sim->user.username));
+
+   g_snprintf(file_name, sizeof(file_name), "%s/%s", sim->dir, DEVSIM_STATE_FILE);
+   in = fopen(file_name, "r");
+   if (!in) {
+      return;
+   }
+   while (fgets(line, sizeof(line), in)) {
+      Pc = strchr(line, '\n');
+      if (Pc) {
+         *Pc = '\0';
+      }
+      if (sscanf(line, "userID %lu", &n) == 1) {
+         sim->user.userID = n;
+      } else if (sscanf(line, "viewerID %lu", &n) == 1) {
+         sim->user.viewerID = n;
+      } else if (sscanf(line, "lastSyncPC %lu", &n) == 1) {
+         sim->user.lastSyncPC = n;
+      } else if (sscanf(line, "successfulSyncDate %lu", &n) == 1) {
+         sim->user.successfulSyncDate = n;
+      } else if (sscanf(line, "lastSyncDate %lu", &n) == 1) {
+         sim->user.lastSyncDate = n;
+      } else if (!strncmp(line, "username ", 9)) {
+         g_strlcpy(sim->user.username, line+9, sizeof(sim->user.username));
+      }
+   }
+   fclose(in);
+}
+
+static int devsim_write_state(struct devsim *sim)
+{
+   FILE *out;
+   char file_name[FILENAME_MAX];
+
+   g_snprintf(file_name, sizeof(file_name), "%s/%s", sim->dir, DEVSIM_STATE_FILE);
+   out = fopen(file_name, "w");
+   if (!out) {
+      fprintf(stderr, "Unable to open file: %s\n", file_name);
+      return EXIT_FAILURE;
+   }
+   fprintf(out, "userID %lu\n", (unsigned long)sim->user.userID);
+   fprintf(out, "viewerID %lu\n", (unsigned long)sim->user.viewerID);
+   fprintf(out, "lastSyncPC %lu\n", (unsigned long)sim->user.lastSyncPC);
+   fprintf(out, "successfulSyncDate %lu\n", (unsigned long)sim->user.successfulSyncDate);
+   fprintf(out, "lastSyncDate %lu\n", (unsigned long)sim->user.lastSyncDate);
+   fprintf(out, "username %s\n", sim->user.username);
+   fclose(out);
+
+   return EXIT_SUCCESS;
+}
+
+/*
+ * DLP packets
+ */
+static int devsim_parse_request(unsigned char *buf, size_t len, int *cmd,
+                                struct devsim_arg *args, int *argc)
+{
+   unsigned char *p, *end;
+   int i, n;
+
+   if (len < 2) {
+      return EXIT_FAILURE;
+   }
+   *cmd = get_byte(buf);
+   n = get_byte(buf+1);
+   if (n > DEVSIM_MAX_ARGS) {
+      return EXIT_FAILURE;
+   }
+   p = buf+2;
+   end = buf+len;
+   for (i=0; i<n; i++) {
+      if (p+2 > end) {
+         return EXIT_FAILURE;
+      }
+      args[i].id = get_byte(p) & DLP_ARG_ID_MASK;
+      if (get_byte(p) & DLP_ARG_FLAG_LONG) {
+         if (p+6 > end) {
+            return EXIT_FAILURE;
+         }
+         args[i].len = get_long(p+2);
+         p += 6;
+      } else if (get_byte(p) & DLP_ARG_FLAG_SHORT) {
+         if (p+4 > end) {
+            return EXIT_FAILURE;
+         }
+         args[i].len = get_short(p+2);
+         p += 4;
+      } else {
+         args[i].len = get_byte(p+1);
+         p += 2;
+      }
+      if (p+args[i].len > end) {
+         return EXIT_FAILURE;
+      }
+      args[i].data = p;
+      p += args[i].len;
+   }
+   *argc = n;
+
+   return EXIT_SUCCESS;
+}
+
+/* Add an argument made of head followed by data to a response */
+static void devsim_reply_arg(pi_buffer_t *reply, int id,
+                             const unsigned char *head, size_t head_len,
+                             const unsigned char *data, size_t data_len)
+{
+   unsigned char arg_head[6];
+   size_t len;
+
+   len = head_len + data_len;
+   if (len < 0x100) {
+      set_byte(arg_head, id);
+      set_byte(arg_head+1, len);
+      pi_buffer_append(reply, arg_head, 2);
+   } else if (len < 0x10000) {
+      set_byte(arg_head, id | DLP_ARG_FLAG_SHORT);
+      set_byte(arg_head+1, 0);
+      set_short(arg_head+2, len);
+      pi_buffer_append(reply, arg_head, 4);
+   } else {
+      set_byte(arg_head, id | DLP_ARG_FLAG_LONG);
+      set_byte(arg_head+1, 0);
+      set_long(arg_head+2, len);
+      pi_buffer_append(reply, arg_head, 6);
+   }
+   if (head_len) {
+      pi_buffer_append(reply, head, head_len);
+   }
+   if (data_len) {
+      pi_buffer_append(reply, data, data_len);
+   }
+   reply->data[1]++;
+}
+
+/* Clip a read at offset of at most max_len bytes to size */
+static void devsim_clip(size_t size, size_t offset, size_t max_len,
+                        size_t *start, size_t *len)
+{
+   *start = (offset < size) ? offset : size;
+   *len = size - *start;
+   if ((max_len != 0xFFFF) && (*len > max_len)) {
+      *len = max_len;
+   }
+}
+
+static struct devsim_db *devsim_handle_db(struct devsim *sim,
+                                          struct devsim_arg *args, int argc)
+{
+   int handle;
+
+   if ((argc < 1) || (args[0].len < 1)) {
+      return NULL;
+   }
+   handle = get_byte(args[0].data);
+   if ((handle < 1) || (handle > DEVSIM_MAX_OPEN)) {
+      return NULL;
+   }
+   return sim->open_dbs[handle-1];
+}
+
+static int devsim_open_handle(struct devsim *sim, struct devsim_db *db)
+{
+   int i;
+
+   for (i=0; i<DEVSIM_MAX_OPEN; i++) {
+      if (sim->open_dbs[i] == db) {
+         return i+1;
+      }
+   }
+   for (i=0; i<DEVSIM_MAX_OPEN; i++) {
+      if (!sim->open_dbs[i]) {
+         sim->open_dbs[i] = db;
+         db->info.flags |= dlpDBFlagOpen;
+         db->next_modified = 0;
+         return i+1;
+      }
+   }
+   return 0;
+}
+
+static void devsim_reply_record(struct devsim *sim, pi_buffer_t *reply,
+                                struct devsim_db *db, int idx,
+                                size_t offset, size_t max_len)
+{
+   unsigned char head[10];
+   struct devsim_record *rec;
+   size_t start, len;
+
+   rec = &db->recs[idx];
+   devsim_clip(rec->size, offset, max_len, &start, &len);
+   set_long(head, rec->id);
+   set_short(head+4, idx);
+   set_short(head+6, rec->size);
+   set_byte(head+8, rec->attr);
+   set_byte(head+9, rec->cat);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 10, rec->data+start, len);
+   sim->records_read++;
+}
+
+static void devsim_reply_resource(struct devsim *sim, pi_buffer_t *reply,
+                                  struct devsim_db *db, int idx,
+                                  size_t offset, size_t max_len)
+{
+   unsigned char head[10];
+   struct devsim_record *rec;
+   size_t start, len;
+
+   rec = &db->recs[idx];
+   devsim_clip(rec->size, offset, max_len, &start, &len);
+   set_long(head, rec->type);
+   set_short(head+4, rec->id);
+   set_short(head+6, idx);
+   set_short(head+8, rec->size);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 10, rec->data+start, len);
+   sim->records_read++;
+}
+
+/*
+ * Request handlers.  Each returns a DLP error code.
+ */
+static int devsim_ReadUserInfo(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   unsigned char head[30];
+   size_t user_len;
+
+   user_len = strlen(sim->user.username) + 1;
+   set_long(head, sim->user.userID);
+   set_long(head+4, sim->user.viewerID);
+   set_long(head+8, sim->user.lastSyncPC);
+   dlp_htopdate(sim->user.successfulSyncDate, head+12);
+   dlp_htopdate(sim->user.lastSyncDate, head+20);
+   set_byte(head+28, user_len);
+   set_byte(head+29, 0);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 30,
+                    (unsigned char *)sim->user.username, user_len);
+
+   return dlpErrNoError;
+}
+
+static int devsim_WriteUserInfo(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   unsigned char *p;
+   int flags;
+   size_t user_len;
+
+   if ((argc < 1) || (args[0].len < 22)) {
+      return dlpErrParam;
+   }
+   p = args[0].data;
+   flags = get_byte(p+20);
+   user_len = get_byte(p+21);
+   if (flags & 0x80) {
+      sim->user.userID = get_long(p);
+   }
+   if (flags & 0x08) {
+      sim->user.viewerID = get_long(p+4);
+   }
+   if (flags & 0x40) {
+      sim->user.lastSyncPC = get_long(p+8);
+   }
+   if (flags & 0x20) {
+      sim->user.lastSyncDate = dlp_ptohdate(p+12);
+      sim->user.successfulSyncDate = sim->user.lastSyncDate;
+   }
+   if ((flags & 0x10) && (22+user_len <= args[0].len)) {
+      memset(sim->user.username, 0, sizeof(sim->user.username));
+      memcpy(sim->user.username, p+22,
+             (user_len < sizeof(sim->user.username)) ? user_len : sizeof(sim->user.username)-1);
+   }
+
+   return dlpErrNoError;
+}
+
+static int devsim_ReadSysInfo(struct devsim *sim, struct devsim_arg *args,
+                              int argc, pi_buffer_t *reply)
+{
+   unsigned char info[14];
+   unsigned char version[12];
+
+   /* Palm OS 4.0 */
+   set_long(info, 0x04003000);
+   set_long(info+4, 0);
+   set_byte(info+8, 0);
+   set_byte(info+9, 4);
+   memcpy(info+10, "dsim", 4);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, info, sizeof(info), NULL, 0);
+
+   set_short(version, DEVSIM_DLP_MAJOR);
+   set_short(version+2, DEVSIM_DLP_MINOR);
+   set_short(version+4, 1);
+   set_short(version+6, 0);
+   set_long(version+8, 0xFFFF);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID+1, version, sizeof(version), NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_GetSysDateTime(struct devsim *sim, struct devsim_arg *args,
+                                 int argc, pi_buffer_t *reply)
+{
+   unsigned char date[8];
+
+   dlp_htopdate(time(NULL), date);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, date, sizeof(date), NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_ok(struct devsim *sim, struct devsim_arg *args,
+                     int argc, pi_buffer_t *reply)
+{
+   return dlpErrNoError;
+}
+
+static int devsim_ReadStorageInfo(struct devsim *sim, struct devsim_arg *args,
+                                  int argc, pi_buffer_t *reply)
+{
+   unsigned char info[48];
+   const char name[] = "RAM";
+   const char manuf[] = "J-Pilot";
+
+   if ((argc < 1) || (args[0].len < 1) || (get_byte(args[0].data) > 0)) {
+      return dlpErrNotFound;
+   }
+   memset(info, 0, sizeof(info));
+   set_byte(info, 0);           /* last card */
+   set_byte(info+1, 0);         /* more */
+   set_byte(info+3, 1);         /* count */
+   set_byte(info+4, 26 + strlen(name) + strlen(manuf));
+   set_byte(info+5, 0);         /* card number */
+   set_short(info+6, 1);        /* card version */
+   dlp_htopdate(time(NULL), info+8);
+   set_long(info+16, 4*1024*1024);
+   set_long(info+20, 64*1024*1024);
+   set_long(info+24, 48*1024*1024);
+   set_byte(info+28, strlen(name));
+   set_byte(info+29, strlen(manuf));
+   memcpy(info+30, name, strlen(name));
+   memcpy(info+30+strlen(name), manuf, strlen(manuf));
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, info,
+                    30+strlen(name)+strlen(manuf), NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_ReadDBList(struct devsim *sim, struct devsim_arg *args,
+                             int argc, pi_buffer_t *reply)
+{
+   pi_buffer_t *list;
+   unsigned char entry[44+sizeof(((struct DBInfo *)0)->name)+1];
+   unsigned char head[4];
+   struct devsim_db *db;
+   int flags, start, count, last, i;
+   size_t name_len, len;
+
+   if ((argc < 1) || (args[0].len < 4)) {
+      return dlpErrParam;
+   }
+   flags = get_byte(args[0].data);
+   start = get_short(args[0].data+2);
+   if (!(flags & dlpDBListRAM)) {
+      return dlpErrNotFound;
+   }
+
+   list = pi_buffer_new(1024);
+   count = 0;
+   last = start;
+   for (i=start; i<sim->num_dbs; i++) {
+      db = sim->dbs[i];
+      if (db->deleted) {
+         continue;
+      }
+      if ((count > 0) && (!(flags & dlpDBListMultiple) || (count >= 20))) {
+         break;
+      }
+      name_len = strlen(db->info.name);
+      len = 44 + name_len + 1;
+      len += len & 1;
+      memset(entry, 0, sizeof(entry));
+      set_byte(entry, len);
+      set_byte(entry+1, db->info.miscFlags);
+      set_short(entry+2, db->info.flags);
+      set_long(entry+4, db->info.type);
+      set_long(entry+8, db->info.creator);
+      set_short(entry+12, db->info.version);
+      set_long(entry+14, db->info.modnum);
+      dlp_htopdate(db->info.createDate, entry+18);
+      dlp_htopdate(db->info.modifyDate, entry+26);
+      dlp_htopdate(db->info.backupDate, entry+34);
+      set_short(entry+42, i);
+      memcpy(entry+44, db->info.name, name_len);
+      pi_buffer_append(list, entry, len);
+      last = i;
+      count++;
+   }
+   if (count == 0) {
+      pi_buffer_free(list);
+      return dlpErrNotFound;
+   }
+
+   set_short(head, last);
+   set_byte(head+2, (i < sim->num_dbs) ? 0x80 : 0);
+   set_byte(head+3, count);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 4, list->data, list->used);
+   pi_buffer_free(list);
+
+   return dlpErrNoError;
+}
+
+static int devsim_OpenDB(struct devsim *sim, struct devsim_arg *args,
+                         int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   char name[sizeof(((struct DBInfo *)0)->name)];
+   unsigned char handle;
+
+   if ((argc < 1) || (args[0].len < 3)) {
+      return dlpErrParam;
+   }
+   memset(name, 0, sizeof(name));
+   memcpy(name, args[0].data+2,
+          (args[0].len-2 < sizeof(name)) ? args[0].len-2 : sizeof(name)-1);
+   db = devsim_find_db(sim, name);
+   if (!db) {
+      return dlpErrNotFound;
+   }
+   handle = devsim_open_handle(sim, db);
+   if (!handle) {
+      return dlpErrTooManyOpen;
+   }
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, &handle, 1, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_CreateDB(struct devsim *sim, struct devsim_arg *args,
+                           int argc, pi_buffer_t *reply)
+{
+   struct DBInfo info;
+   struct devsim_db *db;
+   unsigned char *p;
+   unsigned char handle;
+
+   if ((argc < 1) || (args[0].len < 15)) {
+      return dlpErrParam;
+   }
+   p = args[0].data;
+   memset(&info, 0, sizeof(info));
+   info.creator = get_long(p);
+   info.type = get_long(p+4);
+   info.flags = get_short(p+10);
+   info.version = get_short(p+12);
+   memcpy(info.name, p+14,
+          (args[0].len-14 < sizeof(info.name)) ? args[0].len-14 : sizeof(info.name)-1);
+   info.createDate = info.modifyDate = time(NULL);
+
+   if (devsim_find_db(sim, info.name)) {
+      return dlpErrExists;
+   }
+   db = devsim_db_new(&info);
+   if (!db) {
+      return dlpErrMemory;
+   }
+   if (devsim_add_db(sim, db)) {
+      devsim_db_free(db);
+      return dlpErrMemory;
+   }
+   db->changed = 1;
+   handle = devsim_open_handle(sim, db);
+   if (!handle) {
+      return dlpErrTooManyOpen;
+   }
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, &handle, 1, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_CloseDB(struct devsim *sim, struct devsim_arg *args,
+                          int argc, pi_buffer_t *reply)
+{
+   int i, handle;
+
+   if ((argc >= 1) && (args[0].id == DLP_ARG_FIRST_ID+1)) {
+      /* Close all */
+      for (i=0; i<DEVSIM_MAX_OPEN; i++) {
+         if (sim->open_dbs[i]) {
+            sim->open_dbs[i]->info.flags &= ~dlpDBFlagOpen;
+            sim->open_dbs[i] = NULL;
+         }
+      }
+      return dlpErrNoError;
+   }
+   if ((argc < 1) || (args[0].len < 1)) {
+      return dlpErrParam;
+   }
+   handle = get_byte(args[0].data);
+   if ((handle < 1) || (handle > DEVSIM_MAX_OPEN) || !sim->open_dbs[handle-1]) {
+      return dlpErrNoneOpen;
+   }
+   sim->open_dbs[handle-1]->info.flags &= ~dlpDBFlagOpen;
+   sim->open_dbs[handle-1] = NULL;
+
+   return dlpErrNoError;
+}
+
+static int devsim_DeleteDB(struct devsim *sim, struct devsim_arg *args,
+                           int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   char name[sizeof(((struct DBInfo *)0)->name)];
+
+   if ((argc < 1) || (args[0].len < 3)) {
+      return dlpErrParam;
+   }
+   memset(name, 0, sizeof(name));
+   memcpy(name, args[0].data+2,
+          (args[0].len-2 < sizeof(name)) ? args[0].len-2 : sizeof(name)-1);
+   db = devsim_find_db(sim, name);
+   if (!db) {
+      return dlpErrNotFound;
+   }
+   if (db->info.flags & dlpDBFlagOpen) {
+      return dlpErrOpen;
+   }
+   db->deleted = 1;
+
+   return dlpErrNoError;
+}
+
+static int devsim_read_block(struct devsim_arg *args, int argc,
+                             pi_buffer_t *reply,
+                             unsigned char *block, size_t block_size)
+{
+   unsigned char head[2];
+   size_t start, len;
+
+   if (args[0].len < 6) {
+      return dlpErrParam;
+   }
+   if (!block_size) {
+      return dlpErrNotFound;
+   }
+   devsim_clip(block_size, get_short(args[0].data+2), get_short(args[0].data+4),
+               &start, &len);
+   set_short(head, len);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 2, block+start, len);
+
+   return dlpErrNoError;
+}
+
+static int devsim_ReadAppBlock(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   return devsim_read_block(args, argc, reply, db->app_info, db->app_size);
+}
+
+static int devsim_ReadSortBlock(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   return devsim_read_block(args, argc, reply, db->sort_info, db->sort_size);
+}
+
+static int devsim_WriteAppBlock(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 4) {
+      return dlpErrParam;
+   }
+   if (devsim_set_block(&db->app_info, &db->app_size,
+                        args[0].data+4, args[0].len-4)) {
+      return dlpErrMemory;
+   }
+   devsim_db_touch(db);
+
+   return dlpErrNoError;
+}
+
+static int devsim_WriteSortBlock(struct devsim *sim, struct devsim_arg *args,
+                                 int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 4) {
+      return dlpErrParam;
+   }
+   if (devsim_set_block(&db->sort_info, &db->sort_size,
+                        args[0].data+4, args[0].len-4)) {
+      return dlpErrMemory;
+   }
+   devsim_db_touch(db);
+
+   return dlpErrNoError;
+}
+
+static int devsim_ReadNextModifiedRec(struct devsim *sim, struct devsim_arg *args,
+                                      int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   for (; db->next_modified < db->num_recs; db->next_modified++) {
+      if (db->recs[db->next_modified].attr & (dlpRecAttrDirty | dlpRecAttrDeleted)) {
+         devsim_reply_record(sim, reply, db, db->next_modified, 0, 0xFFFF);
+         db->next_modified++;
+         return dlpErrNoError;
+      }
+   }
+   return dlpErrNotFound;
+}
+
+static int devsim_ReadRecord(struct devsim *sim, struct devsim_arg *args,
+                             int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   unsigned char *p;
+   int idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   p = args[0].data;
+   if (args[0].id == DLP_ARG_FIRST_ID) {
+      /* By unique ID */
+      if (args[0].len < 10) {
+         return dlpErrParam;
+      }
+      idx = devsim_find_record(db, get_long(p+2));
+      if (idx < 0) {
+         return dlpErrNotFound;
+      }
+      devsim_reply_record(sim, reply, db, idx, get_short(p+6), get_short(p+8));
+   } else {
+      /* By index */
+      if (args[0].len < 8) {
+         return dlpErrParam;
+      }
+      idx = get_short(p+2);
+      if (idx >= db->num_recs) {
+         return dlpErrNotFound;
+      }
+      devsim_reply_record(sim, reply, db, idx, get_short(p+4), get_short(p+6));
+   }
+
+   return dlpErrNoError;
+}
+
+static int devsim_WriteRecord(struct devsim *sim, struct devsim_arg *args,
+                              int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   struct devsim_record *rec;
+   unsigned char *p;
+   unsigned char head[4];
+   recordid_t id;
+   int idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 8) {
+      return dlpErrParam;
+   }
+   p = args[0].data;
+   id = get_long(p+2);
+   idx = id ? devsim_find_record(db, id) : -1;
+   if (idx >= 0) {
+      rec = &db->recs[idx];
+      if (devsim_set_record_data(rec, p+8, args[0].len-8)) {
+         return dlpErrMemory;
+      }
+   } else {
+      rec = devsim_append_record(db, p+8, args[0].len-8);
+      if (!rec) {
+         return dlpErrMemory;
+      }
+      if (!id) {
+         id = db->next_id++;
+      } else if (id >= db->next_id) {
+         db->next_id = id + 1;
+      }
+      rec->id = id;
+   }
+   rec->attr = get_byte(p+6);
+   rec->cat = get_byte(p+7);
+   devsim_db_touch(db);
+   sim->records_written++;
+
+   set_long(head, id);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 4, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_DeleteRecord(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   unsigned char *p;
+   int flags, idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 6) {
+      return dlpErrParam;
+   }
+   p = args[0].data;
+   flags = get_byte(p+1);
+   if (flags & 0x80) {
+      /* All records */
+      sim->records_deleted += db->num_recs;
+      while (db->num_recs) {
+         devsim_remove_record(db, db->num_recs-1);
+      }
+   } else if (flags & 0x40) {
+      /* All records of a category */
+      for (idx=db->num_recs-1; idx>=0; idx--) {
+         if (db->recs[idx].cat == (get_long(p+2) & 0xFF)) {
+            devsim_remove_record(db, idx);
+            sim->records_deleted++;
+         }
+      }
+   } else {
+      idx = devsim_find_record(db, get_long(p+2));
+      if (idx < 0) {
+         return dlpErrNotFound;
+      }
+      devsim_remove_record(db, idx);
+      sim->records_deleted++;
+   }
+   devsim_db_touch(db);
+
+   return dlpErrNoError;
+}
+
+static int devsim_ReadResource(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   unsigned char *p;
+   int idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   p = args[0].data;
+   if (args[0].id == DLP_ARG_FIRST_ID) {
+      /* By index */
+      if (args[0].len < 8) {
+         return dlpErrParam;
+      }
+      idx = get_short(p+2);
+      if (idx >= db->num_recs) {
+         return dlpErrNotFound;
+      }
+      devsim_reply_resource(sim, reply, db, idx, get_short(p+4), get_short(p+6));
+   } else {
+      /* By type and ID */
+      if (args[0].len < 12) {
+         return dlpErrParam;
+      }
+      idx = devsim_find_resource(db, get_long(p+2), get_short(p+6));
+      if (idx < 0) {
+         return dlpErrNotFound;
+      }
+      devsim_reply_resource(sim, reply, db, idx, get_short(p+8), get_short(p+10));
+   }
+
+   return dlpErrNoError;
+}
+
+static int devsim_WriteResource(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   struct devsim_record *rec;
+   unsigned char *p;
+   unsigned long type;
+   int id, idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 10) {
+      return dlpErrParam;
+   }
+   p = args[0].data;
+   type = get_long(p+2);
+   id = get_short(p+6);
+   idx = devsim_find_resource(db, type, id);
+   if (idx >= 0) {
+      if (devsim_set_record_data(&db->recs[idx], p+10, args[0].len-10)) {
+         return dlpErrMemory;
+      }
+   } else {
+      rec = devsim_append_record(db, p+10, args[0].len-10);
+      if (!rec) {
+         return dlpErrMemory;
+      }
+      rec->type = type;
+      rec->id = id;
+   }
+   devsim_db_touch(db);
+   sim->records_written++;
+
+   return dlpErrNoError;
+}
+
+static int devsim_DeleteResource(struct devsim *sim, struct devsim_arg *args,
+                                 int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   unsigned char *p;
+   int idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 8) {
+      return dlpErrParam;
+   }
+   p = args[0].data;
+   if (get_byte(p+1) & 0x80) {
+      sim->records_deleted += db->num_recs;
+      while (db->num_recs) {
+         devsim_remove_record(db, db->num_recs-1);
+      }
+   } else {
+      idx = devsim_find_resource(db, get_long(p+2), get_short(p+6));
+      if (idx < 0) {
+         return dlpErrNotFound;
+      }
+      devsim_remove_record(db, idx);
+      sim->records_deleted++;
+   }
+   devsim_db_touch(db);
+
+   return dlpErrNoError;
+}
+
+static int devsim_CleanUpDatabase(struct devsim *sim, struct devsim_arg *args,
+                                  int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   int idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   for (idx=db->num_recs-1; idx>=0; idx--) {
+      if (db->recs[idx].attr & (dlpRecAttrDeleted | dlpRecAttrArchived)) {
+         devsim_remove_record(db, idx);
+         db->changed = 1;
+      }
+   }
+   return dlpErrNoError;
+}
+
+static int devsim_ResetSyncFlags(struct devsim *sim, struct devsim_arg *args,
+                                 int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   int idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   for (idx=0; idx<db->num_recs; idx++) {
+      db->recs[idx].attr &= ~dlpRecAttrDirty;
+   }
+   db->info.flags &= ~dlpDBFlagAppInfoDirty;
+   db->info.backupDate = time(NULL);
+   db->changed = 1;
+
+   return dlpErrNoError;
+}
+
+static int devsim_AddSyncLogEntry(struct devsim *sim, struct devsim_arg *args,
+                                  int argc, pi_buffer_t *reply)
+{
+   if (sim->verbose && (argc >= 1)) {
+      fprintf(stderr, "log: %.*s", (int)args[0].len, args[0].data);
+   }
+   return dlpErrNoError;
+}
+
+static int devsim_ReadOpenDBInfo(struct devsim *sim, struct devsim_arg *args,
+                                 int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   unsigned char head[2];
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   set_short(head, db->num_recs);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 2, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_MoveCategory(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   int from, to, idx;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 3) {
+      return dlpErrParam;
+   }
+   from = get_byte(args[0].data+1);
+   to = get_byte(args[0].data+2);
+   for (idx=0; idx<db->num_recs; idx++) {
+      if (db->recs[idx].cat == from) {
+         db->recs[idx].cat = to;
+      }
+   }
+   devsim_db_touch(db);
+
+   return dlpErrNoError;
+}
+
+static int devsim_EndOfSync(struct devsim *sim, struct devsim_arg *args,
+                            int argc, pi_buffer_t *reply)
+{
+   sim->end_of_sync = 1;
+   return dlpErrNoError;
+}
+
+static int devsim_ResetRecordIndex(struct devsim *sim, struct devsim_arg *args,
+                                   int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   db->next_modified = 0;
+
+   return dlpErrNoError;
+}
+
+static int devsim_ReadRecordIDList(struct devsim *sim, struct devsim_arg *args,
+                                   int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   pi_buffer_t *ids;
+   unsigned char head[4];
+   int start, max, i;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 6) {
+      return dlpErrParam;
+   }
+   start = get_short(args[0].data+2);
+   max = get_short(args[0].data+4);
+
+   ids = pi_buffer_new(max * 4 + 4);
+   for (i=start; (i<db->num_recs) && (i-start<max); i++) {
+      set_long(head, db->recs[i].id);
+      pi_buffer_append(ids, head, 4);
+   }
+   set_short(head, ids->used / 4);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, head, 2, ids->data, ids->used);
+   pi_buffer_free(ids);
+
+   return dlpErrNoError;
+}
+
+static int devsim_SetDBInfo(struct devsim *sim, struct devsim_arg *args,
+                            int argc, pi_buffer_t *reply)
+{
+   struct devsim_db *db;
+   unsigned char *p;
+   time_t t;
+
+   db = devsim_handle_db(sim, args, argc);
+   if (!db) {
+      return dlpErrNoneOpen;
+   }
+   if (args[0].len < 40) {
+      return dlpErrParam;
+   }
+   p = args[0].data;
+   db->info.flags &= ~get_short(p+2);
+   db->info.flags |= get_short(p+4);
+   if (get_short(p+6)) {
+      db->info.version = get_short(p+6);
+   }
+   if ((t = dlp_ptohdate(p+8)) > 0) {
+      db->info.createDate = t;
+   }
+   if ((t = dlp_ptohdate(p+16)) > 0) {
+      db->info.modifyDate = t;
+   }
+   if ((t = dlp_ptohdate(p+24)) > 0) {
+      db->info.backupDate = t;
+   }
+   if (get_long(p+32)) {
+      db->info.type = get_long(p+32);
+   }
+   if (get_long(p+36)) {
+      db->info.creator = get_long(p+36);
+   }
+   db->changed = 1;
+
+   return dlpErrNoError;
+}
+
+/*
+ * Card (VFS) requests
+ */
+static int devsim_card_volume(struct devsim_arg *args, int argc, size_t len)
+{
+   if ((argc < 1) || (args[0].len < len) ||
+       (get_short(args[0].data) != DEVSIM_CARD_VOLUME)) {
+      return dlpErrParam;
+   }
+   return dlpErrNoError;
+}
+
+/* File name in dir of the card path at offset in the first argument */
+static int devsim_card_file_name(struct devsim *sim, struct devsim_arg *args,
+                                 size_t offset, char *file_name, int size)
+{
+   char path[FILENAME_MAX];
+   size_t len;
+
+   len = args[0].len - offset;
+   if ((len < 1) || (len >= sizeof(path))) {
+      return dlpErrParam;
+   }
+   memcpy(path, args[0].data+offset, len);
+   path[len] = '\0';
+   if ((path[0] != '/') || strstr(path, "..")) {
+      return dlpErrParam;
+   }
+   g_snprintf(file_name, size, "%s/%s%s", sim->dir, DEVSIM_CARD_DIR, path);
+
+   return dlpErrNoError;
+}
+
+static struct devsim_vfs_file *devsim_vfs_file(struct devsim *sim,
+                                               struct devsim_arg *args, int argc)
+{
+   unsigned long ref;
+
+   if ((argc < 1) || (args[0].len < 4)) {
+      return NULL;
+   }
+   ref = get_long(args[0].data);
+   if ((ref < 1) || (ref > DEVSIM_MAX_OPEN) || (!sim->vfs_files[ref-1].open)) {
+      return NULL;
+   }
+   return &sim->vfs_files[ref-1];
+}
+
+static void devsim_vfs_close(struct devsim_vfs_file *vfs_file)
+{
+   if (vfs_file->file) {
+      fclose(vfs_file->file);
+   }
+   memset(vfs_file, 0, sizeof(struct devsim_vfs_file));
+}
+
+static int devsim_VFSVolumeEnumerate(struct devsim *sim, struct devsim_arg *args,
+                                     int argc, pi_buffer_t *reply)
+{
+   unsigned char volumes[4];
+
+   set_short(volumes, 1);
+   set_short(volumes+2, DEVSIM_CARD_VOLUME);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, volumes, 4, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSVolumeInfo(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   unsigned char info[28];
+
+   if (devsim_card_volume(args, argc, 2)) {
+      return dlpErrParam;
+   }
+   memset(info, 0, sizeof(info));
+   set_long(info+4, makelong("vfat"));
+   set_long(info+12, makelong("sdig"));
+   set_short(info+18, 1);
+   set_long(info+20, makelong("sdig"));
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, info, sizeof(info), NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSVolumeGetLabel(struct devsim *sim, struct devsim_arg *args,
+                                    int argc, pi_buffer_t *reply)
+{
+   if (devsim_card_volume(args, argc, 2)) {
+      return dlpErrParam;
+   }
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID,
+                    (unsigned char *)DEVSIM_CARD_LABEL, sizeof(DEVSIM_CARD_LABEL),
+                    NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSVolumeSize(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   unsigned char size[8];
+
+   if (devsim_card_volume(args, argc, 2)) {
+      return dlpErrParam;
+   }
+   set_long(size, 0);
+   set_long(size+4, DEVSIM_CARD_SIZE);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, size, 8, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSFileOpen(struct devsim *sim, struct devsim_arg *args,
+                              int argc, pi_buffer_t *reply)
+{
+   char file_name[FILENAME_MAX];
+   unsigned char ref[4];
+   struct stat statb;
+   int mode, i, err;
+
+   if (devsim_card_volume(args, argc, 5)) {
+      return dlpErrParam;
+   }
+   mode = get_short(args[0].data+2);
+   err = devsim_card_file_name(sim, args, 4, file_name, sizeof(file_name));
+   if (err) {
+      return err;
+   }
+   if (stat(file_name, &statb)) {
+      return dlpErrNotFound;
+   }
+   for (i=0; i<DEVSIM_MAX_OPEN; i++) {
+      if (!sim->vfs_files[i].open) {
+         break;
+      }
+   }
+   if (i == DEVSIM_MAX_OPEN) {
+      return dlpErrTooManyOpen;
+   }
+   if (S_ISDIR(statb.st_mode)) {
+      sim->vfs_files[i].is_dir = 1;
+   } else {
+      sim->vfs_files[i].file = fopen(file_name,
+         ((mode & dlpVFSOpenWrite) == dlpVFSOpenWrite) ? "r+b" : "rb");
+      if (!sim->vfs_files[i].file) {
+         return dlpErrNotFound;
+      }
+   }
+   sim->vfs_files[i].open = 1;
+   set_long(ref, i+1);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, ref, 4, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSFileClose(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   struct devsim_vfs_file *vfs_file;
+
+   vfs_file = devsim_vfs_file(sim, args, argc);
+   if (!vfs_file) {
+      return dlpErrParam;
+   }
+   devsim_vfs_close(vfs_file);
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSFileCreate(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   char file_name[FILENAME_MAX];
+   struct stat statb;
+   FILE *file;
+   int err;
+
+   if (devsim_card_volume(args, argc, 3)) {
+      return dlpErrParam;
+   }
+   err = devsim_card_file_name(sim, args, 2, file_name, sizeof(file_name));
+   if (err) {
+      return err;
+   }
+   if (!stat(file_name, &statb)) {
+      return dlpErrExists;
+   }
+   file = fopen(file_name, "wb");
+   if (!file) {
+      return dlpErrNotFound;
+   }
+   fclose(file);
+
+   return dlpErrNoError;
+}
+
+/* Missing parent directories are created too */
+static int devsim_VFSDirCreate(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   char file_name[FILENAME_MAX];
+   char *p;
+   int err;
+
+   if (devsim_card_volume(args, argc, 3)) {
+      return dlpErrParam;
+   }
+   err = devsim_card_file_name(sim, args, 2, file_name, sizeof(file_name));
+   if (err) {
+      return err;
+   }
+   for (p = file_name + strlen(sim->dir) + 1; (p = strchr(p, '/')); p++) {
+      *p = '\0';
+      mkdir(file_name, 0700);
+      *p = '/';
+   }
+   if (mkdir(file_name, 0700) && (errno != EEXIST)) {
+      return dlpErrNotFound;
+   }
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSFileGetAttributes(struct devsim *sim, struct devsim_arg *args,
+                                       int argc, pi_buffer_t *reply)
+{
+   struct devsim_vfs_file *vfs_file;
+   unsigned char attributes[4];
+
+   vfs_file = devsim_vfs_file(sim, args, argc);
+   if (!vfs_file) {
+      return dlpErrParam;
+   }
+   set_long(attributes, vfs_file->is_dir ? vfsFileAttrDirectory : 0);
+   devsim_reply_arg(reply, DLP_ARG_FIRST_ID, attributes, 4, NULL, 0);
+
+   return dlpErrNoError;
+}
+
+static int devsim_VFSFileResize(struct devsim *sim, struct devsim_arg *args,
+                                int argc, pi_buffer_t *reply)
+{
+   struct devsim_vfs_file *vfs_file;
+
+   vfs_file = devsim_vfs_file(sim, args, argc);
+   if ((!vfs_file) || (!vfs_file->file) || (args[0].len < 8)) {
+      return dlpErrParam;
+   }
+   fflush(vfs_file->file);
+   if (ftruncate(fileno(vfs_file->file), get_long(args[0].data+4))) {
+      return dlpErrReadOnly;
+   }
+
+   return dlpErrNoError;
+}
+
+/* The data to write is sent after the response, and is answered by a
+ * second response from devsim_receive_write */
+static int devsim_VFSFileWrite(struct devsim *sim, struct devsim_arg *args,
+                               int argc, pi_buffer_t *reply)
+{
+   struct devsim_vfs_file *vfs_file;
+
+   vfs_file = devsim_vfs_file(sim, args, argc);
+   if ((!vfs_file) || (!vfs_file->file) || (args[0].len < 8)) {
+      return dlpErrParam;
+   }
+   sim->write_file = vfs_file;
+   sim->write_len = get_long(args[0].data+4);
+
+   return dlpErrNoError;
+}
+
+static const struct devsim_command devsim_commands[] = {
+   { dlpFuncReadUserInfo,        "ReadUserInfo",        devsim_ReadUserInfo },
+   { dlpFuncWriteUserInfo,       "WriteUserInfo",       devsim_WriteUserInfo },
+   { dlpFuncReadSysInfo,         "ReadSysInfo",         devsim_ReadSysInfo },
+   { dlpFuncGetSysDateTime,      "GetSysDateTime",      devsim_GetSysDateTime },
+   { dlpFuncSetSysDateTime,      "SetSysDateTime",      devsim_ok },
+   { dlpFuncReadStorageInfo,     "ReadStorageInfo",     devsim_ReadStorageInfo },
+   { dlpFuncReadDBList,          "ReadDBList",          devsim_ReadDBList },
+   { dlpFuncOpenDB,              "OpenDB",              devsim_OpenDB },
+   { dlpFuncCreateDB,            "CreateDB",            devsim_CreateDB },
+   { dlpFuncCloseDB,             "CloseDB",             devsim_CloseDB },
+   { dlpFuncDeleteDB,            "DeleteDB",            devsim_DeleteDB },
+   { dlpFuncReadAppBlock,        "ReadAppBlock",        devsim_ReadAppBlock },
+   { dlpFuncWriteAppBlock,       "WriteAppBlock",       devsim_WriteAppBlock },
+   { dlpFuncReadSortBlock,       "ReadSortBlock",       devsim_ReadSortBlock },
+   { dlpFuncWriteSortBlock,      "WriteSortBlock",      devsim_WriteSortBlock },
+   { dlpFuncReadNextModifiedRec, "ReadNextModifiedRec", devsim_ReadNextModifiedRec },
+   { dlpFuncReadRecord,          "ReadRecord",          devsim_ReadRecord },
+   { dlpFuncWriteRecord,         "WriteRecord",         devsim_WriteRecord },
+   { dlpFuncDeleteRecord,        "DeleteRecord",        devsim_DeleteRecord },
+   { dlpFuncReadResource,        "ReadResource",        devsim_ReadResource },
+   { dlpFuncWriteResource,       "WriteResource",       devsim_WriteResource },
+   { dlpFuncDeleteResource,      "DeleteResource",      devsim_DeleteResource },
+   { dlpFuncCleanUpDatabase,     "CleanUpDatabase",     devsim_CleanUpDatabase },
+   { dlpFuncResetSyncFlags,      "ResetSyncFlags",      devsim_ResetSyncFlags },
+   { dlpFuncResetSystem,         "ResetSystem",         devsim_ok },
+   { dlpFuncAddSyncLogEntry,     "AddSyncLogEntry",     devsim_AddSyncLogEntry },
+   { dlpFuncReadOpenDBInfo,      "ReadOpenDBInfo",      devsim_ReadOpenDBInfo },
+   { dlpFuncMoveCategory,        "MoveCategory",        devsim_MoveCategory },
+   { dlpFuncOpenConduit,         "OpenConduit",         devsim_ok },
+   { dlpFuncEndOfSync,           "EndOfSync",           devsim_EndOfSync },
+   { dlpFuncResetRecordIndex,    "ResetRecordIndex",    devsim_ResetRecordIndex },
+   { dlpFuncReadRecordIDList,    "ReadRecordIDList",    devsim_ReadRecordIDList },
+   { dlpFuncSetDBInfo,           "SetDBInfo",           devsim_SetDBInfo },
+   { dlpFuncVFSVolumeEnumerate,  "VFSVolumeEnumerate",  devsim_VFSVolumeEnumerate },
+   { dlpFuncVFSVolumeInfo,       "VFSVolumeInfo",       devsim_VFSVolumeInfo },
+   { dlpFuncVFSVolumeGetLabel,   "VFSVolumeGetLabel",   devsim_VFSVolumeGetLabel },
+   { dlpFuncVFSVolumeSize,       "VFSVolumeSize",       devsim_VFSVolumeSize },
+   { dlpFuncVFSFileOpen,         "VFSFileOpen",         devsim_VFSFileOpen },
+   { dlpFuncVFSFileClose,        "VFSFileClose",        devsim_VFSFileClose },
+   { dlpFuncVFSFileCreate,       "VFSFileCreate",       devsim_VFSFileCreate },
+   { dlpFuncVFSDirCreate,        "VFSDirCreate",        devsim_VFSDirCreate },
+   { dlpFuncVFSFileGetAttributes, "VFSFileGetAttributes", devsim_VFSFileGetAttributes },
+   { dlpFuncVFSFileResize,       "VFSFileResize",       devsim_VFSFileResize },
+   { dlpFuncVFSFileWrite,        "VFSFileWrite",        devsim_VFSFileWrite },
+   { 0, NULL, NULL }
+};
+
+static const struct devsim_command *devsim_find_command(int cmd)
+{
+   int i;
+
+   for (i=0; devsim_commands[i].name; i++) {
+      if (devsim_commands[i].cmd == cmd) {
+         return &devsim_commands[i];
+      }
+   }
+   return NULL;
+}
+
+/* Answer one request.  The response is left in reply. */
+static void devsim_handle_request(struct devsim *sim, pi_buffer_t *request,
+                                  pi_buffer_t *reply)
+{
+   const struct devsim_command *command;
+   struct devsim_arg args[DEVSIM_MAX_ARGS];
+   unsigned char head[4];
+   int cmd, argc, err;
+   double start;
+
+   pi_buffer_clear(reply);
+   start = devsim_now();
+   if (devsim_parse_request(request->data, request->used, &cmd, args, &argc)) {
+      cmd = request->used ? request->data[0] : 0;
+      err = dlpErrParam;
+   } else {
+      command = devsim_find_command(cmd);
+      err = dlpErrNotSupp;
+      set_byte(head, cmd | DLP_RESPONSE_FLAG);
+      set_byte(head+1, 0);
+      set_short(head+2, 0);
+      pi_buffer_append(reply, head, 4);
+      if (command) {
+         err = command->handler(sim, args, argc, reply);
+      }
+      if (sim->verbose) {
+         fprintf(stderr, "%s: %d\n", command ? command->name : "unknown", err);
+      }
+   }
+   if (err != dlpErrNoError) {
+      /* Errors carry no arguments */
+      pi_buffer_clear(reply);
+      set_byte(head, cmd | DLP_RESPONSE_FLAG);
+      set_byte(head+1, 0);
+      set_short(head+2, 0);
+      pi_buffer_append(reply, head, 4);
+   }
+   set_short(reply->data+2, err);
+
+   sim->stats[cmd & 0xFF].count++;
+   sim->stats[cmd & 0xFF].seconds += devsim_now() - start;
+}
+
+static int devsim_connect(const char *port, int timeout)
+{
+   int sd;
+   int i;
+
+   for (i=0; i<timeout*10; i++) {
+      sd = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_DLP);
+      if (sd < 0) {
+         fprintf(stderr, "pi_socket: %s\n", strerror(errno));
+         return -1;
+      }
+      if (pi_connect(sd, port) >= 0) {
+         return sd;
+      }
+      pi_close(sd);
+      usleep(100000);
+   }
+   fprintf(stderr, "Unable to connect to %s\n", port);
+   return -1;
+}
+
+/* Receive the data of a VFSFileWrite into the card file and answer it */
+static int devsim_receive_write(struct devsim *sim, int sd, pi_buffer_t *buf)
+{
+   unsigned char head[4];
+   size_t len;
+   int err;
+
+   err = dlpErrNoError;
+   while (sim->write_len > 0) {
+      pi_buffer_clear(buf);
+      if (pi_read(sd, buf, DEVSIM_MAX_REQUEST) <= 0) {
+         fprintf(stderr, "Connection closed during a card write\n");
+         return EXIT_FAILURE;
+      }
+      len = (buf->used < sim->write_len) ? buf->used : sim->write_len;
+      if (fwrite(buf->data, 1, len, sim->write_file->file) != len) {
+         err = dlpErrMemory;
+      }
+      sim->write_len -= len;
+      sim->bytes_in += buf->used;
+      sim->card_bytes += len;
+   }
+   sim->write_file = NULL;
+
+   set_byte(head, dlpFuncVFSFileWrite | DLP_RESPONSE_FLAG);
+   set_byte(head+1, 0);
+   set_short(head+2, err);
+   if (pi_write(sd, head, 4) < 0) {
+      fprintf(stderr, "pi_write: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+   }
+   sim->bytes_out += 4;
+
+   return EXIT_SUCCESS;
+}
+
+static int devsim_serve(struct devsim *sim, const char *port, int timeout,
+                        int print_stats)
+{
+   pi_buffer_t *request;
+   pi_buffer_t *reply;
+   const struct devsim_command *command;
+   double start, elapsed;
+   long requests;
+   int sd, r, i;
+
+   sd = devsim_connect(port, timeout);
+   if (sd < 0) {
+      return EXIT_FAILURE;
+   }
+
+   request = pi_buffer_new(0xFFFF);
+   reply = pi_buffer_new(0xFFFF);
+   requests = 0;
+   start = devsim_now();
+   r = EXIT_SUCCESS;
+   while (!sim->end_of_sync) {
+      pi_buffer_clear(request);
+      if (pi_read(sd, request, DEVSIM_MAX_REQUEST) <= 0) {
+         fprintf(stderr, "Connection closed before the end of the sync\n");
+         r = EXIT_FAILURE;
+         break;
+      }
+      sim->bytes_in += request->used;
+      devsim_handle_request(sim, request, reply);
+      if (pi_write(sd, reply->data, reply->used) < 0) {
+         fprintf(stderr, "pi_write: %s\n", strerror(errno));
+         r = EXIT_FAILURE;
+         break;
+      }
+      sim->bytes_out += reply->used;
+      requests++;
+      if (sim->write_len && devsim_receive_write(sim, sd, request)) {
+         r = EXIT_FAILURE;
+         break;
+      }
+      /* As a handheld taken out of its cradle in the middle of a sync */
+      if (sim->drop_after && (sim->records_written >= sim->drop_after)) {
+         fprintf(stderr, "Dropping the connection after %ld record writes\n",
+                 sim->records_written);
+         break;
+      }
+   }
+   for (i=0; i<DEVSIM_MAX_OPEN; i++) {
+      if (sim->vfs_files[i].open) {
+         devsim_vfs_close(&sim->vfs_files[i]);
+      }
+   }
+   elapsed = devsim_now() - start;
+   pi_buffer_free(request);
+   pi_buffer_free(reply);
+   pi_close(sd);
+
+   if (devsim_save_dir(sim) || devsim_write_state(sim)) {
+      r = EXIT_FAILURE;
+   }
+
+   printf("requests=%ld records_read=%ld records_written=%ld records_deleted=%ld "
+          "bytes_in=%ld bytes_out=%ld card_bytes=%ld seconds=%.3f\n",
+          requests, sim->records_read, sim->records_written,
+          sim->records_deleted, sim->bytes_in, sim->bytes_out,
+          sim->card_bytes, elapsed);
+   if (print_stats) {
+      for (i=0; i<256; i++) {
+         if (!sim->stats[i].count) {
+            continue;
+         }
+         command = devsim_find_command(i);
+         printf("  %-20s %8ld %10.3f ms\n",
+                command ? command->name : "unknown",
+                sim->stats[i].count, sim->stats[i].seconds * 1000.0);
+      }
+   }
+
+   return r;
+}
+
+/*
+ * Sample databases for benchmarks
+ */
+static struct devsim_db *devsim_sample_db(struct devsim *sim, const char *name,
+                                          const char *creator, const char *type)
+{
+   struct DBInfo info;
+   struct devsim_db *db;
+
+   memset(&info, 0, sizeof(info));
+   g_strlcpy(info.name, name, sizeof(info.name));
+   info.creator = get_long(creator);
+   info.type = get_long(type);
+   info.flags = dlpDBFlagBackup;
+   info.createDate = info.modifyDate = time(NULL);
+   db = devsim_db_new(&info);
+   if (!db) {
+      return NULL;
+   }
+   if (devsim_add_db(sim, db)) {
+      devsim_db_free(db);
+      return NULL;
+   }
+   db->changed = 1;
+
+   return db;
+}
+
+static void devsim_sample_cai(struct CategoryAppInfo *cai)
+{
+   memset(cai, 0, sizeof(struct CategoryAppInfo));
+   g_strlcpy(cai->name[0], "Unfiled", sizeof(cai->name[0]));
+   g_strlcpy(cai->name[1], "Business", sizeof(cai->name[1]));
+   g_strlcpy(cai->name[2], "Personal", sizeof(cai->name[2]));
+   cai->ID[0] = 0;
+   cai->ID[1] = 1;
+   cai->ID[2] = 2;
+   cai->lastUniqueID = 15;
+}
+
+static void devsim_sample_record(struct devsim_db *db, pi_buffer_t *buf, int i)
+{
+   struct devsim_record *rec;
+
+   rec = devsim_append_record(db, buf->data, buf->used);
+   if (rec) {
+      rec->id = db->next_id++;
+      rec->cat = i % 3;
+      rec->attr = dlpRecAttrDirty;
+   }
+}
+
+static int devsim_generate(struct devsim *sim, int num)
+{
+   struct devsim_db *db;
+   pi_buffer_t *buf;
+   unsigned char ai[0xFFFF];
+   struct MemoAppInfo mai;
+   struct ToDoAppInfo tai;
+   struct AddressAppInfo aai;
+   struct AppointmentAppInfo dai;
+   struct Memo memo;
+   struct ToDo todo;
+   struct Address addr;
+   struct Appointment appt;
+   char text[256], name[64], note[64];
+   time_t now;
+   int i, n, size;
+
+   buf = pi_buffer_new(256);
+   now = time(NULL);
+
+   db = devsim_sample_db(sim, "MemoDB", "memo", "DATA");
+   if (!db) {
+      return EXIT_FAILURE;
+   }
+   memset(&mai, 0, sizeof(mai));
+   devsim_sample_cai(&mai.category);
+   size = pack_MemoAppInfo(&mai, ai, sizeof(ai));
+   devsim_set_block(&db->app_info, &db->app_size, ai, size);
+   for (i=0; i<num; i++) {
+      n = g_snprintf(text, sizeof(text), "Memo %d\n", i);
+      for (; n < 200; n += 10) {
+         g_strlcat(text, "0123456789", sizeof(text));
+      }
+      memo.text = text;
+      pi_buffer_clear(buf);
+      pack_Memo(&memo, buf, memo_v1);
+      devsim_sample_record(db, buf, i);
+   }
+
+   db = devsim_sample_db(sim, "ToDoDB", "todo", "DATA");
+   if (!db) {
+      return EXIT_FAILURE;
+   }
+   memset(&tai, 0, sizeof(tai));
+   devsim_sample_cai(&tai.category);
+   size = pack_ToDoAppInfo(&tai, ai, sizeof(ai));
+   devsim_set_block(&db->app_info, &db->app_size, ai, size);
+   for (i=0; i<num; i++) {
+      memset(&todo, 0, sizeof(todo));
+      g_snprintf(name, sizeof(name), "Todo %d", i);
+      g_snprintf(note, sizeof(note), "Note for todo %d", i);
+      todo.indefinite = (i % 2);
+      todo.due = *localtime(&now);
+      todo.due.tm_mday = 1 + (i % 28);
+      todo.priority = 1 + (i % 5);
+      todo.complete = (i % 7) == 0;
+      todo.description = name;
+      todo.note = note;
+      pi_buffer_clear(buf);
+      pack_ToDo(&todo, buf, todo_v1);
+      devsim_sample_record(db, buf, i);
+   }
+
+   db = devsim_sample_db(sim, "AddressDB", "addr", "DATA");
+   if (!db) {
+      return EXIT_FAILURE;
+   }
+   memset(&aai, 0, sizeof(aai));
+   devsim_sample_cai(&aai.category);
+   size = pack_AddressAppInfo(&aai, ai, sizeof(ai));
+   devsim_set_block(&db->app_info, &db->app_size, ai, size);
+   for (i=0; i<num; i++) {
+      memset(&addr, 0, sizeof(addr));
+      g_snprintf(name, sizeof(name), "Last%d", i);
+      g_snprintf(note, sizeof(note), "555-%04d", i % 10000);
+      addr.entry[entryLastname] = name;
+      addr.entry[entryFirstname] = "First";
+      addr.entry[entryCompany] = "Company";
+      addr.entry[entryPhone1] = note;
+      addr.phoneLabel[0] = 0;
+      addr.phoneLabel[1] = 1;
+      addr.phoneLabel[2] = 2;
+      addr.phoneLabel[3] = 3;
+      addr.phoneLabel[4] = 4;
+      pi_buffer_clear(buf);
+      pack_Address(&addr, buf, address_v1);
+      devsim_sample_record(db, buf, i);
+   }
+
+   db = devsim_sample_db(sim, "DatebookDB", "date", "DATA");
+   if (!db) {
+      return EXIT_FAILURE;
+   }
+   memset(&dai, 0, sizeof(dai));
+   devsim_sample_cai(&dai.category);
+   size = pack_AppointmentAppInfo(&dai, ai, sizeof(ai));
+   devsim_set_block(&db->app_info, &db->app_size, ai, size);
+   for (i=0; i<num; i++) {
+      memset(&appt, 0, sizeof(appt));
+      g_snprintf(name, sizeof(name), "Appointment %d", i);
+      appt.begin = *localtime(&now);
+      appt.begin.tm_mday = 1 + (i % 28);
+      appt.begin.tm_hour = 8 + (i % 10);
+      appt.begin.tm_min = 0;
+      appt.begin.tm_sec = 0;
+      appt.end = appt.begin;
+      appt.end.tm_hour++;
+      appt.repeatType = repeatNone;
+      appt.description = name;
+      pi_buffer_clear(buf);
+      pack_Appointment(&appt, buf, datebook_v1);
+      if (buf->used > 7) {
+         buf->data[7] = DEVSIM_GAPFILL;
+      }
+      devsim_sample_record(db, buf, i);
+   }
+
+   /* Records that only a backup fetches */
+   db = devsim_sample_db(sim, DEVSIM_BENCH_DB, "jpBn", "DATA");
+   if (!db) {
+      return EXIT_FAILURE;
+   }
+   for (i=0; i<num; i++) {
+      n = g_snprintf(text, sizeof(text), "Record %d ", i);
+      memset(text+n, 'x', 100);
+      pi_buffer_clear(buf);
+      pi_buffer_append(buf, text, n+100);
+      devsim_sample_record(db, buf, i);
+   }
+
+   pi_buffer_free(buf);
+
+   return devsim_save_dir(sim);
+}
+
+/* Make every hundred / percent'th record look edited on the handheld */
+static int devsim_modify(struct devsim *sim, int percent)
+{
+   struct devsim_db *db;
+   int i, j, step;
+
+   if (percent <= 0) {
+      return EXIT_SUCCESS;
+   }
+   step = (percent >= 100) ? 1 : (100 / percent);
+   for (i=0; i<sim->num_dbs; i++) {
+      db = sim->dbs[i];
+      if (db->info.flags & dlpDBFlagResource) {
+         continue;
+      }
+      for (j=0; j<db->num_recs; j+=step) {
+         db->recs[j].attr |= dlpRecAttrDirty;
+      }
+      devsim_db_touch(db);
+   }
+   return devsim_save_dir(sim);
+}
+
+/* Print the number of records and the name of each database */
+static int devsim_list(struct devsim *sim)
+{
+   int i;
+
+   for (i=0; i<sim->num_dbs; i++) {
+      printf("%d %s\n", sim->dbs[i]->num_recs, sim->dbs[i]->info.name);
+   }
+   return EXIT_SUCCESS;
+}
+
+/*
+ * Append to the .pc3 file of the DatebookDB.pdb file_name an edit of its
+ * first appointment, as J-Pilot writes it when the appointment is edited
+ * on the desktop.  The record is packed again, so the edit has its
+ * gapfill byte zeroed while the handheld's copy does not.
+ */
+static int devsim_edit(const char *file_name)
+{
+   struct devsim_db *db;
+   struct devsim_record *rec;
+   struct Appointment appt;
+   pi_buffer_t *buf;
+   unsigned char header[DEVSIM_PC3_HEADER_LEN];
+   char pc3_name[FILENAME_MAX];
+   char *description;
+   size_t len;
+   FILE *out;
+   int r;
+
+   db = devsim_load_db(file_name);
+   if (!db) {
+      return EXIT_FAILURE;
+   }
+   if (strcmp(db->info.name, "DatebookDB") || (db->num_recs == 0)) {
+      fprintf(stderr, "%s: only appointments of a DatebookDB can be edited\n",
+              file_name);
+      devsim_db_free(db);
+      return EXIT_FAILURE;
+   }
+   rec = &db->recs[0];
+
+   buf = pi_buffer_new(rec->size);
+   pi_buffer_append(buf, rec->data, rec->size);
+   memset(&appt, 0, sizeof(appt));
+   if (unpack_Appointment(&appt, buf, datebook_v1) < 0) {
+      fprintf(stderr, "%s: unable to unpack the first appointment\n", file_name);
+      pi_buffer_free(buf);
+      devsim_db_free(db);
+      return EXIT_FAILURE;
+   }
+   len = (appt.description ? strlen(appt.description) : 0) + 16;
+   description = malloc(len);
+   if (!description) {
+      free_Appointment(&appt);
+      pi_buffer_free(buf);
+      devsim_db_free(db);
+      return EXIT_FAILURE;
+   }
+   g_snprintf(description, len, "%s (edited)",
+              appt.description ? appt.description : "");
+   free(appt.description);
+   appt.description = description;
+   pi_buffer_clear(buf);
+   r = pack_Appointment(&appt, buf, datebook_v1);
+   free_Appointment(&appt);
+
+   len = strlen(file_name);
+   if ((len > 4) && !strcmp(file_name+len-4, ".pdb")) {
+      len -= 4;
+   }
+   g_snprintf(pc3_name, sizeof(pc3_name), "%.*s.pc3", (int)len, file_name);
+
+   set_long(header, DEVSIM_PC3_HEADER_LEN);
+   set_long(header+4, DEVSIM_PC3_VERSION);
+   set_long(header+8, buf->used);
+   set_long(header+12, rec->id);
+   set_long(header+16, DEVSIM_PC3_REPLACEMENT);
+   set_byte(header+20, (rec->attr & dlpRecAttrSecret) | (rec->cat & 0x0F));
+
+   out = (r < 0) ? NULL : fopen(pc3_name, "a");
+   if (!out ||
+       (fwrite(header, sizeof(header), 1, out) != 1) ||
+       (fwrite(buf->data, buf->used, 1, out) != 1)) {
+      fprintf(stderr, "Unable to write file: %s\n", pc3_name);
+      r = -1;
+   }
+   if (out && fclose(out)) {
+      r = -1;
+   }
+   pi_buffer_free(buf);
+   devsim_db_free(db);
+
+   return (r < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void fprint_devsim_usage_string(FILE *out)
+{
+   fprintf(out, "%s-devsim [ -h || [-v] [-s] [-p port] [-t seconds] [-k writes] dir || -g records dir || -m percent dir || -l dir || -e file ]\n", EPN);
+   fprintf(out, " Simulates a handheld holding the databases in dir and syncs it.\n");
+   fprintf(out, " -p {port} NetSync port to connect to, default %s\n", DEVSIM_DEFAULT_PORT);
+   fprintf(out, " -t {seconds} keep trying to connect for this long, default 30\n");
+   fprintf(out, " -s print the number and time of each kind of request\n");
+   fprintf(out, " -v print every request and sync log entry\n");
+   fprintf(out, " -k {writes} drop the connection after this many record writes\n");
+   fprintf(out, " -g {records} write sample databases with this many records to dir\n");
+   fprintf(out, " -m {percent} mark this percentage of the records in dir as changed\n");
+   fprintf(out, " -l list the number of records of each database in dir\n");
+   fprintf(out, " -e {file} edit the first appointment of DatebookDB.pdb file as J-Pilot\n");
+   fprintf(out, "    would, appending the edit to its .pc3 file\n");
+}
+
+int main(int argc, char *argv[])
+{
+   struct devsim sim;
+   const char *port;
+   int timeout, print_stats;
+   int generate, modify, list;
+   int i, r;
+
+   memset(&sim, 0, sizeof(sim));
+   port = DEVSIM_DEFAULT_PORT;
+   timeout = 30;
+   print_stats = 0;
+   generate = -1;
+   modify = -1;
+   list = 0;
+
+   for (i=1; i<argc; i++) {
+      if (!strcmp(argv[i], "-h")) {
+         fprint_devsim_usage_string(stdout);
+         return EXIT_SUCCESS;
+      } else if (!strcmp(argv[i], "-v")) {
+         sim.verbose = 1;
+      } else if (!strcmp(argv[i], "-s")) {
+         print_stats = 1;
+      } else if (!strcmp(argv[i], "-p") && (i+1 < argc)) {
+         port = argv[++i];
+      } else if (!strcmp(argv[i], "-t") && (i+1 < argc)) {
+         timeout = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "-g") && (i+1 < argc)) {
+         generate = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "-m") && (i+1 < argc)) {
+         modify = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "-k") && (i+1 < argc)) {
+         sim.drop_after = atol(argv[++i]);
+      } else if (!strcmp(argv[i], "-l")) {
+         list = 1;
+      } else if (!strcmp(argv[i], "-e") && (i+1 < argc)) {
+         return devsim_edit(argv[++i]);
+      } else if ((argv[i][0] != '-') && !sim.dir[0]) {
+         g_strlcpy(sim.dir, argv[i], sizeof(sim.dir));
+      } else {
+         fprint_devsim_usage_string(stderr);
+         return EXIT_FAILURE;
+      }
+   }
+   if (!sim.dir[0]) {
+      fprint_devsim_usage_string(stderr);
+      return EXIT_FAILURE;
+   }
+
+   if (generate >= 0) {
+      mkdir(sim.dir, 0700);
+      return devsim_generate(&sim, generate);
+   }
+
+   if (devsim_load_dir(&sim)) {
+      return EXIT_FAILURE;
+   }
+   if (modify >= 0) {
+      r = devsim_modify(&sim, modify);
+   } else if (list) {
+      r = devsim_list(&sim);
+   } else {
+      devsim_read_state(&sim);
+      r = devsim_serve(&sim, port, timeout, print_stats);
+   }
+
+   for (i=0; i<sim.num_dbs; i++) {
+      devsim_db_free(sim.dbs[i]);
+   }
+   free(sim.dbs);
+
+   return r;
+}
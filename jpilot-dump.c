@@ -45,6 +45,7 @@
 #include "otherconv.h"
 #include "prefs.h"
 #include "sync.h"
+#include "query.h"
 
 /********************************* Constants **********************************/
 /* RFCs use CRLF for Internet newline */
@@ -52,6 +53,9 @@
 
 #define LIMIT(a,b,c) if (a < b) {a=b;} if (a > c) {a=c;}
 
+/* Output buffer for the dumps, which are written a few bytes at a time */
+#define DUMP_BUFFER_SIZE 0x40000
+
 /* Uncomment for more debug output */
 /* #define JDUMP_DEBUG 1 */
 
@@ -68,26 +72,12 @@ int  dumpC;
 int  dumpC_type;
 int  dumpM;
 int  dumpT;
+int  dumpJ;
 const char *formatD;
 const char *formatM;
 const char *formatA;
 const char *formatT;
 
-/* Start Hack */
-/* FIXME: The following is a hack.
- * The variables below are global variables in jpilot.c which are unused in
- * this code but must be instantiated for the code to compile.  
- * The same is true of the functions which are only used in GUI mode. */
-pid_t jpilot_master_pid = -1;
-int pipe_to_parent;
-GtkWidget *glob_dialog;
-GtkWidget *glob_date_label;
-gint glob_date_timer_tag;
-
-void output_to_pane(const char *str) { return; }
-int sync_once(struct my_sync_info *sync_info) { return EXIT_SUCCESS; }
-/* End Hack */
-
 /* Structs needed for ContactsDB export */
 
 static address_schema_entry contact_schema[NUM_CONTACT_FIELDS]={
@@ -184,7 +174,7 @@ static char *vCardMapType(int label)
 /****************************** Main Code *************************************/
 static void fprint_jpd_usage_string(FILE *out)
 {
-   fprintf(out, "%s-dump [ +format [-v] || [-h] || [-f] || [-D] || [-i] || [-A] || [-C] || [-T] || [-M] || [-N] ]\n", EPN);
+   fprintf(out, "%s-dump [ +format [-v] || [-h] || [-f] || [-D] || [-i] || [-A] || [-C] || [-T] || [-M] || [-N] || [--json [query options]] ]\n", EPN);
    fprintf(out, _(" +D +A +T +M format like date +format.\n"));
    fprintf(out, _(" -v displays version and exits.\n"));
    fprintf(out, _(" -h displays help and exits.\n"));
@@ -201,6 +191,9 @@ static void fprint_jpd_usage_string(FILE *out)
    fprintf(out, _("    -Cl dumps as ldif.\n"));
    fprintf(out, _(" -T dump ToDo list as CSV.\n"));
    fprintf(out, _(" -M dump Memos.\n"));
+   fprintf(out, _(" --json dump the records of -D, -A, -T and -M (all without them)\n"
+                  "    as one JSON object per line.  The records can be selected with:\n"));
+   query_fprint_usage(out);
 }
 
 /* convert from UTF8 to local encoding */
@@ -1698,7 +1691,10 @@ static int dumpmemo(void)
 
 int main(int argc, char *argv[])
 {
-   int i;
+   int i, r;
+   int query_opts;
+   struct query_filter qf;
+   char N_date[16];
    time_t ltime;
    struct tm *now;
 
@@ -1716,6 +1712,9 @@ int main(int argc, char *argv[])
    dumpA  = FALSE;
    dumpM  = FALSE;
    dumpT  = FALSE;
+   dumpJ  = FALSE;
+   query_filter_init(&qf);
+   query_opts = FALSE;
 
    /* enable internationalization(i18n) before printing any output */
 #if defined(ENABLE_NLS)
@@ -1726,6 +1725,8 @@ int main(int argc, char *argv[])
    textdomain(EPN);
 #endif
 
+   setvbuf(stdout, NULL, _IOFBF, DUMP_BUFFER_SIZE);
+
    /* If called with no arguments then print usage information */
    if (argc == 1)
    {
@@ -1735,6 +1736,25 @@ int main(int argc, char *argv[])
 
    /* process command line options */
    for (i=1; i<argc; i++) {
+      if (!strcmp(argv[i], "--json")) {
+         dumpJ = TRUE;
+         continue;
+      }
+      r = query_parse_option(&qf, argc, argv, &i);
+      if (r < 0) {
+         fprint_jpd_usage_string(stderr);
+         exit(1);
+      }
+      if (r > 0) {
+         query_opts = TRUE;
+         continue;
+      }
+      /* A misspelled query option would dump every record */
+      if (!strncmp(argv[i], "--", 2)) {
+         fprintf(stderr, _("Unknown option: %s\n"), argv[i]);
+         fprint_jpd_usage_string(stderr);
+         exit(1);
+      }
       if (!strncasecmp(argv[i], "+D", 2)) {
          formatD=argv[i];
       }
@@ -1876,6 +1896,12 @@ int main(int argc, char *argv[])
       }  /* end printing format usage */
    }  /* end for over argc */
 
+   if (query_opts && !dumpJ) {
+      fprintf(stderr, _("The query options need --json\n"));
+      fprint_jpd_usage_string(stderr);
+      exit(1);
+   }
+
    pref_init();
    pref_read_rc_file();
 
@@ -1884,6 +1910,28 @@ int main(int argc, char *argv[])
       return EXIT_FAILURE;
    }
 
+   if (dumpJ) {
+      /* The database switches override --db */
+      if (dumpD || dumpI || dumpA || dumpC || dumpT || dumpM) {
+         qf.dbs = 0;
+         if (dumpD || dumpI) qf.dbs |= QUERY_DB_DATEBOOK;
+         if (dumpA || dumpC) qf.dbs |= QUERY_DB_ADDRESS;
+         if (dumpT) qf.dbs |= QUERY_DB_TODO;
+         if (dumpM) qf.dbs |= QUERY_DB_MEMO;
+      }
+      /* -N selects its day like --from and --to */
+      if (dumpN && !qf.have_from && !qf.have_to) {
+         g_snprintf(N_date, sizeof(N_date), "%04d/%02d/%02d", Nyear, Nmonth, Nday);
+         if (!query_parse_date(N_date, &(qf.from))) {
+            memcpy(&(qf.to), &(qf.from), sizeof(struct tm));
+            qf.have_from = qf.have_to = TRUE;
+         }
+      }
+      r = query_run(&qf, stdout);
+      otherconv_free();
+      return (r < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+
    /* dump selected database */
    if (dumpD) {
       dumpbook();
@@ -51,6 +51,10 @@
 #include "libplugin.h"
 #include "sync.h"
 
+/********************************* Constants **********************************/
+/* Maximum number of merges run at once with -j */
+#define MAX_MERGE_PROCS 64
+
 /******************************* Global vars **********************************/
 /* Start Hack */
 /* FIXME: The following is a hack.
@@ -71,6 +75,18 @@ int edit_cats(GtkWidget *widget, char *db_name, struct CategoryAppInfo *cai)
 }
 /* End Hack */
 
+/* One input pdb, pc3 and output pdb triple to merge */
+struct merge_job
+{
+   char *pdb_file;
+   char *pc_file;
+   char *out_file;
+   pid_t pid;
+};
+
+static struct merge_job *jobs;
+static int num_jobs, max_jobs;
+
 /****************************** Main Code *************************************/
 
 static int read_pc_recs(char *file_name, GList **records)
@@ -87,6 +103,7 @@ static int read_pc_recs(char *file_name, GList **records)
       return -1;
    }
 
+   recs_returned = 0;
    while(!feof(pc_in)) {
       temp_br = malloc(sizeof(buf_rec));
       if (!temp_br) {
@@ -106,7 +123,38 @@ static int read_pc_recs(char *file_name, GList **records)
    }
    fclose(pc_in);
 
-   return 0;
+   return recs_returned;
+}
+
+/* Index the pc records which delete, hide or replace a pdb record by
+ * unique_id.  Each list keeps the order of pc_records. */
+static GHashTable *index_pc_recs(GList *pc_records)
+{
+   GHashTable *index;
+   GList *Ppc_record;
+   GList *uid_list;
+   buf_rec *temp_br_pc;
+
+   index = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+   for (Ppc_record=g_list_last(pc_records); Ppc_record; Ppc_record=Ppc_record->prev) {
+      temp_br_pc = (buf_rec *)Ppc_record->data;
+      if ((temp_br_pc->rt!=DELETED_PALM_REC) &&
+          (temp_br_pc->rt!=MODIFIED_PALM_REC) &&
+          (temp_br_pc->rt!=REPLACEMENT_PALM_REC)) {
+         continue;
+      }
+      uid_list = g_hash_table_lookup(index, GUINT_TO_POINTER(temp_br_pc->unique_id));
+      uid_list = g_list_prepend(uid_list, temp_br_pc);
+      g_hash_table_insert(index, GUINT_TO_POINTER(temp_br_pc->unique_id), uid_list);
+   }
+
+   return index;
+}
+
+static void free_index_list(gpointer key, gpointer value, gpointer user_data)
+{
+   g_list_free((GList *)value);
 }
 
 static int merge_pdb_file(char *src_pdb_file, 
@@ -123,13 +171,12 @@ static int merge_pdb_file(char *src_pdb_file,
    size_t size;
    int attr;
    int cat;
+   unsigned char attrib;
    pi_uid_t uid;
-   buf_rec *temp_br_pdb;
    buf_rec *temp_br_pc;
-   GList *Ppdb_record = NULL;
    GList *Ppc_record = NULL;
-   GList *pdb_records = NULL;
    GList *pc_records = NULL;
+   GHashTable *pc_index;
    int dont_add;
    unsigned int next_available_unique_id;
    // Statistics
@@ -153,19 +200,23 @@ static int merge_pdb_file(char *src_pdb_file,
    r = read_pc_recs(src_pc_file, &pc_records);
    if (r < 0) {
       fprintf(stderr, "read_pc_recs returned %d\n", r);
-      exit(1);
+      jp_free_DB_records(&pc_records);
+      return 1;
    }
 
    pf1 = pi_file_open(src_pdb_file);
    if (!pf1) {
       fprintf(stderr, _("%s: Unable to open file:%s\n"), "pi_file_open", src_pdb_file);
-      exit(1);
+      jp_free_DB_records(&pc_records);
+      return 1;
    }
    pi_file_get_info(pf1, &infop);
    pf2 = pi_file_create(dest_pdb_file, &infop);
    if (!pf2) {
       fprintf(stderr, _("%s: Unable to open file:%s\n"), "pi_file_open", dest_pdb_file);
-      exit(1);
+      pi_file_close(pf1);
+      jp_free_DB_records(&pc_records);
+      return 1;
    }
 
    pi_file_get_app_info(pf1, &app_info, &size);
@@ -174,6 +225,10 @@ static int merge_pdb_file(char *src_pdb_file,
    pi_file_get_sort_info(pf1, &sort_info, &size);  
    pi_file_set_sort_info(pf2, sort_info, size);
 
+   pc_index = index_pc_recs(pc_records);
+
+   /* Each pdb record, or its replacements, is written as it is read */
+   next_available_unique_id = 0;
    for(idx=0;;idx++) {
       r = pi_file_read_record(pf1, idx, &record, &size, &attr, &cat, &uid);
       //printf("attr=%d, cat=%d\n", attr, cat);
@@ -181,103 +236,248 @@ static int merge_pdb_file(char *src_pdb_file,
 
       pdb_count++;
 
-      temp_br_pdb = malloc(sizeof(buf_rec));
-      temp_br_pdb->rt = PALM_REC;
-      temp_br_pdb->unique_id = uid;
-      temp_br_pdb->attrib = attr | cat;
-      //temp_br_pdb->buf = record;
-      temp_br_pdb->buf = malloc(size);
-      memcpy(temp_br_pdb->buf, record, size);
-      temp_br_pdb->size = size;
+      // Find the next available unique ID
+      if (uid >= next_available_unique_id) {
+         next_available_unique_id = uid + 1;
+      }
 
       dont_add=0;
 
-      // Look through the pc record list
-      for (Ppc_record=pc_records; Ppc_record; Ppc_record=Ppc_record->next) {
+      // Look through the pc records with this unique ID
+      for (Ppc_record=g_hash_table_lookup(pc_index, GUINT_TO_POINTER(uid));
+           Ppc_record; Ppc_record=Ppc_record->next) {
          temp_br_pc = (buf_rec *)Ppc_record->data;
-         if ((temp_br_pc->rt==DELETED_PC_REC) || 
-             (temp_br_pc->rt==DELETED_DELETED_PALM_REC)) {
-            continue;
-         }
          if ((temp_br_pc->rt==DELETED_PALM_REC) || 
              (temp_br_pc->rt==MODIFIED_PALM_REC)) {
-            if (temp_br_pdb->unique_id == temp_br_pc->unique_id) {
-               // Don't add it to the pdb list
-               dont_add=1;
-               if (temp_br_pc->rt==DELETED_PALM_REC) {
-                  recs_deleted++;
-               }
-               break;
+            // Don't add it to the pdb
+            dont_add=1;
+            if (temp_br_pc->rt==DELETED_PALM_REC) {
+               recs_deleted++;
             }
+            break;
          }
 
-         if ((temp_br_pc->rt==REPLACEMENT_PALM_REC)) {
-            if (temp_br_pdb->unique_id == temp_br_pc->unique_id) {
-               // Replace the record data in the pdb record with replacement record data
-               //printf("REPLACEMENT\n");
-               dont_add=1;
-               pdb_records = g_list_prepend(pdb_records, temp_br_pc);
-               recs_modified++;
-               //break;
-            }
-         }
+         // Write the replacement record data instead of the pdb record
+         dont_add=1;
+         pi_file_append_record(pf2, temp_br_pc->buf, temp_br_pc->size,
+                               (temp_br_pc->attrib)&0xF0, (temp_br_pc->attrib)&0x0F,
+                               temp_br_pc->unique_id);
+         recs_modified++;
+         recs_written++;
       }
 
       if (! dont_add) {
-         pdb_records = g_list_prepend(pdb_records, temp_br_pdb);
+         attrib = attr | cat;
+         pi_file_append_record(pf2, record, size, attrib&0xF0, attrib&0x0F, uid);
+         recs_written++;
       }
    }
 
-
-   // Find the next available unique ID
-   next_available_unique_id = 0;
-   for (Ppdb_record=pdb_records; Ppdb_record; Ppdb_record=Ppdb_record->next) {
-      temp_br_pdb = (buf_rec *)Ppdb_record->data;
-      if (temp_br_pdb->unique_id > next_available_unique_id) {
-         next_available_unique_id = temp_br_pdb->unique_id + 1;
-      }
-   }
-
-   // Add the NEW records to the list
+   // Add the NEW records
    for (Ppc_record=pc_records; Ppc_record; Ppc_record=Ppc_record->next) {
       temp_br_pc = (buf_rec *)Ppc_record->data;
       if ((temp_br_pc->rt==NEW_PC_REC)) {
          temp_br_pc->unique_id = next_available_unique_id++;
-         pdb_records = g_list_prepend(pdb_records, temp_br_pc);
+         pi_file_append_record(pf2, temp_br_pc->buf, temp_br_pc->size,
+                               (temp_br_pc->attrib)&0xF0, (temp_br_pc->attrib)&0x0F,
+                               temp_br_pc->unique_id);
          recs_added++;
-         continue;
+         recs_written++;
       }
    }
 
+   pi_file_close(pf1);
+   r = pi_file_close(pf2);
 
-   pdb_records = g_list_reverse(pdb_records);
+   g_hash_table_foreach(pc_index, free_index_list, NULL);
+   g_hash_table_destroy(pc_index);
+   jp_free_DB_records(&pc_records);
 
-   for (Ppdb_record=pdb_records; Ppdb_record; Ppdb_record=Ppdb_record->next) {
-      temp_br_pdb = (buf_rec *)Ppdb_record->data;
-      //printf("rt=%d\n", temp_br_pdb->rt);
-      //printf("unique_id=%d\n", temp_br_pdb->unique_id);
-      //printf("attrib=%d\n", temp_br_pdb->attrib);
-      //printf("buf=%ld\n", temp_br_pdb->buf);
-      //printf("size=%d\n", temp_br_pdb->size);
-      pi_file_append_record(pf2, temp_br_pdb->buf, temp_br_pdb->size, (temp_br_pdb->attrib)&0xF0, (temp_br_pdb->attrib)&0x0F, temp_br_pdb->unique_id);
-      recs_written++;
+   if (r < 0) {
+      fprintf(stderr, _("Unable to write file: %s\n"), dest_pdb_file);
+      return 1;
    }
 
-   pi_file_close(pf1);
-   pi_file_close(pf2);
-
-   printf(_("Records read from pdb = %d\n"), pdb_count);
-   printf(_("Records added         = %d\n"), recs_added);
-   printf(_("Records deleted       = %d\n"), recs_deleted);
-   printf(_("Records modified      = %d\n"), recs_modified);
-   printf(_("Records written       = %d\n"), recs_written);
+   /* In one write, so that the output of parallel merges is not mixed */
+   printf(_("%s:\n"
+            "Records read from pdb = %d\n"
+            "Records added         = %d\n"
+            "Records deleted       = %d\n"
+            "Records modified      = %d\n"
+            "Records written       = %d\n"),
+          dest_pdb_file, pdb_count, recs_added, recs_deleted,
+          recs_modified, recs_written);
+   fflush(stdout);
 
    return 0;
 }
 
+static int add_job(const char *pdb_file, const char *pc_file, const char *out_file)
+{
+   struct merge_job *new_jobs;
+
+   if (num_jobs >= max_jobs) {
+      new_jobs = realloc(jobs, (max_jobs + 32) * sizeof(struct merge_job));
+      if (!new_jobs) {
+         fprintf(stderr, "%s\n", _("Out of memory"));
+         return EXIT_FAILURE;
+      }
+      jobs = new_jobs;
+      max_jobs += 32;
+   }
+   jobs[num_jobs].pdb_file = strdup(pdb_file);
+   jobs[num_jobs].pc_file = strdup(pc_file);
+   jobs[num_jobs].out_file = strdup(out_file);
+   jobs[num_jobs].pid = -1;
+   num_jobs++;
+
+   return EXIT_SUCCESS;
+}
+
+/* Read a list of merges, one "pdb pc3 output" triple per line */
+static int read_job_file(const char *file_name)
+{
+   FILE *in;
+   char line[3*FILENAME_MAX];
+   char *files[3];
+   char *save;
+   int n, line_num;
+
+   if (!strcmp(file_name, "-")) {
+      in = stdin;
+   } else {
+      in = fopen(file_name, "r");
+      if (!in) {
+         fprintf(stderr, _("Unable to open file: %s\n"), file_name);
+         return EXIT_FAILURE;
+      }
+   }
+
+   for (line_num=1; fgets(line, sizeof(line), in); line_num++) {
+      files[0] = strtok_r(line, " \t\r\n", &save);
+      if ((!files[0]) || (files[0][0]=='#')) {
+         continue;
+      }
+      for (n=1; n<3; n++) {
+         files[n] = strtok_r(NULL, " \t\r\n", &save);
+         if (!files[n]) {
+            break;
+         }
+      }
+      if ((n < 3) || strtok_r(NULL, " \t\r\n", &save)) {
+         fprintf(stderr, _("%s:%d: expected input pdb, input pc3 and output pdb\n"),
+                 file_name, line_num);
+         if (in != stdin) fclose(in);
+         return EXIT_FAILURE;
+      }
+      if (add_job(files[0], files[1], files[2])) {
+         if (in != stdin) fclose(in);
+         return EXIT_FAILURE;
+      }
+   }
+   if (in != stdin) {
+      fclose(in);
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/* Run the merges, up to max_procs of them at once in child processes.
+ * Returns the number of merges that failed. */
+static int run_jobs(int max_procs)
+{
+   pid_t pid;
+   int status;
+   int next, running, failed;
+   int i;
+
+   failed = 0;
+   if (max_procs <= 1) {
+      for (i=0; i<num_jobs; i++) {
+         if (merge_pdb_file(jobs[i].pdb_file, jobs[i].pc_file, jobs[i].out_file)) {
+            failed++;
+         }
+      }
+      return failed;
+   }
+
+   next = 0;
+   running = 0;
+   while ((next < num_jobs) || (running > 0)) {
+      if ((next < num_jobs) && (running < max_procs)) {
+         fflush(NULL);
+         pid = fork();
+         if (pid < 0) {
+            perror("fork");
+            if (running == 0) {
+               /* Nothing to wait for, run it here */
+               if (merge_pdb_file(jobs[next].pdb_file, jobs[next].pc_file,
+                                  jobs[next].out_file)) {
+                  failed++;
+               }
+               next++;
+               continue;
+            }
+         } else if (pid == 0) {
+            exit(merge_pdb_file(jobs[next].pdb_file, jobs[next].pc_file,
+                                jobs[next].out_file) ? EXIT_FAILURE : EXIT_SUCCESS);
+         } else {
+            jobs[next].pid = pid;
+            next++;
+            running++;
+            continue;
+         }
+      }
+
+      pid = waitpid(-1, &status, 0);
+      if (pid < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         break;
+      }
+      for (i=0; i<next; i++) {
+         if (jobs[i].pid == pid) {
+            break;
+         }
+      }
+      if (i == next) {
+         continue;
+      }
+      jobs[i].pid = -1;
+      running--;
+      if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+         fprintf(stderr, _("Merge into %s failed\n"), jobs[i].out_file);
+         failed++;
+      }
+   }
+
+   return failed;
+}
+
+static void fprint_usage_string(FILE *out, const char *prog)
+{
+   fprintf(out, _("Usage: %s [-j JOBS] [-f LIST] [{input pdb file} {input pc3 file} {output pdb file} ...]\n"), prog);
+   fprintf(out, _("  This program will merge an unsynced records file (pc3)\n"));
+   fprintf(out, _("  into the corresponding palm database (pdb) file.\n"));
+   fprintf(out, _("  Any number of databases can be merged, given as triples on the\n"));
+   fprintf(out, _("  command line or one triple per line in the file LIST (- for stdin).\n"));
+   fprintf(out, _("  -j JOBS merges up to JOBS databases at once.\n\n"));
+   fprintf(out, _("  WARNING: Only run this utility if you understand the consequences!\n"));
+   fprintf(out, _("  The merge will leave your databases in an unsync-able state.\n"));
+   fprintf(out, _("  It is intended for cases where J-pilot is being used as a standalone PIM\n"));
+   fprintf(out, _("  and where no syncing occurs to physical hardware.\n"));
+   fprintf(out, _("  WARNING: Make a backup copy of your databases before proceeding.\n"));
+   fprintf(out, _("  It is quite simple to destroy your databases by accidentally merging\n"));
+   fprintf(out, _("  address records into datebook databases, etc.\n"));
+}
 
 int main(int argc, char *argv[])
 {
+   int i;
+   int max_procs;
+   int failed;
+
    /* enable internationalization(i18n) before printing any output */
 #if defined(ENABLE_NLS)
 #  ifdef HAVE_LOCALE_H
@@ -287,28 +487,38 @@ int main(int argc, char *argv[])
    textdomain(EPN);
 #endif
 
-   if (argc != 4) {
-      fprintf(stderr, _("Usage: %s {input pdb file} {input pc3 file} {output pdb file}\n"), argv[0]);
-      fprintf(stderr, _("  This program will merge an unsynced records file (pc3)\n"));
-      fprintf(stderr, _("  into the corresponding palm database (pdb) file.\n\n"));
-      fprintf(stderr, _("  WARNING: Only run this utility if you understand the consequences!\n"));
-      fprintf(stderr, _("  The merge will leave your databases in an unsync-able state.\n"));
-      fprintf(stderr, _("  It is intended for cases where J-pilot is being used as a standalone PIM\n"));
-      fprintf(stderr, _("  and where no syncing occurs to physical hardware.\n"));
-      fprintf(stderr, _("  WARNING: Make a backup copy of your databases before proceeding.\n"));
-      fprintf(stderr, _("  It is quite simple to destroy your databases by accidentally merging\n"));
-      fprintf(stderr, _("  address records into datebook databases, etc.\n"));
-      
+   max_procs = 1;
+   for (i=1; i<argc; i++) {
+      if (!strcmp(argv[i], "-j") && (i+1 < argc)) {
+         max_procs = atoi(argv[++i]);
+         if ((max_procs < 1) || (max_procs > MAX_MERGE_PROCS)) {
+            fprintf(stderr, _("JOBS must be from 1 to %d\n"), MAX_MERGE_PROCS);
+            exit(EXIT_FAILURE);
+         }
+      } else if (!strcmp(argv[i], "-f") && (i+1 < argc)) {
+         if (read_job_file(argv[++i])) {
+            exit(EXIT_FAILURE);
+         }
+      } else if ((argv[i][0] == '-') && (argv[i][1] != '\0')) {
+         fprint_usage_string(stderr, argv[0]);
+         exit(EXIT_FAILURE);
+      } else if (i+2 < argc) {
+         if (add_job(argv[i], argv[i+1], argv[i+2])) {
+            exit(EXIT_FAILURE);
+         }
+         i += 2;
+      } else {
+         fprint_usage_string(stderr, argv[0]);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (num_jobs == 0) {
+      fprint_usage_string(stderr, argv[0]);
       exit(EXIT_FAILURE);
    }
-   char *in_pdb;
-   char *in_pc;
-   char *out_pdb;
-   in_pdb  = argv[1];
-   in_pc   = argv[2];
-   out_pdb = argv[3];
-   
-   merge_pdb_file(in_pdb, in_pc, out_pdb);
+
+   failed = run_jobs(max_procs);
    
-   return EXIT_SUCCESS;
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
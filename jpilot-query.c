@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * jpilot-query.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_LOCALE_H
+#  include <locale.h>
+#endif
+
+/* Jpilot header files */
+#include "utils.h"
+#include "i18n.h"
+#include "otherconv.h"
+#include "prefs.h"
+#include "query.h"
+
+/****************************** Main Code *************************************/
+static void fprint_jpq_usage_string(FILE *out)
+{
+   fprintf(out, "%s-query [ -v || -h || [options] ]\n", EPN);
+   fprintf(out, _(" Writes matching records as one JSON object per line.\n"));
+   fprintf(out, _(" -v displays version and exits.\n"));
+   fprintf(out, _(" -h displays help and exits.\n"));
+   query_fprint_usage(out);
+}
+
+int main(int argc, char *argv[])
+{
+   struct query_filter qf;
+   int i, r;
+
+   /* enable internationalization(i18n) before printing any output */
+#if defined(ENABLE_NLS)
+#  ifdef HAVE_LOCALE_H
+   setlocale(LC_ALL, "");
+#  endif
+   bindtextdomain(EPN, LOCALEDIR);
+   textdomain(EPN);
+#endif
+
+   query_filter_init(&qf);
+
+   /* process command line options */
+   for (i=1; i<argc; i++) {
+      if (!strcmp(argv[i], "-v")) {
+         printf("%s-query %s\n", EPN, VERSION);
+         exit(0);
+      }
+      if (!strcmp(argv[i], "-h")) {
+         fprint_jpq_usage_string(stdout);
+         exit(0);
+      }
+      r = query_parse_option(&qf, argc, argv, &i);
+      if (r == 0) {
+         fprintf(stderr, _("Unknown option: %s\n"), argv[i]);
+      }
+      if (r <= 0) {
+         fprint_jpq_usage_string(stderr);
+         exit(1);
+      }
+   }
+
+   pref_init();
+   pref_read_rc_file();
+
+   if (otherconv_init()) {
+      fprintf(stderr, "Error: could not set encoding\n");
+      return EXIT_FAILURE;
+   }
+
+   r = query_run(&qf, stdout);
+
+   /* clean up */
+   otherconv_free();
+
+   return (r < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
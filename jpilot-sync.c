@@ -24,9 +24,22 @@
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef USE_FLOCK
+#  include <sys/file.h>
+#else
+#  include <fcntl.h>
+#endif
 #ifdef HAVE_LOCALE_H
 #  include <locale.h>
 #endif
+#include <pi-socket.h>
+#include <pi-dlp.h>
 
 #include "i18n.h"
 #include "utils.h"
@@ -35,12 +48,27 @@
 #include "sync.h"
 #include "plugins.h"
 #include "otherconv.h"
+#include "trace.h"
+
+/********************************* Constants **********************************/
+/* Most ports that one daemon syncs on */
+#define MAX_DAEMON_PORTS 16
 
 /******************************* Global vars **********************************/
 int pipe_to_parent, pipe_from_parent;
 pid_t glob_child_pid;
 unsigned char skip_plugins;
 
+/* Daemon mode: a worker process syncs on each port, every user in a home
+ * directory of its own under daemon_dir */
+static char daemon_dir[FILENAME_MAX];
+static int daemon_max_jobs;
+static int num_workers;
+static pid_t worker_pids[MAX_DAEMON_PORTS];
+static volatile sig_atomic_t daemon_quit;
+/* When the handheld of this worker connected, 0 if it has not */
+static double connected_time;
+
 /* Start Hack */
 /* FIXME: The following is a hack.  
  * The variables below are global variables in jpilot.c which are unused in
@@ -60,7 +88,7 @@ void cb_cancel_sync(GtkWidget *widget, unsigned int flags) { return; }
 /****************************** Main Code *************************************/
 static void fprint_jps_usage_string(FILE *out)
 {
-   fprintf(out, "%s-sync [ -v || -h || [-d] [-P] [-b] [-l] [-p port] ]\n", EPN);
+   fprintf(out, "%s-sync [ -v || -h || [-d] [-P] [-b] [-l] [-p port] [-m dir [-j num]] ]\n", EPN);
    fprintf(out, _(" J-Pilot preferences are read to get sync info such as port, rate, number of backups, etc.\n"));
    fprintf(out, _(" -v display version and compile options\n"));
    fprintf(out, _(" -h display help text\n"));
@@ -69,6 +97,74 @@ static void fprint_jps_usage_string(FILE *out)
    fprintf(out, _(" -b sync, and then do a backup\n"));
    fprintf(out, _(" -l loop, otherwise sync once and exit\n"));
    fprintf(out, _(" -p {port} use this port to sync on instead of default\n"));
+   fprintf(out, _(" -m {dir} sync on every -p port at once, each user in a directory under dir\n"));
+   fprintf(out, _(" -j {num} with -m, sync at most num handhelds at a time\n"));
+}
+
+static void print_sync_error(int r, const char *port)
+{
+   switch (r) {
+    case 0:
+      /* sync successful */
+      break;
+    case SYNC_ERROR_BIND:
+      printf("\n");
+      printf(_("Error: connecting to port %s\n"), port);
+      break;
+    case SYNC_ERROR_LISTEN:
+      printf("\n");
+      printf(_("Error: pi_listen\n"));
+      break;
+    case SYNC_ERROR_OPEN_CONDUIT:
+      printf("\n");
+      printf(_("Error: opening conduit to handheld\n"));
+      break;
+    case SYNC_ERROR_PI_ACCEPT:
+      printf("\n");
+      printf(_("Error: pi_accept\n"));
+      break;
+    case SYNC_ERROR_NOT_SAME_USER:
+      printf("\n");
+      printf(_("Error: "));
+      printf(_("This handheld does not have the same user name.\n"));
+      printf(_("as the one that was synced the last time.\n"));
+
+      printf(_("Syncing with different handhelds to the same directory can destroy data.\n"));
+#ifdef ENABLE_PROMETHEON
+      printf(_(" COPILOT_HOME"));
+#else
+      printf(_(" JPILOT_HOME"));
+#endif
+      printf(_(" environment variable can be used to sync different handhelds,\n"));
+      printf(_(" to different directories for the same UNIX user name.\n"));
+      break;
+    case SYNC_ERROR_NOT_SAME_USERID:
+      printf("\n");
+      printf(_("This handheld does not have the same user ID.\n"));
+      printf(_("as the one that was synced the last time.\n"));
+      printf(_(" Syncing with different handhelds to the same directory can destroy data.\n"));
+#ifdef ENABLE_PROMETHEON
+      printf(_(" COPILOT_HOME"));
+#else
+      printf(_(" JPILOT_HOME"));
+#endif
+      printf(_(" environment variable can be used to sync different handhelds,\n"));
+      printf(_(" to different directories for the same UNIX user name.\n"));
+      break;
+    case SYNC_ERROR_NULL_USERID:
+      printf("\n");
+      printf(_("Error: "));
+      printf(_("This handheld has a NULL user ID.\n"));
+      printf(_("Every handheld must have a unique user ID in order to sync properly.\n"));
+      printf(_("If the handheld has been hard reset, \n"));
+      printf(_("   use restore from within "EPN" to restore it.\n"));
+      printf(_("Otherwise, to add a new user name and ID\n"));
+      printf(_("   use \"install-user %s name numeric_id\"\n"), port);
+      break;
+    default:
+      printf("\n");
+      printf(_("Error: sync returned error %d\n"), r);
+   }
 }
 
 static void sig_handler(int sig)
@@ -97,12 +193,317 @@ static void sig_handler(int sig)
    exit(0);
 }
 
+static double daemon_clock(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/* Take one of the daemon_max_jobs sync slots.  The lock on the slot is
+ * held until the worker exits. */
+static int wait_for_slot(int sd)
+{
+   char slot_file[FILENAME_MAX];
+   int fd, i, r;
+   int waiting;
+#ifndef USE_FLOCK
+   struct flock lock;
+#endif
+
+   waiting = FALSE;
+   while (1) {
+      for (i=0; i<daemon_max_jobs; i++) {
+         g_snprintf(slot_file, sizeof(slot_file), "%s/sync_slot.%d", daemon_dir, i);
+         fd = open(slot_file, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+         if (fd < 0) {
+            jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), slot_file);
+            return EXIT_FAILURE;
+         }
+#ifndef USE_FLOCK
+         lock.l_type = F_WRLCK;
+         lock.l_start = 0;
+         lock.l_whence = SEEK_SET;
+         lock.l_len = 0;
+         r = fcntl(fd, F_SETLK, &lock);
+#else
+         r = flock(fd, LOCK_EX | LOCK_NB);
+#endif
+         if (r != -1) {
+            if (waiting) {
+               pi_watchdog(sd, 0);
+            }
+            return EXIT_SUCCESS;
+         }
+         close(fd);
+      }
+      if (!waiting) {
+         jp_logf(JP_LOG_GUI, _("Waiting for one of %d syncs to finish\n"), daemon_max_jobs);
+         /* Keep the handheld from timing out while it waits */
+         pi_watchdog(sd, 7);
+         waiting = TRUE;
+      }
+      sleep(1);
+   }
+}
+
+/* Called by the sync of a worker once its handheld has connected.  The
+ * sync is moved to the home directory of the user of the handheld. */
+static int daemon_connected(int sd, struct my_sync_info *sync_info)
+{
+   struct PilotUser U;
+   char home[FILENAME_MAX];
+   char port[128];
+#ifndef HAVE_SETENV
+   static char str[FILENAME_MAX+16];
+#endif
+
+   if (daemon_max_jobs > 0) {
+      if (wait_for_slot(sd)) {
+         return EXIT_FAILURE;
+      }
+   }
+   connected_time = daemon_clock();
+
+   if (dlp_ReadUserInfo(sd, &U) < 0) {
+      jp_logf(JP_LOG_WARN, "dlp_ReadUserInfo error\n");
+      return EXIT_FAILURE;
+   }
+   /* There is no home directory for a handheld without a user ID */
+   if (U.userID == 0) {
+      return SYNC_ERROR_NULL_USERID;
+   }
+
+   g_snprintf(home, sizeof(home), "%s/%lu", daemon_dir, (unsigned long)U.userID);
+   if (mkdir(home, 0700) && (errno != EEXIST)) {
+      jp_logf(JP_LOG_WARN, _("Can't create directory %s\n"), home);
+      return EXIT_FAILURE;
+   }
+#ifdef HAVE_SETENV
+#  ifdef ENABLE_PROMETHEON
+   setenv("COPILOT_HOME", home, TRUE);
+#  else
+   setenv("JPILOT_HOME", home, TRUE);
+#  endif
+#else
+#  ifdef ENABLE_PROMETHEON
+   g_snprintf(str, sizeof(str), "COPILOT_HOME=%s", home);
+#  else
+   g_snprintf(str, sizeof(str), "JPILOT_HOME=%s", home);
+#  endif
+   putenv(str);
+#endif
+   if (check_hidden_dir()) {
+      return EXIT_FAILURE;
+   }
+   jp_logf(JP_LOG_GUI, _("Syncing user \"%s\" in %s\n"), U.username, home);
+
+   /* The preferences and the character set are those of this user */
+   pref_init();
+   pref_read_rc_file();
+   otherconv_free();
+   if (otherconv_init()) {
+      jp_logf(JP_LOG_WARN, "Error: could not set encoding\n");
+      return EXIT_FAILURE;
+   }
+   g_strlcpy(port, sync_info->port, sizeof(port));
+   setup_sync_info(sync_info, sync_info->flags);
+   g_strlcpy(sync_info->port, port, sizeof(sync_info->port));
+
+   return EXIT_SUCCESS;
+}
+
+static pid_t start_worker(const char *port, int flags, int report_fd)
+{
+   pid_t pid;
+   int r;
+   char line[64];
+
+   pid = fork();
+   switch (pid) {
+    case -1:
+      perror("fork");
+      return -1;
+    case 0:
+      break;
+    default:
+      return pid;
+   }
+
+   signal(SIGHUP, sig_handler);
+   signal(SIGINT, sig_handler);
+   signal(SIGTERM, sig_handler);
+
+   /* preference is not saved, so this is not persistent */
+   set_pref(PREF_PORT, 0, port, FALSE);
+   glob_sync_connected = daemon_connected;
+   connected_time = 0;
+
+   r = setup_sync(flags);
+   print_sync_error(r, port);
+
+   /* Tell the daemon how the sync went and how long it took */
+   g_snprintf(line, sizeof(line), "%d %.3f\n", r,
+              connected_time ? daemon_clock() - connected_time : -1.0);
+   if (write(report_fd, line, strlen(line)) < 0) {
+      jp_logf(JP_LOG_WARN, "write failed %s %d\n", __FILE__, __LINE__);
+   }
+
+   otherconv_free();
+   jp_log_flush();
+   _exit(r ? 1 : 0);
+}
+
+static void daemon_sig_handler(int sig)
+{
+   int i;
+
+   daemon_quit = 1;
+   for (i=0; i<num_workers; i++) {
+      if (worker_pids[i] > 0) {
+         kill(worker_pids[i], SIGTERM);
+      }
+   }
+}
+
+/* Add up the reports that workers have written */
+static void read_reports(int fd, int *syncs, int *failed, double *busy)
+{
+   char buf[1024];
+   char *line, *next;
+   int n, r;
+   double seconds;
+
+   while ((n = read(fd, buf, sizeof(buf)-1)) > 0) {
+      buf[n] = '\0';
+      for (line = buf; *line; line = next) {
+         next = strchr(line, '\n');
+         if (!next) {
+            break;
+         }
+         *next++ = '\0';
+         if (sscanf(line, "%d %lf", &r, &seconds) != 2) {
+            continue;
+         }
+         /* A worker that never connected did not sync */
+         if (seconds < 0) {
+            continue;
+         }
+         (*syncs)++;
+         if (r) {
+            (*failed)++;
+         }
+         *busy += seconds;
+      }
+   }
+}
+
+static void print_daemon_stats(double start, int syncs, int failed, double busy)
+{
+   double elapsed;
+
+   elapsed = daemon_clock() - start;
+   jp_logf(JP_LOG_GUI, _("%d syncs, %d failed, %.1f syncs per hour, "
+                         "%.1f seconds per sync\n"),
+           syncs, failed,
+           (elapsed > 0) ? syncs * 3600.0 / elapsed : 0.0,
+           syncs ? busy / syncs : 0.0);
+}
+
+/* Keep a worker waiting for a handheld on each port until a signal ends
+ * the daemon */
+static int daemon_loop(char ports[][MAX_PREF_LEN], int num_ports, int flags)
+{
+   int report_pipe[2];
+   int i, status, running;
+   int syncs, failed, last_syncs;
+   double busy, start;
+   pid_t pid;
+
+   if (mkdir(daemon_dir, 0700) && (errno != EEXIST)) {
+      jp_logf(JP_LOG_FATAL, _("Can't create directory %s\n"), daemon_dir);
+      return EXIT_FAILURE;
+   }
+   if (pipe(report_pipe)) {
+      perror("pipe");
+      return EXIT_FAILURE;
+   }
+   fcntl(report_pipe[0], F_SETFL, O_NONBLOCK);
+
+   syncs = failed = last_syncs = 0;
+   busy = 0.0;
+   start = daemon_clock();
+   daemon_quit = 0;
+   num_workers = num_ports;
+   for (i=0; i<num_ports; i++) {
+      worker_pids[i] = -1;
+   }
+
+   signal(SIGHUP, daemon_sig_handler);
+   signal(SIGINT, daemon_sig_handler);
+   signal(SIGTERM, daemon_sig_handler);
+
+   for (i=0; i<num_ports; i++) {
+      jp_logf(JP_LOG_GUI, _(" Syncing on device %s\n"), ports[i]);
+      worker_pids[i] = start_worker(ports[i], flags, report_pipe[1]);
+   }
+
+   for (running = num_ports; running > 0; ) {
+      pid = waitpid(-1, &status, 0);
+      if (pid < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         break;
+      }
+      read_reports(report_pipe[0], &syncs, &failed, &busy);
+      if (syncs != last_syncs) {
+         print_daemon_stats(start, syncs, failed, busy);
+         last_syncs = syncs;
+      }
+      for (i=0; i<num_ports; i++) {
+         if (worker_pids[i] == pid) {
+            break;
+         }
+      }
+      if (i == num_ports) {
+         continue;
+      }
+      worker_pids[i] = -1;
+      running--;
+      if (!daemon_quit) {
+         sleep(1);
+      }
+      if (!daemon_quit) {
+         worker_pids[i] = start_worker(ports[i], flags, report_pipe[1]);
+         if (worker_pids[i] > 0) {
+            running++;
+            /* The signal may have come before the pid was stored */
+            if (daemon_quit) {
+               kill(worker_pids[i], SIGTERM);
+            }
+         }
+      }
+   }
+
+   read_reports(report_pipe[0], &syncs, &failed, &busy);
+   print_daemon_stats(start, syncs, failed, busy);
+   close(report_pipe[0]);
+   close(report_pipe[1]);
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
    int flags;
    int r, i;
    int loop;
    char port[MAX_PREF_LEN];
+   char ports[MAX_DAEMON_PORTS][MAX_PREF_LEN];
+   int num_ports;
+   const char *svalue;
 #ifdef ENABLE_PLUGINS
    struct plugin_s *plugin;
    GList *plugin_list, *temp_list;
@@ -122,12 +523,16 @@ int main(int argc, char *argv[])
    glob_child_pid=0;
    loop=0;
    skip_plugins=0;
+   num_ports=0;
+   daemon_dir[0]='\0';
+   daemon_max_jobs=0;
 
    flags = SYNC_NO_FORK;
 
    /* Read preferences from jpilot.rc file */
    pref_init();
    pref_read_rc_file();
+   trace_init();
    if (otherconv_init()) {
       printf("Error: could not set encoding\n");
       exit(1);
@@ -173,6 +578,21 @@ int main(int argc, char *argv[])
             g_strlcpy(port, argv[i], MAX_PREF_LEN);
             /* preference is not saved, so this is not persistent */
             set_pref(PREF_PORT, 0, port, FALSE);
+            if (num_ports < MAX_DAEMON_PORTS) {
+               g_strlcpy(ports[num_ports++], port, MAX_PREF_LEN);
+            } else {
+               jp_logf(JP_LOG_WARN, _("Too many ports, %s is not used\n"), port);
+            }
+         }
+      } else if (!strncmp(argv[i], "-m", 2)) {
+         i++;
+         if (i<argc) {
+            g_strlcpy(daemon_dir, argv[i], sizeof(daemon_dir));
+         }
+      } else if (!strncmp(argv[i], "-j", 2)) {
+         i++;
+         if (i<argc) {
+            daemon_max_jobs = atoi(argv[i]);
          }
       }
    }
@@ -207,70 +627,19 @@ int main(int argc, char *argv[])
    signal(SIGINT, sig_handler);
    signal(SIGTERM, sig_handler);
 
+   if (daemon_dir[0]) {
+      if (num_ports == 0) {
+         get_pref(PREF_PORT, NULL, &svalue);
+         g_strlcpy(ports[num_ports++], svalue, MAX_PREF_LEN);
+      }
+      r = daemon_loop(ports, num_ports, flags);
+      otherconv_free();
+      return r;
+   }
+
    do {
       r = setup_sync(flags);
-      switch (r) {
-       case 0:
-         /* sync successful */
-         break;
-       case SYNC_ERROR_BIND:
-         printf("\n");
-         printf(_("Error: connecting to port %s\n"), port);
-         break;
-       case SYNC_ERROR_LISTEN:
-         printf("\n");
-         printf(_("Error: pi_listen\n"));
-         break;
-       case SYNC_ERROR_OPEN_CONDUIT:
-         printf("\n");
-         printf(_("Error: opening conduit to handheld\n"));
-         break;
-       case SYNC_ERROR_PI_ACCEPT:
-         printf("\n");
-         printf(_("Error: pi_accept\n"));
-         break;
-       case SYNC_ERROR_NOT_SAME_USER:
-         printf("\n");
-         printf(_("Error: "));
-         printf(_("This handheld does not have the same user name.\n"));
-         printf(_("as the one that was synced the last time.\n"));
-
-         printf(_("Syncing with different handhelds to the same directory can destroy data.\n"));
-#ifdef ENABLE_PROMETHEON
-         printf(_(" COPILOT_HOME"));
-#else
-         printf(_(" JPILOT_HOME"));
-#endif
-         printf(_(" environment variable can be used to sync different handhelds,\n"));
-         printf(_(" to different directories for the same UNIX user name.\n"));
-         break;
-       case SYNC_ERROR_NOT_SAME_USERID:
-         printf("\n");
-         printf(_("This handheld does not have the same user ID.\n"));
-         printf(_("as the one that was synced the last time.\n"));
-         printf(_(" Syncing with different handhelds to the same directory can destroy data.\n"));
-#ifdef ENABLE_PROMETHEON
-         printf(_(" COPILOT_HOME"));
-#else
-         printf(_(" JPILOT_HOME"));
-#endif
-         printf(_(" environment variable can be used to sync different handhelds,\n"));
-         printf(_(" to different directories for the same UNIX user name.\n"));
-         break;
-       case SYNC_ERROR_NULL_USERID:
-         printf("\n");
-         printf(_("Error: "));
-         printf(_("This handheld has a NULL user ID.\n"));
-         printf(_("Every handheld must have a unique user ID in order to sync properly.\n"));
-         printf(_("If the handheld has been hard reset, \n"));
-         printf(_("   use restore from within "EPN" to restore it.\n"));
-         printf(_("Otherwise, to add a new user name and ID\n"));
-         printf(_("   use \"install-user %s name numeric_id\"\n"), port);
-         break;
-       default:
-         printf("\n");
-         printf(_("Error: sync returned error %d\n"), r);
-      }
+      print_sync_error(r, port);
       sleep(1);
    } while (loop);
 
@@ -48,6 +48,7 @@
 #include "todo.h"
 #include "memo.h"
 #include "sync.h"
+#include "sync_journal.h"
 #include "log.h"
 #include "prefs_gui.h"
 #include "prefs.h"
@@ -58,6 +59,7 @@
 #include "password.h"
 #include "pidfile.h"
 #include "jpilot.h"
+#include "trace.h"
 
 #include "icons/jpilot-icon4.xpm"
 #include "icons/datebook.xpm"
@@ -935,8 +937,9 @@ static void cb_read_pipe_from_child(gpointer data,
                gtk_window_set_title(GTK_WINDOW(window), title);
                free(user_name);
             }
-            /* And redraw GUI */
-            if (Pstr1) {
+            /* And redraw GUI, if the sync changed what it shows.
+             * Until then it kept showing the files it had read. */
+            if ((Pstr1) && (jp_DB_files_changed())) {
                cb_app_button(NULL, GINT_TO_POINTER(REDRAW));
             }
             break;
@@ -1422,6 +1425,9 @@ static void cb_delete_event(GtkWidget *widget, GdkEvent *event, gpointer data)
    /* Save preferences in jpilot.rc */
    pref_write_rc_file();
 
+   /* Records an interrupted sync sent to the Palm must be marked before
+    * the offsets in its journal are changed */
+   sync_journal_apply();
    cleanup_pc_files();
 
    cleanup_pidfile();
@@ -1567,6 +1573,8 @@ int main(int argc, char *argv[])
    /* read jpilot.rc file for preferences */
    pref_read_rc_file();
 
+   trace_init();
+
    /* Extract first day of week preference from locale in GTK2 */
 #  ifdef HAVE__NL_TIME_FIRST_WEEKDAY
       /* GTK 2.8 libraries */
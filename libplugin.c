@@ -26,6 +26,7 @@
 #include <time.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 
 #include <glib.h>
@@ -33,9 +34,34 @@
 #include "libplugin.h"
 #include "i18n.h"
 #include "utils.h"
+#include "trace.h"
+
+/********************************* Constants **********************************/
+/* Size of the records held for one .pc3 file before they are written out */
+#define PC_WRITE_BATCH_MAX 0x400000
+
+/******************************* Global vars **********************************/
+/* Generation of each database when jp_read_DB_files last read it */
+static GHashTable *read_generations = NULL;
+
+/* Records waiting to be appended to a .pc3 file */
+struct pc_write_batch
+{
+   char *DB_name;
+   /* Packed headers and records */
+   GString *buf;
+   /* Number of records in buf still needing a unique ID */
+   unsigned int num_new;
+};
+
+/* struct pc_write_batch of the databases written while a batch is open */
+static GList *pc_write_batches = NULL;
+static int pc_write_batch_depth = 0;
 
 /****************************** Prototypes ************************************/
+static void jp_unpack_ntohl(unsigned long *l, unsigned char *src);
 static int pack_header(PC3RecordHeader *header, unsigned char *packed_header);
+static int read_DB_files(const char *DB_name, GList **records);
 static int static_find_next_offset(mem_rec_header *mem_rh, long fpos,
                             long *next_offset,
                             unsigned char *attrib, unsigned int *unique_id);
@@ -308,6 +334,145 @@ static void jp_pack_htonl(unsigned char *dest, unsigned long l)
    dest[0]=l>>24 & 0xFF;
 }
 
+/* The batch of DB_name, started if there is none yet */
+static struct pc_write_batch *find_pc_write_batch(const char *DB_name)
+{
+   GList *temp_list;
+   struct pc_write_batch *batch;
+
+   for (temp_list = pc_write_batches; temp_list; temp_list = temp_list->next) {
+      batch = temp_list->data;
+      if (!strcmp(batch->DB_name, DB_name)) {
+         return batch;
+      }
+   }
+   batch = malloc(sizeof(struct pc_write_batch));
+   if (!batch) {
+      return NULL;
+   }
+   batch->DB_name = strdup(DB_name);
+   batch->buf = g_string_sized_new(4096);
+   batch->num_new = 0;
+   pc_write_batches = g_list_prepend(pc_write_batches, batch);
+
+   return batch;
+}
+
+/* Give the new records of a batch their IDs and append it to the .pc3 */
+static int write_pc_write_batch(struct pc_write_batch *batch)
+{
+   FILE *out;
+   char PC_name[FILENAME_MAX];
+   unsigned char *p, *end;
+   unsigned long header_len, rec_len, unique_id;
+   unsigned int next_unique_id;
+   int r;
+
+   if (batch->buf->len == 0) {
+      return EXIT_SUCCESS;
+   }
+   if (batch->num_new) {
+      if (get_next_unique_pc_ids(&next_unique_id, batch->num_new)) {
+         return EXIT_FAILURE;
+      }
+      p = (unsigned char *)batch->buf->str;
+      end = p + batch->buf->len;
+      while (p + 21 <= end) {
+         jp_unpack_ntohl(&header_len, p);
+         jp_unpack_ntohl(&rec_len, p+8);
+         jp_unpack_ntohl(&unique_id, p+12);
+         if (unique_id == 0) {
+            jp_pack_htonl(p+12, next_unique_id++);
+         }
+         p += header_len + rec_len;
+      }
+   }
+
+   g_snprintf(PC_name, sizeof(PC_name), "%s.pc3", batch->DB_name);
+   out = jp_open_home_file(PC_name, "a");
+   if (!out) {
+      jp_logf(JP_LOG_WARN, _("Error opening file: %s\n"), PC_name);
+      return EXIT_FAILURE;
+   }
+   r = EXIT_SUCCESS;
+   if (fwrite(batch->buf->str, batch->buf->len, 1, out) != 1) {
+      jp_logf(JP_LOG_WARN, _("Error writing to file: %s\n"), PC_name);
+      r = EXIT_FAILURE;
+   }
+   jp_close_home_file(out);
+
+   g_string_truncate(batch->buf, 0);
+   batch->num_new = 0;
+
+   return r;
+}
+
+void jp_pc_write_batch_begin(void)
+{
+   pc_write_batch_depth++;
+}
+
+int jp_pc_write_batch_end(void)
+{
+   GList *temp_list;
+   struct pc_write_batch *batch;
+   int r;
+
+   if (pc_write_batch_depth == 0) {
+      return EXIT_SUCCESS;
+   }
+   if (--pc_write_batch_depth > 0) {
+      return EXIT_SUCCESS;
+   }
+
+   r = EXIT_SUCCESS;
+   for (temp_list = pc_write_batches; temp_list; temp_list = temp_list->next) {
+      batch = temp_list->data;
+      if (write_pc_write_batch(batch)) {
+         r = EXIT_FAILURE;
+      }
+      free(batch->DB_name);
+      g_string_free(batch->buf, TRUE);
+      free(batch);
+   }
+   g_list_free(pc_write_batches);
+   pc_write_batches = NULL;
+
+   return r;
+}
+
+/* Hold a record in the open batch.  New records get their IDs later. */
+static int batch_pc_write(const char *DB_name, buf_rec *br)
+{
+   PC3RecordHeader header;
+   unsigned char packed_header[256];
+   struct pc_write_batch *batch;
+   int len;
+
+   batch = find_pc_write_batch(DB_name);
+   if (!batch) {
+      jp_logf(JP_LOG_WARN, "batch_pc_write(): %s\n", _("Out of memory"));
+      return EXIT_FAILURE;
+   }
+
+   header.rec_len=br->size;
+   header.rt=br->rt;
+   header.attrib=br->attrib;
+   header.unique_id=br->unique_id;
+   if (br->unique_id==0) {
+      batch->num_new++;
+   }
+   len = pack_header(&header, packed_header);
+   g_string_append_len(batch->buf, (char *)packed_header, len);
+   g_string_append_len(batch->buf, br->buf, br->size);
+
+   if (batch->buf->len >= PC_WRITE_BATCH_MAX) {
+      return write_pc_write_batch(batch);
+   }
+
+   return EXIT_SUCCESS;
+}
+
 /*
  * if buf_rec->unique_id==0 then the palm assigns an ID, else
  *  use buf_rec->unique_id.
@@ -320,6 +485,10 @@ int jp_pc_write(const char *DB_name, buf_rec *br)
    unsigned char packed_header[256];
    char PC_name[FILENAME_MAX];
 
+   if (pc_write_batch_depth > 0) {
+      return batch_pc_write(DB_name, br);
+   }
+
    g_snprintf(PC_name, sizeof(PC_name), "%s.pc3", DB_name);
    if (br->unique_id==0) {
       get_next_unique_pc_id(&next_unique_id);
@@ -356,7 +525,75 @@ int jp_pdb_file_write_app_block(const char *DB_name, void *bufp, int size_in)
    return pdb_file_write_app_block((char *)DB_name, bufp, size_in);
 }
 
+unsigned int jp_DB_generation(const char *DB_name)
+{
+   char file_name[FILENAME_MAX];
+   char full_name[FILENAME_MAX];
+   struct stat statb;
+   const char *ext[]={"pdb", "pc3"};
+   unsigned int generation;
+   int i;
+
+   generation = 0;
+   for (i=0; i<2; i++) {
+      g_snprintf(file_name, sizeof(file_name), "%s.%s", DB_name, ext[i]);
+      get_home_file_name(file_name, full_name, sizeof(full_name));
+      if (stat(full_name, &statb)) {
+         continue;
+      }
+      /* A swapped in file has a new inode, a written one a new time or size */
+      generation = generation * 31 + (unsigned int)statb.st_ino;
+      generation = generation * 31 + (unsigned int)statb.st_mtime;
+      generation = generation * 31 + (unsigned int)statb.st_size;
+   }
+
+   return generation;
+}
+
+static void check_generation(gpointer key, gpointer value, gpointer data)
+{
+   if (jp_DB_generation(key) != GPOINTER_TO_UINT(value)) {
+      *(int *)data = TRUE;
+   }
+}
+
+int jp_DB_files_changed(void)
+{
+   int changed;
+
+   if (!read_generations) {
+      return FALSE;
+   }
+   changed = FALSE;
+   g_hash_table_foreach(read_generations, check_generation, &changed);
+   if (changed) {
+      g_hash_table_destroy(read_generations);
+      read_generations = NULL;
+   }
+
+   return changed;
+}
+
 int jp_read_DB_files(const char *DB_name, GList **records)
+{
+   int num;
+
+   /* Taken before reading, so that a change made meanwhile is seen */
+   if (!read_generations) {
+      read_generations = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               free, NULL);
+   }
+   g_hash_table_insert(read_generations, strdup(DB_name),
+                       GUINT_TO_POINTER(jp_DB_generation(DB_name)));
+
+   TRACE_BEGIN_DETAIL("read DB files", DB_name);
+   num = read_DB_files(DB_name, records);
+   TRACE_END("read DB files");
+
+   return num;
+}
+
+static int read_DB_files(const char *DB_name, GList **records)
 {
    FILE *in;
    FILE *pc_in;
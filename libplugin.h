@@ -111,6 +111,8 @@ typedef struct {
 } DBHeader;
 
 int get_next_unique_pc_id(unsigned int *next_unique_id);
+/* Reserve count consecutive IDs, the first is returned in next_unique_id */
+int get_next_unique_pc_ids(unsigned int *next_unique_id, unsigned int count);
 
 /* used for jp_delete_record */
 #define CLEAR_FLAG    1
@@ -258,6 +260,18 @@ int jp_get_app_info(const char *DB_name, unsigned char **buf, int *buf_size);
  */
 int jp_read_DB_files(const char *DB_name, GList **records);
 
+/*
+ * The generation of the files of a database.  It changes whenever the
+ * sync swaps in a new copy of the pdb file or the pc3 file is written.
+ */
+unsigned int jp_DB_generation(const char *DB_name);
+/*
+ * Returns TRUE if a database read by jp_read_DB_files is at a new
+ * generation since it was read.  The generations are then forgotten,
+ * as whatever was read from them is to be read again.
+ */
+int jp_DB_files_changed(void);
+
 /*
  *This deletes a record from the appropriate Datafile
  */
@@ -273,6 +287,15 @@ int jp_free_DB_records(GList **records);
 
 int jp_pc_write(const char *DB_name, buf_rec *br);
 
+/*
+ * Between these calls the records written by jp_pc_write are held in
+ * memory and appended to each .pc3 file in one write, for imports.
+ * New records are given their unique IDs in one reservation when they
+ * are written out, so br->unique_id is left 0 for them.  Batches nest.
+ */
+void jp_pc_write_batch_begin(void);
+int jp_pc_write_batch_end(void);
+
 const char *jp_strstr(const char *haystack, const char *needle, int case_sense);
 
 int pc_read_next_rec(FILE *in, buf_rec *br);
@@ -26,13 +26,15 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #ifdef USE_FLOCK
 #  include <sys/file.h>
-#else
-#  include <fcntl.h>
 #endif
+#include <fcntl.h>
 #include <signal.h>
 #include <utime.h>
 
@@ -44,6 +46,10 @@
 
 /********************************* Constants **********************************/
 #define WRITE_MAX_BUF 4096
+/* Debug messages are collected and written to the log file in batches
+ * of up to this size, or after this many seconds */
+#define LOG_BUFFER_SIZE 0x10000
+#define LOG_FLUSH_SECS 1
 
 /******************************* Global vars **********************************/
 int pipe_to_parent;
@@ -55,10 +61,94 @@ int glob_log_gui_mask;
 extern void output_to_pane(const char *str);
 extern pid_t jpilot_master_pid;
 
+static int log_fd = -1;
+/* Messages not yet written to log_fd, by process log_pid */
+static char log_buf[LOG_BUFFER_SIZE];
+static volatile sig_atomic_t log_len;
+static pid_t log_pid;
+static time_t log_flush_time;
+/* Signals that would end the process with messages still in log_buf */
+static const int log_signals[] = {
+   SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM, SIGINT, SIGHUP
+};
+
 /****************************** Prototypes ************************************/
 static int jp_vlogf (int level, const char *format, va_list val);
 
 /****************************** Main Code *************************************/
+/* Only calls that are safe in a signal handler are used */
+void jp_log_flush(void)
+{
+   ssize_t n;
+   int done;
+
+   if ((log_fd < 0) || (log_len == 0)) {
+      return;
+   }
+   /* A forked child leaves the messages of its parent to the parent */
+   if (getpid() == log_pid) {
+      for (done=0; done < log_len; done += n) {
+         n = write(log_fd, log_buf + done, log_len - done);
+         if ((n < 0) && (errno == EINTR)) {
+            n = 0;
+         } else if (n <= 0) {
+            break;
+         }
+      }
+   }
+   log_len = 0;
+}
+
+static void log_exit(void)
+{
+   jp_log_flush();
+}
+
+static void log_signal_handler(int sig)
+{
+   jp_log_flush();
+   signal(sig, SIG_DFL);
+   raise(sig);
+}
+
+static void log_catch_signals(void)
+{
+   void (*old_handler)(int);
+   int i;
+
+   /* Signals the program handles or ignores are left as they are */
+   for (i=0; i < (int)(sizeof(log_signals)/sizeof(log_signals[0])); i++) {
+      old_handler = signal(log_signals[i], log_signal_handler);
+      if (old_handler != SIG_DFL) {
+         signal(log_signals[i], old_handler);
+      }
+   }
+}
+
+static void log_to_file(int level, const char *buf, int size)
+{
+   pid_t pid;
+   time_t now;
+
+   pid = getpid();
+   if (pid != log_pid) {
+      jp_log_flush();
+      log_pid = pid;
+   }
+   if (log_len + size > LOG_BUFFER_SIZE) {
+      jp_log_flush();
+   }
+   memcpy(log_buf + log_len, buf, size);
+   /* Counted once it is complete, for the signal handler */
+   log_len += size;
+
+   now = time(NULL);
+   if ((level != JP_LOG_DEBUG) || (now - log_flush_time >= LOG_FLUSH_SECS)) {
+      jp_log_flush();
+      log_flush_time = now;
+   }
+}
+
 int jp_logf(int level, const char *format, ...)
 {
    va_list val;
@@ -81,7 +171,6 @@ static int jp_vlogf (int level, const char *format, va_list val) {
    char                 *buf, *local_buf;
    int                  size;
    int                  len;
-   static FILE          *fp=NULL;
    static int           err_count=0;
    char                 cmd[16];
 
@@ -91,22 +180,27 @@ static int jp_vlogf (int level, const char *format, va_list val) {
       return EXIT_SUCCESS;
    }
 
-   if ((!fp) && (err_count>10)) {
+   if ((log_fd < 0) && (err_count>10)) {
       return EXIT_FAILURE;
    }
-   if ((!fp) && (err_count==10)) {
+   if ((log_fd < 0) && (err_count==10)) {
       fprintf(stderr, _("Unable to open log file, giving up.\n"));
       err_count++;
       return EXIT_FAILURE;
    }
-   if ((!fp) && (err_count<10)) {
+   if ((log_fd < 0) && (err_count<10)) {
       char fullname[FILENAME_MAX];
       get_home_file_name(EPN".log", fullname, sizeof(fullname));
 
-      fp = fopen(fullname, "w");
-      if (!fp) {
+      log_fd = open(fullname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (log_fd < 0) {
          fprintf(stderr, _("Unable to open log file\n"));
          err_count++;
+      } else {
+         log_pid = getpid();
+         log_flush_time = time(NULL);
+         atexit(log_exit);
+         log_catch_signals();
       }
    }
 
@@ -120,17 +214,18 @@ static int jp_vlogf (int level, const char *format, va_list val) {
    size=strlen(buf);
 
    local_buf = buf;
-   /* UTF-8 text so transform in local encoding */
-   if (g_utf8_validate(buf, -1, NULL))
+   /* UTF-8 text so transform in local encoding, unless it is the same */
+   if ((!g_get_charset(NULL)) &&
+       (ascii_prefix_len(buf, size) < (size_t)size) &&
+       (g_utf8_validate(buf, -1, NULL)))
    {
       local_buf = g_locale_from_utf8(buf, -1, NULL, NULL, NULL);
       if (NULL == local_buf)
          local_buf = buf;
    }
 
-   if ((fp) && (level & glob_log_file_mask)) {
-      fwrite(local_buf, size, 1, fp);
-      fflush(fp);
+   if ((log_fd >= 0) && (level & glob_log_file_mask)) {
+      log_to_file(level, local_buf, strlen(local_buf));
    }
 
    if (level & glob_log_stdout_mask) {
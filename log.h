@@ -46,6 +46,9 @@ extern int glob_log_stdout_mask;
 extern int glob_log_gui_mask;
 
 int jp_logf(int log_level, const char *format, ...);
+/* Debug messages reach the log file in batches.  They are written out at
+ * exit and on fatal signals, call this before _exit() or exec(). */
+void jp_log_flush(void);
 int write_to_parent(int command, const char *format, ...);
 
 #endif
@@ -31,6 +31,7 @@
 #include "i18n.h"
 #include "utils.h"
 #include "log.h"
+#include "trace.h"
 #include "prefs.h"
 #include "libplugin.h"
 #include "password.h"
@@ -123,6 +124,7 @@ int get_memos2(MemoList **memo_list, int sort_order,
    int keep_priv;
    long char_set;
    char *newtext;
+   double unpack_start, conv_start, conv_time;
    long memo_version;
    buf_rec *br;
    pi_buffer_t *RecordBuffer;
@@ -165,6 +167,9 @@ int get_memos2(MemoList **memo_list, int sort_order,
    if (-1 == num)
       return 0;
 
+   TRACE_BEGIN("unpack");
+   unpack_start = TRACE_NOW();
+   conv_time = 0.0;
    for (temp_list = records; temp_list; temp_list = temp_list->next) {
       if (temp_list->data) {
          br=temp_list->data;
@@ -199,6 +204,7 @@ int get_memos2(MemoList **memo_list, int sort_order,
          free_Memo(&memo);
          continue;
       }
+      conv_start = TRACE_NOW();
       if (memo.text) {
          newtext = charset_p2newj(memo.text, -1, char_set);
          if (newtext) {
@@ -206,6 +212,9 @@ int get_memos2(MemoList **memo_list, int sort_order,
             memo.text = newtext;
          }
       }
+      if (glob_trace) {
+         conv_time += trace_now() - conv_start;
+      }
 
       temp_memo_list = malloc(sizeof(MemoList));
       if (!temp_memo_list) {
@@ -222,9 +231,16 @@ int get_memos2(MemoList **memo_list, int sort_order,
       recs_returned++;
    }
 
+   if (glob_trace) {
+      trace_total("charset conversion", unpack_start, conv_time);
+   }
+   TRACE_END("unpack");
+
    jp_free_DB_records(&records);
 
+   TRACE_BEGIN("sort");
    memo_sort(memo_list, sort_order);
+   TRACE_END("sort");
 
    jp_logf(JP_LOG_DEBUG, "Leaving get_memos2()\n");
 
@@ -320,6 +336,91 @@ static int memo_sort(MemoList **memol, int sort_order)
    return EXIT_SUCCESS;
 }
 
+/*
+ * Link new_memo into a list returned by get_memos2() without re-sorting it.
+ * The position is found by a binary search.
+ * sort_order: SORT_ASCENDING | SORT_DESCENDING
+ */
+int memo_insert_sorted(MemoList **memol, MemoList *new_memo, int sort_order)
+{
+   MemoList *temp_memol;
+   MemoList **sort_memol;
+   int count, i;
+   int lo, hi, mid, r;
+
+   /* Count the entries in the list */
+   for (count=0, temp_memol=*memol; temp_memol; temp_memol=temp_memol->next, count++) {}
+
+   if (count==0) {
+      new_memo->next = NULL;
+      *memol = new_memo;
+      return EXIT_SUCCESS;
+   }
+
+   sort_memol = calloc(count, sizeof(MemoList *));
+   if (!sort_memol) {
+      jp_logf(JP_LOG_WARN, "memo_insert_sorted(): %s\n", _("Out of memory"));
+      return EXIT_FAILURE;
+   }
+   for (i=0, temp_memol=*memol; temp_memol; temp_memol=temp_memol->next, i++) {
+      sort_memol[i] = temp_memol;
+   }
+
+   if (sort_order==SORT_DESCENDING) {
+      /* memo_sort() leaves these in database order, new records go last */
+      lo = count;
+   } else {
+      /* Find the first record that comes after the new one.
+       * memo_sort() links the list in reverse order of memo_compare() */
+      lo = 0;
+      hi = count;
+      while (lo < hi) {
+         mid = (lo + hi) / 2;
+         r = memo_compare(&sort_memol[mid], &new_memo);
+         if (r < 0) {
+            hi = mid;
+         } else {
+            lo = mid + 1;
+         }
+      }
+   }
+
+   if (lo==0) {
+      new_memo->next = *memol;
+      *memol = new_memo;
+   } else {
+      new_memo->next = sort_memol[lo-1]->next;
+      sort_memol[lo-1]->next = new_memo;
+   }
+
+   free(sort_memol);
+
+   return EXIT_SUCCESS;
+}
+
+/* Unlink the node holding mmemo from the list and free it */
+int memo_remove(MemoList **memol, MyMemo *mmemo)
+{
+   MemoList *temp_memol, *prev_memol;
+
+   for (prev_memol=NULL, temp_memol=*memol;
+        temp_memol;
+        prev_memol=temp_memol, temp_memol=temp_memol->next) {
+      if (&(temp_memol->mmemo) == mmemo) {
+         if (prev_memol) {
+            prev_memol->next = temp_memol->next;
+         } else {
+            *memol = temp_memol->next;
+         }
+         free_Memo(&(temp_memol->mmemo.memo));
+         free(temp_memol);
+         return EXIT_SUCCESS;
+      }
+   }
+
+   return EXIT_FAILURE;
+}
+
 /*
  * This function writes to the MemosDB-PMem.pc3 file
  *
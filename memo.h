@@ -32,6 +32,10 @@ int get_memos2(MemoList **memo_list, int sort_order,
 int pc_memo_write(struct Memo *memo, PCRecType rt, unsigned char attrib,
                   unsigned int *unique_id);
 
+/* Keep a list returned by get_memos2() sorted while patching it */
+int memo_insert_sorted(MemoList **memol, MemoList *new_memo, int sort_order);
+int memo_remove(MemoList **memol, MyMemo *mmemo);
+
 int memo_print(void);
 int memo_import(GtkWidget *window);
 int memo_export(GtkWidget *window);
@@ -34,6 +34,7 @@
 #include "i18n.h"
 #include "utils.h"
 #include "log.h"
+#include "trace.h"
 #include "prefs.h"
 #include "password.h"
 #include "print.h"
@@ -88,6 +89,7 @@ static MemoList *export_memo_list=NULL;
 /****************************** Prototypes ************************************/
 static int memo_clear_details(void);
 static int memo_clist_redraw(void);
+static int memo_clist_patch(MyMemo *old_mmemo, int flag, MemoList *new_memol);
 static void connect_changed_signals(int con_or_dis);
 static int memo_find(void);
 static int memo_get_details(struct Memo *new_memo, unsigned char *attrib);
@@ -273,7 +275,7 @@ static int cb_memo_import(GtkWidget *parent_window,
    int new_cat_num;
    int priv;
 
-   in=fopen(file_path, "r");
+   in=import_fopen(file_path);
    if (!in) {
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), file_path);
       return EXIT_FAILURE;
@@ -342,6 +344,7 @@ static int cb_memo_import(GtkWidget *parent_window,
       if (EXIT_FAILURE == ret) return EXIT_FAILURE;
 
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       while (1) {
          /* Read the category field */
          ret = read_csv_field(in, text, sizeof(text));
@@ -406,6 +409,7 @@ static int cb_memo_import(GtkWidget *parent_window,
       memolist=NULL;
       dat_get_memos(in, &memolist, &cai);
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       for (temp_memolist=memolist; temp_memolist; temp_memolist=temp_memolist->next) {
 #ifdef JPILOT_DEBUG
          printf("category=%d\n", temp_memolist->mmemo.unique_id);
@@ -460,9 +464,17 @@ static int cb_memo_import(GtkWidget *parent_window,
       free_MemoList(&memolist);
    }
 
+   /* Write out the imported records before they are read back */
+   ret = jp_pc_write_batch_end();
+   if (ret != EXIT_SUCCESS) {
+      jp_logf(JP_LOG_WARN, _("Unable to write the imported records\n"));
+      dialog_generic_ok(parent_window, _("Error"), DIALOG_ERROR,
+                        _("Unable to write the imported records\n"));
+   }
+
    memo_refresh();
    fclose(in);
-   return EXIT_SUCCESS;
+   return ret;
 }
 
 int memo_import(GtkWidget *window)
@@ -499,6 +511,7 @@ static void cb_memo_export_ok(GtkWidget *export_window, GtkWidget *clist,
 {
    MyMemo *mmemo;
    GList *list, *temp_list;
+   gpointer *rows;
    FILE *out;
    struct stat statb;
    int i, r, len;
@@ -536,7 +549,7 @@ static void cb_memo_export_ok(GtkWidget *export_window, GtkWidget *clist,
       }
    }
 
-   out = fopen(filename, "w");
+   out = export_fopen(filename);
    if (!out) {
       g_snprintf(text,sizeof(text), _("Error opening file: %s"), filename);
       dialog_generic(GTK_WINDOW(export_window),
@@ -589,9 +602,10 @@ static void cb_memo_export_ok(GtkWidget *export_window, GtkWidget *clist,
 
    get_pref(PREF_CHAR_SET, &char_set, NULL);
    list=GTK_CLIST(clist)->selection;
+   rows = clist_get_all_row_data(GTK_CLIST(clist));
 
    for (i=0, temp_list=list; temp_list; temp_list = temp_list->next, i++) {
-      mmemo = gtk_clist_get_row_data(GTK_CLIST(clist), GPOINTER_TO_INT(temp_list->data));
+      mmemo = rows[GPOINTER_TO_INT(temp_list->data)];
       if (!mmemo) {
          continue;
          jp_logf(JP_LOG_WARN, _("Can't export memo %d\n"), (long) temp_list->data + 1);
@@ -673,7 +687,7 @@ static void cb_memo_export_ok(GtkWidget *export_window, GtkWidget *clist,
 	 fprintf(out, "   <icon>7</icon>\n");
 	 g_free(utf);
 	 for (i=0, temp_list=list; temp_list; temp_list = temp_list->next, i++) {
-	    mmemo = gtk_clist_get_row_data(GTK_CLIST(clist), GPOINTER_TO_INT(temp_list->data));
+	    mmemo = rows[GPOINTER_TO_INT(temp_list->data)];
 	    if (!mmemo) {
 	       continue;
 	       jp_logf(JP_LOG_WARN, _("Can't export memo %d\n"), (long) temp_list->data + 1);
@@ -720,6 +734,8 @@ static void cb_memo_export_ok(GtkWidget *export_window, GtkWidget *clist,
       }
    }
 
+   g_free(rows);
+
    if (out) {
       fclose(out);
    }
@@ -806,37 +822,45 @@ static int find_menu_cat_pos(int cat)
    }
 }
 
-static void cb_delete_memo(GtkWidget *widget,
-                           gpointer   data)
+/* Delete the selected record from the .pc3 file, or mark it as modified.
+ * Returns EXIT_FAILURE if the record was not changed. */
+static int delete_memo(int flag)
 {
    MyMemo *mmemo;
-   int flag;
+   MyMemo palm_mmemo;
    int show_priv;
    long char_set;
+   int r;
 
    mmemo = gtk_clist_get_row_data(GTK_CLIST(clist), clist_row_selected);
    if (mmemo < (MyMemo *)CLIST_MIN_DATA) {
-      return;
-   }
-   /* Convert to Palm character set */
-   get_pref(PREF_CHAR_SET, &char_set, NULL);
-   if (char_set != CHAR_SET_LATIN1) {
-      if (mmemo->memo.text)
-         charset_j2p(mmemo->memo.text, strlen(mmemo->memo.text)+1, char_set);
+      return EXIT_FAILURE;
    }
 
    /* Do masking like Palm OS 3.5 */
    show_priv = show_privates(GET_PRIVATES);
    if ((show_priv != SHOW_PRIVATES) &&
        (mmemo->attrib & dlpRecAttrSecret)) {
-      return;
+      return EXIT_FAILURE;
    }
    /* End Masking */
+
+   /* Convert a copy to the Palm character set, the record may stay on
+    * the screen as deleted or modified */
+   memcpy(&palm_mmemo, mmemo, sizeof(MyMemo));
+   get_pref(PREF_CHAR_SET, &char_set, NULL);
+   if (char_set != CHAR_SET_LATIN1) {
+      if (mmemo->memo.text) {
+         palm_mmemo.memo.text = strdup(mmemo->memo.text);
+         charset_j2p(palm_mmemo.memo.text, strlen(palm_mmemo.memo.text)+1, char_set);
+      }
+   }
+
    jp_logf(JP_LOG_DEBUG, "mmemo->unique_id = %d\n",mmemo->unique_id);
    jp_logf(JP_LOG_DEBUG, "mmemo->rt = %d\n",mmemo->rt);
-   flag = GPOINTER_TO_INT(data);
+   r = EXIT_FAILURE;
    if ((flag==MODIFY_FLAG) || (flag==DELETE_FLAG)) {
-      delete_pc_record(MEMO, mmemo, flag);
+      r = delete_pc_record(MEMO, &palm_mmemo, flag);
       if (flag==DELETE_FLAG) {
          /* when we redraw we want to go to the line above the deleted one */
          if (clist_row_selected>0) {
@@ -845,9 +869,24 @@ static void cb_delete_memo(GtkWidget *widget,
       }
    }
 
+   if ((char_set != CHAR_SET_LATIN1) && (palm_mmemo.memo.text)) {
+      free(palm_mmemo.memo.text);
+   }
+
    if (flag == DELETE_FLAG) {
-      memo_clist_redraw();
+      /* If the record is still in the file the list is redrawn from it */
+      if ((r != EXIT_SUCCESS) || memo_clist_patch(mmemo, flag, NULL)) {
+         memo_clist_redraw();
+      }
    }
+
+   return r;
+}
+
+static void cb_delete_memo(GtkWidget *widget,
+                           gpointer   data)
+{
+   delete_memo(GPOINTER_TO_INT(data));
 }
 
 static void cb_undelete_memo(GtkWidget *widget,
@@ -1070,10 +1109,13 @@ static void cb_add_new_record(GtkWidget *widget, gpointer data)
 {
    MyMemo *mmemo;
    struct Memo new_memo;
+   MemoList *new_memol;
    unsigned char attrib;
-   int flag;
+   int flag, r;
+   int r_delete = EXIT_SUCCESS;
    unsigned int unique_id;
    int show_priv;
+   PCRecType type;
 
    flag=GPOINTER_TO_INT(data);
 
@@ -1123,25 +1165,52 @@ static void cb_add_new_record(GtkWidget *widget, gpointer data)
 
    /* Keep unique ID intact */
    if (flag==MODIFY_FLAG) {
-      cb_delete_memo(NULL, data);
       if ((mmemo->rt==PALM_REC) || (mmemo->rt==REPLACEMENT_PALM_REC)) {
-         pc_memo_write(&new_memo, REPLACEMENT_PALM_REC, attrib, &unique_id);
+         type = REPLACEMENT_PALM_REC;
       } else {
          unique_id=0;
-         pc_memo_write(&new_memo, NEW_PC_REC, attrib, &unique_id);
+         type = NEW_PC_REC;
       }
+      r_delete = delete_memo(flag);
    } else {
       unique_id=0;
-      pc_memo_write(&new_memo, NEW_PC_REC, attrib, &unique_id);
+      type = NEW_PC_REC;
+   }
+
+   /* The new record is linked into the displayed list as it would be
+    * read back from the database, before pc_memo_write() converts the
+    * text to the Palm character set */
+   new_memol = malloc(sizeof(MemoList));
+   if (new_memol) {
+      new_memol->app_type = MEMO;
+      new_memol->next = NULL;
+      new_memol->mmemo.memo.text = strdup(new_memo.text ? new_memo.text : "");
    }
 
+   r = pc_memo_write(&new_memo, type, attrib, &unique_id);
+
    free_Memo(&new_memo);
-   /* Don't return to modified record if search gui active */
-   if (!glob_find_id) {
-      glob_find_id = unique_id;
+
+   if (new_memol) {
+      new_memol->mmemo.rt = type;
+      new_memol->mmemo.unique_id = unique_id;
+      new_memol->mmemo.attrib = attrib;
+      /* A list that can't be patched to match the file is redrawn */
+      if ((r != EXIT_SUCCESS) || (r_delete != EXIT_SUCCESS)) {
+         free_Memo(&(new_memol->mmemo.memo));
+         free(new_memol);
+         new_memol = NULL;
+      }
    }
-   memo_clist_redraw();
 
+   if ((!new_memol) ||
+       memo_clist_patch((flag==MODIFY_FLAG) ? mmemo : NULL, flag, new_memol)) {
+      /* Don't return to modified record if search gui active */
+      if (!glob_find_id) {
+         glob_find_id = unique_id;
+      }
+      memo_clist_redraw();
+   }
 
    return;
 }
@@ -1375,21 +1444,83 @@ static gboolean cb_key_pressed_right_side(GtkWidget   *widget,
    return FALSE;
 }
 
+/* The text of clist row "row" starts with the row number */
+static void memo_clist_row_text(char *str2, int row, MyMemo *mmemo)
+{
+   size_t copy_max_length;
+   char *last;
+   char str[MEMO_CLIST_CHAR_WIDTH+10];
+   int len, len1;
+
+   sprintf(str, "%d. ", row + 1);
+
+   len1 = strlen(str);
+   len = strlen(mmemo->memo.text)+1;
+   /* ..memo clist does not display '/n' */
+   if ((copy_max_length = len) > MEMO_CLIST_CHAR_WIDTH) {
+      copy_max_length = MEMO_CLIST_CHAR_WIDTH;
+   }
+   last = (char *)multibyte_safe_memccpy(str+len1, mmemo->memo.text,'\n', copy_max_length);
+   if (last) {
+      *(last-1)='\0';
+   } else {
+      str[copy_max_length + len1]='\0';
+   }
+   lstrncpy_remove_cr_lfs(str2, str, MEMO_MAX_COLUMN_LEN);
+}
+
+/* Fill in the text and colors of clist row "row" from mmemo */
+static void memo_clist_set_row(GtkWidget *clist, int row, MyMemo *mmemo)
+{
+   char str2[MEMO_MAX_COLUMN_LEN];
+
+   memo_clist_row_text(str2, row, mmemo);
+   gtk_clist_set_text(GTK_CLIST(clist), row, 0, str2);
+   gtk_clist_set_row_data(GTK_CLIST(clist), row, mmemo);
+
+   /* Highlight row background depending on status */
+   switch (mmemo->rt) {
+    case NEW_PC_REC:
+    case REPLACEMENT_PALM_REC:
+      set_bg_rgb_clist_row(clist, row,
+                           CLIST_NEW_RED, CLIST_NEW_GREEN, CLIST_NEW_BLUE);
+      break;
+    case DELETED_PALM_REC:
+    case DELETED_PC_REC:
+      set_bg_rgb_clist_row(clist, row,
+                           CLIST_DEL_RED, CLIST_DEL_GREEN, CLIST_DEL_BLUE);
+      break;
+    case MODIFIED_PALM_REC:
+      set_bg_rgb_clist_row(clist, row,
+                           CLIST_MOD_RED, CLIST_MOD_GREEN, CLIST_MOD_BLUE);
+      break;
+    default:
+      if (mmemo->attrib & dlpRecAttrSecret) {
+         set_bg_rgb_clist_row(clist, row,
+                              CLIST_PRIVATE_RED, CLIST_PRIVATE_GREEN, CLIST_PRIVATE_BLUE);
+      } else {
+         gtk_clist_set_row_style(GTK_CLIST(clist), row, NULL);
+      }
+   }
+}
+
+static void memo_clist_fill_row(GtkWidget *clist, int row, gpointer row_data)
+{
+   memo_clist_set_row(clist, row, row_data);
+}
+
 static void memo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
                               MemoList **memo_list, int category, int main)
 {
    int num_entries, entries_shown;
-   size_t copy_max_length;
-   char *last;
    gchar *empty_line[] = { "" };
-   char str2[MEMO_MAX_COLUMN_LEN];
    MemoList *temp_memo;
    char str[MEMO_CLIST_CHAR_WIDTH+10];
-   int len, len1;
    int show_priv;
    long show_tooltips;
 
    jp_logf(JP_LOG_DEBUG, "memo_update_clist()\n");
+   TRACE_BEGIN("memo_update_clist");
 
    free_MemoList(memo_list);
 
@@ -1401,6 +1532,7 @@ static void memo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
       memo_clear_details();
    }
 
+   TRACE_BEGIN("fill clist");
    /* Freeze clist to prevent flicker during updating */
    gtk_clist_freeze(GTK_CLIST(clist));
    if (main) {
@@ -1415,6 +1547,7 @@ static void memo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    gtk_widget_show_all(clist);
    gtk_clist_freeze(GTK_CLIST(clist));
 #endif
+   clist_set_fill_func(GTK_CLIST(clist), memo_clist_fill_row);
 
    show_priv = show_privates(GET_PRIVATES);
 
@@ -1445,51 +1578,9 @@ static void memo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
          continue;
       }
 
-      /* Add entry to clist */
-      gtk_clist_append(GTK_CLIST(clist), empty_line);
+      /* Add entry to clist, filled in by memo_clist_fill_row() when drawn */
+      clist_append_unfilled(GTK_CLIST(clist), &(temp_memo->mmemo));
 
-      sprintf(str, "%d. ", entries_shown + 1);
-
-      len1 = strlen(str);
-      len = strlen(temp_memo->mmemo.memo.text)+1;
-      /* ..memo clist does not display '/n' */
-      if ((copy_max_length = len) > MEMO_CLIST_CHAR_WIDTH) {
-         copy_max_length = MEMO_CLIST_CHAR_WIDTH;
-      }
-      last = (char *)multibyte_safe_memccpy(str+len1, temp_memo->mmemo.memo.text,'\n', copy_max_length);
-      if (last) {
-         *(last-1)='\0';
-      } else {
-         str[copy_max_length + len1]='\0';
-      }
-      lstrncpy_remove_cr_lfs(str2, str, MEMO_MAX_COLUMN_LEN);
-      gtk_clist_set_text(GTK_CLIST(clist), entries_shown, 0, str2);
-      gtk_clist_set_row_data(GTK_CLIST(clist), entries_shown, &(temp_memo->mmemo));
-
-      /* Highlight row background depending on status */
-      switch (temp_memo->mmemo.rt) {
-       case NEW_PC_REC:
-       case REPLACEMENT_PALM_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                              CLIST_NEW_RED, CLIST_NEW_GREEN, CLIST_NEW_BLUE);
-         break;
-       case DELETED_PALM_REC:
-       case DELETED_PC_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                              CLIST_DEL_RED, CLIST_DEL_GREEN, CLIST_DEL_BLUE);
-         break;
-       case MODIFIED_PALM_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                              CLIST_MOD_RED, CLIST_MOD_GREEN, CLIST_MOD_BLUE);
-         break;
-       default:
-         if (temp_memo->mmemo.attrib & dlpRecAttrSecret) {
-            set_bg_rgb_clist_row(clist, entries_shown,
-                                 CLIST_PRIVATE_RED, CLIST_PRIVATE_GREEN, CLIST_PRIVATE_BLUE);
-         } else {
-            gtk_clist_set_row_style(GTK_CLIST(clist), entries_shown, NULL);
-         }
-      }
       entries_shown++;
    }
 
@@ -1524,6 +1615,7 @@ static void memo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
 
    /* Unfreeze clist after all changes */
    gtk_clist_thaw(GTK_CLIST(clist));
+   TRACE_END("fill clist");
 
    if (tooltip_widget) {
       get_pref(PREF_SHOW_TOOLTIPS, &show_tooltips, NULL);
@@ -1543,9 +1635,179 @@ static void memo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    /* return focus to clist after any big operation which requires a redraw */
    gtk_widget_grab_focus(GTK_WIDGET(clist));
 
+   TRACE_END("memo_update_clist");
    jp_logf(JP_LOG_DEBUG, "Leaving memo_update_clist()\n");
 }
 
+/* Returns TRUE if memo_update_clist() would give mmemo a row */
+static int memo_clist_shows(MyMemo *mmemo, int show_priv)
+{
+   if (((mmemo->attrib & 0x0F) != memo_category) &&
+       memo_category != CATEGORY_ALL) {
+      return FALSE;
+   }
+   if ((show_priv != SHOW_PRIVATES) &&
+       (mmemo->attrib & dlpRecAttrSecret)) {
+      return FALSE;
+   }
+   return TRUE;
+}
+
+/*
+ * Renumber rows first to last after rows were inserted or removed above
+ * them.  gtk_clist_set_text() walks the row list from the top for every
+ * call, so the cells are rewritten directly while the clist is frozen and
+ * are drawn when it is thawed.
+ */
+static void memo_clist_renumber(int first, int last)
+{
+   GList *temp_list;
+   GtkCListRow *clist_row;
+   char str2[MEMO_MAX_COLUMN_LEN];
+   int row;
+
+   temp_list = g_list_nth(GTK_CLIST(clist)->row_list, first);
+   for (row=first; temp_list && row<=last; row++, temp_list=temp_list->next) {
+      clist_row = GTK_CLIST_ROW(temp_list);
+      /* Rows not drawn yet are numbered when they are filled in */
+      if ((clist_row->cell[0].type != GTK_CELL_TEXT) || (!clist_row->data)) {
+         continue;
+      }
+      memo_clist_row_text(str2, row, clist_row->data);
+      g_free(GTK_CELL_TEXT(clist_row->cell[0])->text);
+      GTK_CELL_TEXT(clist_row->cell[0])->text = g_strdup(str2);
+   }
+}
+
+/*
+ * Apply a single add, modify or delete to glob_memo_list and the clist
+ * instead of re-reading the database and rebuilding the whole clist.
+ * old_mmemo is the record delete_pc_record() was just called on with flag,
+ * or NULL.  new_memol is the record just written, or NULL, and is owned by
+ * the list afterwards.
+ * Returns EXIT_FAILURE, having freed new_memol, if the clist has to be
+ * redrawn.
+ */
+static int memo_clist_patch(MyMemo *old_mmemo, int flag, MemoList *new_memol)
+{
+   gchar *empty_line[] = { "" };
+   MemoList *temp_memo;
+   char str[MEMO_CLIST_CHAR_WIDTH+10];
+   int row, new_row, first, last;
+   int num_entries, entries_shown, entries_before;
+   int show_priv;
+   long show_tooltips;
+
+   show_priv = show_privates(GET_PRIVATES);
+
+   /* A record being searched for and masked records need a full redraw */
+   if (glob_find_id || (show_priv == MASK_PRIVATES)) {
+      if (new_memol) {
+         free_Memo(&(new_memol->mmemo.memo));
+         free(new_memol);
+      }
+      return EXIT_FAILURE;
+   }
+
+   memo_clear_details();
+
+   gtk_clist_freeze(GTK_CLIST(clist));
+   gtk_signal_disconnect_by_func(GTK_OBJECT(clist),
+                                 GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+
+   entries_before = GTK_CLIST(clist)->rows;
+   first = entries_before;
+   last = -1;
+
+   if (old_mmemo) {
+      old_mmemo->rt = pc_record_type_after_delete(old_mmemo->rt, flag);
+      row = gtk_clist_find_row_from_data(GTK_CLIST(clist), old_mmemo);
+      if (row >= 0) {
+         clist_remove(GTK_CLIST(clist), row);
+      }
+      if (pc_record_type_shown(old_mmemo->rt)) {
+         /* Redraw the row in the colors of its new status */
+         if (row >= 0) {
+            gtk_clist_insert(GTK_CLIST(clist), row, empty_line);
+            memo_clist_set_row(clist, row, old_mmemo);
+         }
+      } else {
+         memo_remove(&glob_memo_list, old_mmemo);
+         if (row >= 0) {
+            first = last = row;
+         }
+      }
+   }
+
+   new_row = -1;
+   if (new_memol) {
+      if (memo_insert_sorted(&glob_memo_list, new_memol, SORT_ASCENDING)) {
+         free_Memo(&(new_memol->mmemo.memo));
+         free(new_memol);
+         gtk_signal_connect(GTK_OBJECT(clist), "select_row",
+                            GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+         gtk_clist_thaw(GTK_CLIST(clist));
+         return EXIT_FAILURE;
+      }
+      if (memo_clist_shows(&(new_memol->mmemo), show_priv)) {
+         /* The clist shows the list in order, skipping hidden records */
+         new_row = 0;
+         for (temp_memo = glob_memo_list; temp_memo != new_memol; temp_memo=temp_memo->next) {
+            if (memo_clist_shows(&(temp_memo->mmemo), show_priv)) {
+               new_row++;
+            }
+         }
+         gtk_clist_insert(GTK_CLIST(clist), new_row, empty_line);
+         memo_clist_set_row(clist, new_row, &(new_memol->mmemo));
+         if (new_row < first) first = new_row;
+         if (new_row > last) last = new_row;
+      }
+   }
+
+   /* The rows in between moved up or down by one and need new numbers */
+   entries_shown = GTK_CLIST(clist)->rows;
+   if (entries_shown != entries_before) {
+      last = entries_shown - 1;
+   }
+   if (first <= last) {
+      memo_clist_renumber(first, last);
+   }
+
+   /* GTK may have moved the selection while rows were removed, the row
+    * selected below has to emit a select_row to fill in the details */
+   clist_unselect_all(GTK_CLIST(clist));
+   gtk_signal_connect(GTK_OBJECT(clist), "select_row",
+                      GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+
+   if (new_row >= 0) {
+      clist_row_selected = new_row;
+   }
+   if (entries_shown>0) {
+      if (clist_row_selected >= entries_shown) {
+         clist_row_selected = 0;
+      }
+      clist_select_row(GTK_CLIST(clist), clist_row_selected, 0);
+      if (!gtk_clist_row_is_visible(GTK_CLIST(clist), clist_row_selected)) {
+         gtk_clist_moveto(GTK_CLIST(clist), clist_row_selected, 0, 0.5, 0.0);
+      }
+   }
+
+   gtk_clist_thaw(GTK_CLIST(clist));
+
+   get_pref(PREF_SHOW_TOOLTIPS, &show_tooltips, NULL);
+   for (num_entries=0, temp_memo=glob_memo_list; temp_memo; temp_memo=temp_memo->next) {
+      num_entries++;
+   }
+   sprintf(str, _("%d of %d records"), entries_shown, num_entries);
+   set_tooltip(show_tooltips, glob_tooltips, category_menu1, str, NULL);
+
+   connect_changed_signals(CONNECT_SIGNALS);
+
+   gtk_widget_grab_focus(GTK_WIDGET(clist));
+
+   return EXIT_SUCCESS;
+}
+
 static int memo_find(void)
 {
    int r, found_at;
@@ -245,6 +245,18 @@ char *other_to_UTF(const char *buf, int buf_len)
    return outbuf;
 }
 
+/*
+ *           Conversion to UTF of several strings at once
+ *     No error recovery is attempted, the caller falls back on other_to_UTF
+ */
+char *other_to_UTF_len(const char *buf, gsize len, gsize *out_len)
+{
+   g_iconv(glob_frompda, NULL, NULL, NULL, NULL);
+
+   return (char *)g_convert_with_iconv((gchar *)buf, len, glob_frompda,
+                                       NULL, out_len, NULL);
+}
+
 /*
  *           Conversion to pda encoding using g_iconv
  */
@@ -18,6 +18,8 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  ******************************************************************************/
 
+#include <glib.h>
+
 /*
  * General charset conversion library header (using gconv)
  * Convert Palm  <-> Unix:
@@ -36,4 +38,7 @@ int otherconv_init(void);
 void otherconv_free(void); 
 
 char *other_to_UTF(const char *buf, int buf_len);
+/* Converts all len bytes of buf, '\0's included, in one call.  Returns NULL
+ * if any of them can not be converted. */
+char *other_to_UTF_len(const char *buf, gsize len, gsize *out_len);
 void UTF_to_other(char *const buf, int buf_len);
@@ -150,6 +150,7 @@ static prefType glob_prefs[NUM_PREFS] = {
    {"expense_sort_order", INTTYPE, INTTYPE, 0, NULL, 0},
    {"keyr_export_filename", CHARTYPE, CHARTYPE, 0, NULL, 0},
    {"external_editor", CHARTYPE, CHARTYPE, 0, NULL, 0},
+   {"incremental_backup", INTTYPE, INTTYPE, 1, NULL, 0},
 };
 
 struct name_list {
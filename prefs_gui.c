@@ -639,6 +639,10 @@ void cb_prefs_gui(GtkWidget *widget, gpointer data)
                       "changed", GTK_SIGNAL_FUNC(cb_backups_entry),
                       NULL);
 
+   /* Fetch only changed records when backing up */
+   add_checkbutton(_("Back up only changed records of databases (default YES)"),
+                   PREF_INCREMENTAL_BACKUP, vbox_settings, cb_checkbox_set_pref);
+
    /* Show deleted files check box */
    add_checkbutton(_("Show deleted records (default NO)"),
                    PREF_SHOW_DELETED, vbox_settings, cb_checkbox_set_pref);
@@ -36,6 +36,7 @@
 #include "sync.h"
 #include "prefs.h"
 #include "log.h"
+#include "trace.h"
 #include "i18n.h"
 #ifdef HAVE_LOCALE_H
 #  include <locale.h>
@@ -73,10 +74,16 @@ static void ps_strncat(char *dest, const char *src, int n);
 static FILE *print_open(void)
 {
    const char *command;
+   FILE *f;
 
    get_pref(PREF_PRINT_COMMAND, NULL, &command);
    if (command) {
-      return popen(command, "w");
+      f = popen(command, "w");
+      if (f) {
+         /* Ended by print_close() */
+         TRACE_BEGIN_DETAIL("print", command);
+      }
+      return f;
    } else {
       return NULL;
    }
@@ -85,6 +92,7 @@ static FILE *print_open(void)
 static void print_close(FILE *f)
 {
    pclose(f);
+   TRACE_END("print");
 }
 
 static int courier_12(void)
@@ -0,0 +1,895 @@
+/*******************************************************************************
+ * query.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/*
+ * Filtering of the local databases with output as newline delimited JSON.
+ * Used by the command line tools.
+ */
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <pi-dlp.h>
+#include <pi-calendar.h>
+#include <pi-address.h>
+#include <pi-todo.h>
+#include <pi-memo.h>
+
+#include "i18n.h"
+#include "utils.h"
+#include "log.h"
+#include "prefs.h"
+#include "calendar.h"
+#include "datebook.h"
+#include "address.h"
+#include "todo.h"
+#include "memo.h"
+#include "query.h"
+
+/********************************* Constants **********************************/
+/* Repeating events are expanded day by day for ranges up to this length.
+ * Longer or open ended ranges match any repeat which overlaps them. */
+#define QUERY_MAX_RANGE_DAYS 366
+
+#define QUERY_MAX_FIELDS NUM_CONTACT_ENTRIES
+
+/* Names of the contact entries as used in field terms and JSON output */
+static const struct {
+   int entry;
+   const char *name;
+} contact_field_names[] = {
+   {contLastname,  "lastname"},
+   {contFirstname, "firstname"},
+   {contCompany,   "company"},
+   {contTitle,     "title"},
+   {contPhone1,    "phone1"},
+   {contPhone2,    "phone2"},
+   {contPhone3,    "phone3"},
+   {contPhone4,    "phone4"},
+   {contPhone5,    "phone5"},
+   {contPhone6,    "phone6"},
+   {contPhone7,    "phone7"},
+   {contIM1,       "im1"},
+   {contIM2,       "im2"},
+   {contWebsite,   "website"},
+   {contAddress1,  "address1"},
+   {contCity1,     "city1"},
+   {contState1,    "state1"},
+   {contZip1,      "zip1"},
+   {contCountry1,  "country1"},
+   {contAddress2,  "address2"},
+   {contCity2,     "city2"},
+   {contState2,    "state2"},
+   {contZip2,      "zip2"},
+   {contCountry2,  "country2"},
+   {contAddress3,  "address3"},
+   {contCity3,     "city3"},
+   {contState3,    "state3"},
+   {contZip3,      "zip3"},
+   {contCountry3,  "country3"},
+   {contCustom1,   "custom1"},
+   {contCustom2,   "custom2"},
+   {contCustom3,   "custom3"},
+   {contCustom4,   "custom4"},
+   {contCustom5,   "custom5"},
+   {contCustom6,   "custom6"},
+   {contCustom7,   "custom7"},
+   {contCustom8,   "custom8"},
+   {contCustom9,   "custom9"},
+   {contNote,      "note"}
+};
+
+#define NUM_CONTACT_FIELD_NAMES \
+   (sizeof(contact_field_names)/sizeof(contact_field_names[0]))
+
+/* Names of the text fields of datebook, todo and memo records */
+static const char *record_field_names[] = {
+   "description", "location", "text"
+};
+
+#define NUM_RECORD_FIELD_NAMES \
+   (sizeof(record_field_names)/sizeof(record_field_names[0]))
+
+/* The searchable text of one record */
+struct query_record
+{
+   const char *db;
+   unsigned int unique_id;
+   unsigned char attrib;
+   PCRecType rt;
+   int num_fields;
+   const char *names[QUERY_MAX_FIELDS];
+   const char *values[QUERY_MAX_FIELDS];
+};
+
+/****************************** Main Code *************************************/
+void query_filter_init(struct query_filter *qf)
+{
+   memset(qf, 0, sizeof(*qf));
+   qf->dbs = QUERY_DB_ALL;
+   qf->privates = QUERY_PRIVATE_NO;
+}
+
+int query_parse_date(const char *str, struct tm *date)
+{
+   time_t ltime;
+   int year, mon, day;
+
+   if (!strcasecmp(str, "today")) {
+      time(&ltime);
+      memcpy(date, localtime(&ltime), sizeof(struct tm));
+   } else {
+      if ((sscanf(str, "%d/%d/%d", &year, &mon, &day) != 3) &&
+          (sscanf(str, "%d-%d-%d", &year, &mon, &day) != 3)) {
+         return EXIT_FAILURE;
+      }
+      if ((year < 1904) || (mon < 1) || (mon > 12) || (day < 1) || (day > 31)) {
+         return EXIT_FAILURE;
+      }
+      memset(date, 0, sizeof(struct tm));
+      date->tm_year = year - 1900;
+      date->tm_mon = mon - 1;
+      date->tm_mday = day;
+   }
+   date->tm_hour = 12;
+   date->tm_min = 0;
+   date->tm_sec = 0;
+   date->tm_isdst = -1;
+   mktime(date);
+
+   return EXIT_SUCCESS;
+}
+
+static int query_parse_dbs(const char *str)
+{
+   char *list, *name, *save;
+   int dbs = 0;
+
+   list = strdup(str);
+   for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+      if (!strcasecmp(name, "datebook") || !strcasecmp(name, "calendar")) {
+         dbs |= QUERY_DB_DATEBOOK;
+      } else if (!strcasecmp(name, "address") || !strcasecmp(name, "contacts")) {
+         dbs |= QUERY_DB_ADDRESS;
+      } else if (!strcasecmp(name, "todo") || !strcasecmp(name, "tasks")) {
+         dbs |= QUERY_DB_TODO;
+      } else if (!strcasecmp(name, "memo") || !strcasecmp(name, "memos")) {
+         dbs |= QUERY_DB_MEMO;
+      } else if (!strcasecmp(name, "all")) {
+         dbs |= QUERY_DB_ALL;
+      } else {
+         fprintf(stderr, _("Unknown database: %s\n"), name);
+         dbs = 0;
+         break;
+      }
+   }
+   free(list);
+
+   return dbs;
+}
+
+int query_field_name_valid(const char *name)
+{
+   int i;
+
+   for (i=0; i<NUM_CONTACT_FIELD_NAMES; i++) {
+      if (!strcasecmp(name, contact_field_names[i].name)) {
+         return TRUE;
+      }
+   }
+   for (i=0; i<NUM_RECORD_FIELD_NAMES; i++) {
+      if (!strcasecmp(name, record_field_names[i])) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+void query_fprint_field_names(FILE *out)
+{
+   const char *name;
+   int i, col;
+
+   col = 0;
+   for (i=0; i<NUM_RECORD_FIELD_NAMES + NUM_CONTACT_FIELD_NAMES; i++) {
+      if (i < NUM_RECORD_FIELD_NAMES) {
+         name = record_field_names[i];
+      } else {
+         name = contact_field_names[i - NUM_RECORD_FIELD_NAMES].name;
+      }
+      if ((col > 0) && (col + strlen(name) + 2 > 72)) {
+         fprintf(out, ",\n");
+         col = 0;
+      }
+      col += fprintf(out, "%s%s", col ? ", " : "    ", name);
+   }
+   fprintf(out, "\n");
+}
+
+int query_parse_option(struct query_filter *qf, int argc, char *argv[], int *i)
+{
+   const char *opt;
+   const char *arg;
+   char *eq;
+
+   opt = argv[*i];
+
+   if (!strcmp(opt, "--case-sensitive")) {
+      qf->case_sense = TRUE;
+      return 1;
+   }
+   if (!strcmp(opt, "--modified")) {
+      qf->modified = TRUE;
+      return 1;
+   }
+
+   if (strcmp(opt, "--db") &&
+       strcmp(opt, "--contains") &&
+       strcmp(opt, "--field") &&
+       strcmp(opt, "--category") &&
+       strcmp(opt, "--private") &&
+       strcmp(opt, "--from") &&
+       strcmp(opt, "--to") &&
+       strcmp(opt, "--due-before")) {
+      return 0;
+   }
+
+   if (*i + 1 >= argc) {
+      fprintf(stderr, _("Missing argument for %s\n"), opt);
+      return -1;
+   }
+   (*i)++;
+   arg = argv[*i];
+
+   if (!strcmp(opt, "--db")) {
+      qf->dbs = query_parse_dbs(arg);
+      if (!qf->dbs) {
+         return -1;
+      }
+   } else if (!strcmp(opt, "--contains")) {
+      qf->contains = arg;
+   } else if (!strcmp(opt, "--field")) {
+      eq = strchr(arg, '=');
+      if ((!eq) || (eq == arg) || (qf->num_terms >= QUERY_MAX_FIELD_TERMS)) {
+         fprintf(stderr, _("Bad field term: %s\n"), arg);
+         return -1;
+      }
+      /* Split the argument in place into field name and text */
+      *eq = '\0';
+      if (!query_field_name_valid(arg)) {
+         fprintf(stderr, _("Unknown field: %s, the fields are:\n"), arg);
+         query_fprint_field_names(stderr);
+         *eq = '=';
+         return -1;
+      }
+      qf->terms[qf->num_terms].field = arg;
+      qf->terms[qf->num_terms].text = eq + 1;
+      qf->num_terms++;
+   } else if (!strcmp(opt, "--category")) {
+      qf->category = arg;
+   } else if (!strcmp(opt, "--private")) {
+      if (!strcasecmp(arg, "yes")) {
+         qf->privates = QUERY_PRIVATE_YES;
+      } else if (!strcasecmp(arg, "no")) {
+         qf->privates = QUERY_PRIVATE_NO;
+      } else if (!strcasecmp(arg, "any")) {
+         qf->privates = QUERY_PRIVATE_ANY;
+      } else {
+         fprintf(stderr, _("Bad value for %s: %s\n"), opt, arg);
+         return -1;
+      }
+   } else {
+      struct tm *date;
+
+      if (!strcmp(opt, "--from")) {
+         qf->have_from = TRUE;
+         date = &(qf->from);
+      } else if (!strcmp(opt, "--to")) {
+         qf->have_to = TRUE;
+         date = &(qf->to);
+      } else {
+         qf->have_due_before = TRUE;
+         date = &(qf->due_before);
+      }
+      if (query_parse_date(arg, date)) {
+         fprintf(stderr, _("Bad date: %s\n"), arg);
+         return -1;
+      }
+   }
+
+   return 1;
+}
+
+void query_fprint_usage(FILE *out)
+{
+   fprintf(out, _(" --db LIST           comma separated list of datebook, address, todo, memo.\n"));
+   fprintf(out, _(" --contains TEXT     any text field contains TEXT.\n"));
+   fprintf(out, _(" --field NAME=TEXT   field NAME contains TEXT (may be repeated).\n"));
+   fprintf(out, _("   NAME is one of:\n"));
+   query_fprint_field_names(out);
+   fprintf(out, _(" --category NAME     records in category NAME or number.\n"));
+   fprintf(out, _(" --from DATE         events on or after DATE, todos due on or after DATE.\n"));
+   fprintf(out, _(" --to DATE           events on or before DATE, todos due on or before DATE.\n"));
+   fprintf(out, _(" --due-before DATE   todos due before DATE.\n"));
+   fprintf(out, _(" --private yes|no|any  select private records (default no).\n"));
+   fprintf(out, _(" --modified          records changed since the last sync.\n"));
+   fprintf(out, _(" --case-sensitive    text matches are case sensitive.\n"));
+   fprintf(out, _(" DATE is YYYY/MM/DD, YYYY-MM-DD or today.\n"));
+}
+
+/******************************** JSON output *********************************/
+void json_fprint_string(FILE *out, const char *str)
+{
+   const unsigned char *p;
+
+   if (!str) {
+      fputs("null", out);
+      return;
+   }
+
+   fputc('"', out);
+   for (p = (const unsigned char *)str; *p; p++) {
+      switch (*p) {
+       case '"':  fputs("\\\"", out); break;
+       case '\\': fputs("\\\\", out); break;
+       case '\n': fputs("\\n", out); break;
+       case '\r': fputs("\\r", out); break;
+       case '\t': fputs("\\t", out); break;
+       default:
+         if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+         } else {
+            fputc(*p, out);
+         }
+      }
+   }
+   fputc('"', out);
+}
+
+static void json_fprint_date(FILE *out, const char *name,
+                             const struct tm *date, int with_time)
+{
+   char str[32];
+
+   if (with_time) {
+      strftime(str, sizeof(str), "%Y-%m-%dT%H:%M:%S", date);
+   } else {
+      strftime(str, sizeof(str), "%Y-%m-%d", date);
+   }
+   fprintf(out, ",\"%s\":\"%s\"", name, str);
+}
+
+static void json_fprint_bool(FILE *out, const char *name, int value)
+{
+   fprintf(out, ",\"%s\":%s", name, value ? "true" : "false");
+}
+
+/* Open the JSON object of a record with the fields common to all dbs */
+static void query_fprint_head(FILE *out, struct query_record *qr,
+                              char *cat_names[])
+{
+   fprintf(out, "{\"db\":\"%s\",\"id\":%u", qr->db, qr->unique_id);
+   fputs(",\"category\":", out);
+   json_fprint_string(out, cat_names[qr->attrib & 0x0F]);
+   json_fprint_bool(out, "private", qr->attrib & dlpRecAttrSecret);
+   json_fprint_bool(out, "modified",
+                    (qr->rt == NEW_PC_REC) || (qr->rt == REPLACEMENT_PALM_REC));
+}
+
+/* Write the text fields and close the JSON object of a record */
+static void query_fprint_tail(FILE *out, struct query_record *qr)
+{
+   int i;
+
+   for (i=0; i<qr->num_fields; i++) {
+      if ((qr->values[i]) && (qr->values[i][0])) {
+         fprintf(out, ",\"%s\":", qr->names[i]);
+         json_fprint_string(out, qr->values[i]);
+      }
+   }
+   fputs("}\n", out);
+}
+
+/********************************** Matching **********************************/
+static void query_add_field(struct query_record *qr,
+                            const char *name, const char *value)
+{
+   if (qr->num_fields < QUERY_MAX_FIELDS) {
+      qr->names[qr->num_fields] = name;
+      qr->values[qr->num_fields] = value;
+      qr->num_fields++;
+   }
+}
+
+/* Check the terms common to all record types */
+static int query_match_record(struct query_filter *qf,
+                              struct query_record *qr,
+                              char *cat_names[])
+{
+   const char *cat;
+   char *end;
+   long cat_num;
+   int i, t, found;
+
+   if (qf->privates == QUERY_PRIVATE_NO) {
+      if (qr->attrib & dlpRecAttrSecret) return FALSE;
+   } else if (qf->privates == QUERY_PRIVATE_YES) {
+      if (!(qr->attrib & dlpRecAttrSecret)) return FALSE;
+   }
+
+   if (qf->modified &&
+       (qr->rt != NEW_PC_REC) && (qr->rt != REPLACEMENT_PALM_REC)) {
+      return FALSE;
+   }
+
+   if (qf->category) {
+      cat_num = strtol(qf->category, &end, 10);
+      if ((*end == '\0') && (end != qf->category)) {
+         if (cat_num != (qr->attrib & 0x0F)) return FALSE;
+      } else {
+         cat = cat_names[qr->attrib & 0x0F];
+         if ((!cat) || (strcasecmp(cat, qf->category))) return FALSE;
+      }
+   }
+
+   if (qf->contains) {
+      found = FALSE;
+      for (i=0; i<qr->num_fields; i++) {
+         if (jp_strstr(qr->values[i], qf->contains, qf->case_sense)) {
+            found = TRUE;
+            break;
+         }
+      }
+      if (!found) return FALSE;
+   }
+
+   for (t=0; t<qf->num_terms; t++) {
+      found = FALSE;
+      for (i=0; i<qr->num_fields; i++) {
+         if (!strcasecmp(qr->names[i], qf->terms[t].field)) {
+            if (jp_strstr(qr->values[i], qf->terms[t].text, qf->case_sense)) {
+               found = TRUE;
+            }
+            break;
+         }
+      }
+      if (!found) return FALSE;
+   }
+
+   return TRUE;
+}
+
+static int query_date_terms(struct query_filter *qf)
+{
+   return qf->have_from || qf->have_to || qf->have_due_before;
+}
+
+static int query_event_in_range(struct query_filter *qf,
+                                struct CalendarEvent *cale)
+{
+   struct tm date;
+   int begin_days, from_days, to_days;
+   int i;
+
+   if (qf->have_due_before) {
+      return FALSE;
+   }
+   if (!qf->have_from && !qf->have_to) {
+      return TRUE;
+   }
+
+   begin_days = dateToDays(&(cale->begin));
+   from_days = qf->have_from ? dateToDays(&(qf->from)) : 0;
+   to_days = qf->have_to ? dateToDays(&(qf->to)) : 0;
+
+   if (cale->repeatType == calendarRepeatNone) {
+      if (qf->have_from && (begin_days < from_days)) return FALSE;
+      if (qf->have_to && (begin_days > to_days)) return FALSE;
+      return TRUE;
+   }
+
+   /* Repeating event */
+   if (qf->have_to && (begin_days > to_days)) return FALSE;
+   if (qf->have_from && !(cale->repeatForever) &&
+       (dateToDays(&(cale->repeatEnd)) < from_days)) {
+      return FALSE;
+   }
+   if (!qf->have_from || !qf->have_to ||
+       (to_days - from_days >= QUERY_MAX_RANGE_DAYS)) {
+      return TRUE;
+   }
+
+   memcpy(&date, &(qf->from), sizeof(struct tm));
+   for (i=from_days; i<=to_days; i++) {
+      if (calendar_isApptOnDate(cale, &date)) {
+         return TRUE;
+      }
+      add_days_to_date(&date, 1);
+   }
+
+   return FALSE;
+}
+
+static int query_todo_in_range(struct query_filter *qf, struct ToDo *todo)
+{
+   int due_days;
+
+   if (!query_date_terms(qf)) {
+      return TRUE;
+   }
+   if (todo->indefinite) {
+      return FALSE;
+   }
+
+   due_days = dateToDays(&(todo->due));
+   if (qf->have_from && (due_days < dateToDays(&(qf->from)))) return FALSE;
+   if (qf->have_to && (due_days > dateToDays(&(qf->to)))) return FALSE;
+   if (qf->have_due_before &&
+       (due_days >= dateToDays(&(qf->due_before)))) return FALSE;
+
+   return TRUE;
+}
+
+/*************************** Category name lookup *****************************/
+static void query_load_cat_names(struct CategoryAppInfo *cai, char *cat_names[])
+{
+   long char_set;
+   int i;
+
+   get_pref(PREF_CHAR_SET, &char_set, NULL);
+
+   for (i=0; i<NUM_CATEGORIES; i++) {
+      if (cai->name[i][0]) {
+         cat_names[i] = charset_p2newj(cai->name[i], -1, char_set);
+      } else {
+         cat_names[i] = NULL;
+      }
+   }
+}
+
+static void query_free_cat_names(char *cat_names[])
+{
+   int i;
+
+   for (i=0; i<NUM_CATEGORIES; i++) {
+      if (cat_names[i]) {
+         g_free(cat_names[i]);
+         cat_names[i] = NULL;
+      }
+   }
+}
+
+/* The category to have the database loaders filter on: CATEGORY_ALL
+ * without a category term, -1 if no category matches the term */
+static int query_load_category(struct query_filter *qf, char *cat_names[])
+{
+   char *end;
+   long cat_num;
+   int i;
+
+   if (!qf->category) {
+      return CATEGORY_ALL;
+   }
+   cat_num = strtol(qf->category, &end, 10);
+   if ((*end == '\0') && (end != qf->category)) {
+      return ((cat_num >= 0) && (cat_num < NUM_CATEGORIES)) ? cat_num : -1;
+   }
+   for (i=0; i<NUM_CATEGORIES; i++) {
+      if ((cat_names[i]) && (!strcasecmp(cat_names[i], qf->category))) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+/* Private records are left out by the loaders unless they are asked for */
+static int query_load_privates(struct query_filter *qf)
+{
+   return (qf->privates == QUERY_PRIVATE_NO) ? 0 : 1;
+}
+
+/******************************** Databases ***********************************/
+static int query_datebook(struct query_filter *qf, FILE *out)
+{
+   CalendarEventList *ce_list, *temp_cel;
+   struct CalendarEvent *cale;
+   struct CalendarAppInfo cai;
+   struct query_record qr;
+   struct tm *day;
+   char *cat_names[NUM_CATEGORIES];
+   long datebook_version;
+   int category;
+   int count;
+
+   /* Events have no due date */
+   if (qf->have_due_before) {
+      return 0;
+   }
+
+   get_pref(PREF_DATEBOOK_VERSION, &datebook_version, NULL);
+   get_calendar_or_datebook_app_info(&cai, datebook_version);
+   query_load_cat_names(&(cai.category), cat_names);
+
+   category = query_load_category(qf, cat_names);
+   if (category < 0) {
+      query_free_cat_names(cat_names);
+      return 0;
+   }
+
+   /* The loader drops the events not on a single day before converting
+    * and copying them */
+   day = NULL;
+   if (qf->have_from && qf->have_to &&
+       (dateToDays(&(qf->from)) == dateToDays(&(qf->to)))) {
+      day = &(qf->from);
+   }
+
+   ce_list = NULL;
+   get_days_calendar_events2(&ce_list, day, 0, 0, query_load_privates(qf),
+                             category, NULL);
+
+   count = 0;
+   for (temp_cel = ce_list; temp_cel; temp_cel=temp_cel->next) {
+      cale = &(temp_cel->mcale.cale);
+
+      memset(&qr, 0, sizeof(qr));
+      qr.db = "datebook";
+      qr.unique_id = temp_cel->mcale.unique_id;
+      qr.attrib = temp_cel->mcale.attrib;
+      qr.rt = temp_cel->mcale.rt;
+      query_add_field(&qr, "description", cale->description);
+      query_add_field(&qr, "note", cale->note);
+      if (datebook_version) {
+         query_add_field(&qr, "location", cale->location);
+      }
+
+      if (!query_event_in_range(qf, cale) ||
+          !query_match_record(qf, &qr, cat_names)) {
+         continue;
+      }
+
+      query_fprint_head(out, &qr, cat_names);
+      json_fprint_date(out, "begin", &(cale->begin), !(cale->event));
+      json_fprint_date(out, "end", &(cale->end), !(cale->event));
+      json_fprint_bool(out, "untimed", cale->event);
+      json_fprint_bool(out, "alarm", cale->alarm);
+      json_fprint_bool(out, "repeat", cale->repeatType != calendarRepeatNone);
+      if ((cale->repeatType != calendarRepeatNone) && !(cale->repeatForever)) {
+         json_fprint_date(out, "repeat_end", &(cale->repeatEnd), FALSE);
+      }
+      query_fprint_tail(out, &qr);
+      count++;
+   }
+
+   free_CalendarEventList(&ce_list);
+   query_free_cat_names(cat_names);
+
+   return count;
+}
+
+static int query_address(struct query_filter *qf, FILE *out)
+{
+   AddressList *addr_list;
+   ContactList *cont_list, *temp_cl;
+   struct AddressAppInfo aai;
+   struct ContactAppInfo cai;
+   struct Contact *cont;
+   struct query_record qr;
+   char *cat_names[NUM_CATEGORIES];
+   long address_version;
+   unsigned int i;
+   int category;
+   int count;
+
+   /* Dates only apply to events and todos */
+   if (query_date_terms(qf)) {
+      return 0;
+   }
+
+   get_pref(PREF_ADDRESS_VERSION, &address_version, NULL);
+
+   cont_list = NULL;
+   if (address_version==0) {
+      get_address_app_info(&aai);
+      query_load_cat_names(&(aai.category), cat_names);
+      category = query_load_category(qf, cat_names);
+      addr_list = NULL;
+      if (category >= 0) {
+         get_addresses2(&addr_list, SORT_ASCENDING, 0, 0,
+                        query_load_privates(qf), category);
+      }
+      copy_addresses_to_contacts(addr_list, &cont_list);
+      free_AddressList(&addr_list);
+   } else {
+      get_contact_app_info(&cai);
+      query_load_cat_names(&(cai.category), cat_names);
+      category = query_load_category(qf, cat_names);
+      if (category >= 0) {
+         get_contacts2(&cont_list, SORT_ASCENDING, 0, 0,
+                       query_load_privates(qf), category);
+      }
+   }
+
+   count = 0;
+   for (temp_cl = cont_list; temp_cl; temp_cl=temp_cl->next) {
+      cont = &(temp_cl->mcont.cont);
+
+      memset(&qr, 0, sizeof(qr));
+      qr.db = "address";
+      qr.unique_id = temp_cl->mcont.unique_id;
+      qr.attrib = temp_cl->mcont.attrib;
+      qr.rt = temp_cl->mcont.rt;
+      for (i=0; i<NUM_CONTACT_FIELD_NAMES; i++) {
+         query_add_field(&qr, contact_field_names[i].name,
+                         cont->entry[contact_field_names[i].entry]);
+      }
+
+      if (!query_match_record(qf, &qr, cat_names)) {
+         continue;
+      }
+
+      query_fprint_head(out, &qr, cat_names);
+      if (cont->birthdayFlag) {
+         json_fprint_date(out, "birthday", &(cont->birthday), FALSE);
+      }
+      query_fprint_tail(out, &qr);
+      count++;
+   }
+
+   free_ContactList(&cont_list);
+   query_free_cat_names(cat_names);
+
+   return count;
+}
+
+static int query_todo(struct query_filter *qf, FILE *out)
+{
+   ToDoList *todo_list, *temp_todo;
+   struct ToDo *todo;
+   struct ToDoAppInfo ai;
+   struct query_record qr;
+   char *cat_names[NUM_CATEGORIES];
+   int category;
+   int count;
+
+   get_todo_app_info(&ai);
+   query_load_cat_names(&(ai.category), cat_names);
+
+   category = query_load_category(qf, cat_names);
+   if (category < 0) {
+      query_free_cat_names(cat_names);
+      return 0;
+   }
+
+   todo_list = NULL;
+   get_todos2(&todo_list, SORT_ASCENDING, 0, 0, query_load_privates(qf), 1,
+              category);
+
+   count = 0;
+   for (temp_todo = todo_list; temp_todo; temp_todo=temp_todo->next) {
+      todo = &(temp_todo->mtodo.todo);
+
+      memset(&qr, 0, sizeof(qr));
+      qr.db = "todo";
+      qr.unique_id = temp_todo->mtodo.unique_id;
+      qr.attrib = temp_todo->mtodo.attrib;
+      qr.rt = temp_todo->mtodo.rt;
+      query_add_field(&qr, "description", todo->description);
+      query_add_field(&qr, "note", todo->note);
+
+      if (!query_todo_in_range(qf, todo) ||
+          !query_match_record(qf, &qr, cat_names)) {
+         continue;
+      }
+
+      query_fprint_head(out, &qr, cat_names);
+      if (!todo->indefinite) {
+         json_fprint_date(out, "due", &(todo->due), FALSE);
+      }
+      fprintf(out, ",\"priority\":%d", todo->priority);
+      json_fprint_bool(out, "complete", todo->complete);
+      query_fprint_tail(out, &qr);
+      count++;
+   }
+
+   free_ToDoList(&todo_list);
+   query_free_cat_names(cat_names);
+
+   return count;
+}
+
+static int query_memo(struct query_filter *qf, FILE *out)
+{
+   MemoList *memo_list, *temp_memo;
+   struct MemoAppInfo ai;
+   struct query_record qr;
+   char *cat_names[NUM_CATEGORIES];
+   int category;
+   int count;
+
+   if (query_date_terms(qf)) {
+      return 0;
+   }
+
+   get_memo_app_info(&ai);
+   query_load_cat_names(&(ai.category), cat_names);
+
+   category = query_load_category(qf, cat_names);
+   if (category < 0) {
+      query_free_cat_names(cat_names);
+      return 0;
+   }
+
+   memo_list = NULL;
+   get_memos2(&memo_list, SORT_ASCENDING, 0, 0, query_load_privates(qf),
+              category);
+
+   count = 0;
+   for (temp_memo = memo_list; temp_memo; temp_memo=temp_memo->next) {
+      memset(&qr, 0, sizeof(qr));
+      qr.db = "memo";
+      qr.unique_id = temp_memo->mmemo.unique_id;
+      qr.attrib = temp_memo->mmemo.attrib;
+      qr.rt = temp_memo->mmemo.rt;
+      query_add_field(&qr, "text", temp_memo->mmemo.memo.text);
+
+      if (!query_match_record(qf, &qr, cat_names)) {
+         continue;
+      }
+
+      query_fprint_head(out, &qr, cat_names);
+      query_fprint_tail(out, &qr);
+      count++;
+   }
+
+   free_MemoList(&memo_list);
+   query_free_cat_names(cat_names);
+
+   return count;
+}
+
+int query_run(struct query_filter *qf, FILE *out)
+{
+   int count = 0;
+
+   if (qf->dbs & QUERY_DB_DATEBOOK) {
+      count += query_datebook(qf, out);
+   }
+   if (qf->dbs & QUERY_DB_ADDRESS) {
+      count += query_address(qf, out);
+   }
+   if (qf->dbs & QUERY_DB_TODO) {
+      count += query_todo(qf, out);
+   }
+   if (qf->dbs & QUERY_DB_MEMO) {
+      count += query_memo(qf, out);
+   }
+
+   if (fflush(out)) {
+      return -1;
+   }
+
+   return count;
+}
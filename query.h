@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * query.h
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include <stdio.h>
+#include <time.h>
+
+/* Databases a query can be run over */
+#define QUERY_DB_DATEBOOK 0x01
+#define QUERY_DB_ADDRESS  0x02
+#define QUERY_DB_TODO     0x04
+#define QUERY_DB_MEMO     0x08
+#define QUERY_DB_ALL      0x0F
+
+/* Handling of records marked private */
+#define QUERY_PRIVATE_NO  0  /* only public records (default) */
+#define QUERY_PRIVATE_YES 1  /* only private records */
+#define QUERY_PRIVATE_ANY 2  /* both */
+
+#define QUERY_MAX_FIELD_TERMS 16
+
+/* A "field contains text" term, e.g. lastname=smith */
+struct query_term
+{
+   const char *field;
+   const char *text;
+};
+
+/* All terms of a query must match for a record to be output.
+ * Date terms only match records that carry that date, so address
+ * and memo records never match a query with a date term. */
+struct query_filter
+{
+   int dbs;
+   int case_sense;
+   const char *contains;
+   int num_terms;
+   struct query_term terms[QUERY_MAX_FIELD_TERMS];
+   const char *category;
+   int privates;
+   int have_from;
+   struct tm from;
+   int have_to;
+   struct tm to;
+   int have_due_before;
+   struct tm due_before;
+   /* Only records changed on the PC since the last sync */
+   int modified;
+};
+
+void query_filter_init(struct query_filter *qf);
+
+/* Dates are YYYY/MM/DD, YYYY-MM-DD or "today" */
+int query_parse_date(const char *str, struct tm *date);
+
+/*
+ * Parse the query option at argv[*i], advancing *i past its argument.
+ * Returns 1 if the option was consumed, 0 if it is not a query option,
+ * and -1 if it is a query option with a bad or missing argument.
+ */
+int query_parse_option(struct query_filter *qf, int argc, char *argv[], int *i);
+
+void query_fprint_usage(FILE *out);
+
+/* The names a --field term can use, the text fields of every database */
+int query_field_name_valid(const char *name);
+void query_fprint_field_names(FILE *out);
+
+/* Write each matching record as one JSON object per line (NDJSON).
+ * Returns the number of records written, or -1 on error. */
+int query_run(struct query_filter *qf, FILE *out);
+
+/* Write str as a quoted and escaped JSON string */
+void json_fprint_string(FILE *out, const char *str);
+
+#endif
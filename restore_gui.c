@@ -34,28 +34,81 @@
 #include "prefs.h"
 #include "sync.h"
 #include "log.h"
+#include "backup_store.h"
 #include "restore.h"
 
 /******************************* Global vars **********************************/
 static GtkWidget *user_entry;
 static GtkWidget *user_id_entry;
 static GtkWidget *restore_clist;
+/* Backups in the backup store, newest first */
+static GList *manifests;
+static struct backup_entry *backup_entries;
+static int manifest_selected;
 
 /****************************** Main Code *************************************/
 static gboolean cb_restore_destroy(GtkWidget *widget)
 {
+   backup_store_free_entries(&backup_entries);
+   backup_store_free_manifests(&manifests);
+
    gtk_main_quit();
 
    return FALSE;
 }
 
+static struct backup_entry *find_backup_entry(const char *name)
+{
+   struct backup_entry *temp_entry;
+
+   for (temp_entry = backup_entries; temp_entry; temp_entry = temp_entry->next) {
+      if (!strcmp(temp_entry->name, name)) {
+         return temp_entry;
+      }
+   }
+   return NULL;
+}
+
+/* Databases restored from the backup store are copied out to
+ * JPILOT_HOME/restore to be installed from there */
+static void clean_restore_dir(const char *restore_dir)
+{
+   DIR *dir;
+   struct dirent *dirent;
+   char file[FILENAME_MAX];
+
+   mkdir(restore_dir, 0700);
+   dir = opendir(restore_dir);
+   if (!dir) {
+      return;
+   }
+   while ((dirent = readdir(dir))) {
+      if (dirent->d_name[0]=='.') {
+         continue;
+      }
+      g_snprintf(file, sizeof(file), "%s/%s", restore_dir, dirent->d_name);
+      unlink(file);
+   }
+   closedir(dir);
+}
+
+static void install_backup_file(struct backup_entry *entry, char *backup_file)
+{
+   if (entry && backup_store_extract(entry, backup_file)) {
+      return;
+   }
+   install_append_line(backup_file);
+}
+
 static void cb_restore_ok(GtkWidget *widget, gpointer data)
 {
    GList *list, *temp_list;
    char *text;
    char file[FILENAME_MAX], backup_file[FILENAME_MAX];
    char home_dir[FILENAME_MAX];
+   char restore_dir[FILENAME_MAX];
    struct stat buf, backup_buf;
+   struct backup_entry *entry;
    int r1, r2;
 
    list=GTK_CLIST(restore_clist)->selection;
@@ -66,16 +119,30 @@ static void cb_restore_ok(GtkWidget *widget, gpointer data)
    g_snprintf(file, sizeof(file), "%s/"EPN".install", home_dir);
    unlink(file);
 
+   g_snprintf(restore_dir, sizeof(restore_dir), "%s/restore", home_dir);
+   clean_restore_dir(restore_dir);
+
    jp_logf(JP_LOG_WARN, "%s%s%s\n", "-----===== ", _("Restore Handheld"), " ======-----");
    for (temp_list=list; temp_list; temp_list = temp_list->next) {
       gtk_clist_get_text(GTK_CLIST(restore_clist), GPOINTER_TO_INT(temp_list->data), 0, &text);
       jp_logf(JP_LOG_DEBUG, "row %ld [%s]\n", (long) temp_list->data, text);
-      /* Look for the file in the JPILOT_HOME and JPILOT_HOME/backup.
+      /* Look for the file in the JPILOT_HOME and the chosen backup.
        * Restore the newest modified date one, or the only one.  */
       g_snprintf(file, sizeof(file), "%s/%s", home_dir, text);
-      g_snprintf(backup_file, sizeof(backup_file), "%s/backup/%s", home_dir, text);
       r1 = ! stat(file, &buf);
-      r2 = ! stat(backup_file, &backup_buf);
+      entry = NULL;
+      if (manifest_selected) {
+         entry = find_backup_entry(text);
+         g_snprintf(backup_file, sizeof(backup_file), "%s/%s", restore_dir, text);
+         r2 = (entry != NULL);
+         if (entry) {
+            backup_buf.st_mtime = entry->mtime;
+         }
+      } else {
+         /* No backups in the store yet */
+         g_snprintf(backup_file, sizeof(backup_file), "%s/backup/%s", home_dir, text);
+         r2 = ! stat(backup_file, &backup_buf);
+      }
       if (r1 && r2) {
          /* found in JPILOT_HOME and JPILOT_HOME/backup */
          if (buf.st_mtime > backup_buf.st_mtime) {
@@ -83,7 +150,7 @@ static void cb_restore_ok(GtkWidget *widget, gpointer data)
             install_append_line(file);
          } else {
             jp_logf(JP_LOG_DEBUG, "Restore: found in home and backup, using home/backup file %s\n", text);
-            install_append_line(backup_file);
+            install_backup_file(entry, backup_file);
          }
       } else if (r1) {
          /* only found in JPILOT_HOME */
@@ -92,7 +159,7 @@ static void cb_restore_ok(GtkWidget *widget, gpointer data)
       } else if (r2) {
          /* only found in JPILOT_HOME/backup */
          jp_logf(JP_LOG_DEBUG, "Restore: using home/backup file %s\n", text);
-         install_append_line(backup_file);
+         install_backup_file(entry, backup_file);
       }
    }
 
@@ -106,6 +173,26 @@ static void cb_restore_quit(GtkWidget *widget, gpointer data)
    gtk_widget_destroy(data);
 }
 
+static int restore_clist_append(const char *name)
+{
+   char *row_text[1];
+   gchar *utf8_text;
+
+   utf8_text = g_locale_to_utf8(name, -1, NULL, NULL, NULL);
+   if (!utf8_text) {
+      jp_logf(JP_LOG_GUI, _("Unable to convert filename for GTK display\n"));
+      jp_logf(JP_LOG_GUI, _("See console log to find which file will not be restored\n"));
+      jp_logf(JP_LOG_STDOUT|JP_LOG_FILE, _("Unable to convert filename for GTK display\n"));
+      jp_logf(JP_LOG_STDOUT|JP_LOG_FILE, _("File %s will not be restored\n"), name);
+      return EXIT_FAILURE;
+   }
+   row_text[0] = utf8_text;
+   gtk_clist_append(GTK_CLIST(restore_clist), row_text);
+   g_free(utf8_text);
+
+   return EXIT_SUCCESS;
+}
+
 /*
  * path is the dir to open
  * check_for_dups will check the clist and not add if its a duplicate
@@ -113,7 +200,6 @@ static void cb_restore_quit(GtkWidget *widget, gpointer data)
  */
 static int populate_clist_sub(char *path, int check_for_dups, int check_exts)
 {
-   char *row_text[1];
    DIR *dir;
    struct dirent *dirent;
    char last4[8];
@@ -165,21 +251,8 @@ static int populate_clist_sub(char *path, int check_for_dups, int check_exts)
             if (found) continue;
          }
 
-         row_text[0]=dirent->d_name;
-         {
-            gchar *utf8_text;
-
-            utf8_text = g_locale_to_utf8(row_text[0], -1, NULL, NULL, NULL);
-            if (!utf8_text) {
-               jp_logf(JP_LOG_GUI, _("Unable to convert filename for GTK display\n"));
-               jp_logf(JP_LOG_GUI, _("See console log to find which file will not be restored\n"));
-               jp_logf(JP_LOG_STDOUT|JP_LOG_FILE, _("Unable to convert filename for GTK display\n"));
-               jp_logf(JP_LOG_STDOUT|JP_LOG_FILE, _("File %s will not be restored\n"), row_text[0]);
-               continue;
-            }
-            row_text[0] = utf8_text;
-            gtk_clist_append(GTK_CLIST(restore_clist), row_text);
-            g_free(utf8_text);
+         if (restore_clist_append(dirent->d_name)) {
+            continue;
          }
          num++;
       }
@@ -193,20 +266,90 @@ static int populate_clist_sub(char *path, int check_for_dups, int check_exts)
 static int populate_clist(void)
 {
    char path[FILENAME_MAX];
-
-   get_home_file_name("backup", path, sizeof(path));
-   cleanup_path(path);
-   populate_clist_sub(path, 0, 0);
+   struct backup_entry *temp_entry;
+   GList *temp_list;
+
+   gtk_clist_freeze(GTK_CLIST(restore_clist));
+   gtk_clist_clear(GTK_CLIST(restore_clist));
+   backup_store_free_entries(&backup_entries);
+
+   temp_list = g_list_nth(manifests, manifest_selected-1);
+   if (manifest_selected && temp_list) {
+      backup_store_read_manifest(temp_list->data, &backup_entries);
+      for (temp_entry = backup_entries; temp_entry; temp_entry = temp_entry->next) {
+         restore_clist_append(temp_entry->name);
+      }
+   } else {
+      get_home_file_name("backup", path, sizeof(path));
+      cleanup_path(path);
+      populate_clist_sub(path, 0, 0);
+   }
 
    get_home_file_name("", path, sizeof(path));
    cleanup_path(path);
    populate_clist_sub(path, 1, 1);
 
    gtk_clist_select_all(GTK_CLIST(restore_clist));
+   gtk_clist_thaw(GTK_CLIST(restore_clist));
 
    return EXIT_SUCCESS;
 }
 
+static void cb_backup_menu(GtkWidget *widget, gpointer data)
+{
+   if (!GTK_CHECK_MENU_ITEM(widget)->active) {
+      return;
+   }
+   manifest_selected = GPOINTER_TO_INT(data);
+   populate_clist();
+}
+
+/* Option menu of the backups in the store, labelled with their dates */
+static GtkWidget *make_backup_menu(void)
+{
+   GtkWidget *option_menu;
+   GtkWidget *menu;
+   GtkWidget *menu_item;
+   GSList *group;
+   GList *temp_list;
+   const char *short_date;
+   char pref_time[50];
+   char str1[50], str2[50];
+   char label[100];
+   struct tm when;
+   int i;
+
+   get_pref(PREF_SHORTDATE, NULL, &short_date);
+   get_pref_time_no_secs(pref_time);
+
+   option_menu = gtk_option_menu_new();
+   menu = gtk_menu_new();
+   group = NULL;
+
+   for (i=1, temp_list = manifests; temp_list; i++, temp_list = temp_list->next) {
+      if (backup_store_manifest_time(temp_list->data, &when)) {
+         g_strlcpy(label, temp_list->data, sizeof(label));
+      } else {
+         strftime(str1, sizeof(str1), short_date, &when);
+         strftime(str2, sizeof(str2), pref_time, &when);
+         g_snprintf(label, sizeof(label), "%s %s", str1, str2);
+      }
+      menu_item = gtk_radio_menu_item_new_with_label(group, label);
+      group = gtk_radio_menu_item_group(GTK_RADIO_MENU_ITEM(menu_item));
+      gtk_menu_append(GTK_MENU(menu), menu_item);
+      if (i == manifest_selected) {
+         gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menu_item), TRUE);
+      }
+      gtk_signal_connect(GTK_OBJECT(menu_item), "activate",
+                         GTK_SIGNAL_FUNC(cb_backup_menu), GINT_TO_POINTER(i));
+      gtk_widget_show(menu_item);
+   }
+   gtk_option_menu_set_menu(GTK_OPTION_MENU(option_menu), menu);
+   gtk_option_menu_set_history(GTK_OPTION_MENU(option_menu), manifest_selected-1);
+
+   return option_menu;
+}
+
 int restore_gui(GtkWidget *main_window, int w, int h, int x, int y)
 {
    GtkWidget *restore_window;
@@ -257,6 +400,17 @@ int restore_gui(GtkWidget *main_window, int w, int h, int x, int y)
    gtk_misc_set_alignment(GTK_MISC(label), 0, 0);
    gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
 
+   /* Backup to restore from, the newest is the default */
+   backup_store_get_manifests(&manifests);
+   manifest_selected = manifests ? 1 : 0;
+   if (manifests) {
+      hbox = gtk_hbox_new(FALSE, 5);
+      gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+      label = gtk_label_new(_("Backup"));
+      gtk_box_pack_start(GTK_BOX(hbox), label, FALSE, FALSE, 0);
+      gtk_box_pack_start(GTK_BOX(hbox), make_backup_menu(), FALSE, FALSE, 0);
+   }
+
    /* List of files to restore */
    scrolled_window = gtk_scrolled_window_new(NULL, NULL);
    gtk_container_set_border_width(GTK_CONTAINER(scrolled_window), 0);
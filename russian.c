@@ -27,6 +27,8 @@
 /********************************* Includes ***********************************/
 #include "config.h"
 #include <stdlib.h>
+#include <string.h>
+
 #include "russian.h"
 
 /********************************* Constants **********************************/
@@ -100,28 +102,37 @@ static const unsigned char w2k[256] = {
    0xdc,0xdb,0xc7,0xd8,0xdd,0xd9,0xd7,0xda
 };
 
+/****************************** Prototypes ************************************/
+/* In utils.c, also a prototype in utils.h */
+size_t ascii_prefix_len(const char *buf, size_t len);
+
 /****************************** Main Code *************************************/
-void win1251_to_koi8(char *const buf, int buf_len)
+/* Both tables leave 7-bit ASCII as it is.  The bytes with the high bit set
+ * are mapped, the runs of ASCII between them are skipped a word at a time. */
+static void convert_high(char *const buf, int buf_len,
+                         const unsigned char *table)
 {
-   unsigned char *p;
-   int i;
+   unsigned char *p, *end;
 
-   if (buf == NULL) return;
+   if ((buf == NULL) || (buf_len <= 0)) return;
 
-   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
-      *p = w2k[(*p)];
+   end = memchr(buf, '\0', buf_len);
+   if (end == NULL) {
+      end = (unsigned char *)buf + buf_len;
+   }
+   p = (unsigned char *)buf;
+   while ((p += ascii_prefix_len((char *)p, end - p)) < end) {
+      *p = table[*p];
+      p++;
    }
 }
 
-void koi8_to_win1251(char *const buf, int buf_len)
+void win1251_to_koi8(char *const buf, int buf_len)
 {
-   unsigned char *p;
-   int i;
-
-   if (buf == NULL) return;
-
-   for (i=0, p = (unsigned char *)buf; *p && i < buf_len; p++, i++) {
-        *p = k2w[(*p)];
-   }
+   convert_high(buf, buf_len, w2k);
 }
 
+void koi8_to_win1251(char *const buf, int buf_len)
+{
+   convert_high(buf, buf_len, k2w);
+}
@@ -47,6 +47,62 @@
 /********************************* Constants **********************************/
 #define SEARCH_MAX_COLUMN_LEN 80
 
+/* Number of records examined each time the search idle handler runs */
+#define SEARCH_CHUNK_SIZE 100
+/* Milliseconds of typing inactivity before a search is started */
+#define SEARCH_TYPING_DELAY 250
+
+/* Search phases in the order they are run.
+ * A refined search replaces the four application phases. */
+#define SEARCH_PHASE_DATEBOOK 0
+#define SEARCH_PHASE_ADDRESS  1
+#define SEARCH_PHASE_TODO     2
+#define SEARCH_PHASE_MEMO     3
+#define SEARCH_PHASE_REFINE   4
+#define SEARCH_PHASE_PLUGINS  5
+#define SEARCH_PHASE_DONE     6
+
+/* A record which matched a search.
+ * The searchable text is kept so that a search for a longer needle
+ * can be answered from these results without re-reading the databases. */
+struct search_hit
+{
+   AppType app_type;
+   unsigned int unique_id;
+   const char *app_label;
+   char *date_str;
+   int num_fields;
+   char **fields;
+   int matched;
+};
+
+/* State of a search in progress.
+ * The search is run in chunks from an idle handler so that the GUI stays
+ * responsive and a new keystroke can cancel it. */
+struct search_job
+{
+   char *needle;
+   int case_sense;
+   int phase;
+   int loaded;
+   int refining;
+   int jump_to_first;
+   int count;
+   GtkWidget *clist;
+   guint idle_tag;
+   long datebook_version;
+   char datef[52];
+   const char *datebook_label;
+   const char *address_label;
+   const char *memo_label;
+   CalendarEventList *ce_list, *ce_cur;
+   ContactList *cont_list, *cont_cur;
+   ToDoList *todo_list, *todo_cur;
+   MemoList *memo_list, *memo_cur;
+   GList *refine_cur;
+   GList *hits;
+};
+
 /******************************* Global vars **********************************/
 static struct search_record *search_rl = NULL;
 static GtkWidget *case_sense_checkbox;
@@ -56,6 +112,15 @@ static GtkAccelGroup *accel_group = NULL;
 
 static int clist_row_selected;
 
+static struct search_job *search_job = NULL;
+static guint typing_timer_tag = 0;
+
+/* Results of the last completed search, used to refine the next one */
+static GList *search_cache = NULL;
+static char *search_cache_needle = NULL;
+static int search_cache_case_sense;
+static int search_cache_stale = TRUE;
+
 /****************************** Prototypes ************************************/
 static void cb_clist_selection(GtkWidget *clist, gint row, gint column,
                                GdkEventButton *event, gpointer data);
@@ -76,375 +141,598 @@ static int datebook_search_sort_compare(const void *v1, const void *v2)
    time1 = mktime(&(ce1->begin));
    time2 = mktime(&(ce2->begin));
 
-   return(time2 - time1);
+   /* calendar_sort reverses the qsort order so that the list, which is
+    * appended to the clist, ends up with the newest events first */
+   return(time1 - time2);
 }
 
-static int search_datebook(const char *needle, GtkWidget *clist)
+/* Sort non-datebook results by their text while keeping the datebook
+ * results, which are already in date order, at the top of the list */
+static gint search_compare(GtkCList      *clist,
+                           gconstpointer ptr1,
+                           gconstpointer ptr2)
 {
-   gchar *empty_line[] = { "","" };
-   CalendarEventList *ce_list;
-   CalendarEventList *temp_cel;
-   int found, count;
-   int case_sense;
-   char str[202];
-   char str2[SEARCH_MAX_COLUMN_LEN+2];
-   char date_str[52];
-   char datef[52];
-   const char *svalue1;
-   struct search_record *new_sr;
-   long datebook_version=0;
+   GtkCListRow *row1, *row2;
+   struct search_record *sr1, *sr2;
+   int is_date1, is_date2;
+   char *text1 = NULL;
+   char *text2 = NULL;
+
+   row1 = (GtkCListRow *) ptr1;
+   row2 = (GtkCListRow *) ptr2;
 
-   get_pref(PREF_DATEBOOK_VERSION, &datebook_version, NULL);
-  
-   /* Search Appointments */
-   ce_list = NULL;
+   sr1 = row1->data;
+   sr2 = row2->data;
 
-   get_days_calendar_events2(&ce_list, NULL, 2, 2, 2, CATEGORY_ALL, NULL);
+   is_date1 = sr1 && !sr1->plugin_flag && (sr1->app_type == DATEBOOK);
+   is_date2 = sr2 && !sr2->plugin_flag && (sr2->app_type == DATEBOOK);
 
-   if (ce_list==NULL) {
-      return 0;
+   if (is_date1 || is_date2) {
+      return is_date2 - is_date1;
    }
 
-   /* Sort returned results according to date rather than just HH:MM */
-   calendar_sort(&ce_list, datebook_search_sort_compare);
+   if (row1->cell[clist->sort_column].type == GTK_CELL_TEXT) {
+      text1 = GTK_CELL_TEXT(row1->cell[clist->sort_column])->text;
+   }
+   if (row2->cell[clist->sort_column].type == GTK_CELL_TEXT) {
+      text2 = GTK_CELL_TEXT(row2->cell[clist->sort_column])->text;
+   }
 
-   count = 0;
-   case_sense = GTK_TOGGLE_BUTTON(case_sense_checkbox)->active;
+   if (!text2) {
+      return (text1 != NULL);
+   }
+   if (!text1) {
+      return -1;
+   }
 
-   for (temp_cel = ce_list; temp_cel; temp_cel=temp_cel->next) {
-      found = 0;
-      if ( (temp_cel->mcale.cale.description) &&
-           (temp_cel->mcale.cale.description[0]) ) {
-         if (jp_strstr(temp_cel->mcale.cale.description, needle, case_sense)) {
-            found = 1;
-         }
-      }
-      if ( !found &&
-           (temp_cel->mcale.cale.note) &&
-           (temp_cel->mcale.cale.note[0]) ) {
-         if (jp_strstr(temp_cel->mcale.cale.note, needle, case_sense )) {
-            found = 2;
-         }
-      }
-      if (datebook_version) {
-         if ( !found &&
-              (temp_cel->mcale.cale.location) &&
-              (temp_cel->mcale.cale.location[0]) ) {
-            if (jp_strstr(temp_cel->mcale.cale.location, needle, case_sense )) {
-               found = 3;
-            }
-         }
+   return strcmp(text1, text2);
+}
+
+static void free_search_hit(struct search_hit *hit)
+{
+   int i;
+
+   for (i=0; i<hit->num_fields; i++) {
+      if (hit->fields[i]) {
+         free(hit->fields[i]);
       }
+   }
+   if (hit->fields) {
+      free(hit->fields);
+   }
+   if (hit->date_str) {
+      free(hit->date_str);
+   }
+   free(hit);
+}
 
-      if (found) {
-         gtk_clist_prepend(GTK_CLIST(clist), empty_line);
-         if (datebook_version==0) {
-            gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("datebook"));
-         } else {
-            gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("calendar"));
-         }
+static void free_search_hit_list(GList **hits)
+{
+   GList *temp_list;
 
-         /* get the date */
-         get_pref(PREF_SHORTDATE, NULL, &svalue1);
-         if (svalue1 == NULL) {
-            strcpy(datef, "%x");
-         } else {
-            strncpy(datef, svalue1, sizeof(datef));
-         }
-         strftime(date_str, sizeof(date_str), datef, &temp_cel->mcale.cale.begin);
-         date_str[sizeof(date_str)-1]='\0';
-
-         if (found == 1) {
-            g_snprintf(str, sizeof(str), "%s\t%s",
-                       date_str,
-                       temp_cel->mcale.cale.description);
-         } else if (found == 2) {
-            g_snprintf(str, sizeof(str), "%s\t%s",
-                       date_str,
-                       temp_cel->mcale.cale.note);
-         } else {
-            g_snprintf(str, sizeof(str), "%s\t%s",
-                       date_str,
-                       temp_cel->mcale.cale.location);
-         }
-         lstrncpy_remove_cr_lfs(str2, str, SEARCH_MAX_COLUMN_LEN);
-         gtk_clist_set_text(GTK_CLIST(clist), 0, 1, str2);
+   for (temp_list = *hits; temp_list; temp_list = temp_list->next) {
+      free_search_hit(temp_list->data);
+   }
+   g_list_free(*hits);
+   *hits = NULL;
+}
 
-         /* Add to the search list */
-         new_sr = malloc(sizeof(struct search_record));
-         new_sr->app_type = DATEBOOK;
-         new_sr->plugin_flag = 0;
-         new_sr->unique_id = temp_cel->mcale.unique_id;
-         new_sr->next = search_rl;
-         search_rl = new_sr;
+static void free_search_cache(void)
+{
+   free_search_hit_list(&search_cache);
+   if (search_cache_needle) {
+      free(search_cache_needle);
+      search_cache_needle = NULL;
+   }
+}
+
+static struct search_hit *new_search_hit(AppType app_type,
+                                         const char *app_label,
+                                         unsigned int unique_id,
+                                         const char *date_str,
+                                         const char *fields[],
+                                         int num_fields)
+{
+   struct search_hit *hit;
+   int i;
 
-         gtk_clist_set_row_data(GTK_CLIST(clist), 0, new_sr);
+   hit = calloc(1, sizeof(struct search_hit));
+   if (!hit) {
+      return NULL;
+   }
+   hit->fields = calloc(num_fields, sizeof(char *));
+   if (!hit->fields) {
+      free(hit);
+      return NULL;
+   }
 
-         count++;
+   hit->app_type = app_type;
+   hit->app_label = app_label;
+   hit->unique_id = unique_id;
+   if (date_str) {
+      hit->date_str = strdup(date_str);
+   }
+   hit->num_fields = num_fields;
+   for (i=0; i<num_fields; i++) {
+      if ((fields[i]) && (fields[i][0])) {
+         hit->fields[i] = strdup(fields[i]);
       }
    }
 
-   jp_logf(JP_LOG_DEBUG, "calling free_CalendarEventList\n");
-   free_CalendarEventList(&ce_list);
+   return hit;
+}
 
-   return count;
+/* Returns the index of the first field containing needle, or -1 */
+static int search_fields(const char *fields[], int num_fields,
+                         const char *needle, int case_sense)
+{
+   int i;
+
+   for (i=0; i<num_fields; i++) {
+      if ((fields[i]) && (fields[i][0])) {
+         if (jp_strstr(fields[i], needle, case_sense)) {
+            return i;
+         }
+      }
+   }
+
+   return -1;
 }
 
-static int search_address_or_contacts(const char *needle, GtkWidget *clist)
+/* Append a result row to the clist.  The text shown is the field which
+ * matched, prefixed by the date for datebook records. */
+static void search_append_row(struct search_job *job,
+                              AppType app_type,
+                              int plugin_flag,
+                              unsigned int unique_id,
+                              const char *app_label,
+                              const char *date_str,
+                              const char *text)
 {
    gchar *empty_line[] = { "","" };
+   char str[202];
    char str2[SEARCH_MAX_COLUMN_LEN+2];
-   AddressList *addr_list;
-   ContactList *cont_list;
-   ContactList *temp_cl;
    struct search_record *new_sr;
-   int i, count;
-   int case_sense;
-   long address_version=0;
-
-   get_pref(PREF_ADDRESS_VERSION, &address_version, NULL);
+   int row;
 
-   /* Get addresses and move to a contacts structure, or get contacts directly */
-   if (address_version==0) {
-      addr_list = NULL;
-      get_addresses2(&addr_list, SORT_ASCENDING, 2, 2, 2, CATEGORY_ALL);
-      copy_addresses_to_contacts(addr_list, &cont_list);
-      free_AddressList(&addr_list);
-   } else {
-      cont_list = NULL;
-      get_contacts2(&cont_list, SORT_ASCENDING, 2, 2, 2, CATEGORY_ALL);
-   }
+   row = gtk_clist_append(GTK_CLIST(job->clist), empty_line);
+   gtk_clist_set_text(GTK_CLIST(job->clist), row, 0, app_label);
 
-   if (cont_list==NULL) {
-      return 0;
+   if (text) {
+      if (date_str) {
+         g_snprintf(str, sizeof(str), "%s\t%s", date_str, text);
+         lstrncpy_remove_cr_lfs(str2, str, SEARCH_MAX_COLUMN_LEN);
+      } else {
+         lstrncpy_remove_cr_lfs(str2, (char *)text, SEARCH_MAX_COLUMN_LEN);
+      }
+      gtk_clist_set_text(GTK_CLIST(job->clist), row, 1, str2);
    }
 
-   count = 0;
-   case_sense = GTK_TOGGLE_BUTTON(case_sense_checkbox)->active;
+   /* Add to the search list */
+   new_sr = malloc(sizeof(struct search_record));
+   new_sr->app_type = app_type;
+   new_sr->plugin_flag = plugin_flag;
+   new_sr->unique_id = unique_id;
+   new_sr->next = search_rl;
+   search_rl = new_sr;
 
-   for (temp_cl = cont_list; temp_cl; temp_cl=temp_cl->next) {
-      for (i=0; i<NUM_CONTACT_ENTRIES; i++) {
-         if (temp_cl->mcont.cont.entry[i]) {
-            if ( jp_strstr(temp_cl->mcont.cont.entry[i], needle, case_sense) ) {
-               gtk_clist_prepend(GTK_CLIST(clist), empty_line);
-               if (address_version==0) {
-                  gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("address"));
-               } else {
-                  gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("contact"));
-               }
-               lstrncpy_remove_cr_lfs(str2, temp_cl->mcont.cont.entry[i], SEARCH_MAX_COLUMN_LEN);
-               gtk_clist_set_text(GTK_CLIST(clist), 0, 1, str2);
+   gtk_clist_set_row_data(GTK_CLIST(job->clist), row, new_sr);
 
-               /* Add to the search list */
-               new_sr = malloc(sizeof(struct search_record));
-               new_sr->app_type = ADDRESS;
-               new_sr->plugin_flag = 0;
-               new_sr->unique_id = temp_cl->mcont.unique_id;
-               new_sr->next = search_rl;
-               search_rl = new_sr;
+   job->count++;
+}
 
-               gtk_clist_set_row_data(GTK_CLIST(clist), 0, new_sr);
+/* Test one record from the databases and record it if it matches */
+static void search_record_fields(struct search_job *job,
+                                 AppType app_type,
+                                 const char *app_label,
+                                 unsigned int unique_id,
+                                 struct tm *date,
+                                 const char *fields[],
+                                 int num_fields)
+{
+   struct search_hit *hit;
+   char date_str[52];
+   int found;
 
-               count++;
+   found = search_fields(fields, num_fields, job->needle, job->case_sense);
+   if (found < 0) {
+      return;
+   }
 
-               break;
-            }
-         }
-      }
+   if (date) {
+      strftime(date_str, sizeof(date_str), job->datef, date);
+      date_str[sizeof(date_str)-1]='\0';
    }
 
-   jp_logf(JP_LOG_DEBUG, "calling free_ContactList\n");
-   free_ContactList(&cont_list);
+   hit = new_search_hit(app_type, app_label, unique_id,
+                        date ? date_str : NULL, fields, num_fields);
+   if (!hit) {
+      jp_logf(JP_LOG_WARN, "search_record_fields(): %s\n", _("Out of memory"));
+      return;
+   }
+   job->hits = g_list_prepend(job->hits, hit);
 
-   return count;
+   search_append_row(job, app_type, 0, unique_id, app_label,
+                     hit->date_str, fields[found]);
 }
 
-static int search_todo(const char *needle, GtkWidget *clist)
+/* Test a result of the previous search against the new needle */
+static void search_refine_hit(struct search_job *job, struct search_hit *hit)
 {
-   gchar *empty_line[] = { "","" };
-   char str2[SEARCH_MAX_COLUMN_LEN+2];
-   ToDoList *todo_list;
-   ToDoList *temp_todo;
-   struct search_record *new_sr;
-   int found, count;
-   int case_sense;
+   int found;
 
-   /* Search Appointments */
-   todo_list = NULL;
+   found = search_fields((const char **)hit->fields, hit->num_fields,
+                         job->needle, job->case_sense);
+   if (found < 0) {
+      return;
+   }
 
-   get_todos2(&todo_list, SORT_DESCENDING, 2, 2, 2, 1, CATEGORY_ALL);
+   hit->matched = TRUE;
+   job->hits = g_list_prepend(job->hits, hit);
 
-   if (todo_list==NULL) {
-      return 0;
-   }
+   search_append_row(job, hit->app_type, 0, hit->unique_id, hit->app_label,
+                     hit->date_str, hit->fields[found]);
+}
 
-   count = 0;
-   case_sense = GTK_TOGGLE_BUTTON(case_sense_checkbox)->active;
+#ifdef ENABLE_PLUGINS
+static void search_plugins(struct search_job *job)
+{
+   GList *plugin_list, *temp_list;
+   struct search_result *sr, *temp_sr;
+   struct plugin_s *plugin;
+
+   plugin_list = NULL;
+   plugin_list = get_plugin_list();
 
-   for (temp_todo = todo_list; temp_todo; temp_todo=temp_todo->next) {
-      found = 0;
-      if ( (temp_todo->mtodo.todo.description) &&
-           (temp_todo->mtodo.todo.description[0]) ) {
-         if ( jp_strstr(temp_todo->mtodo.todo.description, needle, case_sense) ) {
-            found = 1;
+   for (temp_list = plugin_list; temp_list; temp_list = temp_list->next) {
+      plugin = (struct plugin_s *)temp_list->data;
+      if (plugin) {
+         sr = NULL;
+         if (plugin->plugin_search) {
+            if (plugin->plugin_search(job->needle, job->case_sense, &sr) > 0) {
+               for (temp_sr=sr; temp_sr; temp_sr=temp_sr->next) {
+                  search_append_row(job, plugin->number, 1, temp_sr->unique_id,
+                                    plugin->menu_name ?
+                                    plugin->menu_name : _("plugin ?"),
+                                    NULL, temp_sr->line);
+               }
+               free_search_result(&sr);
+            }
          }
       }
-      if ( !found &&
-           (temp_todo->mtodo.todo.note) &&
-           (temp_todo->mtodo.todo.note[0]) ) {
-         if ( jp_strstr(temp_todo->mtodo.todo.note, needle, case_sense) ) {
-            found = 2;
-         }
+   }
+}
+#endif
+
+static void search_next_phase(struct search_job *job, int phase)
+{
+   job->phase = phase;
+   job->loaded = FALSE;
+}
+
+/* Examine one record of the current phase, loading the phase's
+ * database first if needed */
+static void search_job_step(struct search_job *job)
+{
+   const char *fields[NUM_CONTACT_ENTRIES];
+   struct CalendarEvent *cale;
+   struct ToDo *todo;
+   AddressList *addr_list;
+   long address_version=0;
+   long memo_version=0;
+   int i;
+
+   switch (job->phase) {
+    case SEARCH_PHASE_DATEBOOK:
+      if (!job->loaded) {
+         get_days_calendar_events2(&job->ce_list, NULL, 2, 2, 2, CATEGORY_ALL, NULL);
+         /* Sort returned results according to date rather than just HH:MM */
+         calendar_sort(&job->ce_list, datebook_search_sort_compare);
+         job->ce_cur = job->ce_list;
+         job->loaded = TRUE;
+      }
+      if (!job->ce_cur) {
+         jp_logf(JP_LOG_DEBUG, "calling free_CalendarEventList\n");
+         free_CalendarEventList(&job->ce_list);
+         search_next_phase(job, SEARCH_PHASE_ADDRESS);
+         break;
       }
+      cale = &(job->ce_cur->mcale.cale);
+      fields[0] = cale->description;
+      fields[1] = cale->note;
+      fields[2] = cale->location;
+      search_record_fields(job, DATEBOOK, job->datebook_label,
+                           job->ce_cur->mcale.unique_id, &(cale->begin),
+                           fields, job->datebook_version ? 3 : 2);
+      job->ce_cur = job->ce_cur->next;
+      break;
 
-      if (found) {
-         gtk_clist_prepend(GTK_CLIST(clist), empty_line);
-         gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("todo"));
-         if (found == 1) {
-            lstrncpy_remove_cr_lfs(str2, temp_todo->mtodo.todo.description, SEARCH_MAX_COLUMN_LEN);
+    case SEARCH_PHASE_ADDRESS:
+      if (!job->loaded) {
+         /* Get addresses and move to a contacts structure,
+          * or get contacts directly */
+         get_pref(PREF_ADDRESS_VERSION, &address_version, NULL);
+         if (address_version==0) {
+            addr_list = NULL;
+            get_addresses2(&addr_list, SORT_ASCENDING, 2, 2, 2, CATEGORY_ALL);
+            copy_addresses_to_contacts(addr_list, &job->cont_list);
+            free_AddressList(&addr_list);
          } else {
-            lstrncpy_remove_cr_lfs(str2, temp_todo->mtodo.todo.note, SEARCH_MAX_COLUMN_LEN);
+            get_contacts2(&job->cont_list, SORT_ASCENDING, 2, 2, 2, CATEGORY_ALL);
          }
-         gtk_clist_set_text(GTK_CLIST(clist), 0, 1, str2);
+         job->cont_cur = job->cont_list;
+         job->loaded = TRUE;
+      }
+      if (!job->cont_cur) {
+         jp_logf(JP_LOG_DEBUG, "calling free_ContactList\n");
+         free_ContactList(&job->cont_list);
+         search_next_phase(job, SEARCH_PHASE_TODO);
+         break;
+      }
+      for (i=0; i<NUM_CONTACT_ENTRIES; i++) {
+         fields[i] = job->cont_cur->mcont.cont.entry[i];
+      }
+      search_record_fields(job, ADDRESS, job->address_label,
+                           job->cont_cur->mcont.unique_id, NULL,
+                           fields, NUM_CONTACT_ENTRIES);
+      job->cont_cur = job->cont_cur->next;
+      break;
 
-         /* Add to the search list */
-         new_sr = malloc(sizeof(struct search_record));
-         new_sr->app_type = TODO;
-         new_sr->plugin_flag = 0;
-         new_sr->unique_id = temp_todo->mtodo.unique_id;
-         new_sr->next = search_rl;
-         search_rl = new_sr;
+    case SEARCH_PHASE_TODO:
+      if (!job->loaded) {
+         get_todos2(&job->todo_list, SORT_DESCENDING, 2, 2, 2, 1, CATEGORY_ALL);
+         job->todo_cur = job->todo_list;
+         job->loaded = TRUE;
+      }
+      if (!job->todo_cur) {
+         jp_logf(JP_LOG_DEBUG, "calling free_ToDoList\n");
+         free_ToDoList(&job->todo_list);
+         search_next_phase(job, SEARCH_PHASE_MEMO);
+         break;
+      }
+      todo = &(job->todo_cur->mtodo.todo);
+      fields[0] = todo->description;
+      fields[1] = todo->note;
+      search_record_fields(job, TODO, _("todo"),
+                           job->todo_cur->mtodo.unique_id, NULL, fields, 2);
+      job->todo_cur = job->todo_cur->next;
+      break;
 
-         gtk_clist_set_row_data(GTK_CLIST(clist), 0, new_sr);
+    case SEARCH_PHASE_MEMO:
+      if (!job->loaded) {
+         get_pref(PREF_MEMO_VERSION, &memo_version, NULL);
+         job->memo_label = (memo_version==0) ? _("memo") : _("memos");
+         get_memos2(&job->memo_list, SORT_DESCENDING, 2, 2, 2, CATEGORY_ALL);
+         job->memo_cur = job->memo_list;
+         job->loaded = TRUE;
+      }
+      if (!job->memo_cur) {
+         jp_logf(JP_LOG_DEBUG, "calling free_MemoList\n");
+         free_MemoList(&job->memo_list);
+         search_next_phase(job, SEARCH_PHASE_PLUGINS);
+         break;
+      }
+      fields[0] = job->memo_cur->mmemo.memo.text;
+      search_record_fields(job, MEMO, job->memo_label,
+                           job->memo_cur->mmemo.unique_id, NULL, fields, 1);
+      job->memo_cur = job->memo_cur->next;
+      break;
 
-         count++;
+    case SEARCH_PHASE_REFINE:
+      if (!job->loaded) {
+         job->refine_cur = search_cache;
+         job->loaded = TRUE;
       }
-   }
+      if (!job->refine_cur) {
+         search_next_phase(job, SEARCH_PHASE_PLUGINS);
+         break;
+      }
+      search_refine_hit(job, job->refine_cur->data);
+      job->refine_cur = job->refine_cur->next;
+      break;
 
-   jp_logf(JP_LOG_DEBUG, "calling free_ToDoList\n");
-   free_ToDoList(&todo_list);
+    case SEARCH_PHASE_PLUGINS:
+      /* Plugins are searched in one go and are never refined */
+#ifdef ENABLE_PLUGINS
+      search_plugins(job);
+#endif
+      search_next_phase(job, SEARCH_PHASE_DONE);
+      break;
 
-   return count;
+    default:
+      search_next_phase(job, SEARCH_PHASE_DONE);
+      break;
+   }
 }
 
-static int search_memo(const char *needle, GtkWidget *clist)
+static void search_job_free(struct search_job *job)
 {
-   gchar *empty_line[] = { "","" };
-   char str2[SEARCH_MAX_COLUMN_LEN+2];
-   MemoList *memo_list;
-   MemoList *temp_memo;
-   struct search_record *new_sr;
-   int count;
-   int case_sense;
-   long memo_version=0;
+   GList *temp_list;
 
-   get_pref(PREF_MEMO_VERSION, &memo_version, NULL);
+   free_CalendarEventList(&job->ce_list);
+   free_ContactList(&job->cont_list);
+   free_ToDoList(&job->todo_list);
+   free_MemoList(&job->memo_list);
+
+   if (job->refining) {
+      /* These hits are still owned by the search cache */
+      for (temp_list = job->hits; temp_list; temp_list = temp_list->next) {
+         ((struct search_hit *)temp_list->data)->matched = FALSE;
+      }
+      g_list_free(job->hits);
+      job->hits = NULL;
+   } else {
+      free_search_hit_list(&job->hits);
+   }
+
+   if (job->needle) {
+      free(job->needle);
+   }
+   free(job);
+}
 
-   /* Search Memos */
-   memo_list = NULL;
+static void search_job_cancel(void)
+{
+   if (!search_job) {
+      return;
+   }
 
-   get_memos2(&memo_list, SORT_DESCENDING, 2, 2, 2, CATEGORY_ALL);
+   jp_logf(JP_LOG_DEBUG, "cancelling search for %s\n", search_job->needle);
 
-   if (memo_list==NULL) {
-      return 0;
+   if (search_job->idle_tag) {
+      gtk_idle_remove(search_job->idle_tag);
    }
+   search_job_free(search_job);
+   search_job = NULL;
+}
 
-   count = 0;
-   case_sense = GTK_TOGGLE_BUTTON(case_sense_checkbox)->active;
+/* Called when all phases are done.
+ * Keeps the results for refining and sorts the clist. */
+static void search_job_finish(struct search_job *job)
+{
+   gchar *empty_line[] = { "","" };
+   GList *temp_list;
+   struct search_hit *hit;
 
-   for (temp_memo = memo_list; temp_memo; temp_memo=temp_memo->next) {
-      if (jp_strstr(temp_memo->mmemo.memo.text, needle, case_sense) ) {
-         gtk_clist_prepend(GTK_CLIST(clist), empty_line);
-         if (memo_version==0) {
-            gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("memo"));
+   jp_logf(JP_LOG_DEBUG, "search for %s found %d records\n",
+           job->needle, job->count);
+
+   if (job->refining) {
+      for (temp_list = search_cache; temp_list; temp_list = temp_list->next) {
+         hit = temp_list->data;
+         if (hit->matched) {
+            hit->matched = FALSE;
          } else {
-            gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("memos"));
-         }
-         if (temp_memo->mmemo.memo.text) {
-            lstrncpy_remove_cr_lfs(str2, temp_memo->mmemo.memo.text, SEARCH_MAX_COLUMN_LEN);
-            gtk_clist_set_text(GTK_CLIST(clist), 0, 1, str2);
+            free_search_hit(hit);
          }
+      }
+      g_list_free(search_cache);
+      search_cache = NULL;
+   }
+   free_search_cache();
 
-         /* Add to the search list */
-         new_sr = malloc(sizeof(struct search_record));
-         new_sr->app_type = MEMO;
-         new_sr->plugin_flag = 0;
-         new_sr->unique_id = temp_memo->mmemo.unique_id;
-         new_sr->next = search_rl;
-         search_rl = new_sr;
+   search_cache = g_list_reverse(job->hits);
+   job->hits = NULL;
+   search_cache_needle = job->needle;
+   job->needle = NULL;
+   search_cache_case_sense = job->case_sense;
+
+   if (job->count == 0) {
+      gtk_clist_prepend(GTK_CLIST(job->clist), empty_line);
+      gtk_clist_set_text(GTK_CLIST(job->clist), 0, 1, _("No records found"));
+   } else {
+      /* sort the results */
+      gtk_clist_set_compare_func(GTK_CLIST(job->clist), search_compare);
+      gtk_clist_set_sort_column(GTK_CLIST(job->clist), 1);
+      gtk_clist_sort(GTK_CLIST(job->clist));
+   }
 
-         gtk_clist_set_row_data(GTK_CLIST(clist), 0, new_sr);
+   /* Highlight the first row in the list of returned items.
+    * This does NOT cause the main window to jump to the selected record. */
+   clist_select_row(GTK_CLIST(job->clist), 0, 0);
 
-         count++;
-      }
+   if (job->jump_to_first) {
+      /* select the first record found */
+      cb_clist_selection(job->clist, 0, 0, (GdkEventButton *)1, NULL);
    }
+}
+
+static gint cb_search_idle(gpointer data)
+{
+   struct search_job *job;
+   int i;
+
+   job = data;
 
-   jp_logf(JP_LOG_DEBUG, "calling free_MemoList\n");
-   free_MemoList(&memo_list);
+   for (i=0; (i<SEARCH_CHUNK_SIZE) && (job->phase != SEARCH_PHASE_DONE); i++) {
+      search_job_step(job);
+   }
+
+   if (job->phase != SEARCH_PHASE_DONE) {
+      return TRUE;
+   }
 
-   return count;
+   search_job_finish(job);
+   search_job = NULL;
+   job->idle_tag = 0;
+   search_job_free(job);
+
+   return FALSE; /* Cause this function not to be called again */
 }
 
-#ifdef ENABLE_PLUGINS
-static int search_plugins(const char *needle, const GtkWidget *clist)
+/* Cancel any search in progress and start a new one for the entry text.
+ * If refine is set and the new text contains the text of the last
+ * completed search then only the previous results are searched. */
+static void search_start(GtkWidget *clist, int jump_to_first, int refine)
 {
-   GList *plugin_list, *temp_list;
-   gchar *empty_line[] = { "","" };
-   char str2[SEARCH_MAX_COLUMN_LEN+2];
-   int count;
-   int case_sense;
-   struct search_result *sr, *temp_sr;
-   struct plugin_s *plugin;
-   struct search_record *new_sr;
+   struct search_job *job;
+   const char *entry_text;
+   const char *svalue1;
 
-   plugin_list = NULL;
-   plugin_list = get_plugin_list();
+   search_job_cancel();
 
-   case_sense = GTK_TOGGLE_BUTTON(case_sense_checkbox)->active;
+   gtk_clist_clear(GTK_CLIST(clist));
+   free_search_record_list(&search_rl);
 
-   count = 0;
-   for (temp_list = plugin_list; temp_list; temp_list = temp_list->next) {
-      plugin = (struct plugin_s *)temp_list->data;
-      if (plugin) {
-         sr = NULL;
-         if (plugin->plugin_search) {
-            if (plugin->plugin_search(needle, case_sense, &sr) > 0) {
-               for (temp_sr=sr; temp_sr; temp_sr=temp_sr->next) {
-                  gtk_clist_prepend(GTK_CLIST(clist), empty_line);
-                  if (plugin->menu_name) {
-                     gtk_clist_set_text(GTK_CLIST(clist), 0, 0, plugin->menu_name);
-                  } else {
-                     gtk_clist_set_text(GTK_CLIST(clist), 0, 0, _("plugin ?"));
-                  }
-                  if (temp_sr->line) {
-                     lstrncpy_remove_cr_lfs(str2, temp_sr->line, SEARCH_MAX_COLUMN_LEN);
-                     gtk_clist_set_text(GTK_CLIST(clist), 0, 1, str2);
-                  }
-
-                  /* Add to the search list */
-                  new_sr = malloc(sizeof(struct search_record));
-                  new_sr->app_type = plugin->number;
-                  new_sr->plugin_flag = 1;
-                  new_sr->unique_id = temp_sr->unique_id;
-                  new_sr->next = search_rl;
-                  search_rl = new_sr;
-
-                  gtk_clist_set_row_data(GTK_CLIST(clist), 0, new_sr);
-
-                  count++;
-               }
-               free_search_result(&sr);
-            }
-         }
-      }
+   entry_text = gtk_entry_get_text(GTK_ENTRY(entry));
+   if (!entry_text || !strlen(entry_text)) {
+      return;
    }
 
-   return count;
+   jp_logf(JP_LOG_DEBUG, "entry text = %s\n", entry_text);
+
+   job = calloc(1, sizeof(struct search_job));
+   if (!job) {
+      jp_logf(JP_LOG_WARN, "search_start(): %s\n", _("Out of memory"));
+      return;
+   }
+   job->needle = strdup(entry_text);
+   job->case_sense = GTK_TOGGLE_BUTTON(case_sense_checkbox)->active;
+   job->jump_to_first = jump_to_first;
+   job->clist = clist;
+
+   get_pref(PREF_DATEBOOK_VERSION, &job->datebook_version, NULL);
+   job->datebook_label = (job->datebook_version==0) ? _("datebook") : _("calendar");
+
+   get_pref(PREF_SHORTDATE, NULL, &svalue1);
+   if (svalue1 == NULL) {
+      strcpy(job->datef, "%x");
+   } else {
+      g_strlcpy(job->datef, svalue1, sizeof(job->datef));
+   }
+
+   if (refine && !search_cache_stale && search_cache_needle &&
+       (job->case_sense == search_cache_case_sense) &&
+       jp_strstr(job->needle, search_cache_needle, job->case_sense)) {
+      jp_logf(JP_LOG_DEBUG, "refining search for %s\n", search_cache_needle);
+      job->refining = TRUE;
+      search_next_phase(job, SEARCH_PHASE_REFINE);
+   } else {
+      long address_version=0;
+
+      get_pref(PREF_ADDRESS_VERSION, &address_version, NULL);
+      job->address_label = (address_version==0) ? _("address") : _("contact");
+      /* The cache is only refilled when this search completes.  If it is
+       * cancelled there is nothing left to refine. */
+      free_search_cache();
+      search_cache_stale = FALSE;
+      search_next_phase(job, SEARCH_PHASE_DATEBOOK);
+   }
+
+   search_job = job;
+   job->idle_tag = gtk_idle_add(cb_search_idle, job);
 }
-#endif
 
 static gboolean cb_destroy(GtkWidget *widget)
 {
+   if (typing_timer_tag) {
+      gtk_timeout_remove(typing_timer_tag);
+      typing_timer_tag = 0;
+   }
+   search_job_cancel();
+   free_search_cache();
+   search_cache_stale = TRUE;
+
    if (search_rl) {
       free_search_record_list(&search_rl);
       search_rl = NULL;
@@ -454,6 +742,17 @@ static gboolean cb_destroy(GtkWidget *widget)
    return FALSE;
 }
 
+/* Records may be edited while the search window is not focused so
+ * the next search has to read the databases again */
+static gboolean cb_focus_out(GtkWidget     *widget,
+                             GdkEventFocus *event,
+                             gpointer       data)
+{
+   search_cache_stale = TRUE;
+
+   return FALSE;
+}
+
 static void cb_quit(GtkWidget *widget, gpointer data)
 {
    gtk_widget_destroy(data);
@@ -461,50 +760,35 @@ static void cb_quit(GtkWidget *widget, gpointer data)
 
 static void cb_entry(GtkWidget *widget, gpointer data)
 {
-   gchar *empty_line[] = { "","" };
-   GtkWidget *clist;
-   const char *entry_text;
-   int count = 0;
-
    jp_logf(JP_LOG_DEBUG, "enter cb_entry\n");
 
-   entry_text = gtk_entry_get_text(GTK_ENTRY(widget));
-   if (!entry_text || !strlen(entry_text)) {
-      return;
+   if (typing_timer_tag) {
+      gtk_timeout_remove(typing_timer_tag);
+      typing_timer_tag = 0;
    }
 
-   jp_logf(JP_LOG_DEBUG, "entry text = %s\n", entry_text);
+   search_start(data, TRUE, FALSE);
+}
 
-   clist = data;
-   gtk_clist_clear(GTK_CLIST(clist));
+static gint cb_typing_timeout(gpointer data)
+{
+   typing_timer_tag = 0;
 
-   count += search_address_or_contacts(entry_text, clist);
-   count += search_todo(entry_text, clist);
-   count += search_memo(entry_text, clist);
-#ifdef ENABLE_PLUGINS
-   count += search_plugins(entry_text, clist);
-#endif
+   search_start(data, FALSE, TRUE);
 
-   /* sort the results */
-   gtk_clist_set_sort_column(GTK_CLIST(clist), 1);
-   gtk_clist_sort(GTK_CLIST(clist));
+   return FALSE; /* Cause this function not to be called again */
+}
 
-   /* the datebook events are already sorted by date */
-   count += search_datebook(entry_text, clist);
+static void cb_entry_changed(GtkWidget *widget, gpointer data)
+{
+   /* A new keystroke makes the search in progress useless */
+   search_job_cancel();
 
-   if (count == 0) {
-      gtk_clist_prepend(GTK_CLIST(clist), empty_line);
-      gtk_clist_set_text(GTK_CLIST(clist), 0, 1, _("No records found"));
+   if (typing_timer_tag) {
+      gtk_timeout_remove(typing_timer_tag);
    }
-
-   /* Highlight the first row in the list of returned items.
-    * This does NOT cause the main window to jump to the selected record. */
-   clist_select_row(GTK_CLIST(clist), 0, 0);
-
-   /* select the first record found */
-   cb_clist_selection(clist, 0, 0, (GdkEventButton *)1, NULL);
-
-   return;
+   typing_timer_tag = gtk_timeout_add(SEARCH_TYPING_DELAY,
+                                      cb_typing_timeout, data);
 }
 
 static void cb_search(GtkWidget *widget, gpointer data)
@@ -598,6 +882,8 @@ void cb_search_gui(GtkWidget *widget, gpointer data)
 
    gtk_signal_connect(GTK_OBJECT(window), "destroy",
                       GTK_SIGNAL_FUNC(cb_destroy), window);
+   gtk_signal_connect(GTK_OBJECT(window), "focus_out_event",
+                      GTK_SIGNAL_FUNC(cb_focus_out), NULL);
 
    accel_group = gtk_accel_group_new();
    gtk_window_add_accel_group(GTK_WINDOW(window), accel_group);
@@ -648,6 +934,10 @@ void cb_search_gui(GtkWidget *widget, gpointer data)
    gtk_signal_connect(GTK_OBJECT(entry), "activate",
                       GTK_SIGNAL_FUNC(cb_entry),
                       clist);
+   /* Search as you type */
+   gtk_signal_connect(GTK_OBJECT(entry), "changed",
+                      GTK_SIGNAL_FUNC(cb_entry_changed),
+                      clist);
 
    hbox = gtk_hbutton_box_new();
    gtk_container_set_border_width(GTK_CONTAINER(hbox), 6);
@@ -0,0 +1,108 @@
+#!/bin/sh
+#
+# Times jpilot-sync against the jpilot-devsim handheld simulator.
+#
+# Usage: sync-bench.sh [records [percent]]
+#
+# records  number of records in each sample database (default 1000)
+# percent  percentage of records changed on the handheld between syncs
+#          (default 10)
+#
+# Run from the build directory after "make jpilot-sync jpilot-devsim",
+# or with "make bench".  The environment variable BENCH_PORT sets the
+# NetSync address the sync listens on (default net:any) and BENCH_HOST
+# the one the simulator connects to (default net:localhost).
+# BENCH_CARD_MB sets the size of the file installed to the simulated
+# card (default 16).
+#
+# Each run prints the wall time seen by the simulator, the records moved
+# and the records per second, followed by the time of the sync phases
+# from the JPILOT_TRACE spans of jpilot-sync.  The card run also prints
+# the bytes per second of the copy to the card.
+
+RECORDS=${1:-1000}
+PERCENT=${2:-10}
+PORT=${BENCH_PORT:-net:any}
+HOST=${BENCH_HOST:-net:localhost}
+CARD_MB=${BENCH_CARD_MB:-16}
+BUILDDIR=${BUILDDIR:-.}
+
+SYNC=$BUILDDIR/jpilot-sync
+DEVSIM=$BUILDDIR/jpilot-devsim
+
+for prog in $SYNC $DEVSIM; do
+   if [ ! -x $prog ]; then
+      echo "$prog not found, build it first" >&2
+      exit 1
+   fi
+done
+
+WORK=`mktemp -d ${TMPDIR:-/tmp}/jpilot-bench.XXXXXX` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+DEVICE=$WORK/device
+JPILOT_HOME=$WORK/home
+export JPILOT_HOME
+mkdir -p $JPILOT_HOME/.jpilot
+
+# Total duration in milliseconds of the begin/end pairs named $2 in file $1
+pair_ms()
+{
+   sed -n "s/.*\"name\":\"$2\".*\"ph\":\"\([BE]\)\",\"ts\":\([0-9]*\).*/\1 \2/p" $1 |
+      awk '$1 == "B" { b = $2 } $1 == "E" { t += $2 - b } END { printf "%.1f", t / 1000 }'
+}
+
+# run_sync name [jpilot-sync options]
+run_sync()
+{
+   name=$1
+   shift
+   trace=$WORK/$name.json
+   rm -f $trace
+   JPILOT_TRACE=$trace $SYNC -p $PORT "$@" > $WORK/$name.log 2>&1 &
+   sync_pid=$!
+   stats=`$DEVSIM -p $HOST $DEVICE`
+   wait $sync_pid
+   if [ $? -ne 0 ] || [ -z "$stats" ]; then
+      echo "$name: sync failed, see the log below" >&2
+      cat $WORK/$name.log >&2
+      exit 1
+   fi
+   eval $stats
+   moved=`expr $records_read + $records_written + $records_deleted`
+   printf "%-8s %8s s %8d records %10.0f records/s" $name $seconds $moved \
+      `echo "$moved $seconds" | awk '{ print ($2 > 0) ? $1 / $2 : 0 }'`
+   printf "   slow %s ms, fast %s ms, fetch %s ms, install %s ms\n" \
+      `pair_ms $trace "slow sync"` `pair_ms $trace "fast sync"` \
+      `pair_ms $trace "fetch"` `pair_ms $trace "install files"`
+}
+
+echo "$RECORDS records per database, $PERCENT% changed between syncs"
+
+$DEVSIM -g $RECORDS $DEVICE || exit 1
+
+# The first sync with an empty home directory is a slow sync
+run_sync slow
+
+# Handheld edits, then a fast sync
+$DEVSIM -m $PERCENT $DEVICE || exit 1
+run_sync fast
+
+# Handheld edits, then a fast sync and a backup of every database
+$DEVSIM -m $PERCENT $DEVICE || exit 1
+run_sync fetch -b
+
+# Install a database of the same size
+$DEVSIM -g $RECORDS $WORK/install || exit 1
+echo "$WORK/install/JpilotBenchDB.pdb" > $JPILOT_HOME/.jpilot/jpilot.install
+run_sync install
+
+# Install a large media file to the card
+dd if=/dev/urandom of=$WORK/media.bin bs=1048576 count=$CARD_MB 2> /dev/null || exit 1
+printf '\001%s\n' "$WORK/media.bin" > $JPILOT_HOME/.jpilot/jpilot.install
+run_sync card
+card_ms=`pair_ms $WORK/card.json "install file"`
+printf "card     %d bytes in %s ms, %.0f bytes/s\n" $card_bytes $card_ms \
+   `echo "$card_bytes $card_ms" | awk '{ print ($2 > 0) ? $1 * 1000 / $2 : 0 }'`
+
+exit 0
@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# Checks jpilot-sync against the jpilot-devsim handheld simulator.
+#
+# Usage: sync-test.sh
+#
+# Run from the build directory after "make jpilot-sync jpilot-devsim",
+# or with "make sync-test".  The environment variables TEST_PORT and
+# TEST_HOST set the NetSync addresses as BENCH_PORT and BENCH_HOST do
+# for sync-bench.sh.
+#
+# Each check prints its name and "ok", or the sync log and exits with
+# a failure.
+
+PORT=${TEST_PORT:-net:any}
+HOST=${TEST_HOST:-net:localhost}
+BUILDDIR=${BUILDDIR:-.}
+
+SYNC=$BUILDDIR/jpilot-sync
+DEVSIM=$BUILDDIR/jpilot-devsim
+
+for prog in $SYNC $DEVSIM; do
+   if [ ! -x $prog ]; then
+      echo "$prog not found, build it first" >&2
+      exit 1
+   fi
+done
+
+WORK=`mktemp -d ${TMPDIR:-/tmp}/jpilot-test.XXXXXX` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+DEVICE=$WORK/device
+JPILOT_HOME=$WORK/home
+export JPILOT_HOME
+mkdir -p $JPILOT_HOME/.jpilot
+
+# run_sync name [jpilot-devsim options]
+# Returns the exit status of jpilot-sync
+run_sync()
+{
+   name=$1
+   shift
+   $SYNC -p $PORT > $WORK/$name.log 2>&1 &
+   sync_pid=$!
+   $DEVSIM -p $HOST "$@" $DEVICE > /dev/null
+   wait $sync_pid
+}
+
+# fail name message
+fail()
+{
+   echo "$1: $2" >&2
+   cat $WORK/$1.log >&2
+   exit 1
+}
+
+# records name database
+records()
+{
+   $DEVSIM -l $DEVICE | awk -v db=$1 '$2 == db { print $1 }'
+}
+
+$DEVSIM -g 4 $DEVICE || exit 1
+
+# The first sync with an empty home directory is a slow sync
+run_sync slow || fail slow "sync failed"
+echo "slow ok"
+
+# An appointment edited on both sides is duplicated on the handheld once,
+# even when the sync that made the copy was interrupted.  The simulator
+# leaves a nonzero gapfill byte in its appointments, which J-Pilot's edit
+# does not have, so the copy is only found when they are compared alike.
+$DEVSIM -e $JPILOT_HOME/.jpilot/DatebookDB.pdb || exit 1
+sed 's/^lastSyncPC .*/lastSyncPC 0/' $DEVICE/devsim.state > $WORK/state &&
+   mv $WORK/state $DEVICE/devsim.state || exit 1
+run_sync conflict -k 1 && fail conflict "sync was not interrupted"
+run_sync conflict || fail conflict "sync failed"
+n=`records DatebookDB`
+[ "$n" = 5 ] || fail conflict "$n appointments instead of 5"
+echo "conflict ok"
+
+exit 0
@@ -37,6 +37,9 @@
 #else
 #  include <fcntl.h>
 #endif
+#if defined(HAVE_POSIX_FADVISE) && defined(USE_FLOCK)
+#  include <fcntl.h>
+#endif
 
 #include <pi-socket.h>
 #include <pi-dlp.h>
@@ -50,6 +53,10 @@
 #include "utils.h"
 #include "sync.h"
 #include "log.h"
+#include "trace.h"
+#include "backup_store.h"
+#include "sync_journal.h"
+#include "sync_stats.h"
 #include "prefs.h"
 #include "datebook.h"
 #include "plugins.h"
@@ -67,6 +74,90 @@
 
 #define USE_LOCKING
 
+/* Number of .pc3 header rewrites queued before they are written out */
+#define PC3_MARK_BATCH 64
+/* Size of the buffer collecting Palm sync log lines */
+#define SYNC_LOG_BATCH 1024
+
+/* Smallest and largest chunk written to a card file in one DLP call */
+#define VFS_CHUNK_MIN 8192
+#define VFS_CHUNK_MAX 65536
+
+/* Every DLP round trip made from this file, and the records and bytes it
+ * moved, are counted in the sync statistics.  No progress functions are
+ * passed to pi_file_install and pi_file_retrieve here, so they are given
+ * the one that counts the records transferred. */
+#define dlp_AddSyncLogEntry(sd, entry) \
+   sync_stats_dlp(dlp_AddSyncLogEntry(sd, entry))
+#define dlp_CleanUpDatabase(sd, db) \
+   sync_stats_dlp(dlp_CleanUpDatabase(sd, db))
+#define dlp_CloseDB(sd, db) \
+   sync_stats_dlp(dlp_CloseDB(sd, db))
+#define dlp_DeleteRecord(sd, db, all, id) \
+   sync_stats_delete(dlp_DeleteRecord(sd, db, all, id))
+#define dlp_EndOfSync(sd, status) \
+   sync_stats_dlp(dlp_EndOfSync(sd, status))
+#define dlp_MoveCategory(sd, db, from, to) \
+   sync_stats_dlp(dlp_MoveCategory(sd, db, from, to))
+#define dlp_OpenConduit(sd) \
+   sync_stats_dlp(dlp_OpenConduit(sd))
+#define dlp_OpenDB(sd, card, mode, name, db) \
+   sync_stats_dlp(dlp_OpenDB(sd, card, mode, name, db))
+#define dlp_ReadAppBlock(sd, db, offset, len, buf) \
+   sync_stats_receive(dlp_ReadAppBlock(sd, db, offset, len, buf), buf)
+#define dlp_ReadDBList(sd, card, flags, start, buf) \
+   sync_stats_dlp(dlp_ReadDBList(sd, card, flags, start, buf))
+#define dlp_ReadNextModifiedRec(sd, db, buf, id, index, attr, cat) \
+   sync_stats_read(dlp_ReadNextModifiedRec(sd, db, buf, id, index, attr, cat), buf)
+#define dlp_ReadOpenDBInfo(sd, db, num) \
+   sync_stats_dlp(dlp_ReadOpenDBInfo(sd, db, num))
+#define dlp_ReadRecordById(sd, db, id, buf, index, attr, cat) \
+   sync_stats_read(dlp_ReadRecordById(sd, db, id, buf, index, attr, cat), buf)
+#define dlp_ReadRecordByIndex(sd, db, index, buf, id, attr, cat) \
+   sync_stats_read(dlp_ReadRecordByIndex(sd, db, index, buf, id, attr, cat), buf)
+#define dlp_ReadRecordIDList(sd, db, sort, start, max, ids, num) \
+   sync_stats_dlp(dlp_ReadRecordIDList(sd, db, sort, start, max, ids, num))
+#define dlp_ReadSortBlock(sd, db, offset, len, buf) \
+   sync_stats_receive(dlp_ReadSortBlock(sd, db, offset, len, buf), buf)
+#define dlp_ReadSysInfo(sd, info) \
+   sync_stats_dlp(dlp_ReadSysInfo(sd, info))
+#define dlp_ReadUserInfo(sd, user) \
+   sync_stats_dlp(dlp_ReadUserInfo(sd, user))
+#define dlp_ResetSyncFlags(sd, db) \
+   sync_stats_dlp(dlp_ResetSyncFlags(sd, db))
+#define dlp_VFSDirCreate(sd, vol, path) \
+   sync_stats_dlp(dlp_VFSDirCreate(sd, vol, path))
+#define dlp_VFSFileClose(sd, ref) \
+   sync_stats_dlp(dlp_VFSFileClose(sd, ref))
+#define dlp_VFSFileCreate(sd, vol, name) \
+   sync_stats_dlp(dlp_VFSFileCreate(sd, vol, name))
+#define dlp_VFSFileGetAttributes(sd, ref, attr) \
+   sync_stats_dlp(dlp_VFSFileGetAttributes(sd, ref, attr))
+#define dlp_VFSFileOpen(sd, vol, path, mode, ref) \
+   sync_stats_dlp(dlp_VFSFileOpen(sd, vol, path, mode, ref))
+#define dlp_VFSFileResize(sd, ref, size) \
+   sync_stats_dlp(dlp_VFSFileResize(sd, ref, size))
+#define dlp_VFSFileWrite(sd, ref, data, len) \
+   sync_stats_send(dlp_VFSFileWrite(sd, ref, data, len), len)
+#define dlp_VFSVolumeEnumerate(sd, num, refs) \
+   sync_stats_dlp(dlp_VFSVolumeEnumerate(sd, num, refs))
+#define dlp_VFSVolumeGetLabel(sd, vol, len, name) \
+   sync_stats_dlp(dlp_VFSVolumeGetLabel(sd, vol, len, name))
+#define dlp_VFSVolumeInfo(sd, vol, info) \
+   sync_stats_dlp(dlp_VFSVolumeInfo(sd, vol, info))
+#define dlp_VFSVolumeSize(sd, vol, used, total) \
+   sync_stats_dlp(dlp_VFSVolumeSize(sd, vol, used, total))
+#define dlp_WriteAppBlock(sd, db, data, len) \
+   sync_stats_send(dlp_WriteAppBlock(sd, db, data, len), len)
+#define dlp_WriteRecord(sd, db, flags, id, cat, data, len, new_id) \
+   sync_stats_write(dlp_WriteRecord(sd, db, flags, id, cat, data, len, new_id), len)
+#define dlp_WriteUserInfo(sd, user) \
+   sync_stats_dlp(dlp_WriteUserInfo(sd, user))
+#define pi_file_install(pf, sd, card, f) \
+   sync_stats_transfer(pi_file_install(pf, sd, card, sync_stats_progress), TRUE)
+#define pi_file_retrieve(pf, sd, card, f) \
+   sync_stats_transfer(pi_file_retrieve(pf, sd, card, sync_stats_progress), FALSE)
+
 /* #define PIPE_DEBUG */
 /* #define JPILOT_DEBUG */
 /* #define SYNC_CAT_DEBUG */
@@ -75,12 +166,23 @@
 extern int pipe_to_parent, pipe_from_parent;
 extern pid_t glob_child_pid;
 
+/* Work committed by the sync in progress */
+static struct sync_journal journal;
+
+int (*glob_sync_connected)(int sd, struct my_sync_info *sync_info)=NULL;
+#ifdef USE_LOCKING
+/* Lock on the home directory that glob_sync_connected chose */
+static int connected_lock_fd=-1;
+#endif
+
 /****************************** Prototypes ************************************/
 /* From jpilot.c for restoring sync icon after successful sync */
 extern void cb_cancel_sync(GtkWidget *widget, unsigned int flags);
 
 static int pi_file_install_VFS(const int fd, const char *basename, const int socket, const char *vfspath, progress_func f);
 static int findVFSPath(int sd, const char *path, long *volume, char *rpath, int *rpathlen);
+static void phase_begin(const char *name, const char *detail);
+static void phase_end(const char *name);
 
 /****************************** Main Code *************************************/
 
@@ -220,17 +322,65 @@ static const char *get_error_str(int error)
    }
 }
 
+/* Zero the gapfill bytes of a record.
+ *
+ * Some databases do not pack tightly into memory and have gaps which
+ * are do-not-cares during comparison.  These gaps can assume any value
+ * on the handheld, so they are zeroed out, the same value that
+ * pilot-link uses.  Records packed by J-Pilot need fewer fixes than
+ * records read from the handheld.
+ *
+ * Returns FALSE for databases whose records can't be compared with
+ * memcmp. */
+static int normalize_record(const char *DB_name, unsigned char *rec,
+                            int rec_len, int remote)
+{
+   if (!strcmp(DB_name,"DatebookDB") ||
+       !strcmp(DB_name,"CalendarDB-PDat")) {
+      if (remote && (rec_len > 7)) {
+         set_byte(rec+7,0);
+      }
+      return TRUE;
+   }
+
+   if (!strcmp(DB_name,"ContactsDB-PAdd")) {
+      if (remote && (rec_len > 6)) {
+         set_byte(rec+4,(get_byte(rec+4)) & 0x0F);
+         set_byte(rec+6,0);
+      }
+      if (rec_len > 16) {
+         set_byte(rec+16,0);
+      }
+      return TRUE;
+   }
+
+   if (!strcmp(DB_name,"ExpenseDB")) {
+      if (remote && (rec_len > 5)) {
+         set_byte(rec+5,0);
+      }
+      return TRUE;
+   }
+
+   if (!strcmp(DB_name,"AddressDB") ||
+       !strcmp(DB_name,"ToDoDB")    ||
+       !strcmp(DB_name,"MemoDB")    ||
+       !strcmp(DB_name,"Memo32DB")  ||
+       !strcmp(DB_name,"MemosDB-PMem") ||
+       !strcmp(DB_name,"Keys-Gtkr")) {
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
 /* Attempt to match records
  *
  * Ideally, one would have comparison routines on a per DB_name basis.
  * This involves a lot of overhead and packing/unpacking of records
  * and the routines are not written.
  *
- * A simpler way to compare records is to use memcmp. Some databases, 
- * however, do not pack tightly into memory and have gaps which are 
- * do-not-cares during comparison. These gaps can assume any value
- * but for comparison they are zeroed out, the same value that 
- * pilot-link uses.
+ * A simpler way to compare records is to use memcmp once the gapfill
+ * bytes are zeroed by normalize_record().
  *
  * For databases that we have no knowledge of only simple comparisons
  * such as record length are possible.  This is almost always good 
@@ -247,47 +397,263 @@ static int match_records(char *DB_name,
       return FALSE;
    }
 
-   /* memcmp works for a few specific databases */
-   if (!strcmp(DB_name,"DatebookDB") ||
-       !strcmp(DB_name,"CalendarDB-PDat")) {
-      /* Hack for gapfill byte */
-      set_byte(rrec+7,0);
-      return !(memcmp(lrec, rrec, lrec_len));
+   if (!normalize_record(DB_name, rrec, rrec_len, TRUE)) {
+      /* Lengths match and no other checks possible */
+      return TRUE;
    }
+   normalize_record(DB_name, lrec, lrec_len, FALSE);
+
+   return !(memcmp(lrec, rrec, lrec_len));
+}
 
-   if (!strcmp(DB_name,"AddressDB"))
-      return !(memcmp(lrec, rrec, lrec_len));
+/*
+ * An index of the records of a handheld database by unique ID and by a
+ * hash of their normalized contents.  Slow sync reads the database once
+ * into the index and then finds records, and copies of records, by
+ * lookups rather than by one round trip per record.
+ */
+struct remote_record
+{
+   recordid_t id;
+   int attr;
+   int category;
+   unsigned char *data;
+   int len;
+   guint hash;
+   /* Already matched to a new local record */
+   int claimed;
+};
 
-   if (!strcmp(DB_name,"ContactsDB-PAdd")) {
-      /* Hack for gapfill bytes */
-      set_byte(rrec+4,(get_byte(rrec+4)) & 0x0F);
-      set_byte(rrec+6,0);
-      set_byte(lrec+16,0);
-      set_byte(rrec+16,0);
-      return !(memcmp(lrec, rrec, lrec_len));
+struct remote_index
+{
+   char *DB_name;
+   int comparable;
+   /* unique ID -> struct remote_record */
+   GHashTable *by_id;
+   /* content hash -> GList of struct remote_record */
+   GHashTable *by_hash;
+};
+
+/* FNV-1a hash of a record with its gapfill bytes zeroed */
+static guint remote_index_hash(const char *DB_name, const void *rec, int len,
+                               int remote)
+{
+   unsigned char *copy;
+   guint hash;
+   int i;
+
+   copy = malloc(len+1);
+   if (!copy) {
+      return 0;
+   }
+   memcpy(copy, rec, len);
+   normalize_record(DB_name, copy, len, remote);
+   hash = 2166136261U;
+   for (i=0; i<len; i++) {
+      hash = (hash ^ copy[i]) * 16777619U;
    }
+   free(copy);
 
-   if (!strcmp(DB_name,"ToDoDB"))
-      return !(memcmp(lrec, rrec, lrec_len));
+   return hash ^ len;
+}
+
+static void remote_index_unhash(struct remote_index *ri,
+                                struct remote_record *rr)
+{
+   GList *list, *new_list;
 
-   if (!strcmp(DB_name,"MemoDB")   || 
-       !strcmp(DB_name,"Memo32DB") ||
-       !strcmp(DB_name,"MemosDB-PMem")) {
-      return !(memcmp(lrec, rrec, lrec_len));
+   list = g_hash_table_lookup(ri->by_hash, GUINT_TO_POINTER(rr->hash));
+   new_list = g_list_remove(list, rr);
+   if (new_list != list) {
+      if (new_list) {
+         g_hash_table_insert(ri->by_hash, GUINT_TO_POINTER(rr->hash), new_list);
+      } else {
+         g_hash_table_remove(ri->by_hash, GUINT_TO_POINTER(rr->hash));
+      }
    }
+}
 
-   if (!strcmp(DB_name,"ExpenseDB")) {
-      /* Hack for gapfill byte */
-      set_byte(rrec+5,0);
-      return !(memcmp(lrec, rrec, lrec_len));
+static void remote_index_remove(struct remote_index *ri, recordid_t id)
+{
+   struct remote_record *rr;
+
+   rr = g_hash_table_lookup(ri->by_id, GUINT_TO_POINTER(id));
+   if (rr) {
+      remote_index_unhash(ri, rr);
+      g_hash_table_remove(ri->by_id, GUINT_TO_POINTER(id));
    }
+}
 
-   if (!strcmp(DB_name,"Keys-Gtkr"))
-      return !(memcmp(lrec, rrec, lrec_len));
+static void free_remote_record(gpointer data)
+{
+   struct remote_record *rr = data;
 
-   /* Lengths match and no other checks possible */
-   return TRUE;
+   free(rr->data);
+   free(rr);
+}
+
+static void free_remote_list(gpointer key, gpointer value, gpointer data)
+{
+   g_list_free(value);
+}
+
+static void remote_index_init(struct remote_index *ri, char *DB_name)
+{
+   ri->DB_name = DB_name;
+   ri->comparable = normalize_record(DB_name, NULL, 0, FALSE);
+   ri->by_id = NULL;
+   ri->by_hash = NULL;
+}
+
+static void remote_index_free(struct remote_index *ri)
+{
+   if (ri->by_hash) {
+      g_hash_table_foreach(ri->by_hash, free_remote_list, NULL);
+      g_hash_table_destroy(ri->by_hash);
+      ri->by_hash = NULL;
+   }
+   if (ri->by_id) {
+      g_hash_table_destroy(ri->by_id);
+      ri->by_id = NULL;
+   }
+}
+
+/* Add or replace the record with unique ID id */
+static int remote_index_set(struct remote_index *ri, recordid_t id,
+                            const void *data, int len, int attr, int category)
+{
+   struct remote_record *rr;
+   GList *list;
+
+   if (!ri->by_id) {
+      return EXIT_SUCCESS;
+   }
+   rr = malloc(sizeof(struct remote_record));
+   if (!rr) {
+      return EXIT_FAILURE;
+   }
+   rr->data = malloc(len+1);
+   if (!rr->data) {
+      free(rr);
+      return EXIT_FAILURE;
+   }
+   memcpy(rr->data, data, len);
+   rr->len = len;
+   rr->id = id;
+   rr->attr = attr;
+   rr->category = category;
+   rr->claimed = FALSE;
+   rr->hash = remote_index_hash(ri->DB_name, rr->data, len, TRUE);
+
+   remote_index_remove(ri, id);
+   g_hash_table_insert(ri->by_id, GUINT_TO_POINTER(id), rr);
+   if (!(attr & dlpRecAttrDeleted)) {
+      list = g_hash_table_lookup(ri->by_hash, GUINT_TO_POINTER(rr->hash));
+      g_hash_table_insert(ri->by_hash, GUINT_TO_POINTER(rr->hash),
+                          g_list_prepend(list, rr));
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/* Read every record of the open database db into the index */
+static int remote_index_build(struct remote_index *ri, int sd, int db)
+{
+   pi_buffer_t *buffer;
+   recordid_t id;
+   int num, i, r, attr, category;
+
+   ri->by_id = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                     NULL, free_remote_record);
+   ri->by_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
 
+   num = 0;
+   dlp_ReadOpenDBInfo(sd, db, &num);
+   buffer = pi_buffer_new(65536);
+   for (i=0; i<num; i++) {
+      pi_buffer_clear(buffer);
+      r = dlp_ReadRecordByIndex(sd, db, i, buffer, &id, &attr, &category);
+      if ((r < 0) ||
+          remote_index_set(ri, id, buffer->data, buffer->used, attr, category)) {
+         jp_logf(JP_LOG_DEBUG, "remote_index_build: reading record %d failed\n", i);
+         pi_buffer_free(buffer);
+         remote_index_free(ri);
+         return EXIT_FAILURE;
+      }
+   }
+   pi_buffer_free(buffer);
+   jp_logf(JP_LOG_DEBUG, "remote_index_build: %d %s records\n", num, ri->DB_name);
+
+   return EXIT_SUCCESS;
+}
+
+/* Same as dlp_ReadRecordById, from the index once it has been built */
+static int remote_index_read(struct remote_index *ri, int sd, int db,
+                             recordid_t id, pi_buffer_t *buffer,
+                             int *attr, int *category)
+{
+   struct remote_record *rr;
+   int index;
+
+   if (!ri->by_id) {
+      return dlp_ReadRecordById(sd, db, id, buffer, &index, attr, category);
+   }
+   pi_buffer_clear(buffer);
+   rr = g_hash_table_lookup(ri->by_id, GUINT_TO_POINTER(id));
+   if (!rr) {
+      return -1;
+   }
+   pi_buffer_append(buffer, rr->data, rr->len);
+   *attr = rr->attr;
+   *category = rr->category;
+
+   return rr->len;
+}
+
+/* Find a record, other than the one with unique ID not_id, that matches
+ * rec.  When ignore_category is set, the categories are not compared.
+ * remote is set when rec was read from the handheld, so that its gapfill
+ * bytes are zeroed as those of the index are.
+ * Returns NULL if there is none or the index has not been built. */
+static struct remote_record *remote_index_find_copy(struct remote_index *ri,
+                                                    const void *rec, int len,
+                                                    int attr, int category,
+                                                    recordid_t not_id,
+                                                    int ignore_category,
+                                                    int remote)
+{
+   struct remote_record *rr;
+   unsigned char *copy;
+   GList *temp_list;
+   guint hash;
+
+   if (!ri->by_hash || !ri->comparable) {
+      return NULL;
+   }
+   hash = remote_index_hash(ri->DB_name, rec, len, remote);
+   temp_list = g_hash_table_lookup(ri->by_hash, GUINT_TO_POINTER(hash));
+   for (; temp_list; temp_list = temp_list->next) {
+      rr = temp_list->data;
+      if (rr->claimed || (rr->id == not_id)) {
+         continue;
+      }
+      /* The hashes match, make sure the records do */
+      copy = malloc(len+1);
+      if (!copy) {
+         return NULL;
+      }
+      memcpy(copy, rec, len);
+      normalize_record(ri->DB_name, copy, len, remote);
+      if (match_records(ri->DB_name, rr->data, rr->len, rr->attr,
+                        ignore_category ? 0 : rr->category,
+                        copy, len, attr, ignore_category ? 0 : category)) {
+         free(copy);
+         return rr;
+      }
+      free(copy);
+   }
+
+   return NULL;
 }
 
 static void filename_make_legal(char *s)
@@ -546,32 +912,6 @@ static int is_backup_dir(char *name)
    return TRUE;
 }
 
-static int compare_back_dates(char *s1, char *s2)
-{
-   /* backupMMDDhhmm */
-   int i1, i2;
-
-   if ((strlen(s1) < 8) || (strlen(s2) < 8)) {
-      return 0;
-   }
-   i1 = atoi(&s1[6]);
-   i2 = atoi(&s2[6]);
-   /* Try to guess the year crossover with a 6 month window */
-   if (((i1/1000000) <= 3) && ((i2/1000000) >= 10)) {
-      return 1;
-   }
-   if (((i1/1000000) >= 10) && ((i2/1000000) <= 3)) {
-      return 2;
-   }
-   if (i1>i2) {
-      return 1;
-   }
-   if (i1<i2) {
-      return 2;
-   }
-   return 0;
-}
-
 static int sync_remove_r(char *full_path)
 {
    DIR *dir;
@@ -603,138 +943,103 @@ static int sync_remove_r(char *full_path)
    return EXIT_SUCCESS;
 }
 
-static int get_oldest_newest_dir(char *oldest, char *newest, int *count)
-{
-   DIR *dir;
-   struct dirent *dirent;
-   char home_dir[FILENAME_MAX];
-   int r;
-
-   get_home_file_name("", home_dir, sizeof(home_dir));
-   jp_logf(JP_LOG_DEBUG, "rotate_backups: opening dir %s\n", home_dir);
-   *count = 0;
-   oldest[0]='\0';
-   newest[0]='\0';
-   dir = opendir(home_dir);
-   if (!dir) {
-      return EXIT_FAILURE;
-   }
-   *count = 0;
-   while((dirent = readdir(dir))) {
-      if (is_backup_dir(dirent->d_name)) {
-         jp_logf(JP_LOG_DEBUG, "backup dir [%s]\n", dirent->d_name);
-         (*count)++;
-         if (oldest[0]=='\0') {
-            strcpy(oldest, dirent->d_name);
-            /* jp_logf(JP_LOG_DEBUG, "oldest is now %s\n", oldest);*/
-         }
-         if (newest[0]=='\0') {
-            strcpy(newest, dirent->d_name);
-            /* jp_logf(JP_LOG_DEBUG, "newest is now %s\n", newest);*/
-         }
-         r = compare_back_dates(oldest, dirent->d_name);
-         if (r==1) {
-            strcpy(oldest, dirent->d_name);
-            /* jp_logf(JP_LOG_DEBUG, "oldest is now %s\n", oldest);*/
-         }
-         r = compare_back_dates(newest, dirent->d_name);
-         if (r==2) {
-            strcpy(newest, dirent->d_name);
-            /* jp_logf(JP_LOG_DEBUG, "newest is now %s\n", newest);*/
-         }
-      }
-   }
-   closedir(dir);
-   return EXIT_SUCCESS;
-}
-
-static int sync_rotate_backups(const int num_backups)
+/*
+ * Older versions kept each backup as a full copy in a backupMMDDhhmm
+ * directory with a symlink named backup pointing to the newest one.
+ * Those directories are moved into the backup store and the newest one
+ * becomes the plain directory backup.
+ */
+static int sync_migrate_backup_dirs(void)
 {
    DIR *dir;
    struct dirent *dirent;
    char home_dir[FILENAME_MAX];
    char full_name[FILENAME_MAX];
-   char full_newdir[FILENAME_MAX];
-   char full_backup[FILENAME_MAX];
-   char full_oldest[FILENAME_MAX];
    char full_src[FILENAME_MAX];
    char full_dest[FILENAME_MAX];
-   int r;
-   int count, safety;
-   char oldest[20];
-   char newest[20];
-   char newdir[20];
-   time_t ltime;
-   struct tm *now;
+   char link_target[FILENAME_MAX];
+   struct stat statb;
+   int len;
 
    get_home_file_name("", home_dir, sizeof(home_dir));
+   g_snprintf(full_name, sizeof(full_name), "%s/backup", home_dir);
 
-   /* We use safety because if removing the directory fails then we
-    * will get stuck in an endless loop */
-   for (safety=100; safety>0; safety--) {
-      r = get_oldest_newest_dir(oldest, newest, &count);
-      if (r<0) {
-         jp_logf(JP_LOG_WARN, _("Unable to read home dir\n"));
-         break;
+   link_target[0]='\0';
+   if (!lstat(full_name, &statb) && S_ISLNK(statb.st_mode)) {
+      len = readlink(full_name, link_target, sizeof(link_target)-1);
+      if (len < 0) {
+         len = 0;
       }
-      if (count > num_backups) {
-         sprintf(full_oldest, "%s/%s", home_dir, oldest);
-         jp_logf(JP_LOG_DEBUG, "count=%d, num_backups=%d\n", count, num_backups);
-         jp_logf(JP_LOG_DEBUG, "removing dir [%s]\n", full_oldest);
-         sync_remove_r(full_oldest);
-      } else {
-         break;
+      link_target[len]='\0';
+      /* A link made by hand is left alone */
+      if (!is_backup_dir(link_target)) {
+         link_target[0]='\0';
       }
    }
 
-   /* Now we should have the same number of backups (or less) as num_backups */
-
-   time(&ltime);
-   now = localtime(&ltime);
-   /* Create the new backup directory */
-   g_snprintf(newdir, sizeof(newdir), "backup%02d%02d%02d%02d",
-              now->tm_mon+1, now->tm_mday, now->tm_hour, now->tm_min);
-   if (strncmp(newdir, newest, sizeof(newdir))) {
-      g_snprintf(full_newdir, sizeof(full_newdir), "%s/%s", home_dir, newdir);
-      if (mkdir(full_newdir, 0700)==0) {
-         count++;
-      }
+   dir = opendir(home_dir);
+   if (!dir) {
+      jp_logf(JP_LOG_WARN, _("Unable to read home dir\n"));
+      return EXIT_FAILURE;
    }
-
-   /* Copy from the newest backup, if it exists */
-   if (strncmp(newdir, newest, sizeof(newdir))) {
-      g_snprintf(full_backup, sizeof(full_backup), "%s/backup", home_dir);
-      g_snprintf(full_newdir, sizeof(full_newdir), "%s/%s", home_dir, newdir);
-      dir = opendir(full_backup);
-      if (dir) {
-         while ((dirent = readdir(dir))) {
-            g_snprintf(full_src, sizeof(full_src), "%s/%s", full_backup, dirent->d_name);
-            g_snprintf(full_dest, sizeof(full_dest), "%s/%s", full_newdir, dirent->d_name);
-            jp_copy_file(full_src, full_dest);
+   while ((dirent = readdir(dir))) {
+      if (!is_backup_dir(dirent->d_name)) {
+         continue;
+      }
+      g_snprintf(full_src, sizeof(full_src), "%s/%s", home_dir, dirent->d_name);
+      if (stat(full_src, &statb) || !S_ISDIR(statb.st_mode)) {
+         continue;
+      }
+      jp_logf(JP_LOG_DEBUG, "moving backup dir [%s] into the backup store\n", full_src);
+      if (backup_store_snapshot(full_src, statb.st_mtime, NULL)) {
+         /* Keep the directory rather than lose the backup */
+         continue;
+      }
+      if (strcmp(dirent->d_name, link_target)) {
+         sync_remove_r(full_src);
+         /* Files other than databases keep the directory around.
+          * Rename it so that it is not moved in again. */
+         if (!stat(full_src, &statb)) {
+            g_snprintf(full_dest, sizeof(full_dest), "%s.migrated", full_src);
+            rename(full_src, full_dest);
          }
-         closedir(dir);
       }
    }
+   closedir(dir);
 
-   /* Remove the oldest backup if needed */
-   if (count > num_backups) {
-      if ( (oldest[0]!='\0') && (strncmp(newdir, oldest, sizeof(newdir))) ) {
-         g_snprintf(full_oldest, sizeof(full_oldest), "%s/%s", home_dir, oldest);
-         jp_logf(JP_LOG_DEBUG, "removing dir [%s]\n", full_oldest);
-         sync_remove_r(full_oldest);
+   if (link_target[0]) {
+      g_snprintf(full_src, sizeof(full_src), "%s/%s", home_dir, link_target);
+      unlink(full_name);
+      if (rename(full_src, full_name)) {
+         jp_logf(JP_LOG_WARN, "rename failed %s %d\n", __FILE__, __LINE__);
       }
    }
 
-   /* Delete the symlink */
-   g_snprintf(full_name, sizeof(full_name), "%s/backup", home_dir);
-   unlink(full_name);
+   /* The current copy of every backed up database */
+   mkdir(full_name, 0700);
+
+   return EXIT_SUCCESS;
+}
+
+/* Record the contents of the backup directory as a new backup and
+ * drop the ones over num_backups */
+static int sync_backup_snapshot(const int num_backups,
+                                struct backup_entry *copies)
+{
+   char full_name[FILENAME_MAX];
+   int r;
 
-   /* Create the symlink */
-   if (symlink(newdir, full_name) != 0) {
-      jp_logf(JP_LOG_WARN, "symlink failed %s %d\n", __FILE__, __LINE__);
+   TRACE_BEGIN("backup snapshot");
+   get_home_file_name("backup", full_name, sizeof(full_name));
+   r = backup_store_snapshot(full_name, time(NULL), copies);
+   if (r == EXIT_SUCCESS) {
+      r = backup_store_rotate(num_backups);
+   } else {
+      jp_logf(JP_LOG_WARN, _("Unable to save backup\n"));
    }
+   TRACE_END("backup snapshot");
 
-   return EXIT_SUCCESS;
+   return r;
 }
 
 static int unpack_datebook_cai_from_ai(struct CategoryAppInfo *cai, unsigned char *ai_raw, int len)
@@ -1030,15 +1335,286 @@ static int pack_memo_cai_into_ai(struct CategoryAppInfo *cai,
    return EXIT_SUCCESS;
 }
 
+/* A record fetched from the handheld by sync_fetch_changed_records() */
+struct changed_record
+{
+   pi_buffer_t *buf;
+   int attr;
+   int category;
+};
+
+static void free_changed_record(gpointer key, gpointer value, gpointer data)
+{
+   struct changed_record *rec = value;
+
+   pi_buffer_free(rec->buf);
+   free(rec);
+}
+
+/*
+ * Bring the backup copy file_name of a record database up to date by
+ * fetching only the records whose dirty or deleted flags are set on
+ * the handheld, taking the others from the old copy.  This is only
+ * valid when no sync has happened since the old copy was fetched, since
+ * the conduit of another desktop may have reset the flags of records it
+ * saw.  The flags are left alone, they belong to the database's own
+ * conduit.  The unique IDs of the fetched and removed records are
+ * returned in changed_list and removed_list.
+ *
+ * Returns EXIT_FAILURE if the database has to be fetched in full.
+ */
+static int sync_fetch_changed_records(int sd, struct DBInfo *info,
+                                      char *file_name,
+                                      char **changed_list,
+                                      char **removed_list)
+{
+   struct pi_file *pf1, *pf2;
+   char file_name2[FILENAME_MAX];
+   GHashTable *changed;
+   GHashTable *on_palm;
+   struct changed_record *rec;
+   GString *changed_ids, *removed_ids;
+   pi_buffer_t *buffer;
+   recordid_t *ids;
+   recordid_t id;
+   pi_uid_t uid;
+   void *record;
+   size_t size;
+   int db, num_recs, num_ids, count;
+   int idx, rindex, attr, cat;
+   int num_changed;
+   int r, failed;
+
+   pf1 = pi_file_open(file_name);
+   if (!pf1) {
+      return EXIT_FAILURE;
+   }
+
+   if (dlp_OpenDB(sd, 0, dlpOpenRead|dlpOpenSecret, info->name, &db) < 0) {
+      pi_file_close(pf1);
+      return EXIT_FAILURE;
+   }
+
+   /* Unique IDs of all records, in the order they are on the handheld */
+   num_recs = 0;
+   dlp_ReadOpenDBInfo(sd, db, &num_recs);
+   ids = malloc((num_recs+1) * sizeof(recordid_t));
+   if (!ids) {
+      jp_logf(JP_LOG_WARN, "sync_fetch_changed_records(): %s\n", _("Out of memory"));
+      dlp_CloseDB(sd, db);
+      pi_file_close(pf1);
+      return EXIT_FAILURE;
+   }
+   for (num_ids=0; num_ids < num_recs; num_ids += count) {
+      count = num_recs - num_ids;
+      if (count > 500) {
+         count = 500;
+      }
+      r = dlp_ReadRecordIDList(sd, db, 0, num_ids, count, ids+num_ids, &count);
+      if ((r < 0) || (count <= 0)) {
+         break;
+      }
+   }
+   if (num_ids != num_recs) {
+      free(ids);
+      dlp_CloseDB(sd, db);
+      pi_file_close(pf1);
+      return EXIT_FAILURE;
+   }
+
+   /* Records changed since their conduit last reset the flags */
+   changed = g_hash_table_new(g_direct_hash, g_direct_equal);
+   while (1) {
+      rec = malloc(sizeof(struct changed_record));
+      if (!rec) {
+         break;
+      }
+      rec->buf = pi_buffer_new(0);
+      r = dlp_ReadNextModifiedRec(sd, db, rec->buf, &id, &idx,
+                                  &rec->attr, &rec->category);
+      if (r < 0) {
+         pi_buffer_free(rec->buf);
+         free(rec);
+         break;
+      }
+      g_hash_table_insert(changed, GUINT_TO_POINTER(id), rec);
+   }
+
+   g_snprintf(file_name2, sizeof(file_name2), "%s2", file_name);
+   pf2 = pi_file_create(file_name2, info);
+   failed = (pf2 == NULL);
+
+   buffer = pi_buffer_new(0xFFFF);
+   if (!failed) {
+      r = dlp_ReadAppBlock(sd, db, 0, -1, buffer);
+      if (r > 0) {
+         pi_file_set_app_info(pf2, buffer->data, buffer->used);
+      }
+      pi_buffer_clear(buffer);
+      r = dlp_ReadSortBlock(sd, db, 0, -1, buffer);
+      if (r > 0) {
+         pi_file_set_sort_info(pf2, buffer->data, buffer->used);
+      }
+   }
+
+   changed_ids = g_string_new("");
+   removed_ids = g_string_new("");
+   on_palm = g_hash_table_new(g_direct_hash, g_direct_equal);
+   num_changed = 0;
+
+   for (idx=0; !failed && idx<num_ids; idx++) {
+      g_hash_table_insert(on_palm, GUINT_TO_POINTER(ids[idx]), GINT_TO_POINTER(1));
+      rec = g_hash_table_lookup(changed, GUINT_TO_POINTER(ids[idx]));
+      if (rec) {
+         pi_file_append_record(pf2, rec->buf->data, rec->buf->used,
+                               rec->attr, rec->category, ids[idx]);
+         g_string_append_printf(changed_ids, "%s%lu",
+                                changed_ids->len ? "," : "",
+                                (unsigned long)ids[idx]);
+         num_changed++;
+         continue;
+      }
+      r = pi_file_read_record_by_id(pf1, ids[idx], &record, &size,
+                                    &rindex, &attr, &cat);
+      if (r >= 0) {
+         /* The handheld has no changes to this record */
+         pi_file_append_record(pf2, record, size, attr & ~dlpRecAttrDirty,
+                               cat, ids[idx]);
+         continue;
+      }
+      /* Not in the old copy either, fetch it on its own */
+      pi_buffer_clear(buffer);
+      r = dlp_ReadRecordById(sd, db, ids[idx], buffer, &rindex, &attr, &cat);
+      if (r < 0) {
+         failed = 1;
+         break;
+      }
+      pi_file_append_record(pf2, buffer->data, buffer->used, attr, cat, ids[idx]);
+      g_string_append_printf(changed_ids, "%s%lu",
+                             changed_ids->len ? "," : "",
+                             (unsigned long)ids[idx]);
+      num_changed++;
+   }
+
+   /* Records of the old copy that are gone from the handheld */
+   for (idx=0; !failed; idx++) {
+      if (pi_file_read_record(pf1, idx, &record, &size, &attr, &cat, &uid) < 0) {
+         break;
+      }
+      if (!g_hash_table_lookup(on_palm, GUINT_TO_POINTER(uid))) {
+         g_string_append_printf(removed_ids, "%s%lu",
+                                removed_ids->len ? "," : "",
+                                (unsigned long)uid);
+      }
+   }
+
+   pi_buffer_free(buffer);
+   g_hash_table_foreach(changed, free_changed_record, NULL);
+   g_hash_table_destroy(changed);
+   g_hash_table_destroy(on_palm);
+   free(ids);
+   pi_file_close(pf1);
+   if (pf2) {
+      if (pi_file_close(pf2) < 0) {
+         failed = 1;
+      }
+   }
+
+   if (!failed && rename(file_name2, file_name)) {
+      failed = 1;
+   }
+   if (failed) {
+      unlink(file_name2);
+   } else {
+      *changed_list = strdup(changed_ids->str);
+      *removed_list = strdup(removed_ids->str);
+      jp_logf(JP_LOG_DEBUG, "%s: fetched %d of %d records\n", info->name,
+              num_changed, num_ids);
+   }
+   dlp_CloseDB(sd, db);
+
+   g_string_free(changed_ids, TRUE);
+   g_string_free(removed_ids, TRUE);
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Fetch a database into file_name.  It is fetched into a new file which
+ * then replaces the old one in a single rename, so whoever reads the old
+ * file meanwhile, such as the GUI, keeps reading a complete copy of it.
+ * On failure the old copy is kept, and its modify time has it fetched
+ * again by the next sync.
+ */
+static int fetch_DB_file(int sd, struct DBInfo *info, const char *file_name)
+{
+   struct pi_file *pi_fp;
+   char new_name[FILENAME_MAX];
+   struct utimbuf times;
+   int failed;
+
+   g_snprintf(new_name, sizeof(new_name), "%s2", file_name);
+   pi_fp = pi_file_create(new_name, info);
+   if (pi_fp==0) {
+      jp_logf(JP_LOG_WARN, _("Failed, unable to create file %s\n"), new_name);
+      return EXIT_FAILURE;
+   }
+   failed = (pi_file_retrieve(pi_fp, sd, 0, NULL)<0);
+   if (pi_file_close(pi_fp)<0) {
+      failed = 1;
+   }
+   if (failed) {
+      jp_logf(JP_LOG_WARN, _("Failed, unable to back up database %s\n"), info->name);
+      unlink(new_name);
+      return EXIT_FAILURE;
+   }
+
+   /* Set the create and modify times of local file to same as on palm */
+   times.actime = info->createDate;
+   times.modtime = info->modifyDate;
+   utime(new_name, &times);
+
+   if (rename(new_name, file_name)) {
+      jp_logf(JP_LOG_WARN, _("Failed, unable to create file %s\n"), file_name);
+      unlink(new_name);
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/*
+ * Note that the backup copy name matches the handheld as of the sync
+ * that leaves sync_date on it.  changed and removed are the record
+ * deltas of an incremental fetch, or NULL, and are taken over.
+ */
+static void note_backup_copy(struct backup_entry **copies, const char *name,
+                             time_t sync_date, char *changed, char *removed)
+{
+   struct backup_entry *copy;
+
+   copy = malloc(sizeof(struct backup_entry));
+   if (!copy) {
+      free(changed);
+      free(removed);
+      return;
+   }
+   memset(copy, 0, sizeof(struct backup_entry));
+   copy->name = strdup(name);
+   copy->changed = changed;
+   copy->removed = removed;
+   copy->synced = sync_date;
+   copy->next = *copies;
+   *copies = copy;
+}
+
 /*
  * Fetch the databases from the palm if modified
  */
 static void fetch_extra_DBs2(int sd, struct DBInfo info, char *palm_dbname[])
 {
-   struct pi_file *pi_fp;
    char full_name[FILENAME_MAX];
    struct stat statb;
-   struct utimbuf times;
    int i;
    int found;
    char db_copy_name[MAX_DBNAME];
@@ -1090,25 +1666,9 @@ static void fetch_extra_DBs2(int sd, struct DBInfo info, char *palm_dbname[])
 
    info.flags &= 0xff;
 
-   pi_fp = pi_file_create(full_name, &info);
-
-   if (pi_fp==0) {
-      jp_logf(JP_LOG_WARN, _("Failed, unable to create file %s\n"), full_name);
-      return;
-   }
-   if (pi_file_retrieve(pi_fp, sd, 0, NULL)<0) {
-      jp_logf(JP_LOG_WARN, _("Failed, unable to back up database %s\n"), info.name);
-      times.actime = 0;
-      times.modtime = 0;
-   } else {
+   if (fetch_DB_file(sd, &info, full_name) == EXIT_SUCCESS) {
       jp_logf(JP_LOG_GUI, _("OK\n"));
-      times.actime = info.createDate;
-      times.modtime = info.modifyDate;
    }
-   pi_file_close(pi_fp);
-
-   /* Set the create and modify times of local file to same as on palm */
-   utime(full_name, &times);
 }
 
 /*
@@ -1143,13 +1703,16 @@ static int fetch_extra_DBs(int sd, char *palm_dbname[])
 /*
  * Fetch the databases from the palm if modified
  *
+ * prev_sync_date is the sync date the handheld had when it connected and
+ * sync_date the one this sync leaves on it.
+ *
  * Be sure to call free_file_name_list(&file_list); before returning from
  * anywhere in this function.
  */
 static int sync_fetch(int sd, unsigned int flags, 
-                      const int num_backups, int fast_sync)
+                      const int num_backups, int fast_sync,
+                      time_t prev_sync_date, time_t sync_date)
 {
-   struct pi_file *pi_fp;
    char full_name[FILENAME_MAX];
    char full_backup_name[FILENAME_MAX];
    char creator[5];
@@ -1209,10 +1772,22 @@ static int sync_fetch(int sd, unsigned int flags,
       { 0, 0, NULL, NULL}
    };
    unsigned int full_backup;
+   int incremental;
+   int have_copy;
+   char *changed, *removed;
+   /* Backup copies as of the previous backup */
+   struct backup_entry *prev_copies, *prev_copy;
+   GList *manifests;
+   /* Backup copies known to match the handheld after this sync */
+   struct backup_entry *copies;
 
    jp_logf(JP_LOG_DEBUG, "sync_fetch flags=0x%x, num_backups=%d, fast=%d\n",
                                              flags, num_backups, fast_sync);
 
+   incremental = get_pref_int_default(PREF_INCREMENTAL_BACKUP, 1);
+   prev_copies = NULL;
+   copies = NULL;
+
    rename_dbnames(palm_dbname);
 
    full_backup = flags & SYNC_FULL_BACKUP;
@@ -1225,9 +1800,14 @@ static int sync_fetch(int sd, unsigned int flags,
 
    if (full_backup) {
       jp_logf(JP_LOG_DEBUG, "Full Backup\n");
-      pi_watchdog(sd,10); /* prevent Palm timing out on long disk copy times */
-      sync_rotate_backups(num_backups);
-      pi_watchdog(sd,0);  /* back to normal behavior */
+      sync_migrate_backup_dirs();
+      if (incremental) {
+         backup_store_get_manifests(&manifests);
+         if (manifests) {
+            backup_store_read_manifest(manifests->data, &prev_copies);
+         }
+         backup_store_free_manifests(&manifests);
+      }
    }
 
    start=cardno=0;
@@ -1407,7 +1987,7 @@ static int sync_fetch(int sd, unsigned int flags,
          file_name = full_backup_name;
       }
       statb.st_mtime = 0;
-      stat(file_name, &statb);
+      have_copy = !stat(file_name, &statb);
 #ifdef JPILOT_DEBUG
       jp_logf(JP_LOG_GUI, "palm dbtime= %d, local dbtime = %d\n", info.modifyDate, statb.st_mtime);
       jp_logf(JP_LOG_GUI, "flags=0x%x\n", info.flags);
@@ -1417,196 +1997,388 @@ static int sync_fetch(int sd, unsigned int flags,
       if (info.modifyDate == statb.st_mtime) {
          jp_logf(JP_LOG_DEBUG, "%s up to date, modify date (2) %ld\n", info.name, info.modifyDate);
          jp_logf(JP_LOG_GUI, _("%s (Creator ID '%s') is up to date, fetch skipped.\n"), db_copy_name, creator);
+         if (full_backup && !main_app) {
+            note_backup_copy(&copies, db_copy_name, sync_date, NULL, NULL);
+         }
          continue;
       }
 
-      jp_logf(JP_LOG_GUI, _("Fetching '%s' (Creator ID '%s')... "), info.name, creator);
+      jp_logf(JP_LOG_GUI, _("Fetching '%s' (Creator ID '%s')... "), info.name, creator);
+
+      info.flags &= 0xff;
+
+      /* Databases that no conduit syncs can be brought up to date from
+       * their changed records, if their copy is still the one the last
+       * backup found to match the handheld and no sync has happened
+       * since then to reset the flags */
+      prev_copy = NULL;
+      if (incremental && fast_sync && have_copy && !main_app &&
+          !(info.flags & dlpDBFlagResource)) {
+         for (prev_copy = prev_copies; prev_copy; prev_copy = prev_copy->next) {
+            if (!strcmp(prev_copy->name, db_copy_name)) {
+               break;
+            }
+         }
+         if (prev_copy &&
+             ((prev_copy->synced == 0) ||
+              (prev_copy->synced != prev_sync_date) ||
+              (prev_copy->mtime != statb.st_mtime) ||
+              (prev_copy->size != statb.st_size))) {
+            prev_copy = NULL;
+         }
+      }
+      if (prev_copy) {
+         TRACE_BEGIN_DETAIL("fetch changed records", info.name);
+         changed = removed = NULL;
+         r = sync_fetch_changed_records(sd, &info, file_name,
+                                        &changed, &removed);
+         TRACE_END("fetch changed records");
+         if (r == EXIT_SUCCESS) {
+            jp_logf(JP_LOG_GUI, _("OK\n"));
+            times.actime = info.createDate;
+            times.modtime = info.modifyDate;
+            utime(file_name, &times);
+            note_backup_copy(&copies, db_copy_name, sync_date, changed, removed);
+            continue;
+         }
+         jp_logf(JP_LOG_DEBUG, "fetching changed records failed, fetching all of %s\n", info.name);
+      }
+
+      if (fetch_DB_file(sd, &info, file_name)) {
+         continue;
+      }
+      jp_logf(JP_LOG_GUI, _("OK\n"));
+      if (full_backup && !main_app) {
+         note_backup_copy(&copies, db_copy_name, sync_date, NULL, NULL);
+      }
+
+      /* This call preserves the file times */
+      if (main_app && !fast_sync && full_backup) {
+         jp_copy_file(full_name, full_backup_name);
+      }
+   }
+   }
+   pi_buffer_free(buffer);
+   palmos_error = pi_palmos_error(sd);
+   if (palmos_error==dlpErrNotFound) {
+      jp_logf(JP_LOG_DEBUG, "Good return code (dlpErrNotFound)\n");
+      if (full_backup) {
+         jp_logf(JP_LOG_DEBUG, "Removing apps not found on the palm\n");
+         move_removed_apps(file_list);
+      }
+   } else {
+      jp_logf(JP_LOG_WARN, "ReadDBList returned = %d\n", r);
+      jp_logf(JP_LOG_WARN, "palmos_error = %d\n", palmos_error);
+      jp_logf(JP_LOG_WARN, "dlp_strerror is %s\n", dlp_strerror(palmos_error));
+   }
+
+   if (full_backup) {
+      pi_watchdog(sd,10); /* prevent Palm timing out on long disk copy times */
+      sync_backup_snapshot(num_backups, copies);
+      pi_watchdog(sd,0);  /* back to normal behavior */
+   }
+   backup_store_free_entries(&copies);
+   backup_store_free_entries(&prev_copies);
+
+   free_file_name_list(&file_list);
+
+   return EXIT_SUCCESS;
+}
+
+/* A file of the install list, opened and checked before the handheld
+ * connects so that the connected session only has to send it */
+struct install_item
+{
+   /* The line of the install list */
+   char *line;
+   char *filename;
+   /* Installed into VFS_INSTALL_DIR of the card instead of the handheld */
+   int sdcard;
+   /* The open database, if the file is one */
+   struct pi_file *f;
+   struct DBInfo info;
+   /* errno of opening the file, or -1 if it is not a database */
+   int error;
+   /* The file as it was opened, to notice it being replaced since */
+   struct stat statb;
+};
+
+/* Install list as read before the handheld connected */
+static GList *install_queue = NULL;
+
+/* VFS volume of the last path looked up, for the connection cached_sd */
+static int cached_sd = -1;
+static char cached_vfspath[vfsMAXFILENAME];
+static long cached_volume;
+static char cached_rpath[vfsMAXFILENAME];
+static int cached_rpathlen;
+
+static struct install_item *install_item_new(const char *line)
+{
+   struct install_item *item;
+   int fd;
+
+   item = malloc(sizeof(struct install_item));
+   if (!item) {
+      jp_logf(JP_LOG_WARN, "install_item_new(): %s\n", _("Out of memory"));
+      return NULL;
+   }
+   memset(item, 0, sizeof(struct install_item));
+   item->line = strdup(line);
+   if (line[0] == '\001') {
+      /* found SDCARD indicator */
+      item->sdcard = TRUE;
+      line++;
+   }
+   item->filename = strdup(line);
+   if ((!item->line) || (!item->filename)) {
+      jp_logf(JP_LOG_WARN, "install_item_new(): %s\n", _("Out of memory"));
+      free(item->line);
+      free(item->filename);
+      free(item);
+      return NULL;
+   }
+
+   if (stat(item->filename, &(item->statb))) {
+      memset(&(item->statb), 0, sizeof(item->statb));
+   }
+   item->f = pi_file_open(item->filename);
+   if (item->f) {
+      pi_file_get_info(item->f, &(item->info));
+   }
+   /* Any file can go to the card, only databases to the handheld */
+   if ((!item->f) || (item->sdcard)) {
+      fd = open(item->filename, O_RDONLY);
+      if (fd < 0) {
+         item->error = errno;
+      } else {
+         close(fd);
+         if (!item->f && !item->sdcard) {
+            item->error = -1;
+         }
+      }
+   }
+
+   return item;
+}
+
+static void install_item_free(struct install_item *item)
+{
+   if (item->f) {
+      pi_file_close(item->f);
+   }
+   free(item->line);
+   free(item->filename);
+   free(item);
+}
+
+static void free_install_queue(void)
+{
+   GList *temp_list;
+
+   for (temp_list = install_queue; temp_list; temp_list = temp_list->next) {
+      install_item_free(temp_list->data);
+   }
+   g_list_free(install_queue);
+   install_queue = NULL;
+}
+
+/* Read the install list and open every file of it while the handheld
+ * has not connected yet */
+static int sync_prepare_install(void)
+{
+   FILE *in;
+   char line[1002];
+   struct install_item *item;
+   int num, num_bad;
+
+   free_install_queue();
+
+   in = jp_open_home_file(EPN".install", "r");
+   if (!in) {
+      return EXIT_FAILURE;
+   }
+   num = num_bad = 0;
+   while (fgets(line, 1000, in)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (!line[0]) {
+         continue;
+      }
+      item = install_item_new(line);
+      if (!item) {
+         break;
+      }
+      if (item->error) {
+         num_bad++;
+      }
+      install_queue = g_list_prepend(install_queue, item);
+      num++;
+   }
+   jp_close_home_file(in);
+   install_queue = g_list_reverse(install_queue);
+
+   jp_logf(JP_LOG_DEBUG, "install queue: %d files, %d not usable\n", num, num_bad);
 
-      info.flags &= 0xff;
+   return EXIT_SUCCESS;
+}
 
-      pi_fp = pi_file_create(file_name, &info);
-      if (pi_fp==0) {
-         jp_logf(JP_LOG_WARN, _("Failed, unable to create file %s\n"),
-                main_app ? full_name : full_backup_name);
-         continue;
+/* Take the item of line out of the install queue, or open it now if it
+ * was added to the install list after the queue was read or the file
+ * was written or replaced since it was opened */
+static struct install_item *take_install_item(const char *line)
+{
+   GList *temp_list;
+   struct install_item *item;
+   struct stat statb;
+
+   for (temp_list = install_queue; temp_list; temp_list = temp_list->next) {
+      item = temp_list->data;
+      if (!strcmp(item->line, line)) {
+         install_queue = g_list_delete_link(install_queue, temp_list);
+         if (!stat(item->filename, &statb) &&
+             (statb.st_dev == item->statb.st_dev) &&
+             (statb.st_ino == item->statb.st_ino) &&
+             (statb.st_size == item->statb.st_size) &&
+             (statb.st_mtime == item->statb.st_mtime)) {
+            return item;
+         }
+         jp_logf(JP_LOG_DEBUG, "install queue: %s changed, opening it again\n",
+                 item->filename);
+         install_item_free(item);
+         break;
       }
-      if (pi_file_retrieve(pi_fp, sd, 0, NULL)<0) {
-         jp_logf(JP_LOG_WARN, _("Failed, unable to back up database %s\n"), info.name);
-         times.actime = 0;
-         times.modtime = 0;
-      } else {
-         jp_logf(JP_LOG_GUI, _("OK\n"));
-         times.actime = info.createDate;
-         times.modtime = info.modifyDate;
+   }
+
+   return install_item_new(line);
+}
+
+/* findVFSPath enumerates the volumes of the card, which only has to be
+ * done once per connection for the files of one directory */
+static int find_VFS_path_cached(int sd, const char *path, long *volume,
+                                char *rpath, int *rpathlen)
+{
+   int r;
+
+   if ((sd != cached_sd) || (strcmp(path, cached_vfspath)) ||
+       (*rpathlen <= cached_rpathlen)) {
+      cached_sd = -1;
+      r = findVFSPath(sd, path, volume, rpath, rpathlen);
+      if (r < 0) {
+         return r;
       }
-      pi_file_close(pi_fp);
+      cached_sd = sd;
+      g_strlcpy(cached_vfspath, path, sizeof(cached_vfspath));
+      cached_volume = *volume;
+      g_strlcpy(cached_rpath, rpath, sizeof(cached_rpath));
+      cached_rpathlen = *rpathlen;
+      return r;
+   }
 
-      /* Set the create and modify times of local file to same as on palm */
-      utime(file_name, &times);
+   *volume = cached_volume;
+   memset(rpath, 0, *rpathlen);
+   strcpy(rpath, cached_rpath);
+   *rpathlen = cached_rpathlen;
 
-      /* This call preserves the file times */
-      if (main_app && !fast_sync && full_backup) {
-         jp_copy_file(full_name, full_backup_name);
+   return 0;
+}
+
+/* Rename a database that a reset protects on the handheld, so that
+ * installing it again is not refused */
+static int rename_protected_db(struct install_item *item)
+{
+   const char *names[][2]={
+      {"Graffiti ShortCuts",  "Graffiti ShortCuts "},
+      {"Graffiti ShortCuts ", "Graffiti ShortCuts"},
+      {"Net Prefs",           "Net Prefs "},
+      {"Net Prefs ",          "Net Prefs"},
+      {NULL, NULL}
+   };
+   int i;
+
+   for (i=0; names[i][0]; i++) {
+      if (!strcmp(item->info.name, names[i][0])) {
+         break;
       }
    }
+   if (!names[i][0]) {
+      return EXIT_FAILURE;
    }
-   pi_buffer_free(buffer);
-   palmos_error = pi_palmos_error(sd);
-   if (palmos_error==dlpErrNotFound) {
-      jp_logf(JP_LOG_DEBUG, "Good return code (dlpErrNotFound)\n");
-      if (full_backup) {
-         jp_logf(JP_LOG_DEBUG, "Removing apps not found on the palm\n");
-         move_removed_apps(file_list);
-      }
-   } else {
-      jp_logf(JP_LOG_WARN, "ReadDBList returned = %d\n", r);
-      jp_logf(JP_LOG_WARN, "palmos_error = %d\n", palmos_error);
-      jp_logf(JP_LOG_WARN, "dlp_strerror is %s\n", dlp_strerror(palmos_error));
+
+   strcpy(item->info.name, names[i][1]);
+   /* This requires a reset */
+   item->info.flags |= dlpDBFlagReset;
+   item->info.flags |= dlpDBFlagNewer;
+   pi_file_close(item->f);
+   pdb_file_write_dbinfo(item->filename, &(item->info));
+   item->f = pi_file_open(item->filename);
+   if (item->f==0) {
+      jp_logf(JP_LOG_WARN, _("\nUnable to open file: %s\n"), item->filename);
+      return EXIT_FAILURE;
    }
-        
-   free_file_name_list(&file_list);
 
    return EXIT_SUCCESS;
 }
 
-static int sync_install(char *filename, int sd, char *vfspath)
+static int sync_install(struct install_item *item, int sd)
 {
-   struct pi_file *f;
-   struct  DBInfo info;
+   char vfsdir[] = "/PALM/Launcher/";   /* Install location for SDCARD files */
    char *Pc;
    char log_entry[256];
-   int r, try_again;
+   int r;
    long char_set;
    char creator[5];
-   int sdcard_install;
+   int fd;
 
    get_pref(PREF_CHAR_SET, &char_set, NULL);
 
-   Pc = strrchr(filename, '/');
+   Pc = strrchr(item->filename, '/');
    if (!Pc) {
-      Pc = filename;
+      Pc = item->filename;
    } else {
       Pc++;
    }
 
-   sdcard_install = (vfspath != NULL);
-
    jp_logf(JP_LOG_GUI, _("Installing %s "), Pc);
-   f = pi_file_open(filename);
-   if (f==NULL && !sdcard_install) {
-      int fd;
-
-      if ((fd = open(filename, O_RDONLY)) < 0) {
-         jp_logf(JP_LOG_WARN, _("\nUnable to open file: '%s': %s!\n"),
-                                                    filename, strerror(errno));
-      } else {
-         close(fd);
-         jp_logf(JP_LOG_WARN, _("\nUnable to sync file: '%s': file corrupted?\n"),
-                 filename);
-      }
+   if (item->error > 0) {
+      jp_logf(JP_LOG_WARN, _("\nUnable to open file: '%s': %s!\n"),
+              item->filename, strerror(item->error));
       return EXIT_FAILURE;
    }
-   if (f != NULL) {
-      memset(&info, 0, sizeof(info));
-      pi_file_get_info(f, &info);
-      creator[0] = (info.creator & 0xFF000000) >> 24;
-      creator[1] = (info.creator & 0x00FF0000) >> 16,
-      creator[2] = (info.creator & 0x0000FF00) >> 8,
-      creator[3] = (info.creator & 0x000000FF);
+   if (item->error < 0) {
+      jp_logf(JP_LOG_WARN, _("\nUnable to sync file: '%s': file corrupted?\n"),
+              item->filename);
+      return EXIT_FAILURE;
+   }
+   if (item->f != NULL) {
+      creator[0] = (item->info.creator & 0xFF000000) >> 24;
+      creator[1] = (item->info.creator & 0x00FF0000) >> 16,
+      creator[2] = (item->info.creator & 0x0000FF00) >> 8,
+      creator[3] = (item->info.creator & 0x000000FF);
       creator[4] = '\0';
    }
 
-   if (!sdcard_install) {
+   if (!item->sdcard) {
       jp_logf(JP_LOG_GUI, _("(Creator ID '%s')... "), creator);
-      r = pi_file_install(f, sd, 0, NULL);
+      r = pi_file_install(item->f, sd, 0, NULL);
+      /* TODO: make this generic? Not sure it would work 100% of the time */
+      if ((r<0) && (rename_protected_db(item) == EXIT_SUCCESS)) {
+         /* Try again */
+         r = pi_file_install(item->f, sd, 0, NULL);
+      }
    } else {
-      if (f != NULL) {
+      if (item->f != NULL) {
          jp_logf(JP_LOG_GUI, _("(Creator ID '%s') "), creator);
       }
-      jp_logf(JP_LOG_GUI, _("(SDcard dir %s)... "), vfspath);
-      const char *basename = strrchr(filename, '/');
-      if (!basename) {
-         basename = filename;
-      } else {
-         basename++;
-      }
-      int fd;
-      if ((fd = open(filename, O_RDONLY)) < 0)
-      {
+      jp_logf(JP_LOG_GUI, _("(SDcard dir %s)... "), vfsdir);
+      if ((fd = open(item->filename, O_RDONLY)) < 0) {
          jp_logf(JP_LOG_WARN, _("\nUnable to open file: '%s': %s!\n"),
-                                                    filename, strerror(errno));
-         pi_file_close(f);
+                 item->filename, strerror(errno));
          return EXIT_FAILURE;
       }
-      r = pi_file_install_VFS(fd, basename, sd, vfspath, NULL);
+      r = pi_file_install_VFS(fd, Pc, sd, vfsdir, NULL);
       close(fd);
    }
 
-   if (r<0 && !sdcard_install) {
-      try_again = 0;
-      /* TODO: make this generic? Not sure it would work 100% of the time */
-      /* Here we make a special exception for graffiti */
-      if (!strcmp(info.name, "Graffiti ShortCuts")) {
-         strcpy(info.name, "Graffiti ShortCuts ");
-         /* This requires a reset */
-         info.flags |= dlpDBFlagReset;
-         info.flags |= dlpDBFlagNewer;
-         pi_file_close(f);
-         pdb_file_write_dbinfo(filename, &info);
-         f = pi_file_open(filename);
-         if (f==0) {
-            jp_logf(JP_LOG_WARN, _("\nUnable to open file: %s\n"), filename);
-            return EXIT_FAILURE;
-         }
-         try_again = 1;
-      } else if (!strcmp(info.name, "Graffiti ShortCuts ")) {
-         strcpy(info.name, "Graffiti ShortCuts");
-         /* This requires a reset */
-         info.flags |= dlpDBFlagReset;
-         info.flags |= dlpDBFlagNewer;
-         pi_file_close(f);
-         pdb_file_write_dbinfo(filename, &info);
-         f = pi_file_open(filename);
-         if (f==0) {
-            jp_logf(JP_LOG_WARN, _("\nUnable to open file: %s\n"), filename);
-            return EXIT_FAILURE;
-         }
-         try_again = 1;
-      }
-      /* Here we make a special exception for Net Prefs */
-      if (!strcmp(info.name, "Net Prefs")) {
-         strcpy(info.name, "Net Prefs ");
-         /* This requires a reset */
-         info.flags |= dlpDBFlagReset;
-         info.flags |= dlpDBFlagNewer;
-         pi_file_close(f);
-         pdb_file_write_dbinfo(filename, &info);
-         f = pi_file_open(filename);
-         if (f==0) {
-            jp_logf(JP_LOG_WARN, _("\nUnable to open file: %s\n"), filename);
-            return EXIT_FAILURE;
-         }
-         try_again = 1;
-      } else if (!strcmp(info.name, "Net Prefs ")) {
-         strcpy(info.name, "Net Prefs");
-         /* This requires a reset */
-         info.flags |= dlpDBFlagReset;
-         info.flags |= dlpDBFlagNewer;
-         pi_file_close(f);
-         pdb_file_write_dbinfo(filename, &info);
-         f = pi_file_open(filename);
-         if (f==0) {
-            jp_logf(JP_LOG_WARN, _("\nUnable to open file: %s\n"), filename);
-            return EXIT_FAILURE;
-         }
-         try_again = 1;
-      }
-      if (try_again) {
-         /* Try again */
-         r = pi_file_install(f, sd, 0, NULL);
-      }
-   }
-
    if (r<0) {
       g_snprintf(log_entry, sizeof(log_entry), _("Install %s failed"), Pc);
       charset_j2p(log_entry, sizeof(log_entry), char_set);
@@ -1614,7 +2386,6 @@ static int sync_install(char *filename, int sd, char *vfspath)
       dlp_AddSyncLogEntry(sd, "\n");;
       jp_logf(JP_LOG_GUI, _("Failed.\n"));
       jp_logf(JP_LOG_WARN, "%s\n", log_entry);
-      if (f) pi_file_close(f);
       return EXIT_FAILURE;
    }
    else {
@@ -1624,7 +2395,6 @@ static int sync_install(char *filename, int sd, char *vfspath)
       dlp_AddSyncLogEntry(sd, "\n");;
       jp_logf(JP_LOG_GUI, _("OK\n"));
    }
-   if (f) pi_file_close(f);
 
    return EXIT_SUCCESS;
 }
@@ -1638,11 +2408,12 @@ static int sync_process_install_file(int sd)
    char line[1002];
    char *Pc;
    int r, line_count;
-   char vfsdir[] = "/PALM/Launcher/";   // Install location for SDCARD files
+   struct install_item *item;
 
    in = jp_open_home_file(EPN".install", "r");
    if (!in) {
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s%s\n"), EPN, ".install");
+      free_install_queue();
       return EXIT_FAILURE;
    }
 
@@ -1650,9 +2421,14 @@ static int sync_process_install_file(int sd)
    if (!out) {
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s%s\n"), EPN, ".install.tmp");
       fclose(in);
+      free_install_queue();
       return EXIT_FAILURE;
    }
 
+   cached_sd = -1;
+
+   /* The install list is read again since files may have been added to it
+    * while waiting for the handheld.  The files opened then are used. */
    for (line_count=0; (!feof(in)); line_count++) {
       line[0]='\0';
       Pc = fgets(line, 1000, in);
@@ -1662,11 +2438,14 @@ static int sync_process_install_file(int sd)
       if (line[strlen(line)-1]=='\n') {
          line[strlen(line)-1]='\0';
       }
-      if (line[0] == '\001') {
-         /* found SDCARD indicator */
-         r = sync_install(&(line[1]), sd, vfsdir);
+      item = take_install_item(line);
+      if (item) {
+         phase_begin("install file", item->filename);
+         r = sync_install(item, sd);
+         phase_end("install file");
+         install_item_free(item);
       } else {
-         r = sync_install(line, sd, NULL);
+         r = EXIT_FAILURE;
       }
       
       if (r==0) {
@@ -1679,6 +2458,8 @@ static int sync_process_install_file(int sd)
 
    rename_file(EPN".install.tmp", EPN".install");
 
+   free_install_queue();
+
    return EXIT_SUCCESS;
 }
 
@@ -2068,6 +2849,115 @@ static int sync_categories(char *DB_name,
    return EXIT_SUCCESS;
 }
 
+/* Record status changes in the .pc3 file are queued and written out in
+ * batches.  Rewriting each header as soon as its record was sent seeks
+ * the stream backwards and throws away its read buffer for every record. */
+struct pc3_marks
+{
+   FILE *pc_file;
+   const char *DB_name;
+   int num;
+   long offset[PC3_MARK_BATCH];
+   PC3RecordHeader header[PC3_MARK_BATCH];
+};
+
+static void pc3_marks_init(struct pc3_marks *marks, FILE *pc_file,
+                           const char *DB_name)
+{
+   marks->pc_file = pc_file;
+   marks->DB_name = DB_name;
+   marks->num = 0;
+}
+
+static int pc3_marks_flush(struct pc3_marks *marks)
+{
+   long pos;
+   int i;
+
+   if (marks->num == 0) {
+      return EXIT_SUCCESS;
+   }
+
+   pos = ftell(marks->pc_file);
+   for (i=0; i<marks->num; i++) {
+      if (fseek(marks->pc_file, marks->offset[i], SEEK_SET)) {
+         jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+         return EXIT_FAILURE;
+      }
+      write_header(marks->pc_file, &(marks->header[i]));
+   }
+   marks->num = 0;
+
+   if (fseek(marks->pc_file, pos, SEEK_SET)) {
+      jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/* Queue the header of the record starting at offset to be rewritten.
+ * The mark is journaled at once so that an interrupted sync does not
+ * send the record to the Palm again. */
+static int pc3_marks_add(struct pc3_marks *marks, long offset,
+                         PC3RecordHeader *header)
+{
+   sync_journal_mark(&journal, marks->DB_name, offset, header);
+
+   marks->offset[marks->num] = offset;
+   memcpy(&(marks->header[marks->num]), header, sizeof(PC3RecordHeader));
+   marks->num++;
+
+   if (marks->num >= PC3_MARK_BATCH) {
+      return pc3_marks_flush(marks);
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/* Lines for the Palm sync log are collected and sent with one
+ * dlp_AddSyncLogEntry instead of two round trips per record.
+ * Messages must already be converted to the Palm character set. */
+struct sync_log
+{
+   int sd;
+   int len;
+   char buf[SYNC_LOG_BATCH];
+};
+
+static void sync_log_init(struct sync_log *slog, int sd)
+{
+   slog->sd = sd;
+   slog->len = 0;
+   slog->buf[0] = '\0';
+}
+
+static void sync_log_flush(struct sync_log *slog)
+{
+   if (slog->len > 0) {
+      dlp_AddSyncLogEntry(slog->sd, slog->buf);
+   }
+   slog->len = 0;
+   slog->buf[0] = '\0';
+}
+
+static void sync_log_add(struct sync_log *slog, const char *message)
+{
+   int len;
+
+   len = strlen(message);
+   if (slog->len + len + 2 > SYNC_LOG_BATCH) {
+      sync_log_flush(slog);
+   }
+   if (len + 2 > SYNC_LOG_BATCH) {
+      len = SYNC_LOG_BATCH - 2;
+   }
+   memcpy(slog->buf + slog->len, message, len);
+   slog->len += len;
+   slog->buf[slog->len++] = '\n';
+   slog->buf[slog->len] = '\0';
+}
+
 static int slow_sync_application(char *DB_name, int sd)
 {
    int db;
@@ -2082,8 +2972,11 @@ static int slow_sync_application(char *DB_name, int sd)
    int lrec_len;
    /* remote (Palm) record */
    pi_buffer_t *rrec;
-   int  rindex, rattr, rcategory;
+   int  rattr, rcategory;
    size_t rrec_len;
+   struct remote_index remote;
+   struct remote_record *copy;
+   int num_new, num_lookups, num_remote;
    long char_set;
    char log_entry[256];
    char write_log_message[256];
@@ -2091,7 +2984,11 @@ static int slow_sync_application(char *DB_name, int sd)
    char error_log_message_d[256];
    char delete_log_message[256];
    char conflict_log_message[256];
+   char skip_log_message[256];
    int  same;
+   long rec_offset, next_offset;
+   struct pc3_marks marks;
+   struct sync_log sync_log;
 
    jp_logf(JP_LOG_DEBUG, "slow_sync_application\n");
 
@@ -2116,6 +3013,8 @@ static int slow_sync_application(char *DB_name, int sd)
               _("Deleted an %s record."), DB_name);
       g_snprintf(conflict_log_message, sizeof(conflict_log_message),
               _("Sync Conflict: duplicated an %s record."), DB_name);
+      g_snprintf(skip_log_message, sizeof(skip_log_message),
+              _("Skipped an %s record already on the handheld."), DB_name);
    } else {
       g_snprintf(write_log_message, sizeof(write_log_message),
               _("Wrote a %s record."), DB_name);
@@ -2127,7 +3026,16 @@ static int slow_sync_application(char *DB_name, int sd)
               _("Deleted a %s record."), DB_name);
       g_snprintf(conflict_log_message, sizeof(conflict_log_message),
               _("Sync Conflict: duplicated a %s record."), DB_name);
+      g_snprintf(skip_log_message, sizeof(skip_log_message),
+              _("Skipped a %s record already on the handheld."), DB_name);
    }
+   /* Convert the sync log messages once rather than for every record */
+   charset_j2p(write_log_message, sizeof(write_log_message), char_set);
+   charset_j2p(error_log_message_w, sizeof(error_log_message_w), char_set);
+   charset_j2p(error_log_message_d, sizeof(error_log_message_d), char_set);
+   charset_j2p(delete_log_message, sizeof(delete_log_message), char_set);
+   charset_j2p(conflict_log_message, sizeof(conflict_log_message), char_set);
+   charset_j2p(skip_log_message, sizeof(skip_log_message), char_set);
 
    g_snprintf(pc_filename, sizeof(pc_filename), "%s.pc3", DB_name);
    pc_in = jp_open_home_file(pc_filename, "r+");
@@ -2135,6 +3043,8 @@ static int slow_sync_application(char *DB_name, int sd)
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), pc_filename);
       return EXIT_FAILURE;
    }
+   pc3_marks_init(&marks, pc_in, DB_name);
+   sync_log_init(&sync_log, sd);
    /* Open the applications database, store access handle in db */
    ret = dlp_OpenDB(sd, 0, dlpOpenReadWrite, DB_name, &db);
    if (ret < 0) {
@@ -2142,6 +3052,8 @@ static int slow_sync_application(char *DB_name, int sd)
       charset_j2p(log_entry, sizeof(log_entry), char_set);
       dlp_AddSyncLogEntry(sd, log_entry);
       jp_logf(JP_LOG_WARN, "slow_sync_application: %s", log_entry);
+      pc3_marks_flush(&marks);
+      sync_log_flush(&sync_log);
       fclose(pc_in);
       return EXIT_FAILURE;
    }
@@ -2151,8 +3063,39 @@ static int slow_sync_application(char *DB_name, int sd)
    jp_logf(JP_LOG_GUI , "number of records = %d\n", num);
 #endif
 
+   /* Count the local changes that need records from the handheld */
+   num_new = num_lookups = 0;
+   while (read_header(pc_in, &header) == 1) {
+      if (header.rt==NEW_PC_REC) {
+         num_new++;
+      } else if ((header.rt==REPLACEMENT_PALM_REC) ||
+                 (header.rt==DELETED_PALM_REC) ||
+                 (header.rt==MODIFIED_PALM_REC)) {
+         num_lookups++;
+      }
+      if (fseek(pc_in, header.rec_len, SEEK_CUR)) {
+         break;
+      }
+   }
+   rewind(pc_in);
+
+   /* Reading the whole database once pays off when new records have to
+    * be checked for copies already on the handheld, or when there are
+    * many records to look up.  Otherwise they are read one at a time. */
+   remote_index_init(&remote, DB_name);
+   if (num_new || num_lookups) {
+      num_remote = 0;
+      dlp_ReadOpenDBInfo(sd, db, &num_remote);
+      if ((num_new && remote.comparable) || (num_lookups*8 >= num_remote)) {
+         TRACE_BEGIN_DETAIL("index records", DB_name);
+         remote_index_build(&remote, sd, db);
+         TRACE_END("index records");
+      }
+   }
+
    /* Loop over records in .pc3 file */
    while (!feof(pc_in)) {
+      rec_offset = ftell(pc_in);
       num = read_header(pc_in, &header);
       if (num!=1) {
          if (ferror(pc_in)) break;
@@ -2162,10 +3105,14 @@ static int slow_sync_application(char *DB_name, int sd)
       lrec_len = header.rec_len;
       if (lrec_len > 0x10000) {
          jp_logf(JP_LOG_WARN, _("PC file corrupt?\n"));
+         pc3_marks_flush(&marks);
+         sync_log_flush(&sync_log);
          fclose(pc_in);
          dlp_CloseDB(sd, db);
+         remote_index_free(&remote);
          return EXIT_FAILURE;
       }
+      next_offset = rec_offset + header.header_len + lrec_len;
 
       /* Case 5: */
       if ((header.rt==NEW_PC_REC) || (header.rt==REPLACEMENT_PALM_REC)) {
@@ -2195,14 +3142,14 @@ static int slow_sync_application(char *DB_name, int sd)
                break;
             }
 
-            ret = dlp_ReadRecordById(sd, db, header.unique_id, rrec,
-                                     &rindex, &rattr, &rcategory);
+            ret = remote_index_read(&remote, sd, db, header.unique_id, rrec,
+                                    &rattr, &rcategory);
             rrec_len = rrec->used;
 #ifdef JPILOT_DEBUG
             if (ret>=0 ) {
                printf("read record by id %s returned %d\n", DB_name, ret);
-               printf("id %ld, index %d, size %d, attr 0x%x, category %d\n",
-                      header.unique_id, rindex, rrec_len, rattr, rcategory);
+               printf("id %ld, size %d, attr 0x%x, category %d\n",
+                      header.unique_id, rrec_len, rattr, rcategory);
             } else {
                printf("Case 5: read record by id failed\n");
             }
@@ -2232,21 +3179,28 @@ static int slow_sync_application(char *DB_name, int sd)
                   jp_logf(JP_LOG_DEBUG, "Case 5: duplicating record\n");
                   jp_logf(JP_LOG_GUI, _("Sync Conflict: a %s record must be manually merged\n"), DB_name);
 
-                  /* Write record to Palm and get new unique ID */
-                  jp_logf(JP_LOG_DEBUG, "Duplicating PC record to palm\n");
-                  ret = dlp_WriteRecord(sd, db, rattr & dlpRecAttrSecret,
-                                        0, 0,
-                                        rrec->data, rrec_len, &new_unique_id);
-
-                  if (ret < 0) {
-                     jp_logf(JP_LOG_WARN, "dlp_WriteRecord failed\n");
-                     charset_j2p(error_log_message_w,255,char_set);
-                     dlp_AddSyncLogEntry(sd, error_log_message_w);
-                     dlp_AddSyncLogEntry(sd, "\n");
+                  /* A copy left by an earlier sync need not be made again */
+                  copy = remote_index_find_copy(&remote, rrec->data, rrec_len,
+                                                rattr, 0, header.unique_id,
+                                                TRUE, TRUE);
+                  if (copy) {
+                     jp_logf(JP_LOG_DEBUG, "Case 5: record was already duplicated as %ld\n", copy->id);
+                     copy->claimed = TRUE;
                   } else {
-                     charset_j2p(conflict_log_message,255,char_set);
-                     dlp_AddSyncLogEntry(sd, conflict_log_message);
-                     dlp_AddSyncLogEntry(sd, "\n");
+                     /* Write record to Palm and get new unique ID */
+                     jp_logf(JP_LOG_DEBUG, "Duplicating PC record to palm\n");
+                     ret = dlp_WriteRecord(sd, db, rattr & dlpRecAttrSecret,
+                                           0, 0,
+                                           rrec->data, rrec_len, &new_unique_id);
+
+                     if (ret < 0) {
+                        jp_logf(JP_LOG_WARN, "dlp_WriteRecord failed\n");
+                        sync_log_add(&sync_log, error_log_message_w);
+                     } else {
+                        sync_log_add(&sync_log, conflict_log_message);
+                        remote_index_set(&remote, new_unique_id, rrec->data,
+                                         rrec_len, rattr & dlpRecAttrSecret, 0);
+                     }
                   }
                }
             }
@@ -2255,16 +3209,38 @@ static int slow_sync_application(char *DB_name, int sd)
 
          } /* endif REPLACEMENT_PALM_REC */
 
-         jp_logf(JP_LOG_DEBUG, "Writing PC record to palm\n");
+         /* A new record may already be on the Palm when an earlier sync
+          * was interrupted after writing it */
+         copy = NULL;
+         if (header.rt==NEW_PC_REC) {
+            copy = remote_index_find_copy(&remote, lrec, lrec_len,
+                                          header.attrib & 0xF0,
+                                          header.attrib & 0x0F, 0,
+                                          FALSE, FALSE);
+         }
 
-         if (header.rt==REPLACEMENT_PALM_REC) {
-            ret = dlp_WriteRecord(sd, db, header.attrib & dlpRecAttrSecret,
-                                  header.unique_id, header.attrib & 0x0F,
-                                  lrec, lrec_len, &header.unique_id);
+         if (copy) {
+            jp_logf(JP_LOG_DEBUG, "Case 5: record is already on the palm as %ld\n", copy->id);
+            copy->claimed = TRUE;
+            header.unique_id = copy->id;
+            ret = 0;
          } else {
-            ret = dlp_WriteRecord(sd, db, header.attrib & dlpRecAttrSecret,
-                                  0, header.attrib & 0x0F,
-                                  lrec, lrec_len, &header.unique_id);
+            jp_logf(JP_LOG_DEBUG, "Writing PC record to palm\n");
+
+            if (header.rt==REPLACEMENT_PALM_REC) {
+               ret = dlp_WriteRecord(sd, db, header.attrib & dlpRecAttrSecret,
+                                     header.unique_id, header.attrib & 0x0F,
+                                     lrec, lrec_len, &header.unique_id);
+            } else {
+               ret = dlp_WriteRecord(sd, db, header.attrib & dlpRecAttrSecret,
+                                     0, header.attrib & 0x0F,
+                                     lrec, lrec_len, &header.unique_id);
+            }
+            if (ret >= 0) {
+               remote_index_set(&remote, header.unique_id, lrec, lrec_len,
+                                header.attrib & dlpRecAttrSecret,
+                                header.attrib & 0x0F);
+            }
          }
 
          if (lrec) {
@@ -2274,22 +3250,19 @@ static int slow_sync_application(char *DB_name, int sd)
 
          if (ret < 0) {
             jp_logf(JP_LOG_WARN, "dlp_WriteRecord failed\n");
-            charset_j2p(error_log_message_w,255,char_set);
-            dlp_AddSyncLogEntry(sd, error_log_message_w);
-            dlp_AddSyncLogEntry(sd, "\n");
+            sync_log_add(&sync_log, error_log_message_w);
          } else {
-            charset_j2p(write_log_message,255,char_set);
-            dlp_AddSyncLogEntry(sd, write_log_message);
-            dlp_AddSyncLogEntry(sd, "\n");
+            sync_log_add(&sync_log, copy ? skip_log_message : write_log_message);
             /* mark the record as deleted in the pc file */
-            if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-               jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+            header.rt=DELETED_PC_REC;
+            if (pc3_marks_add(&marks, rec_offset, &header)) {
+               pc3_marks_flush(&marks);
+               sync_log_flush(&sync_log);
                fclose(pc_in);
                dlp_CloseDB(sd, db);
+               remote_index_free(&remote);
                return EXIT_FAILURE;
             }
-            header.rt=DELETED_PC_REC;
-            write_header(pc_in, &header);
          }
       } /* endif Case 5 */
 
@@ -2318,14 +3291,14 @@ static int slow_sync_application(char *DB_name, int sd)
             break;
          }
 
-         ret = dlp_ReadRecordById(sd, db, header.unique_id, rrec,
-                                  &rindex, &rattr, &rcategory);
+         ret = remote_index_read(&remote, sd, db, header.unique_id, rrec,
+                                 &rattr, &rcategory);
          rrec_len = rrec->used;
 #ifdef JPILOT_DEBUG
          if (ret>=0 ) {
             printf("read record by id %s returned %d\n", DB_name, ret);
-            printf("id %ld, index %d, size %d, attr 0x%x, category %d\n",
-                   header.unique_id, rindex, rrec_len, rattr, rcategory);
+            printf("id %ld, size %d, attr 0x%x, category %d\n",
+                   header.unique_id, rrec_len, rattr, rcategory);
          } else {
             printf("Case 3&4: read record by id failed\n");
          }
@@ -2336,16 +3309,17 @@ static int slow_sync_application(char *DB_name, int sd)
              * been deleted from the Palm side.
              * Mark the local record as deleted */
             jp_logf(JP_LOG_DEBUG, "Case 3&4: no remote record found, must have been deleted on the Palm\n");
-            if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-               jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+            header.rt=DELETED_DELETED_PALM_REC;
+            if (pc3_marks_add(&marks, rec_offset, &header)) {
+               pc3_marks_flush(&marks);
+               sync_log_flush(&sync_log);
                fclose(pc_in);
                dlp_CloseDB(sd, db);
+               remote_index_free(&remote);
                free(lrec);
                pi_buffer_free(rrec);
                return EXIT_FAILURE;
             }
-            header.rt=DELETED_DELETED_PALM_REC;
-            write_header(pc_in, &header);
          } else {
             /* Record exists on the palm and has been deleted from PC 
              * If the two records are the same, then no changes have
@@ -2363,41 +3337,40 @@ static int slow_sync_application(char *DB_name, int sd)
                if (ret < 0) {
                   jp_logf(JP_LOG_WARN, _("dlp_DeleteRecord failed\n"\
                   "This could be because the record was already deleted on the Palm\n"));
-                  charset_j2p(error_log_message_d,255,char_set);
-                  dlp_AddSyncLogEntry(sd, error_log_message_d);
-                  dlp_AddSyncLogEntry(sd, "\n");
+                  sync_log_add(&sync_log, error_log_message_d);
                } else {
-                  charset_j2p(delete_log_message,255,char_set);
-                  dlp_AddSyncLogEntry(sd, delete_log_message);
-                  dlp_AddSyncLogEntry(sd, "\n");
+                  sync_log_add(&sync_log, delete_log_message);
+                  remote_index_remove(&remote, header.unique_id);
                }
                
                /* Now mark the record in pc3 file as deleted */
-               if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-                  jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+               header.rt=DELETED_DELETED_PALM_REC;
+               if (pc3_marks_add(&marks, rec_offset, &header)) {
+                  pc3_marks_flush(&marks);
+                  sync_log_flush(&sync_log);
                   fclose(pc_in);
                   dlp_CloseDB(sd, db);
+                  remote_index_free(&remote);
                   free(lrec);
                   pi_buffer_free(rrec);
                   return EXIT_FAILURE;
                }
-               header.rt=DELETED_DELETED_PALM_REC;
-               write_header(pc_in, &header);
 
             } else {
                /* Record has been changed on the palm and deletion can't occur
                 * Mark the pc3 record as having been dealt with */
                jp_logf(JP_LOG_DEBUG, "Case 3: skipping PC deleted record\n");
-               if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-                  jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+               header.rt=DELETED_PC_REC;
+               if (pc3_marks_add(&marks, rec_offset, &header)) {
+                  pc3_marks_flush(&marks);
+                  sync_log_flush(&sync_log);
                   fclose(pc_in);
                   dlp_CloseDB(sd, db);
+                  remote_index_free(&remote);
                   free(lrec);
                   pi_buffer_free(rrec);
                   return EXIT_FAILURE;
                }
-               header.rt=DELETED_PC_REC;
-               write_header(pc_in, &header);
             } /* end if checking whether old & new records are the same */
 
             /* free buffers */
@@ -2412,15 +3385,20 @@ static int slow_sync_application(char *DB_name, int sd)
       } /* end if Case 3&4 */
 
       /* move to next record in .pc3 file */
-      if (fseek(pc_in, lrec_len, SEEK_CUR)) {
+      if (fseek(pc_in, next_offset, SEEK_SET)) {
          jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+         pc3_marks_flush(&marks);
+         sync_log_flush(&sync_log);
          fclose(pc_in);
          dlp_CloseDB(sd, db);
+         remote_index_free(&remote);
          return EXIT_FAILURE;
       }
 
    } /* end while on feof(pc_in) */
 
+   pc3_marks_flush(&marks);
+   sync_log_flush(&sync_log);
    fclose(pc_in);
 #ifdef JPILOT_DEBUG
    dlp_ReadOpenDBInfo(sd, db, &num);
@@ -2428,9 +3406,11 @@ static int slow_sync_application(char *DB_name, int sd)
 #endif
    dlp_ResetSyncFlags(sd, db);
    dlp_CleanUpDatabase(sd, db);
-   dlp_CloseDB(sd, db);
+   ret = dlp_CloseDB(sd, db);
+   remote_index_free(&remote);
 
-   return EXIT_SUCCESS;
+   /* The connection was lost if the database could not be closed */
+   return (ret < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 static int fast_sync_local_recs(char *DB_name, int sd, int db)
@@ -2453,6 +3433,9 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
    char delete_log_message[256];
    char conflict_log_message[256];
    int same;
+   long rec_offset, next_offset;
+   struct pc3_marks marks;
+   struct sync_log sync_log;
 
    jp_logf(JP_LOG_DEBUG, "fast_sync_local_recs\n");
    get_pref(PREF_CHAR_SET, &char_set, NULL);
@@ -2481,15 +3464,25 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
       g_snprintf(conflict_log_message, sizeof(conflict_log_message),
               _("Sync Conflict: duplicated a %s record."), DB_name);
    }
+   /* Convert the sync log messages once rather than for every record */
+   charset_j2p(write_log_message, sizeof(write_log_message), char_set);
+   charset_j2p(error_log_message_w, sizeof(error_log_message_w), char_set);
+   charset_j2p(error_log_message_d, sizeof(error_log_message_d), char_set);
+   charset_j2p(delete_log_message, sizeof(delete_log_message), char_set);
+   charset_j2p(conflict_log_message, sizeof(conflict_log_message), char_set);
+
    g_snprintf(pc_filename, sizeof(pc_filename), "%s.pc3", DB_name);
    pc_in = jp_open_home_file(pc_filename, "r+");
    if (pc_in==NULL) {
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), pc_filename);
       return EXIT_FAILURE;
    }
+   pc3_marks_init(&marks, pc_in, DB_name);
+   sync_log_init(&sync_log, sd);
 
    /* Loop over records in .pc3 file */
    while (!feof(pc_in)) {
+      rec_offset = ftell(pc_in);
       num = read_header(pc_in, &header);
       if (num!=1) {
          if (ferror(pc_in)) break;
@@ -2499,9 +3492,12 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
       lrec_len = header.rec_len;
       if (lrec_len > 0x10000) {
          jp_logf(JP_LOG_WARN, _("PC file corrupt?\n"));
+         pc3_marks_flush(&marks);
+         sync_log_flush(&sync_log);
          fclose(pc_in);
          return EXIT_FAILURE;
       }
+      next_offset = rec_offset + header.header_len + lrec_len;
 
       /* Case 5: */
       if ((header.rt==NEW_PC_REC) || (header.rt==REPLACEMENT_PALM_REC)) {
@@ -2578,13 +3574,9 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
 
                   if (ret < 0) {
                      jp_logf(JP_LOG_WARN, "dlp_WriteRecord failed\n");
-                     charset_j2p(error_log_message_w,255,char_set);
-                     dlp_AddSyncLogEntry(sd, error_log_message_w);
-                     dlp_AddSyncLogEntry(sd, "\n");
+                     sync_log_add(&sync_log, error_log_message_w);
                   } else {
-                     charset_j2p(conflict_log_message,255,char_set);
-                     dlp_AddSyncLogEntry(sd, conflict_log_message);
-                     dlp_AddSyncLogEntry(sd, "\n");
+                     sync_log_add(&sync_log, conflict_log_message);
                   }
                }
             }
@@ -2624,21 +3616,17 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
 
          if (ret < 0) {
             jp_logf(JP_LOG_WARN, "dlp_WriteRecord failed\n");
-            charset_j2p(error_log_message_w,255,char_set);
-            dlp_AddSyncLogEntry(sd, error_log_message_w);
-            dlp_AddSyncLogEntry(sd, "\n");
+            sync_log_add(&sync_log, error_log_message_w);
          } else {
-            charset_j2p(write_log_message,255,char_set);
-            dlp_AddSyncLogEntry(sd, write_log_message);
-            dlp_AddSyncLogEntry(sd, "\n");
+            sync_log_add(&sync_log, write_log_message);
             /* mark the record as deleted in the pc file */
-            if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-               jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+            header.rt=DELETED_PC_REC;
+            if (pc3_marks_add(&marks, rec_offset, &header)) {
+               pc3_marks_flush(&marks);
+               sync_log_flush(&sync_log);
                fclose(pc_in);
                return EXIT_FAILURE;
             }
-            header.rt=DELETED_PC_REC;
-            write_header(pc_in, &header);
          }
 
       } /* endif Case 5 */
@@ -2677,15 +3665,15 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
              * has already been deleted from the Palm side.
              * Mark the local record as deleted */
             jp_logf(JP_LOG_DEBUG, "Case 3&4: no remote record found, must have been deleted on the Palm\n");
-            if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-               jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+            header.rt=DELETED_DELETED_PALM_REC;
+            if (pc3_marks_add(&marks, rec_offset, &header)) {
+               pc3_marks_flush(&marks);
+               sync_log_flush(&sync_log);
                fclose(pc_in);
                free(lrec);
                free(rrec);
                return EXIT_FAILURE;
             }
-            header.rt=DELETED_DELETED_PALM_REC;
-            write_header(pc_in, &header);
          } else {
             /* Record exists on the palm and has been deleted from PC 
              * If the two records are the same, then no changes have
@@ -2703,39 +3691,35 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
                if (ret < 0) {
                   jp_logf(JP_LOG_WARN, _("dlp_DeleteRecord failed\n"
                                          "This could be because the record was already deleted on the Palm\n"));
-                  charset_j2p(error_log_message_d,255,char_set);
-                  dlp_AddSyncLogEntry(sd, error_log_message_d);
-                  dlp_AddSyncLogEntry(sd, "\n");
+                  sync_log_add(&sync_log, error_log_message_d);
                } else {
-                  charset_j2p(delete_log_message,255,char_set);
-                  dlp_AddSyncLogEntry(sd, delete_log_message);
-                  dlp_AddSyncLogEntry(sd, "\n");
+                  sync_log_add(&sync_log, delete_log_message);
                   pdb_file_delete_record_by_id(DB_name, header.unique_id);
                }
                
                /* Now mark the record in pc3 file as deleted */
-               if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-                  jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+               header.rt=DELETED_DELETED_PALM_REC;
+               if (pc3_marks_add(&marks, rec_offset, &header)) {
+                  pc3_marks_flush(&marks);
+                  sync_log_flush(&sync_log);
                   fclose(pc_in);
                   free(lrec);
                   free(rrec);
                   return EXIT_FAILURE;
                }
-               header.rt=DELETED_DELETED_PALM_REC;
-               write_header(pc_in, &header);
             } else {
                /* Record has been changed on the palm and deletion can't occur
                 * Mark the pc3 record as having been dealt with */
                jp_logf(JP_LOG_DEBUG, "Case 3: skipping PC deleted record\n");
-               if (fseek(pc_in, -(header.header_len+lrec_len), SEEK_CUR)) {
-                  jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+               header.rt=DELETED_PC_REC;
+               if (pc3_marks_add(&marks, rec_offset, &header)) {
+                  pc3_marks_flush(&marks);
+                  sync_log_flush(&sync_log);
                   fclose(pc_in);
                   free(lrec);
                   free(rrec);
                   return EXIT_FAILURE;
                }
-               header.rt=DELETED_PC_REC;
-               write_header(pc_in, &header);
             } /* end if checking whether old & new records are the same */
 
             /* free buffers */
@@ -2752,14 +3736,18 @@ static int fast_sync_local_recs(char *DB_name, int sd, int db)
       } /* end if Case 3&4 */
 
       /* move to next record in .pc3 file */
-      if (fseek(pc_in, lrec_len, SEEK_CUR)) {
+      if (fseek(pc_in, next_offset, SEEK_SET)) {
          jp_logf(JP_LOG_WARN, _("fseek failed - fatal error\n"));
+         pc3_marks_flush(&marks);
+         sync_log_flush(&sync_log);
          fclose(pc_in);
          return EXIT_FAILURE;
       }
 
    } /* end while on feof(pc_in) */
 
+   pc3_marks_flush(&marks);
+   sync_log_flush(&sync_log);
    fclose(pc_in);
 
    return EXIT_SUCCESS;
@@ -2809,6 +3797,7 @@ static int fast_sync_application(char *DB_name, int sd)
    recordid_t rid=0;
    int rindex, rrec_len, rattr, rcategory;
    int num_local_recs, num_palm_recs;
+   int local_ret;
    char *extra_dbname[2];
 
    jp_logf(JP_LOG_DEBUG, "fast_sync_application %s\n", DB_name);
@@ -2892,7 +3881,7 @@ static int fast_sync_application(char *DB_name, int sd)
       pi_buffer_free(rrec);
    } /* end while over Palm records */
 
-   fast_sync_local_recs(DB_name, sd, db);
+   local_ret = fast_sync_local_recs(DB_name, sd, db);
 
    dlp_ResetSyncFlags(sd, db);
    dlp_CleanUpDatabase(sd, db);
@@ -2901,7 +3890,10 @@ static int fast_sync_application(char *DB_name, int sd)
    dlp_ReadOpenDBInfo(sd, db, &num_palm_recs);
    pdb_file_count_recs(DB_name, &num_local_recs);
 
-   dlp_CloseDB(sd, db);
+   ret = dlp_CloseDB(sd, db);
+   if ((ret < 0) || (local_ret != EXIT_SUCCESS)) {
+      return EXIT_FAILURE;
+   }
 
    if (num_local_recs != num_palm_recs) {
       extra_dbname[0] = DB_name;
@@ -2915,6 +3907,50 @@ static int fast_sync_application(char *DB_name, int sd)
    return EXIT_SUCCESS;
 }
 
+/* The phases of a sync are traced and counted in the sync statistics */
+static void phase_begin(const char *name, const char *detail)
+{
+   TRACE_BEGIN_DETAIL(name, detail);
+   sync_stats_begin(name, detail);
+}
+
+static void phase_end(const char *name)
+{
+   sync_stats_end();
+   TRACE_END(name);
+}
+
+/* Sync the categories and records of one database, unless an interrupted
+ * sync already finished it */
+static void sync_database(char *DB_name, int sd, int fast_sync,
+                          int (*unpack_cai_from_ai)(struct CategoryAppInfo *cai, unsigned char *ai_raw, int len),
+                          int (*pack_cai_into_ai)(struct CategoryAppInfo *cai, unsigned char *ai_raw, int len))
+{
+   int ret;
+
+   if (sync_journal_is_done(&journal, DB_name)) {
+      jp_logf(JP_LOG_GUI, _("%s was synced before the sync was interrupted, skipped.\n"), DB_name);
+      return;
+   }
+
+   phase_begin(fast_sync ? "fast sync" : "slow sync", DB_name);
+   if (unpack_cai_from_ai && pack_cai_into_ai) {
+      phase_begin("categories", DB_name);
+      sync_categories(DB_name, sd, unpack_cai_from_ai, pack_cai_into_ai);
+      phase_end("categories");
+   }
+   if (fast_sync) {
+      ret = fast_sync_application(DB_name, sd);
+   } else {
+      ret = slow_sync_application(DB_name, sd);
+   }
+   phase_end(fast_sync ? "fast sync" : "slow sync");
+
+   if (ret == EXIT_SUCCESS) {
+      sync_journal_done(&journal, DB_name);
+   }
+}
+
 static int jp_install_user(const char *device, int sd, 
                            struct my_sync_info *sync_info)
 {
@@ -2955,6 +3991,7 @@ static int jp_sync(struct my_sync_info *sync_info)
 #endif
    char buf[1024];
    long char_set;
+   time_t sync_date;
 #ifdef JPILOT_DEBUG
    pi_buffer_t *buffer;
 #endif
@@ -3063,7 +4100,9 @@ static int jp_sync(struct my_sync_info *sync_info)
          if (plugin->sync_on) {
             if (plugin->plugin_pre_sync_pre_connect) {
                jp_logf(JP_LOG_DEBUG, "sync:calling plugin_pre_sync_pre_connect for [%s]\n", plugin->name);
+               phase_begin("plugin pre_sync_pre_connect", plugin->name);
                plugin->plugin_pre_sync_pre_connect();
+               phase_end("plugin pre_sync_pre_connect");
             }
          }
       }
@@ -3091,13 +4130,40 @@ static int jp_sync(struct my_sync_info *sync_info)
    jp_logf(JP_LOG_GUI, _(" Press the HotSync button now\n"));
    jp_logf(JP_LOG_GUI, "****************************************\n");
 
+   /* Open the files to install while waiting for the handheld.  When
+    * glob_sync_connected chooses the home directory, the install list is
+    * that of the user connecting and is only read once connected. */
+   if (!glob_sync_connected) {
+      sync_prepare_install();
+   }
+
+   phase_begin("connect", device);
    ret = jp_pilot_connect(&sd, device);
+   phase_end("connect");
    if (ret) {
       return ret;
    }
 
+   if (glob_sync_connected) {
+      ret = glob_sync_connected(sd, sync_info);
+      if (ret) {
+         dlp_EndOfSync(sd, 0);
+         pi_close(sd);
+         return ret;
+      }
+#ifdef USE_LOCKING
+      if (sync_lock(&connected_lock_fd)) {
+         dlp_EndOfSync(sd, 0);
+         pi_close(sd);
+         return EXIT_FAILURE;
+      }
+#endif
+   }
+
    if (SYNC_INSTALL_USER & sync_info->flags) {
+      phase_begin("install user", NULL);
       ret = jp_install_user(device, sd, sync_info);
+      phase_end("install user");
       write_to_parent(PIPE_FINISHED, "\n");
       return ret;
    }
@@ -3116,7 +4182,9 @@ static int jp_sync(struct my_sync_info *sync_info)
          if (plugin->sync_on) {
             if (plugin->plugin_pre_sync) {
                jp_logf(JP_LOG_DEBUG, "sync:calling plugin_pre_sync for [%s]\n", plugin->name);
+               phase_begin("plugin pre_sync", plugin->name);
                plugin->plugin_pre_sync();
+               phase_end("plugin pre_sync");
             }
          }
       }
@@ -3235,7 +4303,9 @@ static int jp_sync(struct my_sync_info *sync_info)
       return SYNC_ERROR_OPEN_CONDUIT;
    }
 
+   phase_begin("install files", NULL);
    sync_process_install_file(sd);
+   phase_end("install files");
 
    if ((SYNC_RESTORE & sync_info->flags)) {
       U.userID=sync_info->userID;
@@ -3272,28 +4342,20 @@ static int jp_sync(struct my_sync_info *sync_info)
         (U.lastSyncPC == sync_info->PC_ID) ) {
       fast_sync=1;
       jp_logf(JP_LOG_GUI, _("Doing a fast sync.\n"));
-      for (i=0; dbname[i][0]; i++) {
-         if (get_pref_int_default(pref_sync_array[i], 1)) {
-            if (unpack_cai_from_buf[i] && pack_cai_into_buf[i]) {
-               sync_categories(dbname[i], sd,
-                               unpack_cai_from_buf[i],
-                               pack_cai_into_buf[i]);
-            }
-            fast_sync_application(dbname[i], sd);
-         }
-      }
    } else {
       fast_sync=0;
       jp_logf(JP_LOG_GUI, _("Doing a slow sync.\n"));
-      for (i=0; dbname[i][0]; i++) {
-         if (get_pref_int_default(pref_sync_array[i], 1)) {
-            if (unpack_cai_from_buf[i] && pack_cai_into_buf[i]) {
-               sync_categories(dbname[i], sd,
-                               unpack_cai_from_buf[i],
-                               pack_cai_into_buf[i]);
-            }
-            slow_sync_application(dbname[i], sd);
-         }
+   }
+
+   /* Any sync completed since an interrupted one changes the last sync
+    * date, and the interrupted one can then no longer be resumed */
+   sync_journal_open(&journal, U.userID, sync_info->PC_ID, fast_sync,
+                     U.successfulSyncDate);
+
+   for (i=0; dbname[i][0]; i++) {
+      if (get_pref_int_default(pref_sync_array[i], 1)) {
+         sync_database(dbname[i], sd, fast_sync,
+                       unpack_cai_from_buf[i], pack_cai_into_buf[i]);
       }
    }
 
@@ -3309,26 +4371,10 @@ static int jp_sync(struct my_sync_info *sync_info)
          continue;
       }
       jp_logf(JP_LOG_DEBUG, "syncing plugin DB: [%s]\n", plugin->db_name);
-      if (fast_sync) {
-         if (plugin->sync_on) {
-            if (plugin->plugin_unpack_cai_from_ai &&
-                plugin->plugin_pack_cai_into_ai) {
-               sync_categories(plugin->db_name, sd,
-                               plugin->plugin_unpack_cai_from_ai,
-                               plugin->plugin_pack_cai_into_ai);
-            }
-            fast_sync_application(plugin->db_name, sd);
-         }
-      } else {
-         if (plugin->sync_on) {
-            if (plugin->plugin_unpack_cai_from_ai &&
-                plugin->plugin_pack_cai_into_ai) {
-               sync_categories(plugin->db_name, sd,
-                               plugin->plugin_unpack_cai_from_ai,
-                               plugin->plugin_pack_cai_into_ai);
-            }
-            slow_sync_application(plugin->db_name, sd);
-         }
+      if (plugin->sync_on) {
+         sync_database(plugin->db_name, sd, fast_sync,
+                       plugin->plugin_unpack_cai_from_ai,
+                       plugin->plugin_pack_cai_into_ai);
       }
    }
 #endif
@@ -3345,22 +4391,31 @@ static int jp_sync(struct my_sync_info *sync_info)
          if (plugin->sync_on) {
             if (plugin->plugin_sync) {
                jp_logf(JP_LOG_DEBUG, "calling plugin_sync for [%s]\n", plugin->name);
+               phase_begin("plugin sync", plugin->name);
                plugin->plugin_sync(sd);
+               phase_end("plugin sync");
             }
          }
       }
    }
 #endif
 
-   sync_fetch(sd, sync_info->flags, sync_info->num_backups, fast_sync);
+   /* Backup copies fetched now are marked with the sync date this sync
+    * leaves on the handheld */
+   sync_date = time(NULL);
+   phase_begin("fetch", NULL);
+   sync_fetch(sd, sync_info->flags, sync_info->num_backups, fast_sync,
+              U.successfulSyncDate, sync_date);
+   phase_end("fetch");
 
    /* Tell the user who it is, with this PC id. */
    U.lastSyncPC = sync_info->PC_ID;
-   U.successfulSyncDate = time(NULL);
+   U.successfulSyncDate = sync_date;
    U.lastSyncDate = U.successfulSyncDate;
    dlp_WriteUserInfo(sd, &U);
    if (strncpy(buf,_("Thank you for using J-Pilot."),1024) == NULL) {
       jp_logf(JP_LOG_DEBUG, "memory allocation internal error\n");
+      sync_journal_close(&journal);
       dlp_EndOfSync(sd, 0);
       pi_close(sd);
 #ifdef ENABLE_PLUGINS
@@ -3375,10 +4430,18 @@ static int jp_sync(struct my_sync_info *sync_info)
    dlp_AddSyncLogEntry(sd, buf);
    dlp_AddSyncLogEntry(sd, "\n");
 
-   dlp_EndOfSync(sd, 0);
+   ret = dlp_EndOfSync(sd, 0);
    pi_close(sd);
 
-   cleanup_pc_files();
+   if (ret < 0) {
+      /* The connection was lost.  The journal and the .pc3 offsets it
+       * refers to are kept for the next sync to resume from. */
+      jp_logf(JP_LOG_WARN, _("The sync was interrupted, the next sync will resume it.\n"));
+      sync_journal_close(&journal);
+   } else {
+      sync_journal_finish(&journal);
+      cleanup_pc_files();
+   }
 
 #ifdef ENABLE_PLUGINS
    /* Do the sync plugin calls */
@@ -3392,7 +4455,9 @@ static int jp_sync(struct my_sync_info *sync_info)
          if (plugin->sync_on) {
             if (plugin->plugin_post_sync) {
                jp_logf(JP_LOG_DEBUG, "calling plugin_post_sync for [%s]\n", plugin->name);
+               phase_begin("plugin post_sync", plugin->name);
                plugin->plugin_post_sync();
+               phase_end("plugin post_sync");
             }
          }
       }
@@ -3425,10 +4490,14 @@ int sync_once(struct my_sync_info *sync_info)
 #endif
 
 #ifdef USE_LOCKING
-   r = sync_lock(&fd);
+   /* With glob_sync_connected the home directory is only known, and
+    * locked, once the handheld has connected */
+   fd = -1;
+   r = glob_sync_connected ? 0 : sync_lock(&fd);
    if (r) {
       jp_logf(JP_LOG_DEBUG, "Child cannot lock file\n");
       if (!(SYNC_NO_FORK & sync_info->flags)) {
+         jp_log_flush();
          _exit(255);
       } else {
          return EXIT_FAILURE;
@@ -3469,22 +4538,84 @@ int sync_once(struct my_sync_info *sync_info)
       }
    }
 
+   TRACE_BEGIN("sync");
+   sync_stats_start();
    r = jp_sync(&sync_info_copy);
+   sync_stats_finish(r);
+   TRACE_END("sync");
    if (r) {
       jp_logf(JP_LOG_WARN, _("Exiting with status %s\n"), get_error_str(r));
       jp_logf(JP_LOG_WARN, _("Finished.\n"));
    }
 #ifdef USE_LOCKING
-   sync_unlock(fd);
+   if (fd >= 0) {
+      sync_unlock(fd);
+   }
+   if (connected_lock_fd >= 0) {
+      sync_unlock(connected_lock_fd);
+      connected_lock_fd = -1;
+   }
 #endif
    jp_logf(JP_LOG_DEBUG, "sync child exiting\n");
    if (!(SYNC_NO_FORK & sync_info->flags)) {
+      jp_log_flush();
       _exit(255);
    } else {
       return r;
    }
 }
 
+/* Size of the chunks a file is written to a card in.  Writing starts with
+ * small chunks and doubles the size while that makes the copy faster, a
+ * round trip per chunk being what costs most on a slow link.  When the
+ * handheld takes less than a whole chunk the size is halved. */
+struct vfs_chunk_tuning
+{
+   size_t size;
+   size_t best_size;
+   double best_rate;
+   int growing;
+};
+
+static void vfs_chunk_init(struct vfs_chunk_tuning *tuning)
+{
+   tuning->size = VFS_CHUNK_MIN;
+   tuning->best_size = VFS_CHUNK_MIN;
+   tuning->best_rate = 0.0;
+   tuning->growing = TRUE;
+}
+
+static void vfs_chunk_next(struct vfs_chunk_tuning *tuning, size_t asked,
+                           size_t written, double seconds)
+{
+   double rate;
+
+   if (written < asked) {
+      tuning->growing = FALSE;
+      if (tuning->size > VFS_CHUNK_MIN) {
+         tuning->size /= 2;
+      }
+      return;
+   }
+   /* A short read at the end of the file says nothing about the link */
+   if ((!tuning->growing) || (asked < tuning->size) || (seconds <= 0.0)) {
+      return;
+   }
+   rate = written / seconds;
+   if (rate > tuning->best_rate) {
+      tuning->best_rate = rate;
+      tuning->best_size = tuning->size;
+      if (tuning->size < VFS_CHUNK_MAX) {
+         tuning->size *= 2;
+      } else {
+         tuning->growing = FALSE;
+      }
+   } else {
+      tuning->size = tuning->best_size;
+      tuning->growing = FALSE;
+   }
+}
+
 /***********************************************************************/
 /* Imported from pilot-xfer.c, pilot-link-0.12.5, 2010-10-31 */
 /***********************************************************************/
@@ -3536,8 +4667,12 @@ static int pi_file_install_VFS(const int fd, const char *basename, const int soc
 	int
 	            writesize,
 	            offset;
-	size_t      readsize;
+	ssize_t     readsize;
 	size_t      written_so_far = 0;
+	struct vfs_chunk_tuning tuning;
+	double      copy_start,
+	            write_start,
+	            seconds;
 	enum { no_path=0, appended_filename=1, retried=2, done=3 } path_steps;
 	struct stat sbuf;
 	pi_progress_t progress;
@@ -3547,7 +4682,7 @@ static int pi_file_install_VFS(const int fd, const char *basename, const int soc
 		return bad_local_file;
 	}
 
-	if (findVFSPath(socket,vfspath,&volume,rpath,&rpathlen) < 0)
+	if (find_VFS_path_cached(socket,vfspath,&volume,rpath,&rpathlen) < 0)
 	{
 		fprintf(stderr,"\n   VFS path '%s' does not exist.\n\n", vfspath);
 		return bad_vfs_path;
@@ -3661,8 +4796,7 @@ static int pi_file_install_VFS(const int fd, const char *basename, const int soc
 		/* Non-fatal error, continue */
 	}
 
-#define FBUFSIZ 65536
-	filebuffer = (char *)malloc(FBUFSIZ);
+	filebuffer = (char *)malloc(VFS_CHUNK_MAX);
 	if (NULL == filebuffer)
 	{
 		fprintf(stderr,"   Cannot allocate memory for file copy.\n");
@@ -3676,21 +4810,35 @@ static int pi_file_install_VFS(const int fd, const char *basename, const int soc
 	progress.data.vfs.path = (char *) basename;
 	progress.data.vfs.total_bytes = sbuf.st_size;
 
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	vfs_chunk_init(&tuning);
+	copy_start = trace_now();
+
 	writesize = 0;
 	written_so_far = 0;
 	while (writesize >= 0)
 	{
-		readsize = read(fd,filebuffer,FBUFSIZ);
+		readsize = read(fd,filebuffer,tuning.size);
 		if (readsize <= 0) break;
+#ifdef HAVE_POSIX_FADVISE
+		/* Have the next chunk read from disk while this one is sent */
+		posix_fadvise(fd, written_so_far + readsize, VFS_CHUNK_MAX,
+		              POSIX_FADV_WILLNEED);
+#endif
 		offset=0;
 		while (readsize > 0)
 		{
+			write_start = trace_now();
 			writesize = dlp_VFSFileWrite(socket,file,filebuffer+offset,readsize);
 			if (writesize < 0)
 			{
 				fprintf(stderr,"   Error while writing file.\n");
 				break;
 			}
+			vfs_chunk_next(&tuning, readsize, writesize,
+			               trace_now() - write_start);
 			readsize -= writesize;
 			offset += writesize;
 			written_so_far += writesize;
@@ -3706,6 +4854,13 @@ static int pi_file_install_VFS(const int fd, const char *basename, const int soc
 		}
 	}
 
+	seconds = trace_now() - copy_start;
+	jp_logf(JP_LOG_GUI, _("(%ld bytes at %.0f bytes/s) "),
+	        (long)written_so_far,
+	        (seconds > 0) ? written_so_far / seconds : 0.0);
+	jp_logf(JP_LOG_DEBUG, "pi_file_install_VFS: %s in %d byte chunks\n",
+	        basename, (int)tuning.size);
+
 cleanup:
 	free(filebuffer);
 	dlp_VFSFileClose(socket,file);
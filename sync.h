@@ -53,6 +53,12 @@ struct my_sync_info {
    char username[128];
 };
 
+/* If set, called as soon as a handheld has connected.  It may point
+ * JPILOT_HOME at another directory and fill in sync_info from the
+ * preferences there, the sync then locks that directory.  A non zero
+ * return ends the sync. */
+extern int (*glob_sync_connected)(int sd, struct my_sync_info *sync_info);
+
 int sync_once(struct my_sync_info *sync_info);
 int sync_loop(const char *port, unsigned int flags, const int num_backups);
 
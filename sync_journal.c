@@ -0,0 +1,285 @@
+/*******************************************************************************
+ * sync_journal.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "i18n.h"
+#include "utils.h"
+#include "log.h"
+#include "sync_journal.h"
+
+/********************************* Constants **********************************/
+#define JOURNAL_HEADER "# J-Pilot sync journal 1"
+
+/****************************** Main Code *************************************/
+static int pc3_stat(const char *DB_name, long *size, time_t *mtime)
+{
+   char pc_filename[FILENAME_MAX];
+   char full_name[FILENAME_MAX];
+   struct stat statb;
+
+   g_snprintf(pc_filename, sizeof(pc_filename), "%s.pc3", DB_name);
+   get_home_file_name(pc_filename, full_name, sizeof(full_name));
+   if (stat(full_name, &statb)) {
+      return EXIT_FAILURE;
+   }
+   *size = statb.st_size;
+   *mtime = statb.st_mtime;
+
+   return EXIT_SUCCESS;
+}
+
+/* Rewrite the header of the record at offset, if it is the same record
+ * and it has not been marked yet */
+static int apply_mark(FILE *pc_file, long offset, unsigned long rec_len,
+                      unsigned long rt, unsigned long unique_id)
+{
+   PC3RecordHeader header;
+
+   if (fseek(pc_file, offset, SEEK_SET)) {
+      return EXIT_FAILURE;
+   }
+   if (read_header(pc_file, &header) != 1) {
+      return EXIT_FAILURE;
+   }
+   if ((header.rec_len != rec_len) || (header.rt == PALM_REC) ||
+       (header.rt & SPENT_PC_RECORD_BIT)) {
+      return EXIT_SUCCESS;
+   }
+
+   header.rt = rt;
+   header.unique_id = unique_id;
+   if (fseek(pc_file, offset, SEEK_SET)) {
+      return EXIT_FAILURE;
+   }
+   write_header(pc_file, &header);
+
+   return EXIT_SUCCESS;
+}
+
+static void free_done_list(GList **done)
+{
+   GList *temp_list;
+   struct sync_journal_db *db;
+
+   for (temp_list = *done; temp_list; temp_list = temp_list->next) {
+      db = temp_list->data;
+      free(db->DB_name);
+      free(db);
+   }
+   g_list_free(*done);
+   *done = NULL;
+}
+
+/* Write the marks of the journal into the .pc3 files.  If session is the
+ * session line of the journal, its finished databases are added to done. */
+static int journal_read(const char *session, GList **done)
+{
+   FILE *in;
+   FILE *pc_file;
+   char full_name[FILENAME_MAX];
+   char pc_filename[FILENAME_MAX];
+   char line[512];
+   char cur_name[256];
+   char *name;
+   long offset, size, mtime;
+   unsigned long rec_len, rt, unique_id;
+   int same_session;
+   int n, num;
+   struct sync_journal_db *db;
+
+   get_home_file_name(SYNC_JOURNAL_FILE, full_name, sizeof(full_name));
+   in = fopen(full_name, "r");
+   if (!in) {
+      return EXIT_SUCCESS;
+   }
+
+   same_session = FALSE;
+   pc_file = NULL;
+   cur_name[0] = '\0';
+   num = 0;
+   while (fgets(line, sizeof(line), in)) {
+      line[strcspn(line, "\n")] = '\0';
+      n = 0;
+      if (!strncmp(line, "session ", 8)) {
+         same_session = (session && !strcmp(line, session));
+      } else if ((sscanf(line, "mark %ld %lu %lu %lu %n", &offset, &rec_len,
+                         &rt, &unique_id, &n) == 4) && n) {
+         name = line + n;
+         if (strcmp(name, cur_name)) {
+            if (pc_file) {
+               jp_close_home_file(pc_file);
+            }
+            g_strlcpy(cur_name, name, sizeof(cur_name));
+            g_snprintf(pc_filename, sizeof(pc_filename), "%s.pc3", cur_name);
+            pc_file = jp_open_home_file(pc_filename, "r+");
+            if (!pc_file) {
+               jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), pc_filename);
+            }
+         }
+         if (pc_file) {
+            if (apply_mark(pc_file, offset, rec_len, rt, unique_id)) {
+               jp_logf(JP_LOG_WARN, "sync_journal: unable to mark record at %ld in %s\n",
+                       offset, pc_filename);
+            } else {
+               num++;
+            }
+         }
+      } else if (same_session && done &&
+                 (sscanf(line, "done %ld %ld %n", &size, &mtime, &n) == 2) && n) {
+         db = malloc(sizeof(struct sync_journal_db));
+         if (!db) {
+            break;
+         }
+         db->DB_name = strdup(line + n);
+         db->size = size;
+         db->mtime = mtime;
+         *done = g_list_prepend(*done, db);
+      }
+   }
+   if (pc_file) {
+      jp_close_home_file(pc_file);
+   }
+   fclose(in);
+
+   jp_logf(JP_LOG_DEBUG, "sync_journal: checked %d marks\n", num);
+
+   return EXIT_SUCCESS;
+}
+
+int sync_journal_open(struct sync_journal *journal,
+                      unsigned long user_id, unsigned long pc_id,
+                      int fast_sync, time_t last_sync)
+{
+   char full_name[FILENAME_MAX];
+   char session[100];
+   GList *temp_list;
+   struct sync_journal_db *db;
+
+   journal->file = NULL;
+   journal->done = NULL;
+
+   g_snprintf(session, sizeof(session), "session %lu %lu %d %ld",
+              user_id, pc_id, fast_sync ? 1 : 0, (long)last_sync);
+
+   journal_read(session, &(journal->done));
+
+   /* The marks are in the .pc3 files now, only the databases are kept */
+   get_home_file_name(SYNC_JOURNAL_FILE, full_name, sizeof(full_name));
+   journal->file = fopen(full_name, "w");
+   if (!journal->file) {
+      jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), full_name);
+      free_done_list(&(journal->done));
+      return EXIT_FAILURE;
+   }
+   fprintf(journal->file, "%s\n%s\n", JOURNAL_HEADER, session);
+   for (temp_list = journal->done; temp_list; temp_list = temp_list->next) {
+      db = temp_list->data;
+      fprintf(journal->file, "done %ld %ld %s\n",
+              db->size, (long)db->mtime, db->DB_name);
+   }
+   fflush(journal->file);
+
+   if (journal->done) {
+      jp_logf(JP_LOG_GUI, _("Resuming the interrupted sync.\n"));
+   }
+
+   return EXIT_SUCCESS;
+}
+
+void sync_journal_close(struct sync_journal *journal)
+{
+   if (journal->file) {
+      fclose(journal->file);
+      journal->file = NULL;
+   }
+   free_done_list(&(journal->done));
+}
+
+void sync_journal_mark(struct sync_journal *journal, const char *DB_name,
+                       long offset, PC3RecordHeader *header)
+{
+   if (!journal->file) {
+      return;
+   }
+   /* Flushed for each record, the record is already on the handheld */
+   fprintf(journal->file, "mark %ld %lu %lu %lu %s\n", offset,
+           header->rec_len, header->rt, header->unique_id, DB_name);
+   fflush(journal->file);
+}
+
+void sync_journal_done(struct sync_journal *journal, const char *DB_name)
+{
+   long size;
+   time_t mtime;
+
+   if (!journal->file) {
+      return;
+   }
+   if (pc3_stat(DB_name, &size, &mtime)) {
+      size = -1;
+      mtime = 0;
+   }
+   fprintf(journal->file, "done %ld %ld %s\n", size, (long)mtime, DB_name);
+   fflush(journal->file);
+}
+
+int sync_journal_is_done(struct sync_journal *journal, const char *DB_name)
+{
+   GList *temp_list;
+   struct sync_journal_db *db;
+   long size;
+   time_t mtime;
+
+   for (temp_list = journal->done; temp_list; temp_list = temp_list->next) {
+      db = temp_list->data;
+      if (strcmp(db->DB_name, DB_name)) {
+         continue;
+      }
+      if (pc3_stat(DB_name, &size, &mtime)) {
+         size = -1;
+         mtime = 0;
+      }
+      return ((size == db->size) && (mtime == db->mtime));
+   }
+
+   return FALSE;
+}
+
+void sync_journal_finish(struct sync_journal *journal)
+{
+   sync_journal_close(journal);
+   unlink_file(SYNC_JOURNAL_FILE);
+}
+
+int sync_journal_apply(void)
+{
+   journal_read(NULL, NULL);
+   unlink_file(SYNC_JOURNAL_FILE);
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+ * sync_journal.h
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+#ifndef __SYNC_JOURNAL_H__
+#define __SYNC_JOURNAL_H__
+
+#include <time.h>
+#include <glib.h>
+
+#include "libplugin.h"
+
+/*
+ * While a sync runs it keeps a journal in JPILOT_HOME/sync.journal of
+ * the work that has been committed on both sides:
+ *
+ *  - every .pc3 record that was written to or deleted from the handheld,
+ *    with the header the record is to be marked with,
+ *  - every database that was completely synced, with the size and modify
+ *    time of its .pc3 file at that point.
+ *
+ * The .pc3 marks are batched, so an interrupted sync can leave records on
+ * the handheld that still look pending in the .pc3 file.  The next sync
+ * first writes the journaled marks into the .pc3 files.  If it is for the
+ * same handheld, PC and kind of sync, and no other sync has completed in
+ * between, it also skips the databases the interrupted sync finished.
+ *
+ * The journal is removed when the .pc3 files are compacted, at the end of
+ * a sync and when J-Pilot exits, after its marks have been written.
+ */
+
+#define SYNC_JOURNAL_FILE "sync.journal"
+
+struct sync_journal_db
+{
+   char *DB_name;
+   long size;
+   time_t mtime;
+};
+
+struct sync_journal
+{
+   /* Open for appending while a sync runs, otherwise NULL */
+   FILE *file;
+   /* struct sync_journal_db of the databases an interrupted sync finished */
+   GList *done;
+};
+
+/* Write the marks of an earlier journal into the .pc3 files and start a
+ * journal for a sync.  The finished databases of the earlier journal are
+ * kept when it was for the same session. */
+int sync_journal_open(struct sync_journal *journal,
+                      unsigned long user_id, unsigned long pc_id,
+                      int fast_sync, time_t last_sync);
+void sync_journal_close(struct sync_journal *journal);
+/* The sync completed and every mark is in the .pc3 files, remove the journal */
+void sync_journal_finish(struct sync_journal *journal);
+
+/* Record that the header of the .pc3 record at offset is to become header */
+void sync_journal_mark(struct sync_journal *journal, const char *DB_name,
+                       long offset, PC3RecordHeader *header);
+
+/* Record that DB_name has been synced */
+void sync_journal_done(struct sync_journal *journal, const char *DB_name);
+
+/* Returns TRUE if the interrupted sync finished DB_name and its .pc3 file
+ * has not changed since */
+int sync_journal_is_done(struct sync_journal *journal, const char *DB_name);
+
+/* Write the marks of the journal into the .pc3 files and remove it */
+int sync_journal_apply(void);
+
+#endif
@@ -0,0 +1,356 @@
+/*******************************************************************************
+ * sync_stats.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "i18n.h"
+#include "log.h"
+#include "sync_stats.h"
+
+/********************************* Constants **********************************/
+/* Deepest nesting of phases that is kept apart */
+#define MAX_PHASE_DEPTH 16
+/* Round trips to open, describe and close a database in a file transfer */
+#define TRANSFER_DLP_CALLS 4
+
+/******************************* Global vars **********************************/
+int glob_sync_stats=0;
+
+struct sync_counts
+{
+   long dlp_calls;
+   long records_read;
+   long records_written;
+   long records_deleted;
+   long bytes_read;
+   long bytes_written;
+};
+
+struct sync_phase
+{
+   char *name;
+   char *detail;
+   double start;
+   double duration;
+   struct sync_counts counts;
+};
+
+static double stats_start;
+static time_t stats_time;
+static struct sync_counts stats_total;
+static struct sync_phase *phases;
+static int num_phases, max_phases;
+/* Indexes into phases of the phases begun and not yet ended */
+static int open_phases[MAX_PHASE_DEPTH];
+static int depth;
+/* Last progress reported during a file transfer */
+static pi_progress_t last_progress;
+
+/****************************** Main Code *************************************/
+static double stats_clock(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void free_phases(void)
+{
+   int i;
+
+   for (i=0; i<num_phases; i++) {
+      free(phases[i].name);
+      free(phases[i].detail);
+   }
+   free(phases);
+   phases = NULL;
+   num_phases = max_phases = 0;
+   depth = 0;
+}
+
+void sync_stats_start(void)
+{
+   const char *file;
+
+   glob_sync_stats = 0;
+   file = getenv(SYNC_STATS_ENV_VAR);
+   if ((!file) || (!file[0])) {
+      return;
+   }
+
+   free_phases();
+   memset(&stats_total, 0, sizeof(stats_total));
+   memset(&last_progress, 0, sizeof(last_progress));
+   stats_start = stats_clock();
+   stats_time = time(NULL);
+   glob_sync_stats = 1;
+}
+
+void sync_stats_begin(const char *name, const char *detail)
+{
+   struct sync_phase *new_phases;
+   struct sync_phase *phase;
+
+   if (!glob_sync_stats) {
+      return;
+   }
+   if (num_phases >= max_phases) {
+      new_phases = realloc(phases, (max_phases + 32) * sizeof(struct sync_phase));
+      if (!new_phases) {
+         jp_logf(JP_LOG_WARN, "sync_stats_begin(): %s\n", _("Out of memory"));
+         free_phases();
+         glob_sync_stats = 0;
+         return;
+      }
+      phases = new_phases;
+      max_phases += 32;
+   }
+   phase = &(phases[num_phases]);
+   memset(phase, 0, sizeof(struct sync_phase));
+   phase->name = strdup(name);
+   phase->detail = detail ? strdup(detail) : NULL;
+   phase->start = stats_clock() - stats_start;
+
+   /* Deeper phases are counted in the deepest one that is kept apart */
+   if (depth < MAX_PHASE_DEPTH) {
+      open_phases[depth] = num_phases;
+   }
+   depth++;
+   num_phases++;
+}
+
+void sync_stats_end(void)
+{
+   if ((!glob_sync_stats) || (depth == 0)) {
+      return;
+   }
+   depth--;
+   if (depth < MAX_PHASE_DEPTH) {
+      phases[open_phases[depth]].duration =
+         stats_clock() - stats_start - phases[open_phases[depth]].start;
+   }
+}
+
+static struct sync_counts *current_counts(void)
+{
+   if (depth == 0) {
+      return NULL;
+   }
+   if (depth > MAX_PHASE_DEPTH) {
+      return &(phases[open_phases[MAX_PHASE_DEPTH-1]].counts);
+   }
+   return &(phases[open_phases[depth-1]].counts);
+}
+
+static void count(long dlp_calls, long read, long written, long deleted,
+                  long bytes_read, long bytes_written)
+{
+   struct sync_counts *counts[2];
+   int i;
+
+   counts[0] = &stats_total;
+   counts[1] = current_counts();
+   for (i=0; i<2; i++) {
+      if (!counts[i]) {
+         continue;
+      }
+      counts[i]->dlp_calls += dlp_calls;
+      counts[i]->records_read += read;
+      counts[i]->records_written += written;
+      counts[i]->records_deleted += deleted;
+      counts[i]->bytes_read += bytes_read;
+      counts[i]->bytes_written += bytes_written;
+   }
+}
+
+int sync_stats_dlp(int ret)
+{
+   if (glob_sync_stats) {
+      count(1, 0, 0, 0, 0, 0);
+   }
+   return ret;
+}
+
+int sync_stats_read(int ret, pi_buffer_t *record)
+{
+   if (glob_sync_stats) {
+      if ((ret >= 0) && record) {
+         count(1, 1, 0, 0, record->used, 0);
+      } else {
+         count(1, 0, 0, 0, 0, 0);
+      }
+   }
+   return ret;
+}
+
+int sync_stats_receive(int ret, pi_buffer_t *buffer)
+{
+   if (glob_sync_stats) {
+      count(1, 0, 0, 0, ((ret >= 0) && buffer) ? buffer->used : 0, 0);
+   }
+   return ret;
+}
+
+int sync_stats_write(int ret, size_t len)
+{
+   if (glob_sync_stats) {
+      if (ret >= 0) {
+         count(1, 0, 1, 0, 0, len);
+      } else {
+         count(1, 0, 0, 0, 0, 0);
+      }
+   }
+   return ret;
+}
+
+int sync_stats_send(int ret, size_t len)
+{
+   if (glob_sync_stats) {
+      count(1, 0, 0, 0, 0, (ret >= 0) ? len : 0);
+   }
+   return ret;
+}
+
+int sync_stats_delete(int ret)
+{
+   if (glob_sync_stats) {
+      count(1, 0, 0, (ret >= 0) ? 1 : 0, 0, 0);
+   }
+   return ret;
+}
+
+int sync_stats_progress(int sd, pi_progress_t *progress)
+{
+   memcpy(&last_progress, progress, sizeof(pi_progress_t));
+   return PI_TRANSFER_CONTINUE;
+}
+
+int sync_stats_transfer(int ret, int sent)
+{
+   long records, bytes;
+
+   if (glob_sync_stats) {
+      records = last_progress.data.db.transferred_records;
+      bytes = last_progress.transferred_bytes;
+      if (sent) {
+         count(records + TRANSFER_DLP_CALLS, 0, records, 0, 0, bytes);
+      } else {
+         count(records + TRANSFER_DLP_CALLS, records, 0, 0, bytes, 0);
+      }
+   }
+   memset(&last_progress, 0, sizeof(last_progress));
+
+   return ret;
+}
+
+/* Copy src into dest as the inside of a JSON string */
+static void json_escape(char *dest, const char *src, int max)
+{
+   int n;
+
+   for (n=0; (*src) && (n < max-7); src++) {
+      if ((*src=='"') || (*src=='\\')) {
+         dest[n++] = '\\';
+         dest[n++] = *src;
+      } else if ((unsigned char)*src < 0x20) {
+         sprintf(dest+n, "\\u%04x", (unsigned char)*src);
+         n += 6;
+      } else {
+         dest[n++] = *src;
+      }
+   }
+   dest[n] = '\0';
+}
+
+static void write_counts(FILE *out, struct sync_counts *counts)
+{
+   fprintf(out, "\"dlp_calls\":%ld,\"records_read\":%ld,"
+           "\"records_written\":%ld,\"records_deleted\":%ld,"
+           "\"bytes_read\":%ld,\"bytes_written\":%ld",
+           counts->dlp_calls, counts->records_read,
+           counts->records_written, counts->records_deleted,
+           counts->bytes_read, counts->bytes_written);
+}
+
+void sync_stats_finish(int result)
+{
+   const char *file;
+   FILE *out;
+   char when[32];
+   char name[256];
+   char detail[256];
+   double seconds;
+   int i;
+
+   if (!glob_sync_stats) {
+      return;
+   }
+   while (depth > 0) {
+      sync_stats_end();
+   }
+   seconds = stats_clock() - stats_start;
+
+   jp_logf(JP_LOG_GUI, "sync stats: seconds=%.3f dlp_calls=%ld "
+           "records_read=%ld records_written=%ld records_deleted=%ld "
+           "bytes_read=%ld bytes_written=%ld\n",
+           seconds, stats_total.dlp_calls, stats_total.records_read,
+           stats_total.records_written, stats_total.records_deleted,
+           stats_total.bytes_read, stats_total.bytes_written);
+
+   file = getenv(SYNC_STATS_ENV_VAR);
+   out = fopen(file, "a");
+   if (!out) {
+      jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), file);
+      free_phases();
+      glob_sync_stats = 0;
+      return;
+   }
+
+   strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", localtime(&stats_time));
+   fprintf(out, "{\"time\":\"%s\",\"result\":%d,\"seconds\":%.3f,",
+           when, result, seconds);
+   write_counts(out, &stats_total);
+   fprintf(out, ",\"phases\":[");
+   for (i=0; i<num_phases; i++) {
+      json_escape(name, phases[i].name, sizeof(name));
+      fprintf(out, "%s{\"name\":\"%s\",", i ? "," : "", name);
+      if (phases[i].detail) {
+         json_escape(detail, phases[i].detail, sizeof(detail));
+         fprintf(out, "\"detail\":\"%s\",", detail);
+      }
+      fprintf(out, "\"start\":%.3f,\"seconds\":%.3f,",
+              phases[i].start, phases[i].duration);
+      write_counts(out, &(phases[i].counts));
+      fprintf(out, "}");
+   }
+   fprintf(out, "]}\n");
+   fclose(out);
+
+   free_phases();
+   glob_sync_stats = 0;
+}
@@ -0,0 +1,64 @@
+/*******************************************************************************
+ * sync_stats.h
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+#ifndef __SYNC_STATS_H__
+#define __SYNC_STATS_H__
+
+#include <pi-buffer.h>
+#include <pi-file.h>
+
+/*
+ * Timing and throughput of each phase of a sync.  Statistics are off
+ * unless the environment variable JPILOT_SYNC_STATS names a file.  Each
+ * sync then appends one line to the file with a JSON object of the
+ * totals and of every phase, and logs a summary line.
+ *
+ * A phase counts the DLP round trips, records and bytes of its own,
+ * not those of the phases begun inside it.  The round trips of a
+ * database transferred by pi_file_retrieve or pi_file_install are
+ * counted as one per record and four to open, describe and close it.
+ */
+
+#define SYNC_STATS_ENV_VAR "JPILOT_SYNC_STATS"
+
+extern int glob_sync_stats;
+
+void sync_stats_start(void);
+/* Write the statistics of the sync that returned result */
+void sync_stats_finish(int result);
+
+void sync_stats_begin(const char *name, const char *detail);
+void sync_stats_end(void);
+
+/* These take the return value of a DLP call, count the call, and count
+ * what it moved if it succeeded.  They return ret. */
+int sync_stats_dlp(int ret);
+int sync_stats_read(int ret, pi_buffer_t *record);
+int sync_stats_receive(int ret, pi_buffer_t *buffer);
+int sync_stats_write(int ret, size_t len);
+int sync_stats_send(int ret, size_t len);
+int sync_stats_delete(int ret);
+
+/* Progress function for pi_file_retrieve and pi_file_install, whose
+ * return value is then passed to sync_stats_transfer */
+int sync_stats_progress(int sd, pi_progress_t *progress);
+int sync_stats_transfer(int ret, int sent);
+
+#endif
@@ -31,6 +31,7 @@
 #include "i18n.h"
 #include "utils.h"
 #include "log.h"
+#include "trace.h"
 #include "todo.h"
 #include "prefs.h"
 #include "libplugin.h"
@@ -127,8 +128,9 @@ int get_todos2(ToDoList **todo_list, int sort_order,
    int keep_priv;
    buf_rec *br;
    long char_set;
-   char *buf;
+   char *fields[2];
    pi_buffer_t *RecordBuffer;
+   double unpack_start, conv_start, conv_time;
 #ifdef ENABLE_MANANA
    long ivalue;
 #endif
@@ -176,6 +178,9 @@ int get_todos2(ToDoList **todo_list, int sort_order,
       return 0;
 #endif
 
+   TRACE_BEGIN("unpack");
+   unpack_start = TRACE_NOW();
+   conv_time = 0.0;
    for (temp_list = records; temp_list; temp_list = temp_list->next) {
       if (temp_list->data) {
          br=temp_list->data;
@@ -215,19 +220,14 @@ int get_todos2(ToDoList **todo_list, int sort_order,
          continue;
       }
 
-      if (todo.description) {
-         buf = charset_p2newj(todo.description, -1, char_set);
-         if (buf) {
-            free(todo.description);
-            todo.description = buf;
-         }
-      }
-      if (todo.note) {
-         buf = charset_p2newj(todo.note, -1, char_set);
-         if (buf) {
-            free(todo.note);
-            todo.note = buf;
-         }
+      conv_start = TRACE_NOW();
+      fields[0] = todo.description;
+      fields[1] = todo.note;
+      charset_p2j_fields(fields, 2, char_set);
+      todo.description = fields[0];
+      todo.note = fields[1];
+      if (glob_trace) {
+         conv_time += trace_now() - conv_start;
       }
       temp_todo_list = malloc(sizeof(ToDoList));
       if (!temp_todo_list) {
@@ -244,9 +244,16 @@ int get_todos2(ToDoList **todo_list, int sort_order,
       recs_returned++;
    }
 
+   if (glob_trace) {
+      trace_total("charset conversion", unpack_start, conv_time);
+   }
+   TRACE_END("unpack");
+
    jp_free_DB_records(&records);
 
+   TRACE_BEGIN("sort");
    todo_sort(todo_list, sort_order);
+   TRACE_END("sort");
 
    jp_logf(JP_LOG_DEBUG, "Leaving get_todos2()\n");
 
@@ -518,3 +525,91 @@ static int todo_sort(ToDoList **todol, int sort_order)
    return EXIT_SUCCESS;
 }
 
+/*
+ * Link new_todo into a list sorted by get_todos2() without re-sorting it.
+ * The position is found by a binary search.
+ * sort_order: SORT_ASCENDING | SORT_DESCENDING
+ */
+int todo_insert_sorted(ToDoList **todol, ToDoList *new_todo, int sort_order)
+{
+   ToDoList *temp_todol;
+   ToDoList **sort_todol;
+   struct ToDoAppInfo ai;
+   int count, i;
+   int lo, hi, mid, r;
+
+   /* Count the entries in the list */
+   for (count=0, temp_todol=*todol; temp_todol; temp_todol=temp_todol->next, count++) {}
+
+   if (count==0) {
+      new_todo->next = NULL;
+      *todol = new_todo;
+      return EXIT_SUCCESS;
+   }
+
+   get_todo_app_info(&ai);
+
+   glob_Ptodo_app_info = &ai;
+
+   sort_todol = calloc(count, sizeof(ToDoList *));
+   if (!sort_todol) {
+      jp_logf(JP_LOG_WARN, "todo_insert_sorted(): %s\n", _("Out of memory"));
+      return EXIT_FAILURE;
+   }
+   for (i=0, temp_todol=*todol; temp_todol; temp_todol=temp_todol->next, i++) {
+      sort_todol[i] = temp_todol;
+   }
+
+   /* Find the first record that comes after the new one.
+    * todo_sort() links an ascending list in reverse order of todo_compare() */
+   lo = 0;
+   hi = count;
+   while (lo < hi) {
+      mid = (lo + hi) / 2;
+      r = todo_compare(&new_todo, &sort_todol[mid]);
+      if (sort_order==SORT_ASCENDING) {
+         r = -r;
+      }
+      if (r < 0) {
+         hi = mid;
+      } else {
+         lo = mid + 1;
+      }
+   }
+
+   if (lo==0) {
+      new_todo->next = *todol;
+      *todol = new_todo;
+   } else {
+      new_todo->next = sort_todol[lo-1]->next;
+      sort_todol[lo-1]->next = new_todo;
+   }
+
+   free(sort_todol);
+
+   return EXIT_SUCCESS;
+}
+
+/* Unlink the node holding mtodo from the list and free it */
+int todo_remove(ToDoList **todol, MyToDo *mtodo)
+{
+   ToDoList *temp_todol, *prev_todol;
+
+   for (prev_todol=NULL, temp_todol=*todol;
+        temp_todol;
+        prev_todol=temp_todol, temp_todol=temp_todol->next) {
+      if (&(temp_todol->mtodo) == mtodo) {
+         if (prev_todol) {
+            prev_todol->next = temp_todol->next;
+         } else {
+            *todol = temp_todol->next;
+         }
+         free_ToDo(&(temp_todol->mtodo.todo));
+         free(temp_todol);
+         return EXIT_SUCCESS;
+      }
+   }
+
+   return EXIT_FAILURE;
+}
+
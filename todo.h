@@ -38,6 +38,9 @@ int get_todos(ToDoList **todo_list, int sort_order);
 int get_todos2(ToDoList **todo_list, int sort_order,
                int modified, int deleted, int privates, int completed,
                int category);
+/* Keep a list returned by get_todos2() sorted while patching it */
+int todo_insert_sorted(ToDoList **todol, ToDoList *new_todo, int sort_order);
+int todo_remove(ToDoList **todol, MyToDo *mtodo);
 int get_todo_app_info(struct ToDoAppInfo *ai);
 int pc_todo_write(struct ToDo *todo, PCRecType rt, unsigned char attrib,
                   unsigned int *unique_id);
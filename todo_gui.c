@@ -35,6 +35,7 @@
 #include "i18n.h"
 #include "utils.h"
 #include "log.h"
+#include "trace.h"
 #include "prefs.h"
 #include "password.h"
 #include "print.h"
@@ -100,6 +101,7 @@ static int record_changed;
 /****************************** Prototypes ************************************/
 static int todo_clear_details(void);
 static int todo_clist_redraw(void);
+static int todo_clist_patch(MyToDo *old_mtodo, int flag, ToDoList *new_todo);
 static int todo_find(void);
 static void cb_add_new_record(GtkWidget *widget, gpointer data);
 static void connect_changed_signals(int con_or_dis);
@@ -409,7 +411,7 @@ static int cb_todo_import(GtkWidget *parent_window,
    int priv, indefinite, priority, completed;
    int year, month, day;
 
-   in=fopen(file_path, "r");
+   in=import_fopen(file_path);
    if (!in) {
       jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), file_path);
       return EXIT_FAILURE;
@@ -426,6 +428,7 @@ static int cb_todo_import(GtkWidget *parent_window,
       if (EXIT_FAILURE == ret) return EXIT_FAILURE;
 
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       while (1) {
          /* Read the category field */
          ret = read_csv_field(in, text, sizeof(text));
@@ -502,8 +505,8 @@ static int cb_todo_import(GtkWidget *parent_window,
          new_todo.description=description;
          new_todo.note=note;
 
-         todo_to_text(&new_todo, text, sizeof(text));
          if (!import_all) {
+            todo_to_text(&new_todo, text, sizeof(text));
             ret=import_record_ask(parent_window, pane,
                                   text,
                                   &(todo_app_info.category),
@@ -536,6 +539,7 @@ static int cb_todo_import(GtkWidget *parent_window,
       todolist=NULL;
       dat_get_todos(in, &todolist, &cai);
       import_all=FALSE;
+      jp_pc_write_batch_begin();
       for (temp_todolist=todolist; temp_todolist; temp_todolist=temp_todolist->next) {
          index=temp_todolist->mtodo.unique_id-1;
          if (index<0) {
@@ -584,9 +588,17 @@ static int cb_todo_import(GtkWidget *parent_window,
       free_ToDoList(&todolist);
    }
 
+   /* Write out the imported records before they are read back */
+   ret = jp_pc_write_batch_end();
+   if (ret != EXIT_SUCCESS) {
+      jp_logf(JP_LOG_WARN, _("Unable to write the imported records\n"));
+      dialog_generic_ok(parent_window, _("Error"), DIALOG_ERROR,
+                        _("Unable to write the imported records\n"));
+   }
+
    todo_refresh();
    fclose(in);
-   return EXIT_SUCCESS;
+   return ret;
 }
 
 int todo_import(GtkWidget *window)
@@ -626,6 +638,7 @@ static void cb_todo_export_ok(GtkWidget *export_window, GtkWidget *clist,
 {
    MyToDo *mtodo;
    GList *list, *temp_list;
+   gpointer *rows;
    FILE *out;
    struct stat statb;
    int i, r;
@@ -667,7 +680,7 @@ static void cb_todo_export_ok(GtkWidget *export_window, GtkWidget *clist,
       }
    }
 
-   out = fopen(filename, "w");
+   out = export_fopen(filename);
    if (!out) {
       g_snprintf(text, sizeof(text), _("Error opening file: %s"), filename);
       dialog_generic(GTK_WINDOW(export_window),
@@ -718,9 +731,10 @@ static void cb_todo_export_ok(GtkWidget *export_window, GtkWidget *clist,
 
    get_pref(PREF_CHAR_SET, &char_set, NULL);
    list=GTK_CLIST(clist)->selection;
+   rows = clist_get_all_row_data(GTK_CLIST(clist));
 
    for (i=0, temp_list=list; temp_list; temp_list = temp_list->next, i++) {
-      mtodo = gtk_clist_get_row_data(GTK_CLIST(clist), GPOINTER_TO_INT(temp_list->data));
+      mtodo = rows[GPOINTER_TO_INT(temp_list->data)];
       if (!mtodo) {
          continue;
          jp_logf(JP_LOG_WARN, _("Can't export todo %d\n"), (long) temp_list->data + 1);
@@ -845,6 +859,8 @@ static void cb_todo_export_ok(GtkWidget *export_window, GtkWidget *clist,
       }
    }
 
+   g_free(rows);
+
    if (out) {
       fclose(out);
    }
@@ -933,39 +949,48 @@ static int find_menu_cat_pos(int cat)
    }
 }
 
-static void cb_delete_todo(GtkWidget *widget,
-                           gpointer   data)
+/* Delete the selected record from the .pc3 file, or mark it as modified.
+ * Returns EXIT_FAILURE if the record was not changed. */
+static int delete_todo(int flag)
 {
    MyToDo *mtodo;
-   int flag;
+   MyToDo palm_mtodo;
    int show_priv;
    long char_set;
+   int r;
 
    mtodo = gtk_clist_get_row_data(GTK_CLIST(clist), clist_row_selected);
    if (mtodo < (MyToDo *)CLIST_MIN_DATA) {
-      return;
-   }
-
-   /* Convert to Palm character set */
-   get_pref(PREF_CHAR_SET, &char_set, NULL);
-   if (char_set != CHAR_SET_LATIN1) {
-      if (mtodo->todo.description)
-         charset_j2p(mtodo->todo.description, strlen(mtodo->todo.description)+1, char_set);
-      if (mtodo->todo.note)
-         charset_j2p(mtodo->todo.note, strlen(mtodo->todo.note)+1, char_set);
+      return EXIT_FAILURE;
    }
 
    /* Do masking like Palm OS 3.5 */
    show_priv = show_privates(GET_PRIVATES);
    if ((show_priv != SHOW_PRIVATES) &&
        (mtodo->attrib & dlpRecAttrSecret)) {
-      return;
+      return EXIT_FAILURE;
    }
    /* End Masking */
-   flag = GPOINTER_TO_INT(data);
+
+   /* Convert a copy to the Palm character set, the record may stay on
+    * the screen as deleted or modified */
+   memcpy(&palm_mtodo, mtodo, sizeof(MyToDo));
+   get_pref(PREF_CHAR_SET, &char_set, NULL);
+   if (char_set != CHAR_SET_LATIN1) {
+      if (mtodo->todo.description) {
+         palm_mtodo.todo.description = strdup(mtodo->todo.description);
+         charset_j2p(palm_mtodo.todo.description, strlen(palm_mtodo.todo.description)+1, char_set);
+      }
+      if (mtodo->todo.note) {
+         palm_mtodo.todo.note = strdup(mtodo->todo.note);
+         charset_j2p(palm_mtodo.todo.note, strlen(palm_mtodo.todo.note)+1, char_set);
+      }
+   }
+
+   r = EXIT_FAILURE;
    if ((flag==MODIFY_FLAG) || (flag==DELETE_FLAG)) {
       jp_logf(JP_LOG_DEBUG, "calling delete_pc_record\n");
-      delete_pc_record(TODO, mtodo, flag);
+      r = delete_pc_record(TODO, &palm_mtodo, flag);
       if (flag==DELETE_FLAG) {
          /* when we redraw we want to go to the line above the deleted one */
          if (clist_row_selected>0) {
@@ -974,9 +999,29 @@ static void cb_delete_todo(GtkWidget *widget,
       }
    }
 
+   if (char_set != CHAR_SET_LATIN1) {
+      if (palm_mtodo.todo.description) {
+         free(palm_mtodo.todo.description);
+      }
+      if (palm_mtodo.todo.note) {
+         free(palm_mtodo.todo.note);
+      }
+   }
+
    if (flag == DELETE_FLAG) {
-      todo_clist_redraw();
+      /* If the record is still in the file the list is redrawn from it */
+      if ((r != EXIT_SUCCESS) || todo_clist_patch(mtodo, flag, NULL)) {
+         todo_clist_redraw();
+      }
    }
+
+   return r;
+}
+
+static void cb_delete_todo(GtkWidget *widget,
+                           gpointer   data)
+{
+   delete_todo(GPOINTER_TO_INT(data));
 }
 
 static void cb_undelete_todo(GtkWidget *widget,
@@ -1280,14 +1325,33 @@ static int todo_get_details(struct ToDo *new_todo, unsigned char *attrib)
    return EXIT_SUCCESS;
 }
 
+/* Copy todo the way it is read back from the database */
+static void copy_todo_for_list(struct ToDo *todo, struct ToDo *copy)
+{
+   memcpy(copy, todo, sizeof(struct ToDo));
+   memset(&(copy->due), 0, sizeof(struct tm));
+   if (!todo->indefinite) {
+      copy->due.tm_year = todo->due.tm_year;
+      copy->due.tm_mon = todo->due.tm_mon;
+      copy->due.tm_mday = todo->due.tm_mday;
+      copy->due.tm_isdst = -1;
+      mktime(&(copy->due));
+   }
+   copy->description = strdup(todo->description ? todo->description : "");
+   copy->note = strdup(todo->note ? todo->note : "");
+}
+
 static void cb_add_new_record(GtkWidget *widget, gpointer data)
 {
    MyToDo *mtodo;
    struct ToDo new_todo;
+   ToDoList *new_todol;
    unsigned char attrib = 0;
-   int flag;
+   int flag, r;
+   int r_delete = EXIT_SUCCESS;
    int show_priv;
    unsigned int unique_id;
+   PCRecType type;
 
    flag=GPOINTER_TO_INT(data);
    unique_id = 0;
@@ -1335,24 +1399,51 @@ static void cb_add_new_record(GtkWidget *widget, gpointer data)
    set_new_button_to(CLEAR_FLAG);
 
    if (flag==MODIFY_FLAG) {
-      cb_delete_todo(NULL, data);
       if ((mtodo->rt==PALM_REC) || (mtodo->rt==REPLACEMENT_PALM_REC)) {
-         pc_todo_write(&new_todo, REPLACEMENT_PALM_REC, attrib, &unique_id);
+         type = REPLACEMENT_PALM_REC;
       } else {
          unique_id=0;
-         pc_todo_write(&new_todo, NEW_PC_REC, attrib, &unique_id);
+         type = NEW_PC_REC;
       }
+      r_delete = delete_todo(flag);
    } else {
       unique_id=0;
-      pc_todo_write(&new_todo, NEW_PC_REC, attrib, &unique_id);
+      type = NEW_PC_REC;
    }
+
+   /* The new record is linked into the displayed list as it would be
+    * read back from the database, before pc_todo_write() converts it to
+    * the Palm character set */
+   new_todol = malloc(sizeof(ToDoList));
+   if (new_todol) {
+      new_todol->app_type = TODO;
+      new_todol->next = NULL;
+      copy_todo_for_list(&new_todo, &(new_todol->mtodo.todo));
+   }
+
+   r = pc_todo_write(&new_todo, type, attrib, &unique_id);
    free_ToDo(&new_todo);
 
-   /* Don't return to modified record if search gui active */
-   if (!glob_find_id) {
-      glob_find_id = unique_id;
+   if (new_todol) {
+      new_todol->mtodo.rt = type;
+      new_todol->mtodo.unique_id = unique_id;
+      new_todol->mtodo.attrib = attrib;
+      /* A list that can't be patched to match the file is redrawn */
+      if ((r != EXIT_SUCCESS) || (r_delete != EXIT_SUCCESS)) {
+         free_ToDo(&(new_todol->mtodo.todo));
+         free(new_todol);
+         new_todol = NULL;
+      }
+   }
+
+   if ((!new_todol) ||
+       todo_clist_patch((flag==MODIFY_FLAG) ? mtodo : NULL, flag, new_todol)) {
+      /* Don't return to modified record if search gui active */
+      if (!glob_find_id) {
+         glob_find_id = unique_id;
+      }
+      todo_clist_redraw();
    }
-   todo_clist_redraw();
 
    return;
 }
@@ -1443,6 +1534,82 @@ static gint GtkClistCompareDates(GtkCList *clist,
    return(time1 - time2);
 }
 
+/* Function is used to sort clist based on the Priority field */
+static gint GtkClistComparePriority(GtkCList *clist,
+                                    gconstpointer ptr1,
+                                    gconstpointer ptr2)
+{
+   MyToDo *mtodo1, *mtodo2;
+
+   mtodo1 = ((GtkCListRow *) ptr1)->data;
+   mtodo2 = ((GtkCListRow *) ptr2)->data;
+
+   return mtodo1->todo.priority - mtodo2->todo.priority;
+}
+
+/* Function is used to sort clist based on the Note field.
+ * Records with a note come first, as they did when sorting on the
+ * pixmap and empty text cells */
+static gint GtkClistCompareNote(GtkCList *clist,
+                                gconstpointer ptr1,
+                                gconstpointer ptr2)
+{
+   MyToDo *mtodo1, *mtodo2;
+   int note1, note2;
+
+   mtodo1 = ((GtkCListRow *) ptr1)->data;
+   mtodo2 = ((GtkCListRow *) ptr2)->data;
+
+   note1 = (mtodo1->todo.note && mtodo1->todo.note[0]);
+   note2 = (mtodo2->todo.note && mtodo2->todo.note[0]);
+
+   return note2 - note1;
+}
+
+/* Function is used to sort clist based on the text shown for the
+ * Description field */
+static gint GtkClistCompareDescription(GtkCList *clist,
+                                       gconstpointer ptr1,
+                                       gconstpointer ptr2)
+{
+   MyToDo *mtodo1, *mtodo2;
+   char str1[TODO_MAX_COLUMN_LEN+2];
+   char str2[TODO_MAX_COLUMN_LEN+2];
+
+   mtodo1 = ((GtkCListRow *) ptr1)->data;
+   mtodo2 = ((GtkCListRow *) ptr2)->data;
+
+   str1[0] = str2[0] = '\0';
+   lstrncpy_remove_cr_lfs(str1, mtodo1->todo.description, TODO_MAX_COLUMN_LEN);
+   lstrncpy_remove_cr_lfs(str2, mtodo2->todo.description, TODO_MAX_COLUMN_LEN);
+
+   return strcmp(str1, str2);
+}
+
+/* Rows are only filled in when they are drawn, so every column is sorted
+ * on the records instead of the clist text */
+static void todo_clist_set_compare_func(GtkWidget *clist, int column)
+{
+   switch (column) {
+    case TODO_CHECK_COLUMN: /* Checkbox column */
+      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareCheckbox);
+      break;
+    case TODO_PRIORITY_COLUMN:
+      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistComparePriority);
+      break;
+    case TODO_NOTE_COLUMN:
+      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareNote);
+      break;
+    case TODO_DATE_COLUMN:  /* Due Date column */
+      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareDates);
+      break;
+    case TODO_TEXT_COLUMN:
+    default:
+      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareDescription);
+      break;
+   }
+}
+
 static void cb_clist_click_column(GtkWidget *clist, int column)
 {
    MyToDo *mtodo;
@@ -1475,17 +1642,7 @@ static void cb_clist_click_column(GtkWidget *clist, int column)
    clist_col_selected = column;
 
    gtk_clist_set_sort_column(GTK_CLIST(clist), column);
-   switch (column) {
-    case TODO_CHECK_COLUMN: /* Checkbox column */
-      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareCheckbox);
-      break;
-    case TODO_DATE_COLUMN:  /* Due Date column */
-      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareDates);
-      break;
-    default: /* All other columns can use GTK default sort function */
-      gtk_clist_set_compare_func(GTK_CLIST(clist),NULL);
-      break;
-   }
+   todo_clist_set_compare_func(clist, column);
    gtk_clist_sort (GTK_CLIST (clist));
 
    /* Return to previously selected item */
@@ -1767,18 +1924,18 @@ static gboolean cb_key_pressed_right_side(GtkWidget   *widget,
 void todo_clist_clear(GtkCList *clist)
 {
    GtkStyle *base_style, *row_style, *cell_style; 
-   int i;
+   GList *temp_list;
 
    base_style = gtk_widget_get_style(GTK_WIDGET(clist));
   
-   for (i=0; i<GTK_CLIST(clist)->rows ; i++)
+   for (temp_list = clist->row_list; temp_list; temp_list = temp_list->next)
    {
-      row_style = gtk_clist_get_row_style(GTK_CLIST(clist), i);
+      row_style = GTK_CLIST_ROW(temp_list)->style;
       if (row_style && (row_style != base_style))
       {
          g_object_unref(row_style);  
       }
-      cell_style = gtk_clist_get_cell_style(GTK_CLIST(clist), i, TODO_DATE_COLUMN);
+      cell_style = GTK_CLIST_ROW(temp_list)->cell[TODO_DATE_COLUMN].style;
       if (cell_style && (cell_style != base_style))
       {
          g_object_unref(cell_style);  
@@ -1788,21 +1945,130 @@ void todo_clist_clear(GtkCList *clist)
    gtk_clist_clear(GTK_CLIST(clist));
 
 }
-void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
-                       ToDoList **todo_list, int category, int main)
+
+static void todo_due_str(char *str, int len, struct ToDo *todo)
+{
+   const char *svalue;
+
+   if (!todo->indefinite) {
+      get_pref(PREF_SHORTDATE, NULL, &svalue);
+      strftime(str, len, svalue, &(todo->due));
+   }
+   else {
+      g_snprintf(str, len, "%s", _("No date"));
+   }
+}
+
+/* Fill in the text, pixmaps and colors of clist row "row" from mtodo.
+ * comp_now is today in the same form as comp_due below */
+static void todo_clist_set_row(GtkWidget *clist, int row, MyToDo *mtodo,
+                               int comp_now)
 {
-   int num_entries, entries_shown;
-   gchar *empty_line[] = { "","","","","" };
    GdkPixmap *pixmap_note;
    GdkPixmap *pixmap_check;
    GdkPixmap *pixmap_checked;
    GdkBitmap *mask_note;
    GdkBitmap *mask_check;
    GdkBitmap *mask_checked;
-   ToDoList *temp_todo;
    char str[50];
    char str2[TODO_MAX_COLUMN_LEN+2];
-   const char *svalue;
+   struct tm *due;
+   int comp_due;
+
+   get_pixmaps(clist, PIXMAP_NOTE, &pixmap_note, &mask_note);
+   get_pixmaps(clist, PIXMAP_BOX_CHECK, &pixmap_check, &mask_check);
+   get_pixmaps(clist, PIXMAP_BOX_CHECKED, &pixmap_checked,&mask_checked);
+#ifdef __APPLE__
+   mask_note = NULL;
+   mask_check = NULL;
+   mask_checked = NULL;
+#endif
+
+   /* Put a checkbox or checked checkbox pixmap up */
+   if (mtodo->todo.complete) {
+      gtk_clist_set_pixmap(GTK_CLIST(clist), row, TODO_CHECK_COLUMN, pixmap_checked, mask_checked);
+   } else {
+      gtk_clist_set_pixmap(GTK_CLIST(clist), row, TODO_CHECK_COLUMN, pixmap_check, mask_check);
+   }
+
+   /* Print the priority number */
+   sprintf(str, "%d", mtodo->todo.priority);
+   gtk_clist_set_text(GTK_CLIST(clist), row, TODO_PRIORITY_COLUMN, str);
+
+   /* Put a note pixmap up */
+   if (mtodo->todo.note[0]) {
+      gtk_clist_set_pixmap(GTK_CLIST(clist), row, TODO_NOTE_COLUMN, pixmap_note, mask_note);
+   } else {
+      gtk_clist_set_text(GTK_CLIST(clist), row, TODO_NOTE_COLUMN, "");
+   }
+
+   /* Print the due date */
+   todo_due_str(str, sizeof(str), &(mtodo->todo));
+   gtk_clist_set_text(GTK_CLIST(clist), row, TODO_DATE_COLUMN, str);
+   /* Print the todo text */
+   lstrncpy_remove_cr_lfs(str2, mtodo->todo.description, TODO_MAX_COLUMN_LEN);
+   gtk_clist_set_text(GTK_CLIST(clist), row, TODO_TEXT_COLUMN, str2);
+
+   gtk_clist_set_row_data(GTK_CLIST(clist), row, mtodo);
+
+   /* Highlight row background depending on status */
+   switch (mtodo->rt) {
+    case NEW_PC_REC:
+    case REPLACEMENT_PALM_REC:
+      set_bg_rgb_clist_row(clist, row,
+                       CLIST_NEW_RED, CLIST_NEW_GREEN, CLIST_NEW_BLUE);
+      break;
+    case DELETED_PALM_REC:
+    case DELETED_PC_REC:
+      set_bg_rgb_clist_row(clist, row,
+                       CLIST_DEL_RED, CLIST_DEL_GREEN, CLIST_DEL_BLUE);
+      break;
+    case MODIFIED_PALM_REC:
+      set_bg_rgb_clist_row(clist, row,
+                       CLIST_MOD_RED, CLIST_MOD_GREEN, CLIST_MOD_BLUE);
+      break;
+    default:
+      if (mtodo->attrib & dlpRecAttrSecret) {
+         set_bg_rgb_clist_row(clist, row,
+                          CLIST_PRIVATE_RED, CLIST_PRIVATE_GREEN, CLIST_PRIVATE_BLUE);
+      } else {
+         gtk_clist_set_row_style(GTK_CLIST(clist), row, NULL);
+      }
+   }
+
+   /* Highlight dates of items overdue or due today */
+   if (!(mtodo->todo.indefinite)) {
+      due = &(mtodo->todo.due);
+      comp_due=due->tm_year*380+due->tm_mon*31+due->tm_mday-1;
+
+      if (comp_due < comp_now) {
+         set_fg_rgb_clist_cell(clist, row, TODO_DATE_COLUMN, CLIST_OVERDUE_RED, CLIST_OVERDUE_GREEN, CLIST_OVERDUE_BLUE);
+      } else if (comp_due == comp_now) {
+         set_fg_rgb_clist_cell(clist, row, TODO_DATE_COLUMN, CLIST_DUENOW_RED, CLIST_DUENOW_GREEN, CLIST_DUENOW_BLUE);
+      }
+   }
+}
+
+static void todo_clist_fill_row(GtkWidget *clist, int row, gpointer row_data)
+{
+   time_t ltime;
+   struct tm *now;
+   int comp_now;
+
+   time(&ltime);
+   now = localtime(&ltime);
+   comp_now=now->tm_year*380+now->tm_mon*31+now->tm_mday-1;
+
+   todo_clist_set_row(clist, row, row_data, comp_now);
+}
+
+void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
+                       ToDoList **todo_list, int category, int main)
+{
+   int num_entries, entries_shown;
+   gchar *empty_line[] = { "","","","","" };
+   ToDoList *temp_todo;
+   char str[50];
    long hide_completed, hide_not_due;
    long show_tooltips;
    int show_priv;
@@ -1810,6 +2076,8 @@ void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    struct tm *now, *due;
    int comp_now, comp_due;
 
+   TRACE_BEGIN("todo_update_clist");
+
    free_ToDoList(todo_list);
 
    /* Need to get all records including private ones for the tooltips calculation */
@@ -1820,6 +2088,7 @@ void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
       todo_clear_details();
    }
 
+   TRACE_BEGIN("fill clist");
    /* Freeze clist to prevent flicker during updating */
    gtk_clist_freeze(GTK_CLIST(clist));
    if (main) {
@@ -1833,19 +2102,12 @@ void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    gtk_widget_show_all(clist);
    gtk_clist_freeze(GTK_CLIST(clist));
 #endif
+   clist_set_fill_func(GTK_CLIST(clist), todo_clist_fill_row);
 
    /* Collect preferences and constant pixmaps for loop */
    get_pref(PREF_TODO_HIDE_COMPLETED, &hide_completed, NULL);
    get_pref(PREF_TODO_HIDE_NOT_DUE, &hide_not_due, NULL);
    show_priv = show_privates(GET_PRIVATES);
-   get_pixmaps(clist, PIXMAP_NOTE, &pixmap_note, &mask_note);
-   get_pixmaps(clist, PIXMAP_BOX_CHECK, &pixmap_check, &mask_check);
-   get_pixmaps(clist, PIXMAP_BOX_CHECKED, &pixmap_checked,&mask_checked);
-#ifdef __APPLE__
-   mask_note = NULL;
-   mask_check = NULL;
-   mask_checked = NULL;
-#endif
    /* Current time used for calculating overdue items */
    time(&ltime);
    now = localtime(&ltime);
@@ -1899,78 +2161,12 @@ void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
          continue;
       }
 
-      /* Add entry to clist */
-      gtk_clist_append(GTK_CLIST(clist), empty_line);
-
-      /* Put a checkbox or checked checkbox pixmap up */
-      if (temp_todo->mtodo.todo.complete) {
-         gtk_clist_set_pixmap(GTK_CLIST(clist), entries_shown, TODO_CHECK_COLUMN, pixmap_checked, mask_checked);
-      } else {
-         gtk_clist_set_pixmap(GTK_CLIST(clist), entries_shown, TODO_CHECK_COLUMN, pixmap_check, mask_check);
-      }
-
-      /* Print the priority number */
+      /* Add entry to clist, filled in by todo_clist_fill_row() when drawn */
+      clist_append_unfilled(GTK_CLIST(clist), &(temp_todo->mtodo));
       sprintf(str, "%d", temp_todo->mtodo.todo.priority);
-      gtk_clist_set_text(GTK_CLIST(clist), entries_shown, TODO_PRIORITY_COLUMN, str);
-
-      /* Put a note pixmap up */
-      if (temp_todo->mtodo.todo.note[0]) {
-         gtk_clist_set_pixmap(GTK_CLIST(clist), entries_shown, TODO_NOTE_COLUMN, pixmap_note, mask_note);
-      } else {
-         gtk_clist_set_text(GTK_CLIST(clist), entries_shown, TODO_NOTE_COLUMN, "");
-      }
-
-      /* Print the due date */
-      if (!temp_todo->mtodo.todo.indefinite) {
-         get_pref(PREF_SHORTDATE, NULL, &svalue);
-         strftime(str, sizeof(str), svalue, &(temp_todo->mtodo.todo.due));
-      }
-      else {
-         sprintf(str, _("No date"));
-      }
-      gtk_clist_set_text(GTK_CLIST(clist), entries_shown, TODO_DATE_COLUMN, str);
-      /* Print the todo text */
-      lstrncpy_remove_cr_lfs(str2, temp_todo->mtodo.todo.description, TODO_MAX_COLUMN_LEN);
-      gtk_clist_set_text(GTK_CLIST(clist), entries_shown, TODO_TEXT_COLUMN, str2);
-
-      gtk_clist_set_row_data(GTK_CLIST(clist), entries_shown, &(temp_todo->mtodo));
-
-      /* Highlight row background depending on status */
-      switch (temp_todo->mtodo.rt) {
-       case NEW_PC_REC:
-       case REPLACEMENT_PALM_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                          CLIST_NEW_RED, CLIST_NEW_GREEN, CLIST_NEW_BLUE);
-         break;
-       case DELETED_PALM_REC:
-       case DELETED_PC_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                          CLIST_DEL_RED, CLIST_DEL_GREEN, CLIST_DEL_BLUE);
-         break;
-       case MODIFIED_PALM_REC:
-         set_bg_rgb_clist_row(clist, entries_shown,
-                          CLIST_MOD_RED, CLIST_MOD_GREEN, CLIST_MOD_BLUE);
-         break;
-       default:
-         if (temp_todo->mtodo.attrib & dlpRecAttrSecret) {
-            set_bg_rgb_clist_row(clist, entries_shown,
-                             CLIST_PRIVATE_RED, CLIST_PRIVATE_GREEN, CLIST_PRIVATE_BLUE);
-         } else {
-            gtk_clist_set_row_style(GTK_CLIST(clist), entries_shown, NULL);
-         }
-      }
-
-      /* Highlight dates of items overdue or due today */
-      if (!(temp_todo->mtodo.todo.indefinite)) {
-         due = &(temp_todo->mtodo.todo.due);
-         comp_due=due->tm_year*380+due->tm_mon*31+due->tm_mday-1;
-
-         if (comp_due < comp_now) {
-            set_fg_rgb_clist_cell(clist, entries_shown, TODO_DATE_COLUMN, CLIST_OVERDUE_RED, CLIST_OVERDUE_GREEN, CLIST_OVERDUE_BLUE);
-         } else if (comp_due == comp_now) {
-            set_fg_rgb_clist_cell(clist, entries_shown, TODO_DATE_COLUMN, CLIST_DUENOW_RED, CLIST_DUENOW_GREEN, CLIST_DUENOW_BLUE);
-         }
-      }
+      clist_fit_column_text(GTK_CLIST(clist), TODO_PRIORITY_COLUMN, str);
+      todo_due_str(str, sizeof(str), &(temp_todo->mtodo.todo));
+      clist_fit_column_text(GTK_CLIST(clist), TODO_DATE_COLUMN, str);
 
       entries_shown++;
    }
@@ -1978,7 +2174,9 @@ void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    jp_logf(JP_LOG_DEBUG, "entries_shown=%d\n",entries_shown);
 
    /* Sort the clist */
+   TRACE_BEGIN("sort clist");
    gtk_clist_sort(GTK_CLIST(clist));
+   TRACE_END("sort clist");
 
    if (main) {
       gtk_signal_connect(GTK_OBJECT(clist), "select_row",
@@ -2009,6 +2207,7 @@ void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
 
    /* Unfreeze clist after all changes */
    gtk_clist_thaw(GTK_CLIST(clist));
+   TRACE_END("fill clist");
 
    if (tooltip_widget) {
       get_pref(PREF_SHOW_TOOLTIPS, &show_tooltips, NULL);
@@ -2024,6 +2223,143 @@ void todo_update_clist(GtkWidget *clist, GtkWidget *tooltip_widget,
    /* return focus to clist after any big operation which requires a redraw */
    gtk_widget_grab_focus(GTK_WIDGET(clist));
 
+   TRACE_END("todo_update_clist");
+}
+
+/*
+ * Apply a single add, modify or delete to glob_todo_list and the clist
+ * instead of re-reading the database and rebuilding the whole clist.
+ * old_mtodo is the record delete_pc_record() was just called on with flag,
+ * or NULL.  new_todo is the record just written, or NULL, and is owned by
+ * the list afterwards.
+ * Returns EXIT_FAILURE, having freed new_todo, if the clist has to be redrawn.
+ */
+static int todo_clist_patch(MyToDo *old_mtodo, int flag, ToDoList *new_todo)
+{
+   gchar *empty_line[] = { "","","","","" };
+   GtkCListRow *new_row_p;
+   GList *temp_list;
+   ToDoList *temp_todo;
+   char str[50];
+   int row, new_row, last_row;
+   int num_entries, entries_shown;
+   int show_priv;
+   int r;
+   long show_tooltips;
+   time_t ltime;
+   struct tm *now;
+   int comp_now;
+
+   show_priv = show_privates(GET_PRIVATES);
+
+   /* A record being searched for and masked records need a full redraw */
+   if (glob_find_id || (show_priv == MASK_PRIVATES)) {
+      if (new_todo) {
+         free_ToDo(&(new_todo->mtodo.todo));
+         free(new_todo);
+      }
+      return EXIT_FAILURE;
+   }
+
+   time(&ltime);
+   now = localtime(&ltime);
+   comp_now=now->tm_year*380+now->tm_mon*31+now->tm_mday-1;
+
+   todo_clear_details();
+
+   gtk_clist_freeze(GTK_CLIST(clist));
+   gtk_signal_disconnect_by_func(GTK_OBJECT(clist),
+                                 GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+
+   if (old_mtodo) {
+      old_mtodo->rt = pc_record_type_after_delete(old_mtodo->rt, flag);
+      row = gtk_clist_find_row_from_data(GTK_CLIST(clist), old_mtodo);
+      if (row >= 0) {
+         clist_remove(GTK_CLIST(clist), row);
+      }
+      if (pc_record_type_shown(old_mtodo->rt)) {
+         /* The fields the clist is sorted on are unchanged, so the row
+          * stays where it was in the colors of its new status */
+         if (row >= 0) {
+            gtk_clist_insert(GTK_CLIST(clist), row, empty_line);
+            todo_clist_set_row(clist, row, old_mtodo, comp_now);
+         }
+      } else {
+         todo_remove(&glob_todo_list, old_mtodo);
+      }
+   }
+
+   new_row = -1;
+   if (new_todo) {
+      if (todo_insert_sorted(&glob_todo_list, new_todo, SORT_ASCENDING)) {
+         free_ToDo(&(new_todo->mtodo.todo));
+         free(new_todo);
+         gtk_signal_connect(GTK_OBJECT(clist), "select_row",
+                            GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+         gtk_clist_thaw(GTK_CLIST(clist));
+         return EXIT_FAILURE;
+      }
+      /* A new record is shown even if the hide completed or hide not due
+       * options would hide it, the same as a record found by a search */
+      if ((((new_todo->mtodo.attrib & 0x0F) == todo_category) ||
+           todo_category == CATEGORY_ALL) &&
+          ((show_priv == SHOW_PRIVATES) ||
+           !(new_todo->mtodo.attrib & dlpRecAttrSecret))) {
+         last_row = gtk_clist_append(GTK_CLIST(clist), empty_line);
+         todo_clist_set_row(clist, last_row, &(new_todo->mtodo), comp_now);
+
+         /* Move the row to its place in the current clist sort order */
+         new_row_p = GTK_CLIST_ROW(GTK_CLIST(clist)->row_list_end);
+         for (new_row = 0, temp_list = GTK_CLIST(clist)->row_list;
+              new_row < last_row;
+              new_row++, temp_list = temp_list->next) {
+            r = GTK_CLIST(clist)->compare(GTK_CLIST(clist), new_row_p,
+                                          GTK_CLIST_ROW(temp_list));
+            if (GTK_CLIST(clist)->sort_type == GTK_SORT_DESCENDING) {
+               r = -r;
+            }
+            if (r < 0) {
+               break;
+            }
+         }
+         if (new_row < last_row) {
+            gtk_clist_row_move(GTK_CLIST(clist), last_row, new_row);
+         }
+      }
+   }
+
+   /* GTK may have moved the selection while rows were removed, the row
+    * selected below has to emit a select_row to fill in the details */
+   clist_unselect_all(GTK_CLIST(clist));
+   gtk_signal_connect(GTK_OBJECT(clist), "select_row",
+                      GTK_SIGNAL_FUNC(cb_clist_selection), NULL);
+
+   entries_shown = GTK_CLIST(clist)->rows;
+   if (new_row >= 0) {
+      clist_row_selected = new_row;
+   }
+   if (entries_shown>0) {
+      if (clist_row_selected >= entries_shown) {
+         clist_row_selected = 0;
+      }
+      clist_select_row(GTK_CLIST(clist), clist_row_selected, TODO_PRIORITY_COLUMN);
+      if (!gtk_clist_row_is_visible(GTK_CLIST(clist), clist_row_selected)) {
+         gtk_clist_moveto(GTK_CLIST(clist), clist_row_selected, 0, 0.5, 0.0);
+      }
+   }
+
+   gtk_clist_thaw(GTK_CLIST(clist));
+
+   get_pref(PREF_SHOW_TOOLTIPS, &show_tooltips, NULL);
+   for (num_entries=0, temp_todo=glob_todo_list; temp_todo; temp_todo=temp_todo->next) {
+      num_entries++;
+   }
+   sprintf(str, _("%d of %d records"), entries_shown, num_entries);
+   set_tooltip(show_tooltips, glob_tooltips, category_menu1, str, NULL);
+
+   gtk_widget_grab_focus(GTK_WIDGET(clist));
+
+   return EXIT_SUCCESS;
 }
 
 static int todo_find(void)
@@ -2315,17 +2651,7 @@ int todo_gui(GtkWidget *vbox, GtkWidget *hbox)
    get_pref(PREF_TODO_SORT_COLUMN, &ivalue, NULL);
    clist_col_selected = ivalue;
    gtk_clist_set_sort_column(GTK_CLIST(clist), clist_col_selected);
-   switch (clist_col_selected) {
-    case TODO_CHECK_COLUMN: /* Checkbox column */
-      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareCheckbox);
-      break;
-    case TODO_DATE_COLUMN:  /* Due Date column */
-      gtk_clist_set_compare_func(GTK_CLIST(clist),GtkClistCompareDates);
-      break;
-    default: /* All other columns can use GTK default sort function */
-      gtk_clist_set_compare_func(GTK_CLIST(clist),NULL);
-      break;
-   }
+   todo_clist_set_compare_func(clist, clist_col_selected);
    get_pref(PREF_TODO_SORT_ORDER, &ivalue, NULL);
    gtk_clist_set_sort_type(GTK_CLIST (clist), ivalue);
 
@@ -0,0 +1,48 @@
+/*******************************************************************************
+ * tool_stubs.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/*
+ * Globals and GUI functions of jpilot.c needed by the code that
+ * jpilot-dump and jpilot-query share with J-Pilot
+ */
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "utils.h"
+#include "sync.h"
+
+/******************************* Global vars **********************************/
+/* Start Hack */
+/* FIXME: The following is a hack.
+ * The variables below are global variables in jpilot.c which are unused in
+ * this code but must be instantiated for the code to compile.  
+ * The same is true of the functions which are only used in GUI mode. */
+pid_t jpilot_master_pid = -1;
+int pipe_to_parent;
+GtkWidget *glob_dialog;
+GtkWidget *glob_date_label;
+gint glob_date_timer_tag;
+
+void output_to_pane(const char *str) { return; }
+int sync_once(struct my_sync_info *sync_info) { return EXIT_SUCCESS; }
+/* End Hack */
@@ -0,0 +1,216 @@
+/*******************************************************************************
+ * trace.c
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+/********************************* Includes ***********************************/
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "i18n.h"
+#include "log.h"
+#include "trace.h"
+
+/********************************* Constants **********************************/
+#define TRACE_BUF_SIZE  65536
+/* Longest event line, names and details are cut to fit */
+#define TRACE_EVENT_MAX 512
+
+/******************************* Global vars **********************************/
+int glob_trace=0;
+
+static int trace_fd=-1;
+static double trace_start;
+static char trace_buf[TRACE_BUF_SIZE];
+static int trace_len;
+static int trace_depth;
+/* Process the buffered events belong to, the sync runs in a forked child */
+static pid_t trace_pid;
+
+/****************************** Main Code *************************************/
+static double trace_clock(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+double trace_now(void)
+{
+   return trace_clock() - trace_start;
+}
+
+void trace_flush(void)
+{
+   int done, r;
+
+   if (trace_fd < 0) {
+      return;
+   }
+   /* A forked child does not write out what its parent buffered */
+   if (trace_pid != getpid()) {
+      trace_len = 0;
+      trace_depth = 0;
+      trace_pid = getpid();
+      return;
+   }
+
+   /* The file is opened for appending so that the events of the sync
+    * process and of the GUI are not written over each other */
+   for (done=0; done < trace_len; done += r) {
+      r = write(trace_fd, trace_buf+done, trace_len-done);
+      if (r < 0) {
+         if (errno == EINTR) {
+            r = 0;
+            continue;
+         }
+         break;
+      }
+   }
+   trace_len = 0;
+}
+
+static void trace_exit(void)
+{
+   trace_flush();
+}
+
+void trace_init(void)
+{
+   const char *file;
+
+   file = getenv(TRACE_ENV_VAR);
+   if ((!file) || (!file[0])) {
+      return;
+   }
+
+   trace_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+   if (trace_fd < 0) {
+      jp_logf(JP_LOG_WARN, _("Unable to open file: %s\n"), file);
+      return;
+   }
+
+   trace_start = trace_clock();
+   trace_pid = getpid();
+   trace_len = 0;
+   trace_depth = 0;
+   glob_trace = 1;
+
+   /* The closing ] of the array is optional in the trace event format */
+   strcpy(trace_buf, "[\n");
+   trace_len = strlen(trace_buf);
+   trace_flush();
+
+   atexit(trace_exit);
+}
+
+/* Copy src into dest as the inside of a JSON string */
+static void trace_escape(char *dest, const char *src, int max)
+{
+   int n;
+
+   for (n=0; (*src) && (n < max-7); src++) {
+      if ((*src=='"') || (*src=='\\')) {
+         dest[n++] = '\\';
+         dest[n++] = *src;
+      } else if ((unsigned char)*src < 0x20) {
+         sprintf(dest+n, "\\u%04x", (unsigned char)*src);
+         n += 6;
+      } else {
+         dest[n++] = *src;
+      }
+   }
+   dest[n] = '\0';
+}
+
+static void trace_event(const char *name, char phase, double ts,
+                        double duration, const char *detail)
+{
+   char ename[TRACE_EVENT_MAX/4];
+   char edetail[TRACE_EVENT_MAX/4];
+   char args[TRACE_EVENT_MAX/4+32];
+   char dur[64];
+   pid_t pid;
+
+   /* Drop what a parent process left in the buffer before forking */
+   pid = getpid();
+   if (trace_pid != pid) {
+      trace_flush();
+   }
+
+   if (trace_len + TRACE_EVENT_MAX > TRACE_BUF_SIZE) {
+      trace_flush();
+   }
+
+   trace_escape(ename, name, sizeof(ename));
+   args[0] = '\0';
+   if (detail) {
+      trace_escape(edetail, detail, sizeof(edetail));
+      g_snprintf(args, sizeof(args), ",\"args\":{\"detail\":\"%s\"}", edetail);
+   }
+   dur[0] = '\0';
+   if (phase == 'X') {
+      g_snprintf(dur, sizeof(dur), ",\"dur\":%.0f", duration);
+   }
+
+   /* There are no threads doing work, the process id is used for both */
+   trace_len += g_snprintf(trace_buf+trace_len, TRACE_BUF_SIZE-trace_len,
+                           "{\"name\":\"%s\",\"cat\":\"jpilot\",\"ph\":\"%c\","
+                           "\"ts\":%.0f%s,\"pid\":%d,\"tid\":%d%s},\n",
+                           ename, phase, ts, dur, (int)pid, (int)pid, args);
+}
+
+void trace_begin(const char *name, const char *detail)
+{
+   if (trace_fd < 0) {
+      return;
+   }
+   trace_event(name, 'B', trace_now(), 0.0, detail);
+   trace_depth++;
+}
+
+void trace_end(const char *name)
+{
+   if (trace_fd < 0) {
+      return;
+   }
+   trace_event(name, 'E', trace_now(), 0.0, NULL);
+   if (trace_depth > 0) {
+      trace_depth--;
+   }
+   if (trace_depth == 0) {
+      trace_flush();
+   }
+}
+
+void trace_total(const char *name, double start, double duration)
+{
+   if (trace_fd < 0) {
+      return;
+   }
+   trace_event(name, 'X', start, duration, NULL);
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************
+ * trace.h
+ * A module of J-Pilot http://jpilot.org
+ *
+ * Copyright (C) 1999-2014 by Judd Montgomery
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ******************************************************************************/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Timing spans written in the Chrome trace event format, which can be
+ * loaded in chrome://tracing or Perfetto.  Tracing is off unless the
+ * environment variable JPILOT_TRACE names the file to write, and then
+ * costs one test of glob_trace per span.
+ *
+ * Spans nest and must be ended in the reverse order they were begun.
+ * Events are written out when the outermost span of a process ends.
+ */
+
+#define TRACE_ENV_VAR "JPILOT_TRACE"
+
+extern int glob_trace;
+
+void trace_init(void);
+void trace_flush(void);
+void trace_begin(const char *name, const char *detail);
+void trace_end(const char *name);
+/* Microseconds since trace_init() */
+double trace_now(void);
+/* A span of total duration "duration" that was accumulated from several
+ * intervals, drawn as starting at "start" */
+void trace_total(const char *name, double start, double duration);
+
+#define TRACE_BEGIN(name) \
+   do { if (glob_trace) trace_begin((name), NULL); } while (0)
+#define TRACE_BEGIN_DETAIL(name, detail) \
+   do { if (glob_trace) trace_begin((name), (detail)); } while (0)
+#define TRACE_END(name) \
+   do { if (glob_trace) trace_end(name); } while (0)
+#define TRACE_NOW() (glob_trace ? trace_now() : 0.0)
+
+#endif
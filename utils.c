@@ -60,6 +60,9 @@
 
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
+/* The high bit of every byte of a word */
+#define WORD_HIGH_BITS ((unsigned long)-1 / 0xff * 0x80)
+
 /* Uncomment for verbose debugging of the alarm code */
 /* #define ALARMS_DEBUG */
 
@@ -432,12 +435,72 @@ static void cb_today(GtkWidget *widget, gpointer data)
    gtk_calendar_select_day(GTK_CALENDAR(cal), now->tm_mday);
 }
 
+size_t ascii_prefix_len(const char *buf, size_t len)
+{
+   unsigned long w;
+   size_t i;
+
+   for (i=0; i + sizeof(w) <= len; i += sizeof(w)) {
+      memcpy(&w, buf + i, sizeof(w));
+      if (w & WORD_HIGH_BITS) {
+         break;
+      }
+   }
+   for (; i<len; i++) {
+      if (buf[i] & 0x80) {
+         break;
+      }
+   }
+
+   return i;
+}
+
+/*
+ * Returns the length of the string in buf, at most max_len, or -1 if a byte
+ * of it is not 7-bit ASCII.  A max_len of -1 is no limit.  Only the first
+ * max_len bytes are read, buf need not be terminated within them.
+ */
+static int ascii_len(const char *buf, int max_len)
+{
+   const char *end;
+   size_t len;
+
+   if (max_len >= 0) {
+      end = memchr(buf, '\0', max_len);
+      len = end ? (size_t)(end - buf) : (size_t)max_len;
+   } else {
+      len = strlen(buf);
+   }
+   if (ascii_prefix_len(buf, len) < len) {
+      return -1;
+   }
+
+   return len;
+}
+
+/* Returns TRUE if the conversions to and from char_set leave 7-bit ASCII
+ * as it is.  Shift-JIS has a yen sign and an overline in place of the
+ * backslash and the tilde. */
+static int ascii_unchanged(long char_set)
+{
+   return (char_set != CHAR_SET_SJIS_UTF);
+}
+
 /*
  *         JPA overwrite a host character set string by its
  *             conversion to a Palm Pilot character string
  */
 void charset_j2p(char *buf, int max_len, long char_set)
 {
+   int len;
+
+   if (ascii_unchanged(char_set)) {
+      len = ascii_len(buf, max_len);
+      if ((len >= 0) && (len < max_len)) {
+         return;
+      }
+   }
+
    switch (char_set) {
     case CHAR_SET_JAPANESE: Euc2Sjis(buf, max_len); break;
     case CHAR_SET_LATIN1  : /* No conversion required */ break;
@@ -458,6 +521,14 @@ void charset_p2j(char *const buf, int max_len, int char_set)
 {
    char *newbuf;
    gchar *end;
+   int len;
+
+   if (ascii_unchanged(char_set)) {
+      len = ascii_len(buf, max_len);
+      if ((len >= 0) && (len < max_len)) {
+         return;
+      }
+   }
 
    newbuf = charset_p2newj(buf, max_len, char_set);
 
@@ -482,6 +553,15 @@ void charset_p2j(char *const buf, int max_len, int char_set)
 char *charset_p2newj(const char *buf, int max_len, int char_set)
 {
    char *newbuf = NULL;
+   int len;
+
+   /* Conversions stop short of max_len to leave room for the '\0' */
+   if (ascii_unchanged(char_set) && ((max_len == -1) || (max_len > 0))) {
+      len = ascii_len(buf, (max_len == -1) ? -1 : max_len - 1);
+      if (len >= 0) {
+         return g_strndup(buf, len);
+      }
+   }
 
    /* Allocate a longer buffer if not done in conversion routine.
     * Only old conversion routines don't assign a buffer */
@@ -533,6 +613,75 @@ char *charset_p2newj(const char *buf, int max_len, int char_set)
    return (newbuf);
 }
 
+void charset_p2j_fields(char **fields, int num, int char_set)
+{
+   GString *joined;
+   char *utf, *p, *end, *buf;
+   gsize utf_len;
+   int *index;
+   int i, n, count;
+
+   index = malloc(num * sizeof(int));
+   if (!index) {
+      /* Convert them all one at a time */
+      for (i=0; i<num; i++) {
+         if (fields[i]) {
+            buf = charset_p2newj(fields[i], -1, char_set);
+            if (buf) {
+               free(fields[i]);
+               fields[i] = buf;
+            }
+         }
+      }
+      return;
+   }
+
+   /* The fields that are left as they are keep their strings */
+   count = 0;
+   for (i=0; i<num; i++) {
+      if ((fields[i]) &&
+          ((!ascii_unchanged(char_set)) || (ascii_len(fields[i], -1) < 0))) {
+         index[count++] = i;
+      }
+   }
+
+   /* The iconv conversions are joined into one call, a '\0' between two
+    * fields converts to a '\0' */
+   utf = NULL;
+   if ((char_set >= CHAR_SET_UTF) && (count > 1)) {
+      joined = g_string_new(NULL);
+      for (n=0; n<count; n++) {
+         g_string_append_len(joined, fields[index[n]],
+                             strlen(fields[index[n]]) + 1);
+      }
+      utf = other_to_UTF_len(joined->str, joined->len, &utf_len);
+      g_string_free(joined, TRUE);
+   }
+
+   if (utf) {
+      p = utf;
+      end = utf + utf_len;
+      for (n=0; (n<count) && (p<end); n++) {
+         buf = g_strndup(p, end - p);
+         p += strlen(buf) + 1;
+         free(fields[index[n]]);
+         fields[index[n]] = buf;
+      }
+      g_free(utf);
+   } else {
+      /* One at a time, which also recovers from unconvertible characters */
+      for (n=0; n<count; n++) {
+         buf = charset_p2newj(fields[index[n]], -1, char_set);
+         if (buf) {
+            free(fields[index[n]]);
+            fields[index[n]] = buf;
+         }
+      }
+   }
+
+   free(index);
+}
+
 /* This function will copy an empty DB file 
  * from the share directory to the users JPILOT_HOME directory
  * if it doesn't exist already and its length is > 0 */
@@ -856,12 +1005,17 @@ int clist_find_id(GtkWidget *clist,
                   int *found_at)
 {
    int i, found;
+   GList *temp_list;
    MyAddress *maddr;
 
    *found_at = 0;
 
-   for (found = i = 0; i<GTK_CLIST(clist)->rows; i++) {
-      maddr = gtk_clist_get_row_data(GTK_CLIST(clist), i);
+   /* Walk the rows directly, gtk_clist_get_row_data() has to walk the
+    * row list from the start for every row */
+   for (found = i = 0, temp_list = GTK_CLIST(clist)->row_list;
+        temp_list;
+        temp_list = temp_list->next, i++) {
+      maddr = GTK_CLIST_ROW(temp_list)->data;
       if (maddr < (MyAddress *)CLIST_MIN_DATA) {
          break;
       }
@@ -875,17 +1029,35 @@ int clist_find_id(GtkWidget *clist,
    return found;
 }
 
+gpointer *clist_get_all_row_data(GtkCList *clist)
+{
+   gpointer *rows;
+   GList *temp_list;
+   int i;
+
+   /* One pass over the rows instead of a gtk_clist_get_row_data() walk
+    * from the first row for each one */
+   rows = g_new0(gpointer, clist->rows + 1);
+   for (i = 0, temp_list = clist->row_list;
+        temp_list && (i < clist->rows);
+        temp_list = temp_list->next, i++) {
+      rows[i] = GTK_CLIST_ROW(temp_list)->data;
+   }
+
+   return rows;
+}
+
 /* Encapsulate GTK function to make it free all resources */
 void clist_clear(GtkCList *clist)
 {
    GtkStyle *base_style, *row_style; 
-   int i;
+   GList *temp_list;
 
    base_style = gtk_widget_get_style(GTK_WIDGET(clist));
   
-   for (i=0; i<GTK_CLIST(clist)->rows ; i++)
+   for (temp_list = clist->row_list; temp_list; temp_list = temp_list->next)
    {
-      row_style = gtk_clist_get_row_style(GTK_CLIST(clist), i);
+      row_style = GTK_CLIST_ROW(temp_list)->style;
       if (row_style && (row_style != base_style))
       {
          g_object_unref(row_style);  
@@ -895,6 +1067,166 @@ void clist_clear(GtkCList *clist)
    gtk_clist_clear(GTK_CLIST(clist));
 }
 
+/* Encapsulate GTK function to make it free all resources */
+void clist_remove(GtkCList *clist, int row)
+{
+   GtkStyle *base_style, *style; 
+   int col;
+
+   base_style = gtk_widget_get_style(GTK_WIDGET(clist));
+
+   style = gtk_clist_get_row_style(clist, row);
+   if (style && (style != base_style))
+   {
+      g_object_unref(style);
+   }
+   for (col=0; col<clist->columns; col++)
+   {
+      style = gtk_clist_get_cell_style(clist, row, col);
+      if (style && (style != base_style))
+      {
+         g_object_unref(style);
+      }
+   }
+
+   gtk_clist_remove(clist, row);
+}
+
+/* Encapsulate broken GTK function, in browse mode it only unselects
+ * the focus row */
+void clist_unselect_all(GtkCList *clist)
+{
+   int i;
+
+   for (i = g_list_length(clist->selection); (i > 0) && clist->selection; i--)
+   {
+      gtk_clist_unselect_row(clist, GPOINTER_TO_INT(clist->selection->data), 0);
+   }
+}
+
+/* A row appended by clist_append_unfilled() has no cell contents yet */
+static int clist_row_unfilled(GtkCList *clist, GtkCListRow *clist_row)
+{
+   int col;
+
+   if (!clist_row->data) {
+      return FALSE;
+   }
+   for (col=0; col<clist->columns; col++) {
+      if (clist_row->cell[col].type != GTK_CELL_EMPTY) {
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+static gboolean cb_clist_fill_exposed(GtkWidget *widget,
+                                      GdkEventExpose *event,
+                                      gpointer data)
+{
+   clist_fill_visible_rows(GTK_CLIST(widget));
+
+   return FALSE;
+}
+
+/*
+ * Large record lists are put into the clist as rows carrying only their
+ * row data.  The text and colors of a row are filled in by fill_row just
+ * before the row is first drawn, so rows that are never scrolled into
+ * view cost no formatting, strings or styles.
+ */
+void clist_set_fill_func(GtkCList *clist, clist_fill_row_func fill_row)
+{
+   int col;
+
+   if (!gtk_object_get_data(GTK_OBJECT(clist), "clist_fill_row")) {
+      gtk_signal_connect(GTK_OBJECT(clist), "expose_event",
+                         GTK_SIGNAL_FUNC(cb_clist_fill_exposed), NULL);
+   }
+   gtk_object_set_data(GTK_OBJECT(clist), "clist_fill_row", (gpointer)fill_row);
+
+   /* Auto resized columns start again from the width of their titles and
+    * are widened by clist_fit_column_text() as the rows are appended */
+   for (col=0; col<clist->columns; col++) {
+      if (clist->column[col].auto_resize) {
+         gtk_clist_set_column_min_width(clist, col, -1);
+         gtk_clist_set_column_width(clist, col,
+                                    gtk_clist_optimal_column_width(clist, col));
+      }
+   }
+   gtk_object_set_data_full(GTK_OBJECT(clist), "clist_fit_layout",
+                            gtk_widget_create_pango_layout(GTK_WIDGET(clist), NULL),
+                            g_object_unref);
+}
+
+/*
+ * GtkCList sizes auto resized columns from the cells it has been given,
+ * which for unfilled rows is only those drawn so far.  For columns whose
+ * width depends on the record the pane passes the text each row will
+ * show as it is appended, so the column fits the whole list up front.
+ */
+void clist_fit_column_text(GtkCList *clist, int column, const char *text)
+{
+   PangoLayout *layout;
+   int width;
+
+   layout = gtk_object_get_data(GTK_OBJECT(clist), "clist_fit_layout");
+   if (!layout) {
+      return;
+   }
+   pango_layout_set_text(layout, text, -1);
+   pango_layout_get_pixel_size(layout, &width, NULL);
+
+   if (width > clist->column[column].min_width) {
+      gtk_clist_set_column_min_width(clist, column, width);
+   }
+}
+
+int clist_append_unfilled(GtkCList *clist, gpointer data)
+{
+   gchar *no_text[CLIST_MAX_COLUMNS];
+   int row, col;
+
+   for (col=0; col<CLIST_MAX_COLUMNS; col++) {
+      no_text[col] = NULL;
+   }
+   row = gtk_clist_append(clist, no_text);
+   gtk_clist_set_row_data(clist, row, data);
+
+   return row;
+}
+
+void clist_fill_visible_rows(GtkCList *clist)
+{
+   clist_fill_row_func fill_row;
+   GList *temp_list;
+   int first, last, row;
+
+   fill_row = (clist_fill_row_func)gtk_object_get_data(GTK_OBJECT(clist),
+                                                       "clist_fill_row");
+   if ((!fill_row) || (clist->rows==0) || (clist->row_height<=0)) {
+      return;
+   }
+
+   /* voffset is minus the pixel offset of the top of the window, rows are
+    * row_height apart plus one pixel of spacing */
+   first = -clist->voffset / (clist->row_height + 1);
+   last = (clist->clist_window_height - clist->voffset) / (clist->row_height + 1);
+   if (first < 0) {
+      first = 0;
+   }
+   if (last >= clist->rows) {
+      last = clist->rows - 1;
+   }
+
+   temp_list = g_list_nth(clist->row_list, first);
+   for (row=first; temp_list && row<=last; row++, temp_list=temp_list->next) {
+      if (clist_row_unfilled(clist, GTK_CLIST_ROW(temp_list))) {
+         fill_row(GTK_WIDGET(clist), row, GTK_CLIST_ROW(temp_list)->data);
+      }
+   }
+}
+
 /* Encapsulate GTK tooltip function which no longer supports disabling as
  * of GTK 2.12 */
 void set_tooltip(int show_tooltip, 
@@ -1186,6 +1518,39 @@ int delete_pc_record(AppType app_type, void *VP, int flag)
    return EXIT_SUCCESS;
 }
 
+PCRecType pc_record_type_after_delete(PCRecType rt, int flag)
+{
+   switch (rt) {
+    case PALM_REC:
+      if (flag==MODIFY_FLAG) {
+         return MODIFIED_PALM_REC;
+      }
+      return DELETED_PALM_REC;
+    case NEW_PC_REC:
+    case REPLACEMENT_PALM_REC:
+      return DELETED_PC_REC;
+    default:
+      return rt;
+   }
+}
+
+int pc_record_type_shown(PCRecType rt)
+{
+   long show_deleted, show_modified;
+
+   switch (rt) {
+    case DELETED_PALM_REC:
+    case DELETED_PC_REC:
+      get_pref(PREF_SHOW_DELETED, &show_deleted, NULL);
+      return show_deleted ? TRUE : FALSE;
+    case MODIFIED_PALM_REC:
+      get_pref(PREF_SHOW_MODIFIED, &show_modified, NULL);
+      return show_modified ? TRUE : FALSE;
+    default:
+      return TRUE;
+   }
+}
+
 /* nob = number of buttons */
 int dialog_generic(GtkWindow *main_window,
                    char *title, int type,
@@ -2109,6 +2474,12 @@ void get_month_info(int month, int day, int year, int *dow, int *ndim)
 }
 
 int get_next_unique_pc_id(unsigned int *next_unique_id)
+{
+   return get_next_unique_pc_ids(next_unique_id, 1);
+}
+
+/* Reserve count consecutive IDs in one update of the next_id file */
+int get_next_unique_pc_ids(unsigned int *next_unique_id, unsigned int count)
 {
    FILE *pc_in_out;
    char file_name[FILENAME_MAX];
@@ -2162,7 +2533,8 @@ int get_next_unique_pc_id(unsigned int *next_unique_id)
    /* rewind(pc_in_out); */
    /* todo - if > 16777216 then cleanup */
 
-   write_to_next_id_open(pc_in_out, *next_unique_id);
+   /* The file keeps the last ID handed out */
+   write_to_next_id_open(pc_in_out, *next_unique_id + count - 1);
    jp_close_home_file(pc_in_out);
    
    return EXIT_SUCCESS;
@@ -3187,11 +3559,46 @@ void set_fg_rgb_clist_cell(GtkWidget *clist, int row, int col, int r, int g, int
    gtk_clist_set_cell_style(GTK_CLIST(clist), row, col, new_style);
 }
 
-int setup_sync(unsigned int flags)
+int setup_sync_info(struct my_sync_info *sync_info, unsigned int flags)
 {
    long num_backups;
    const char *svalue;
    const char *port;
+
+   get_pref(PREF_PORT, NULL, &port);
+   get_pref(PREF_NUM_BACKUPS, &num_backups, NULL);
+   jp_logf(JP_LOG_DEBUG, "pref port=[%s]\n", port);
+   jp_logf(JP_LOG_DEBUG, "num_backups=%d\n", num_backups);
+   get_pref(PREF_USER, NULL, &svalue);
+   g_strlcpy(sync_info->username, svalue, sizeof(sync_info->username));
+   get_pref(PREF_USER_ID, &(sync_info->userID), NULL);
+
+   get_pref(PREF_PC_ID, &(sync_info->PC_ID), NULL);
+   if (sync_info->PC_ID == 0) {
+      srandom(time(NULL));
+      /* RAND_MAX is 32768 on Solaris machines for some reason.
+       * If someone knows how to fix this, let me know. */
+      if (RAND_MAX==32768) {
+         sync_info->PC_ID = 1+(2000000000.0*random()/(2147483647+1.0));
+      } else {
+         sync_info->PC_ID = 1+(2000000000.0*random()/(RAND_MAX+1.0));
+      }
+      jp_logf(JP_LOG_WARN, _("PC ID is 0.\n"));
+      jp_logf(JP_LOG_WARN, _("Generated a new PC ID.  It is %lu\n"), sync_info->PC_ID);
+      set_pref(PREF_PC_ID, sync_info->PC_ID, NULL, TRUE);
+   }
+   
+   sync_info->sync_over_ride = 0;
+   g_strlcpy(sync_info->port, port, sizeof(sync_info->port));
+   sync_info->flags=flags;
+   sync_info->num_backups=num_backups;
+
+   return EXIT_SUCCESS;
+}
+
+int setup_sync(unsigned int flags)
+{
+   const char *svalue;
    int r;
 #ifndef HAVE_SETENV
    char str[80];
@@ -3212,33 +3619,7 @@ int setup_sync(unsigned int flags)
       }
    }
 
-   get_pref(PREF_PORT, NULL, &port);
-   get_pref(PREF_NUM_BACKUPS, &num_backups, NULL);
-   jp_logf(JP_LOG_DEBUG, "pref port=[%s]\n", port);
-   jp_logf(JP_LOG_DEBUG, "num_backups=%d\n", num_backups);
-   get_pref(PREF_USER, NULL, &svalue);
-   g_strlcpy(sync_info.username, svalue, sizeof(sync_info.username));
-   get_pref(PREF_USER_ID, &(sync_info.userID), NULL);
-
-   get_pref(PREF_PC_ID, &(sync_info.PC_ID), NULL);
-   if (sync_info.PC_ID == 0) {
-      srandom(time(NULL));
-      /* RAND_MAX is 32768 on Solaris machines for some reason.
-       * If someone knows how to fix this, let me know. */
-      if (RAND_MAX==32768) {
-         sync_info.PC_ID = 1+(2000000000.0*random()/(2147483647+1.0));
-      } else {
-         sync_info.PC_ID = 1+(2000000000.0*random()/(RAND_MAX+1.0));
-      }
-      jp_logf(JP_LOG_WARN, _("PC ID is 0.\n"));
-      jp_logf(JP_LOG_WARN, _("Generated a new PC ID.  It is %lu\n"), sync_info.PC_ID);
-      set_pref(PREF_PC_ID, sync_info.PC_ID, NULL, TRUE);
-   }
-   
-   sync_info.sync_over_ride = 0;
-   g_strlcpy(sync_info.port, port, sizeof(sync_info.port));
-   sync_info.flags=flags;
-   sync_info.num_backups=num_backups;
+   setup_sync_info(&sync_info, flags);
 
    r = sync_once(&sync_info);
 
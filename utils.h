@@ -184,10 +184,14 @@ typedef struct {
    struct Address addr;
 } MyAddress;
 
+/* Collation key used for sorting, see address.h */
+struct addr_sort_key;
+
 typedef struct AddressList_s {
    AppType app_type;
    struct AddressList_s *next;
    MyAddress maddr;
+   struct addr_sort_key *sort_key;
 } AddressList;
 
 typedef struct {
@@ -230,6 +234,7 @@ typedef struct ContactList_s {
    AppType app_type;
    struct ContactList_s *next;
    MyContact mcont;
+   struct addr_sort_key *sort_key;
 } ContactList;
 
 /* Calendar */
@@ -298,6 +303,13 @@ int find_next_offset(mem_rec_header *mem_rh, long fpos,
 int delete_pc_record(AppType app_type, void *VP, int flag);
 int undelete_pc_record(AppType app_type, void *VP, int flag);
 
+/* The type a record of type rt has after delete_pc_record(rt, flag) */
+PCRecType pc_record_type_after_delete(PCRecType rt, int flag);
+
+/* Returns TRUE if the get_*2() routines return records of type rt when
+ * asked to follow the show deleted and show modified preferences */
+int pc_record_type_shown(PCRecType rt);
+
 void get_month_info(int month, int day, int year, int *dow, int *ndim);
 
 void free_mem_rec_header(mem_rec_header **mem_rh);
@@ -308,6 +320,9 @@ int get_app_info(char *DB_name, unsigned char **buf, int *buf_size);
 
 int cleanup_pc_files(void);
 
+struct my_sync_info;
+/* Fill in sync_info from the preferences of the current home directory */
+int setup_sync_info(struct my_sync_info *sync_info, unsigned int flags);
 int setup_sync(unsigned int flags);
 
 /* Returns the number of the button that was pressed */
@@ -349,6 +364,18 @@ void entry_set_multiline_truncate(GtkEntry *entry, gboolean value);
 
 void clist_clear(GtkCList *clist);
 
+void clist_remove(GtkCList *clist, int row);
+
+void clist_unselect_all(GtkCList *clist);
+
+/* Rows of long record lists are only filled in when they are drawn */
+#define CLIST_MAX_COLUMNS 8
+typedef void (*clist_fill_row_func)(GtkWidget *clist, int row, gpointer row_data);
+void clist_set_fill_func(GtkCList *clist, clist_fill_row_func fill_row);
+int clist_append_unfilled(GtkCList *clist, gpointer data);
+void clist_fit_column_text(GtkCList *clist, int column, const char *text);
+void clist_fill_visible_rows(GtkCList *clist);
+
 void set_tooltip(int show_tooltip, 
                         GtkTooltips *tooltips,
                         GtkWidget *widget,
@@ -363,6 +390,9 @@ int clist_find_id(GtkWidget *clist,
                   unsigned int unique_id,
                   int *found_at);
 
+/* The row data of every row of clist, indexed by row.  Free with g_free(). */
+gpointer *clist_get_all_row_data(GtkCList *clist);
+
 int check_copy_DBs_to_home(void);
 
 
@@ -486,6 +516,9 @@ int jp_close_home_file(FILE *pc_in);
 /* Routines used for i18n string manipulation */
 void multibyte_safe_strncpy(char *dst, char *src, size_t len);
 char *multibyte_safe_memccpy(char *dst, const char *src, int c, size_t len);
+/* Number of 7-bit ASCII bytes that buf starts with, among its first len,
+ * tested a word at a time */
+size_t ascii_prefix_len(const char *buf, size_t len);
 
 /* host character set of J-Pilot (j) to Palm character set (p) */
 void charset_j2p(char *buf, int max_len, long char_set);
@@ -493,6 +526,9 @@ void charset_j2p(char *buf, int max_len, long char_set);
 /* Palm character set (p) to host character set of J-Pilot (j) */
 void charset_p2j(char *buf, int max_len, int char_set);
 char *charset_p2newj(const char *buf, int max_len, int char_set);
+/* Replace the num strings of fields by their conversion, as charset_p2newj
+ * with no length limit.  NULL fields are skipped. */
+void charset_p2j_fields(char **fields, int num, int char_set);
 
 /* Versions of character conversion routines for plugins */
 void jp_charset_j2p(char *buf, int max_len);